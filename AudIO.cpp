@@ -1,150 +1,428 @@
 #include "AudIO.h"
 
+#include <cmath>
+#include <cstring>
+#include <type_traits>
+
 #include "Audaptr.h"
+#include "SampleConvert.h"
 
 using namespace std;
 
 namespace Audaptr
 {
+	// Read up to NumItems samples from the output ring into the device buffer, converting to the device format.
+	// The ring may split the items into two contiguous segments. Returns the number of items that were not available.
+	template<int Channels, typename SampleT>
+	static inline size_t ReadOutputRing(QuickBuffer<float> &Ring, SampleT *pDest, size_t NumItems, const size_t NumChannels)
+	{
+		for(int Segment = 0; (Segment < 2) && (NumItems > 0); Segment++) {
+			size_t Available = 0;
+			const float *pRead = Ring.ReadAcquire(Available, NumItems);
+			if(!pRead)
+				break;
+			// Only whole frames are transferred, so that a channel never lands in the wrong slot.
+			const size_t ThisRead = ((Available > NumItems) ? NumItems : Available) / NumChannels * NumChannels;
+			if(ThisRead == 0)
+				break;
+			ConvertFrames<Channels>(pRead, pDest, ThisRead / NumChannels, NumChannels);
+			Ring.ReadRelease(ThisRead);
+			pDest += ThisRead;
+			NumItems -= ThisRead;
+		}
+		return NumItems;
+	}
+
+	// Read up to NumFrames frames from the output ring and route them onto the device channels, converting to the
+	// device format. Returns the number of frames that were not available.
+	template<typename SampleT>
+	static inline size_t ReadRoutedOutputRing(QuickBuffer<float> &Ring, RoutingMatrix &Routing, SampleT *pDest, size_t NumFrames)
+	{
+		const size_t NumRingChannels = (size_t)Routing.NumSources(), NumDeviceChannels = (size_t)Routing.NumDestinations();
+		for(int Segment = 0; (Segment < 2) && (NumFrames > 0); Segment++) {
+			size_t Available = 0;
+			const float *pRead = Ring.ReadAcquire(Available, NumFrames * NumRingChannels);
+			if(!pRead)
+				break;
+			const size_t ThisRead = min(Available / NumRingChannels, NumFrames);
+			if(ThisRead == 0)
+				break;
+			Routing.Process(pRead, pDest, ThisRead);
+			Ring.ReadRelease(ThisRead * NumRingChannels);
+			pDest += ThisRead * NumDeviceChannels;
+			NumFrames -= ThisRead;
+		}
+		return NumFrames;
+	}
+
+	template<int Channels, typename SampleT>
+	void AudIO::RenderOutput(const StreamParams &Params, SampleT *pDest, const size_t NumFrames, const PaStreamCallbackFlags StatusFlags) noexcept
+	{
+		const size_t NumChannels = Channels ? (size_t)Channels : (size_t)OutputParams_.channelCount;
+
+		// Play silence until the producer has pre-rolled enough audio, rather than underrunning straight away.
+		if(!OutputPrimed_.load(memory_order_relaxed)) {
+			const size_t NumRingChannels = Params.pOutputRouting ? (size_t)Params.pOutputRouting->NumSources() : NumChannels;
+			const size_t Threshold = min(Params.OutputPrimingFrames * NumRingChannels, OutputBuffer_.Size() / 2);
+			if(OutputBuffer_.ReadableCount() < Threshold) {
+				memset(pDest, 0, NumFrames * NumChannels * sizeof(SampleT));
+				return;
+			}
+			OutputPrimed_.store(true, memory_order_release);
+		}
+
+		// This is read in up to two segments, because the buffer may segment read transactions.
+		const size_t NumMissing = Params.pOutputRouting ?
+			ReadRoutedOutputRing(OutputBuffer_, *Params.pOutputRouting, pDest, NumFrames) :
+			ReadOutputRing<Channels>(OutputBuffer_, pDest, NumFrames * NumChannels, NumChannels) / NumChannels;
+
+		// If no data in the output buffer, increment a count to record the underflow; do not block in this callback.
+		if((NumMissing > 0) || (StatusFlags & paOutputOverflow))
+			OutputOverflowCount_.fetch_add(1, memory_order_relaxed);
+		if(NumMissing > 0) {
+			OutputRingUnderflowCount_.fetch_add(1, memory_order_relaxed);
+			AUDAPTR_TRACE_INSTANT("AudIO output underrun");
+			Log_.Write(RtLogLevel::Warning, "Output ring underrun: {} of {} frames missing", NumMissing, NumFrames);
+		}
+
+		// Never leave the rest of the device buffer as it was: it would replay stale samples.
+		const size_t NumPlayed = NumFrames - NumMissing;
+		TrackOutput(Params.OutputUnderrun, pDest, NumPlayed, NumChannels);
+		ConcealOutput(Params.OutputUnderrun, pDest + NumPlayed * NumChannels, NumMissing, NumChannels);
+	}
+
+	template<int Channels, typename SampleT>
+	void AudIO::DeliverInputBlocks(const StreamParams &Params, const SampleT *pInput, size_t NumFrames, const size_t NumChannels, const PaStreamCallbackFlags StatusFlags) noexcept
+	{
+		BlockPool &Pool = *Params.pInputBlockPool;
+		const size_t FramesPerBlock = Pool.FramesPerBlock();
+		bool Dropped = false;
+		while(NumFrames > 0) {
+			const size_t Count = min(NumFrames, FramesPerBlock);
+			BlockRef Block = Pool.Acquire();
+			if(Block) {
+				if(Params.pInputRouting)
+					Params.pInputRouting->Process(pInput, Block->Frames(), Count);
+				else
+					ConvertFrames<Channels>(pInput, Block->Frames(), Count, NumChannels);
+				Block->SetFrames(Count, InputBlockFrame_);
+			}
+			// A block that cannot be queued goes straight back to the pool.
+			if(!Block || !Params.pInputBlockQueue->Push(Block)) {
+				InputRingOverflowCount_.fetch_add(1, memory_order_relaxed);
+				AUDAPTR_TRACE_INSTANT("AudIO input overflow");
+				Log_.Write(RtLogLevel::Warning, Block ? "Input block queue full: frames {} to {} dropped" : "Input block pool exhausted: frames {} to {} dropped", InputBlockFrame_, InputBlockFrame_ + Count - 1);
+				Dropped = true;
+			}
+			InputBlockFrame_ += Count;
+			pInput += Count * NumChannels;
+			NumFrames -= Count;
+		}
+		if(Dropped || (StatusFlags & paInputOverflow))
+			InputOverflowCount_.fetch_add(1, memory_order_relaxed);
+	}
+
+	template<typename SampleT>
+	void AudIO::DeliverInputShards(const StreamParams &Params, const SampleT *pInput, const size_t NumFrames, const PaStreamCallbackFlags StatusFlags) noexcept
+	{
+		ChannelShards &Shards = *Params.pInputShards;
+		const bool Complete = Params.pInputRouting ? Shards.Write(*Params.pInputRouting, pInput, NumFrames) : Shards.Write(pInput, NumFrames);
+		if(!Complete) {
+			InputRingOverflowCount_.fetch_add(1, memory_order_relaxed);
+			AUDAPTR_TRACE_INSTANT("AudIO input overflow");
+			Log_.Write(RtLogLevel::Warning, "Input channel group full: {} frames dropped", NumFrames);
+		}
+		if(!Complete || (StatusFlags & paInputOverflow))
+			InputOverflowCount_.fetch_add(1, memory_order_relaxed);
+	}
+
+	template<typename SampleT>
+	void AudIO::TrackOutput(const UnderrunPolicy Policy, SampleT *pFrames, const size_t NumFrames, const size_t NumChannels) noexcept
+	{
+		if(NumFrames == 0)
+			return;
+		if(ConcealedFrames_ > 0) {
+			// The underrun is over: record its length, and fade back in from the concealment.
+			if(ConcealedFrames_ > LongestOutputUnderrun_.load(memory_order_relaxed))
+				LongestOutputUnderrun_.store(ConcealedFrames_, memory_order_relaxed);
+			ConcealedFrames_ = 0;
+			FadeInPos_ = (Policy != UnderrunPolicy::Zero) ? 0 : kFadeFrames;
+		}
+		// The fade may span several device buffers, so it continues from where the previous one left it.
+		const size_t FadeFrames = min(NumFrames, kFadeFrames - FadeInPos_);
+		for(size_t Frame = 0; Frame < FadeFrames; Frame++) {
+			const float Gain = (float)(FadeInPos_ + Frame + 1) / (float)(kFadeFrames + 1);
+			for(size_t Channel = 0; Channel < NumChannels; Channel++)
+				pFrames[Frame * NumChannels + Channel] = (SampleT)(Gain * pFrames[Frame * NumChannels + Channel]);
+		}
+		FadeInPos_ += FadeFrames;
+		if(Policy == UnderrunPolicy::Zero)
+			return;
+
+		// Keep the most recent frames, in floating point, to conceal a later underrun with.
+		const size_t NumKept = min(NumFrames, kHistoryFrames);
+		const SampleT *pKept = pFrames + (NumFrames - NumKept) * NumChannels;
+		for(size_t Kept = 0; Kept < NumKept;) {
+			const size_t Run = min(NumKept - Kept, kHistoryFrames - HistoryPos_);
+			ConvertSamples(pKept + Kept * NumChannels, vOutputHistory_.data() + HistoryPos_ * NumChannels, Run * NumChannels);
+			Kept += Run;
+			HistoryPos_ = (HistoryPos_ + Run) % kHistoryFrames;
+		}
+		HistoryFrames_ = min(HistoryFrames_ + NumKept, kHistoryFrames);
+	}
+
+	template<typename SampleT>
+	void AudIO::ConcealOutput(const UnderrunPolicy Policy, SampleT *pFrames, const size_t NumFrames, const size_t NumChannels) noexcept
+	{
+		if(NumFrames == 0)
+			return;
+		OutputUnderrunFrames_.fetch_add(NumFrames, memory_order_relaxed);
+
+		// Fade the last frame, or the history replayed from its oldest frame, out over Span frames of the underrun.
+		size_t Frame = 0;
+		if((Policy != UnderrunPolicy::Zero) && (HistoryFrames_ > 0)) {
+			const size_t Span = (Policy == UnderrunPolicy::Fade) ? kFadeFrames : HistoryFrames_;
+			const size_t Oldest = (HistoryPos_ + kHistoryFrames - HistoryFrames_) % kHistoryFrames;
+			const size_t Last = (HistoryPos_ + kHistoryFrames - 1) % kHistoryFrames;
+			while((Frame < NumFrames) && (ConcealedFrames_ + Frame < Span)) {
+				const size_t Chunk = min({NumFrames - Frame, Span - ConcealedFrames_ - Frame, kHistoryFrames});
+				for(size_t n = 0; n < Chunk; n++) {
+					const size_t Position = ConcealedFrames_ + Frame + n;
+					const float Gain = (float)(Span - Position) / (float)(Span + 1);
+					const size_t Source = (Policy == UnderrunPolicy::Fade) ? Last : (Oldest + Position) % kHistoryFrames;
+					const float *pSource = vOutputHistory_.data() + Source * NumChannels;
+					float *pScratch = vConcealScratch_.data() + n * NumChannels;
+					for(size_t Channel = 0; Channel < NumChannels; Channel++)
+						pScratch[Channel] = Gain * pSource[Channel];
+				}
+				ConvertSamples(vConcealScratch_.data(), pFrames + Frame * NumChannels, Chunk * NumChannels);
+				Frame += Chunk;
+			}
+		}
+		memset(pFrames + Frame * NumChannels, 0, (NumFrames - Frame) * NumChannels * sizeof(SampleT));
+		ConcealedFrames_ += NumFrames;
+	}
+
 	// Called by the PortAudio engine when audio is needed, possibly at interrupt level. Do not block.
+	// Channels is the channel count when known at compile time (0 otherwise); SampleT is the device sample type.
+	template<int Channels, typename SampleT>
 	int InputPaCallback(const void *pInputBuffer, void *pOutputBuffer, unsigned long FramesPerBuffer, const PaStreamCallbackTimeInfo *pTimeInfo, PaStreamCallbackFlags StatusFlags, void *pUserData)
 	{
 		// StatusFlags: paInputUnderflow, paInputOverflow, paOutputUnderflow, paOutputOverflow, paPrimingOutput
-		AudIO *pAudioIO = reinterpret_cast<AudIO *>(pUserData);
-
-		size_t uNumToRead = (size_t)FramesPerBuffer * pAudioIO->InputParams_.channelCount;
+		AUDAPTR_TRACE_THREAD("PortAudio callback");
+		AUDAPTR_TRACE_SCOPE("AudIO::InputPaCallback");
+		AudIO *pAudioIO = static_cast<AudIO *>(pUserData);
+		const size_t uNumChannels = Channels ? (size_t)Channels : (size_t)pAudioIO->InputParams_.channelCount;
+		const AudIO::StreamParams *pParams = pAudioIO->Params_.Acquire();
+		if(pParams->pCallbackRecorder)
+			pParams->pCallbackRecorder->Record(FramesPerBuffer, StatusFlags);
+		if(StatusFlags)
+			pAudioIO->NoteStatusFlags(StatusFlags);
+		RoutingMatrix *pRouting = pParams->pInputRouting;
+		const size_t uNumToRead = (size_t)FramesPerBuffer * (pRouting ? (size_t)pRouting->NumDestinations() : uNumChannels);
 
-		// If no free space in the input buffer, increment a count to record the overflow; do not block in this callback.
-		auto *pfBuffer = pAudioIO->InputBuffer_.WriteReserve(uNumToRead);
-		if(!pfBuffer || (StatusFlags & paInputOverflow))
-			pAudioIO->InputOverflowCount_++;
+		if(pParams->pInputBlockPool)
+			pAudioIO->DeliverInputBlocks<Channels>(*pParams, static_cast<const SampleT *>(pInputBuffer), (size_t)FramesPerBuffer, uNumChannels, StatusFlags);
+		else if(pParams->pInputShards)
+			pAudioIO->DeliverInputShards(*pParams, static_cast<const SampleT *>(pInputBuffer), (size_t)FramesPerBuffer, StatusFlags);
 		else {
-			memcpy(pfBuffer, pInputBuffer, uNumToRead * sizeof(float));
-			pAudioIO->InputBuffer_.WriteCommit(uNumToRead);
+			// If no free space in the input buffer, increment a count to record the overflow; do not block in this callback.
+			auto *pfBuffer = pAudioIO->InputBuffer_.WriteReserve(uNumToRead);
+			if(!pfBuffer || (StatusFlags & paInputOverflow))
+				pAudioIO->InputOverflowCount_.fetch_add(1, memory_order_relaxed);
+			if(!pfBuffer) {
+				pAudioIO->InputRingOverflowCount_.fetch_add(1, memory_order_relaxed);
+				AUDAPTR_TRACE_INSTANT("AudIO input overflow");
+				pAudioIO->Log_.Write(RtLogLevel::Warning, "Input ring overflow: {} frames dropped", FramesPerBuffer);
+			}
+			else {
+				// Only the routed channels reach the ring, so unselected inputs cost no ring bandwidth.
+				if(pRouting)
+					pRouting->Process(static_cast<const SampleT *>(pInputBuffer), pfBuffer, FramesPerBuffer);
+				else
+					ConvertFrames<Channels>(static_cast<const SampleT *>(pInputBuffer), pfBuffer, FramesPerBuffer, uNumChannels);
+				pAudioIO->InputBuffer_.WriteCommit(uNumToRead);
+			}
 		}
+		// Meter and record the device buffer rather than the ring, so that both continue while the ring is full.
+		if(pParams->pInputMeter)
+			pParams->pInputMeter->Process(static_cast<const SampleT *>(pInputBuffer), FramesPerBuffer);
+		if(pParams->pCaptureRing)
+			pParams->pCaptureRing->Write(pInputBuffer, FramesPerBuffer);
+		pAudioIO->Params_.Release();
 		if(!pAudioIO->InputBuffer_.IsOpen())
 			return paComplete;
 		return paContinue;
 	}
 
+	template<int Channels, typename SampleT>
 	int OutputPaCallback(const void *pInputBuffer, void *pOutputBuffer, unsigned long FramesPerBuffer, const PaStreamCallbackTimeInfo *pTimeInfo, PaStreamCallbackFlags StatusFlags, void *pUserData)
 	{
 		// StatusFlags: paOutputUnderflow, paOutputOverflow, paOutputUnderflow, paOutputOverflow, paPrimingOutput
-		AudIO *pAudioIO = reinterpret_cast<AudIO *>(pUserData);
-		size_t uNumToWrite = (size_t)FramesPerBuffer * pAudioIO->OutputParams_.channelCount, uAvailable;
-
-		auto *pfRead = pAudioIO->OutputBuffer_.ReadAcquire(uAvailable);
-		size_t uThisWrite = (uAvailable > uNumToWrite) ? uNumToWrite : uAvailable;
-		memcpy(pOutputBuffer, pfRead, uThisWrite * sizeof(float));
-		uNumToWrite -= uThisWrite;
-		pOutputBuffer = (float *)pOutputBuffer + uThisWrite;
-		// This check is necessary because the buffer may segment read transactions.
-		if((uNumToWrite > 0) && pAudioIO->OutputBuffer_.IsOpen()) {
-			pfRead = pAudioIO->OutputBuffer_.ReadAcquire(uAvailable);
-			uThisWrite = (uAvailable > uNumToWrite) ? uNumToWrite : uAvailable;
-			memcpy(pOutputBuffer, pfRead, uThisWrite * sizeof(float));
-			uNumToWrite -= uThisWrite;
-			pOutputBuffer = (float *)pOutputBuffer + uThisWrite;
-			pAudioIO->OutputBuffer_.ReadRelease(uThisWrite);
-		}
-		// If no free space in the output buffer, increment a count to record the overflow; do not block in this callback.
-		if((uNumToWrite > 0) || (StatusFlags & paOutputOverflow))
-			pAudioIO->OutputOverflowCount_++;
+		AUDAPTR_TRACE_THREAD("PortAudio callback");
+		AUDAPTR_TRACE_SCOPE("AudIO::OutputPaCallback");
+		AudIO *pAudioIO = static_cast<AudIO *>(pUserData);
+		const AudIO::StreamParams *pParams = pAudioIO->Params_.Acquire();
+		if(pParams->pCallbackRecorder)
+			pParams->pCallbackRecorder->Record(FramesPerBuffer, StatusFlags);
+		if(StatusFlags)
+			pAudioIO->NoteStatusFlags(StatusFlags);
+		pAudioIO->RenderOutput<Channels>(*pParams, static_cast<SampleT *>(pOutputBuffer), (size_t)FramesPerBuffer, StatusFlags);
+		pAudioIO->Params_.Release();
 		if(!pAudioIO->OutputBuffer_.IsOpen())
 			return paComplete;
 		return paContinue;
 	}
 
+	template<int Channels, typename SampleT>
 	int DuplexPaCallback(const void *pInputBuffer, void *pOutputBuffer, unsigned long FramesPerBuffer, const PaStreamCallbackTimeInfo *pTimeInfo, PaStreamCallbackFlags StatusFlags, void *pUserData)
 	{
 		// TODO: Check StatusFlags: paInputUnderflow, paInputOverflow, paOutputUnderflow, paOutputOverflow, paPrimingOutput
-		AudIO *pAudioIO = reinterpret_cast<AudIO *>(pUserData);
-
-		size_t uNumToWrite = (size_t)FramesPerBuffer * pAudioIO->InputParams_.channelCount;
+		// Specialised instantiations (Channels > 0) require equal input and output channel counts.
+		AUDAPTR_TRACE_THREAD("PortAudio callback");
+		AUDAPTR_TRACE_SCOPE("AudIO::DuplexPaCallback");
+		AudIO *pAudioIO = static_cast<AudIO *>(pUserData);
+		const size_t uNumInputChannels = Channels ? (size_t)Channels : (size_t)pAudioIO->InputParams_.channelCount;
+		const AudIO::StreamParams *pParams = pAudioIO->Params_.Acquire();
+		if(pParams->pCallbackRecorder)
+			pParams->pCallbackRecorder->Record(FramesPerBuffer, StatusFlags);
+		if(StatusFlags)
+			pAudioIO->NoteStatusFlags(StatusFlags);
+		RoutingMatrix *pInputRouting = pParams->pInputRouting;
+		const size_t uNumToWrite = (size_t)FramesPerBuffer * (pInputRouting ? (size_t)pInputRouting->NumDestinations() : uNumInputChannels);
 
 		// Read from the output buffer and write to the device
-		size_t uNumToRead = (size_t)FramesPerBuffer * pAudioIO->OutputParams_.channelCount, uAvailable;
-		auto *pfBuff = pAudioIO->OutputBuffer_.ReadAcquire(uAvailable);
-		if(pfBuff) {
-			size_t uThisRead = (uAvailable > uNumToRead) ? uNumToRead : uAvailable;
-			memcpy(pOutputBuffer, pfBuff, uThisRead * sizeof(float));
-			uNumToRead -= uThisRead;
-			pOutputBuffer = (float *)pOutputBuffer + uThisRead;
-			pAudioIO->OutputBuffer_.ReadRelease(uThisRead);
-			// This check is necessary because the buffer may segment read transactions.
-			if((uNumToRead > 0) && pAudioIO->OutputBuffer_.IsOpen()) {
-				pfBuff = pAudioIO->OutputBuffer_.ReadAcquire(uAvailable);
-				uThisRead = (uAvailable > uNumToRead) ? uNumToRead : uAvailable;
-				memcpy(pOutputBuffer, pfBuff, uThisRead * sizeof(float));
-				uNumToRead -= uThisRead;
-				pOutputBuffer = (float *)pOutputBuffer + uThisRead;
-				pAudioIO->OutputBuffer_.ReadRelease(uThisRead);
-			}
-		}
-		// If no free space in the output buffer, increment a count to record the overflow; do not block in this callback.
-		if((uNumToRead > 0) || (StatusFlags & paOutputOverflow))
-			pAudioIO->OutputOverflowCount_++;
+		pAudioIO->RenderOutput<Channels>(*pParams, static_cast<SampleT *>(pOutputBuffer), (size_t)FramesPerBuffer, StatusFlags);
 
-		// If no free space in the input buffer, increment a count to record the overflow; do not block in this callback.
-		pfBuff = pAudioIO->InputBuffer_.WriteReserve(uNumToWrite);
-		if(!pfBuff || (StatusFlags & paInputOverflow))
-			pAudioIO->InputOverflowCount_++;
+		if(pParams->pInputBlockPool)
+			pAudioIO->DeliverInputBlocks<Channels>(*pParams, static_cast<const SampleT *>(pInputBuffer), (size_t)FramesPerBuffer, uNumInputChannels, StatusFlags);
+		else if(pParams->pInputShards)
+			pAudioIO->DeliverInputShards(*pParams, static_cast<const SampleT *>(pInputBuffer), (size_t)FramesPerBuffer, StatusFlags);
 		else {
-			memcpy(pfBuff, pInputBuffer, uNumToWrite * sizeof(float));
-			pAudioIO->InputBuffer_.WriteCommit(uNumToWrite);
+			// If no free space in the input buffer, increment a count to record the overflow; do not block in this callback.
+			auto *pfBuff = pAudioIO->InputBuffer_.WriteReserve(uNumToWrite);
+			if(!pfBuff || (StatusFlags & paInputOverflow))
+				pAudioIO->InputOverflowCount_.fetch_add(1, memory_order_relaxed);
+			if(!pfBuff) {
+				pAudioIO->InputRingOverflowCount_.fetch_add(1, memory_order_relaxed);
+				AUDAPTR_TRACE_INSTANT("AudIO input overflow");
+				pAudioIO->Log_.Write(RtLogLevel::Warning, "Input ring overflow: {} frames dropped", FramesPerBuffer);
+			}
+			else {
+				if(pInputRouting)
+					pInputRouting->Process(static_cast<const SampleT *>(pInputBuffer), pfBuff, FramesPerBuffer);
+				else
+					ConvertFrames<Channels>(static_cast<const SampleT *>(pInputBuffer), pfBuff, FramesPerBuffer, uNumInputChannels);
+				pAudioIO->InputBuffer_.WriteCommit(uNumToWrite);
+			}
 		}
+		if(pParams->pInputMeter)
+			pParams->pInputMeter->Process(static_cast<const SampleT *>(pInputBuffer), FramesPerBuffer);
+		if(pParams->pCaptureRing)
+			pParams->pCaptureRing->Write(pInputBuffer, FramesPerBuffer);
+		pAudioIO->Params_.Release();
 
 		if(!pAudioIO->OutputBuffer_.IsOpen() || !pAudioIO->InputBuffer_.IsOpen())
 			return paComplete;
 		return paContinue;
 	}
 
+	template<int Channels, typename SampleT>
+	static PaStreamCallback *CallbackFor(const IOType Type)
+	{
+		switch(Type) {
+		case IOType::Input:
+			return &InputPaCallback<Channels, SampleT>;
+		case IOType::Output:
+			return &OutputPaCallback<Channels, SampleT>;
+		case IOType::Duplex:
+			break;
+		}
+		return &DuplexPaCallback<Channels, SampleT>;
+	}
+
+	// Select an instantiation specialised for common channel counts, falling back to the generic instantiation.
+	template<typename SampleT>
+	static PaStreamCallback *CallbackFor(const IOType Type, const int NumInputChannels, const int NumOutputChannels)
+	{
+		int Channels = (Type == IOType::Output) ? NumOutputChannels : NumInputChannels;
+		if((Type == IOType::Duplex) && (NumInputChannels != NumOutputChannels))
+			Channels = 0;
+		switch(Channels) {
+		case 1:
+			return CallbackFor<1, SampleT>(Type);
+		case 2:
+			return CallbackFor<2, SampleT>(Type);
+		case 8:
+			return CallbackFor<8, SampleT>(Type);
+		case 32:
+			return CallbackFor<32, SampleT>(Type);
+		default:
+			return CallbackFor<0, SampleT>(Type);
+		}
+	}
 
 	AudIO::AudIO() :
-		PaInitFlag_(0), pPaStream_(nullptr),
 		InputBuffer_(65536),
-		InputOverflowCount_(0),
 		OutputBuffer_(65536),
+		InputOverflowCount_(0),
 		OutputOverflowCount_(0),
 		Status_("Audio device closed")
 	{
 	}
 
 	AudIO::AudIO(const Binding &DeviceToUse) :
-		Binding_(DeviceToUse),
-		PaInitFlag_(0), pPaStream_(nullptr),
 		InputBuffer_(65536),
-		InputOverflowCount_(0),
 		OutputBuffer_(65536),
+		InputOverflowCount_(0),
 		OutputOverflowCount_(0),
+		Binding_(DeviceToUse),
 		Status_("Audio device closed")
 	{
-		SampleRate_Hz_ = Binding_.SampleRates_Hz_.front();
+		SampleRate_Hz_ = Binding_.PreferredSampleRate_Hz();
+	}
+
+	AudIO::~AudIO()
+	{
+		if(pPaStream_ || (PaInitFlag_ > 0)) {
+			// A destructor must not throw; the stream is closed regardless.
+			try {
+				Stop();
+			}
+			catch(const Exception &) {
+			}
+			Close();
+		}
+		// The log detaches itself from its logger (if that still exists) when it is destroyed.
 	}
 
 	bool AudIO::Bind(const Binding &ToBind, double Latency_s, const int NumInputChannels, const int NumOutputChannels)
 	{
 		// TODO: Set ASIO host parameters
-		Binding_ = ToBind;
-		SampleRate_Hz_ = static_cast<uint32_t>(Binding_.SampleRates_Hz_.front());
+		// Binding resizes the rings, which the callback of an open stream still uses.
+		if(pPaStream_)
+			throw Exception("Device cannot be bound while it is open");
 		if(Latency_s < ToBind.MinLatency_s())
 			throw Exception("Latency requested is lower than the minimum possible");
 		if(Latency_s > ToBind.MaxLatency_s())
 			throw Exception("Latency requested is higher than the maximum possible");
-		switch(ToBind.Type_) {
+		Binding_ = ToBind;
+		SampleRate_Hz_ = static_cast<uint32_t>(Binding_.PreferredSampleRate_Hz());
+		RequestedLatency_s_ = Latency_s;
+		switch(ToBind.Type()) {
 		case Audaptr::IOType::Input:
 			if(NumInputChannels <= 0)
 				throw Exception("Number of input channels should be greater than zero for input");
 			if(NumInputChannels > ToBind.MaxInputChannels())
 				throw Exception("Number of input channels exceeds the maximum possible");
-			InputParams_ = PaStreamParameters{Binding_.DeviceIndex_, NumInputChannels, paFloat32, Latency_s, pHostParams_};
+			InputParams_ = PaStreamParameters{Binding_.DeviceIndex(), NumInputChannels, SampleFormat_, Latency_s, pHostParams_};
 			break;
 		case Audaptr::IOType::Output:
 			if(NumOutputChannels <= 0)
 				throw Exception("Number of output channels should be greater than zero for output");
 			if(NumInputChannels > ToBind.MaxOutputChannels())
 				throw Exception("Number of input channels exceeds the maximum possible");
-			OutputParams_ = PaStreamParameters{Binding_.DeviceIndex_, NumOutputChannels, paFloat32, Latency_s, pHostParams_};
+			OutputParams_ = PaStreamParameters{Binding_.DeviceIndex(), NumOutputChannels, SampleFormat_, Latency_s, pHostParams_};
 			break;
 		case Audaptr::IOType::Duplex:
 			if(NumInputChannels <= 0)
@@ -155,21 +433,106 @@ namespace Audaptr
 				throw Exception("Number of output channels should be greater than zero for duplex operation");
 			if(NumInputChannels > ToBind.MaxOutputChannels())
 				throw Exception("Number of input channels exceeds the maximum possible");
-			InputParams_ = PaStreamParameters{Binding_.DeviceIndex_, NumInputChannels, paFloat32, Latency_s, pHostParams_};
-			OutputParams_ = PaStreamParameters{Binding_.DeviceIndex_, NumOutputChannels, paFloat32, Latency_s, pHostParams_};
+			InputParams_ = PaStreamParameters{Binding_.DeviceIndex(), NumInputChannels, SampleFormat_, Latency_s, pHostParams_};
+			OutputParams_ = PaStreamParameters{Binding_.DeviceIndex(), NumOutputChannels, SampleFormat_, Latency_s, pHostParams_};
 		}
-		PaInitFlag_ = 0;
-		pPaStream_ = nullptr;
-		InputBuffer_.Close();
-		OutputBuffer_.Close();
+		SizeRings();
+		// The priming threshold depends on the sample rate.
+		PublishParams();
 		return true;
 	}
 
+	void AudIO::OpenRings()
+	{
+		if(Binding_.Type() != IOType::Output)
+			InputBuffer_.Open();
+		if(Binding_.Type() != IOType::Input)
+			OutputBuffer_.Open();
+	}
+
+	void AudIO::SizeRings()
+	{
+		// Size the rings for the channel count, sample rate and latency, rather than a fixed capacity.
+		const double RingLatency_s = (RingLatency_s_ > 0.0) ? RingLatency_s_ : RingHeadroom_ * RequestedLatency_s_;
+		if(Binding_.Type() != IOType::Output)
+			InputBuffer_.Resize(RingCapacity(NumInputRingChannels(), SampleRate_Hz_, RingLatency_s));
+		else
+			InputBuffer_.Close();
+		if(Binding_.Type() != IOType::Input)
+			OutputBuffer_.Resize(RingCapacity(NumOutputRingChannels(), SampleRate_Hz_, RingLatency_s));
+		else
+			OutputBuffer_.Close();
+	}
+
+	size_t AudIO::RingCapacity(const int NumChannels, const double SampleRate_Hz, const double Latency_s)
+	{
+		// A whole, power-of-2 number of frames, so that the ring never splits a frame and blocks tend to stay contiguous.
+		const double dFrames = ceil(SampleRate_Hz * max(Latency_s, kMinRingLatency_s));
+		size_t Frames = 1;
+		while((double)Frames < dFrames)
+			Frames <<= 1;
+		return Frames * (size_t)max(NumChannels, 1);
+	}
+
+	void AudIO::SetRingLatency_s(const double RingLatency_s)
+	{
+		if(pPaStream_)
+			throw Exception("Ring latency cannot be changed while the device is open");
+		RingLatency_s_ = RingLatency_s;
+	}
+
+	void AudIO::SetRingHeadroom(const double Headroom)
+	{
+		if(Headroom < 1.0)
+			throw Exception("Ring headroom should be at least 1");
+		RingHeadroom_ = Headroom;
+	}
+
+	void AudIO::ResetOverflowCounts()
+	{
+		InputOverflowCount_.store(0, memory_order_relaxed);
+		OutputOverflowCount_.store(0, memory_order_relaxed);
+		InputRingOverflowCount_.store(0, memory_order_relaxed);
+		OutputRingUnderflowCount_.store(0, memory_order_relaxed);
+		InputDeviceXrunCount_.store(0, memory_order_relaxed);
+		OutputDeviceXrunCount_.store(0, memory_order_relaxed);
+		OutputUnderrunFrames_.store(0, memory_order_relaxed);
+		LongestOutputUnderrun_.store(0, memory_order_relaxed);
+	}
+
+	void AudIO::SetOutputUnderrunPolicy(const UnderrunPolicy Policy)
+	{
+		OutputUnderrunPolicy_ = Policy;
+		PublishParams();
+	}
+
+	void AudIO::SetOutputPriming_s(const double Priming_s)
+	{
+		if(Priming_s < 0.0)
+			throw Exception("Output priming duration cannot be negative");
+		OutputPriming_s_ = Priming_s;
+		PublishParams();
+	}
+
 	bool AudIO::Open()
 	{
 		PaError iPaErr;
 		unsigned long FramesPerBuffer = 0; // allow PortAudio to choose the number of frames per buffer
-		iPaErr = Pa_Initialize();
+		if(pInputMeter_ && (Binding_.Type() != IOType::Output) && (pInputMeter_->NumChannels() != InputParams_.channelCount))
+			throw Exception("Input meter has " + to_string(pInputMeter_->NumChannels()) + " channels, but " + to_string(InputParams_.channelCount) + " are bound");
+		if(pCaptureRing_ && (Binding_.Type() != IOType::Output))
+			CheckCaptureRing(*pCaptureRing_);
+		if(pInputBlockPool_ && (Binding_.Type() != IOType::Output))
+			CheckInputBlocks(*pInputBlockPool_);
+		if(pInputShards_ && (Binding_.Type() != IOType::Output))
+			CheckInputShards(*pInputShards_);
+		InputBlockFrame_ = 0;
+		if(pInputRouting_ && (Binding_.Type() != IOType::Output) && (pInputRouting_->NumSources() != InputParams_.channelCount))
+			throw Exception("Input routing has " + to_string(pInputRouting_->NumSources()) + " sources, but " + to_string(InputParams_.channelCount) + " input channels are bound");
+		if(pOutputRouting_ && (Binding_.Type() != IOType::Input) && (pOutputRouting_->NumDestinations() != OutputParams_.channelCount))
+			throw Exception("Output routing has " + to_string(pOutputRouting_->NumDestinations()) + " destinations, but " + to_string(OutputParams_.channelCount) + " output channels are bound");
+		// The runtime keeps PortAudio initialised between streams, rather than initialising it for each one.
+		iPaErr = AudioRuntime::Instance().Acquire();
 		if(iPaErr != 0) {
 			Status_ = Binding_ .TypeName() + ": " + string(Binding_.DeviceName()) + " error: " + g_mapPaError[iPaErr];
 			return false;
@@ -177,34 +540,41 @@ namespace Audaptr
 		else
 			PaInitFlag_++;
 		PaStreamParameters *pInputParams = nullptr, *pOutputParams = nullptr;
-		auto PaCallback = InputPaCallback;
 		switch(Binding_.Type()) {
 		case IOType::Input:
 			pInputParams = &InputParams_;
-			InputBuffer_.Open();
 			break;
 		case IOType::Output:
 			pOutputParams = &OutputParams_;
-			PaCallback = OutputPaCallback;
-			OutputBuffer_.Open();
 			break;
 		case IOType::Duplex:
 			pInputParams = &InputParams_;
 			pOutputParams = &OutputParams_;
-			PaCallback = DuplexPaCallback;
-			InputBuffer_.Open();
-			OutputBuffer_.Open();
 			break;
 		}
-		iPaErr = Pa_OpenStream(&pPaStream_, pInputParams, pOutputParams, SampleRate_Hz_, FramesPerBuffer, paClipOff | paDitherOff, PaCallback, this);
+		OpenRings();
+		if(pOutputParams) {
+			vOutputHistory_.assign(kHistoryFrames * (size_t)OutputParams_.channelCount, 0.0f);
+			vConcealScratch_.assign(kHistoryFrames * (size_t)OutputParams_.channelCount, 0.0f);
+		}
+		// Blocking reads and writes convert and route through scratch frames, which hold floats at most.
+		if(Mode_ == IOMode::Blocking) {
+			vReadScratch_.assign(pInputParams ? kBlockingChunkFrames * (size_t)InputParams_.channelCount * sizeof(float) : 0, 0);
+			vWriteScratch_.assign(pOutputParams ? kBlockingChunkFrames * (size_t)OutputParams_.channelCount * sizeof(float) : 0, 0);
+		}
+		if(Mode_ != IOMode::Blocking)
+			BeginCallbackSession();
+		iPaErr = Pa_OpenStream(&pPaStream_, pInputParams, pOutputParams, SampleRate_Hz_, FramesPerBuffer, paClipOff | paDitherOff, (Mode_ == IOMode::Blocking) ? nullptr : Callback(), this);
 		if(iPaErr != 0) {
 			Status_ = Binding_.TypeName() + ": " + string(Pa_GetDeviceInfo(InputParams_.device)->name) + " error: " + g_mapPaError[iPaErr];
 			return false;
 		}
+		Pa_SetStreamFinishedCallback(pPaStream_, &AudIO::StreamFinishedCallback);
+		AudioRuntime::Instance().Register(this);
+		SetState(StreamState::Open);
 
 		// Reset input buffers
-		OutputOverflowCount_ = 0;
-		InputOverflowCount_ = 0;
+		ResetOverflowCounts();
 		const PaStreamInfo *pStreamInfo = Pa_GetStreamInfo(pPaStream_);
 		double dInputLatency = (double)pStreamInfo->inputLatency;
 		switch(Binding_.Type()) {
@@ -229,18 +599,28 @@ namespace Audaptr
 			return false;
 		}
 
+		// The callback is not running, so its concealment state may be reset here.
+		OutputPrimed_.store(false, memory_order_relaxed);
+		HistoryPos_ = 0;
+		HistoryFrames_ = 0;
+		ConcealedFrames_ = 0;
+		FadeInPos_ = kFadeFrames;
+
 		PaError iPaErr = Pa_StartStream(pPaStream_);
 		if(iPaErr) {
 			InputBuffer_.Close();
 			Status_ = "Error when attempting to start input stream: " + PaErrorString(iPaErr);
 			return false;
 		}
+		SetState(StreamState::Running);
 		return true;
 	}
 
 	bool AudIO::Stop()
 	{
 		if(Started()) {
+			// Publish the state first, so that the finished callback raised by stopping is not taken for an end.
+			SetState(StreamState::Stopped);
 			PaError iPaErr = Pa_StopStream(pPaStream_);
 			if(iPaErr)
 				throw Exception("PortAudio error when attempting to stop stream: " + PaErrorString(iPaErr));
@@ -252,17 +632,429 @@ namespace Audaptr
 	bool AudIO::Close()
 	{
 		if(pPaStream_) {
+			AudioRuntime::Instance().Unregister(this);
 			PaError iPaErr = Pa_CloseStream(pPaStream_);
 			pPaStream_ = nullptr;
 		}
 		if(PaInitFlag_ > 0) {
-			Pa_Terminate();
+			AudioRuntime::Instance().Release();
 			PaInitFlag_--;
 		}
 		Status_ = "Audio device closed";
+		if(State_.load(memory_order_relaxed) != StreamState::Closed)
+			SetState(StreamState::Closed);
 		return false;
 	}
 
+	bool AudIO::Reopen(const double Latency_s)
+	{
+		const bool Running = pPaStream_ && Started();
+		const Binding Bound = Binding_;
+		const int NumInputChannels = InputParams_.channelCount, NumOutputChannels = OutputParams_.channelCount;
+		// Hold a reference across the re-open, so that PortAudio is not terminated in between.
+		const PaError iPaErr = AudioRuntime::Instance().Acquire();
+		if(iPaErr) {
+			Status_ = "Error when attempting to re-open stream: " + PaErrorString(iPaErr);
+			return false;
+		}
+		bool Reopened = false;
+		try {
+			Stop();
+			if(pPaStream_ && (Latency_s == RequestedLatency_s_)) {
+				// The device parameters are unchanged, so the stream stays open and only the rings are rebuilt.
+				SizeRings();
+				OpenRings();
+				InputBlockFrame_ = 0;
+				Reopened = !Running || Start();
+			}
+			else {
+				Close();
+				Bind(Bound, Latency_s, NumInputChannels, NumOutputChannels);
+				Reopened = Open() && (!Running || Start());
+			}
+		}
+		catch(...) {
+			AudioRuntime::Instance().Release();
+			throw;
+		}
+		AudioRuntime::Instance().Release();
+		return Reopened;
+	}
+
+	void AudIO::SetState(const StreamState State)
+	{
+		State_.store(State, memory_order_release);
+		if(BufferNotifier *pNotifier = pStateNotifier_.load(memory_order_acquire))
+			pNotifier->Notify();
+	}
+
+	void AudIO::StreamFinishedCallback(void *pUserData)
+	{
+		AudIO *pAudioIO = static_cast<AudIO *>(pUserData);
+		StreamState Running = StreamState::Running;
+		if(pAudioIO->State_.compare_exchange_strong(Running, StreamState::Finished, memory_order_acq_rel)) {
+			pAudioIO->Log_.Write(RtLogLevel::Info, "Stream finished");
+			if(BufferNotifier *pNotifier = pAudioIO->pStateNotifier_.load(memory_order_acquire))
+				pNotifier->Notify();
+		}
+	}
+
+	void AudIO::NoteStatusFlags(const PaStreamCallbackFlags StatusFlags) noexcept
+	{
+		// Counted apart from the rings, so that a device xrun coinciding with a ring xrun is not hidden by it.
+		if(StatusFlags & (paInputUnderflow | paInputOverflow))
+			InputDeviceXrunCount_.fetch_add(1, memory_order_relaxed);
+		if(StatusFlags & (paOutputUnderflow | paOutputOverflow))
+			OutputDeviceXrunCount_.fetch_add(1, memory_order_relaxed);
+		// Priming the output is expected at the start of a stream; anything else means samples were lost.
+		if(StatusFlags & ~(PaStreamCallbackFlags)paPrimingOutput)
+			Log_.Write(RtLogLevel::Warning, "Stream callback status flags 0x{x}", StatusFlags);
+	}
+
+	void AudIO::SetLogger(RtLogger *pLogger)
+	{
+		Log_.Detach();
+		if(pLogger)
+			pLogger->Attach(Log_, Binding_.TypeName() + ": " + string(Binding_.DeviceName()));
+	}
+
+	RealTimeReport AudIO::ConfigureRealTime(const RealTimeConfig &Config)
+	{
+		RealTimeReport Report;
+		ConfigureCurrentThread(Config, Report);
+		if(Config.PrefaultBuffers) {
+			if(pPaStream_ && Started()) {
+				Report.Prefaulted = false;
+				Report.Status += string(Report.Status.empty() ? "" : "; ") + "Buffers not pre-faulted: stream is running";
+			}
+			else {
+				InputBuffer_.Prefault();
+				OutputBuffer_.Prefault();
+			}
+		}
+		if(Config.LockMemory) {
+#ifdef _WIN32
+			LockRegion(InputBuffer_.Data(), InputBuffer_.Size() * sizeof(float), Report);
+			LockRegion(OutputBuffer_.Data(), OutputBuffer_.Size() * sizeof(float), Report);
+#else
+			LockProcessMemory(Report);
+#endif
+		}
+		return Report;
+	}
+
+	void AudIO::SetInputMeter(LevelMeter *pMeter)
+	{
+		if(pPaStream_ && pMeter && (pMeter->NumChannels() != InputParams_.channelCount))
+			throw Exception("Input meter has " + to_string(pMeter->NumChannels()) + " channels, but " + to_string(InputParams_.channelCount) + " are bound");
+		pInputMeter_ = pMeter;
+		PublishParams();
+	}
+
+	void AudIO::CheckCaptureRing(const CaptureRing &Ring) const
+	{
+		if(Ring.NumChannels() != InputParams_.channelCount)
+			throw Exception("Capture ring has " + to_string(Ring.NumChannels()) + " channels, but " + to_string(InputParams_.channelCount) + " are bound");
+		if(Ring.SampleFormat() != SampleFormat_)
+			throw Exception("Capture ring sample format does not match that of the device");
+	}
+
+	void AudIO::SetCaptureRing(CaptureRing *pRing)
+	{
+		if(pPaStream_ && pRing)
+			CheckCaptureRing(*pRing);
+		pCaptureRing_ = pRing;
+		PublishParams();
+	}
+
+	void AudIO::CheckInputBlocks(const BlockPool &Pool) const
+	{
+		const int NumRingChannels = pInputRouting_ ? pInputRouting_->NumDestinations() : InputParams_.channelCount;
+		if(Pool.NumChannels() != NumRingChannels)
+			throw Exception("Block pool has " + to_string(Pool.NumChannels()) + " channels, but the input delivers " + to_string(NumRingChannels));
+	}
+
+	void AudIO::SetInputBlocks(BlockPool *pPool, BlockQueue *pQueue)
+	{
+		if(pPool && !pQueue)
+			throw Exception("Input blocks require a queue");
+		if(pPaStream_ && pPool)
+			CheckInputBlocks(*pPool);
+		pInputBlockPool_ = pPool;
+		pInputBlockQueue_ = pPool ? pQueue : nullptr;
+		PublishParams();
+	}
+
+	void AudIO::CheckInputShards(const ChannelShards &Shards) const
+	{
+		const int NumRingChannels = pInputRouting_ ? pInputRouting_->NumDestinations() : InputParams_.channelCount;
+		if(Shards.NumChannels() != NumRingChannels)
+			throw Exception("Channel shards take " + to_string(Shards.NumChannels()) + " channels, but the input delivers " + to_string(NumRingChannels));
+	}
+
+	void AudIO::SetInputShards(ChannelShards *pShards)
+	{
+		if(pPaStream_ && pShards)
+			CheckInputShards(*pShards);
+		pInputShards_ = pShards;
+		PublishParams();
+	}
+
+	void AudIO::BeginCallbackSession()
+	{
+		if(!pCallbackRecorder_)
+			return;
+		const int NumInputChannels = (Binding_.Type() != IOType::Output) ? InputParams_.channelCount : 0;
+		const int NumOutputChannels = (Binding_.Type() != IOType::Input) ? OutputParams_.channelCount : 0;
+		pCallbackRecorder_->Begin(Binding_.Type(), NumInputChannels, NumOutputChannels, SampleRate_Hz_, SampleFormat_);
+	}
+
+	void AudIO::SetCallbackRecorder(CallbackRecorder *pRecorder)
+	{
+		// Stop the callback recording into the previous recorder before starting a session in the new one.
+		pCallbackRecorder_ = nullptr;
+		PublishParams();
+		pCallbackRecorder_ = pRecorder;
+		if(pPaStream_ && (Mode_ != IOMode::Blocking))
+			BeginCallbackSession();
+		PublishParams();
+	}
+
+	void AudIO::SetInputRouting(RoutingMatrix *pRouting)
+	{
+		// The ring cannot be resized under a running stream, so the number of ring channels must stay the same.
+		if(pPaStream_ && (!pRouting || !pInputRouting_ || (pRouting->NumSources() != pInputRouting_->NumSources()) || (pRouting->NumDestinations() != pInputRouting_->NumDestinations())))
+			throw Exception("Input routing can only be replaced by one of the same dimensions while the device is open");
+		pInputRouting_ = pRouting;
+		if(!pPaStream_ && (RequestedLatency_s_ > 0.0))
+			SizeRings();
+		PublishParams();
+	}
+
+	void AudIO::SetOutputRouting(RoutingMatrix *pRouting)
+	{
+		if(pPaStream_ && (!pRouting || !pOutputRouting_ || (pRouting->NumSources() != pOutputRouting_->NumSources()) || (pRouting->NumDestinations() != pOutputRouting_->NumDestinations())))
+			throw Exception("Output routing can only be replaced by one of the same dimensions while the device is open");
+		pOutputRouting_ = pRouting;
+		if(!pPaStream_ && (RequestedLatency_s_ > 0.0))
+			SizeRings();
+		PublishParams();
+	}
+
+	void AudIO::PublishParams()
+	{
+		const size_t OutputPrimingFrames = (SampleRate_Hz_ > 0.0) ? (size_t)ceil(OutputPriming_s_ * SampleRate_Hz_) : 0;
+		Params_.Publish(make_unique<StreamParams>(StreamParams{pInputMeter_, pInputRouting_, pOutputRouting_, pCaptureRing_, pInputBlockPool_, pInputBlockQueue_, pInputShards_, pCallbackRecorder_, OutputUnderrunPolicy_, OutputPrimingFrames}));
+		// Once the callback in progress (if any) returns, nothing refers to the previous settings.
+		Params_.Synchronize();
+	}
+
+	void AudIO::SetBufferAllocator(BufferAllocator *pAllocator)
+	{
+		if(pPaStream_)
+			throw Exception("Buffer allocator cannot be changed while the device is open");
+		InputBuffer_.SetAllocator(pAllocator);
+		OutputBuffer_.SetAllocator(pAllocator);
+	}
+
+	void AudIO::SetSampleFormat(const PaSampleFormat Format)
+	{
+		if((Format != paFloat32) && (Format != paInt16))
+			throw Exception("Sample format not supported: only 32-bit float and 16-bit integer are available");
+		if(pPaStream_)
+			throw Exception("Sample format cannot be changed while the device is open");
+		SampleFormat_ = Format;
+		InputParams_.sampleFormat = Format;
+		OutputParams_.sampleFormat = Format;
+	}
+
+	void AudIO::SetIOMode(const IOMode Mode)
+	{
+		if(pPaStream_)
+			throw Exception("I/O mode cannot be changed while the device is open");
+		Mode_ = Mode;
+	}
+
+	bool AudIO::ReadStream(void *pFrames, const size_t NumFrames)
+	{
+		const PaError iPaErr = Pa_ReadStream(pPaStream_, pFrames, (unsigned long)NumFrames);
+		if(iPaErr == paInputOverflowed) {
+			// The frames were still read; the overflow happened before this call.
+			InputOverflowCount_.fetch_add(1, memory_order_relaxed);
+			InputDeviceXrunCount_.fetch_add(1, memory_order_relaxed);
+			return false;
+		}
+		if(iPaErr)
+			throw Exception("PortAudio error when reading from the stream: " + PaErrorString(iPaErr));
+		return true;
+	}
+
+	bool AudIO::WriteStream(const void *pFrames, const size_t NumFrames)
+	{
+		const PaError iPaErr = Pa_WriteStream(pPaStream_, pFrames, (unsigned long)NumFrames);
+		if(iPaErr == paOutputUnderflowed) {
+			OutputOverflowCount_.fetch_add(1, memory_order_relaxed);
+			OutputDeviceXrunCount_.fetch_add(1, memory_order_relaxed);
+			return false;
+		}
+		if(iPaErr)
+			throw Exception("PortAudio error when writing to the stream: " + PaErrorString(iPaErr));
+		return true;
+	}
+
+	template<typename SampleT>
+	bool AudIO::ReadConverted(float *pFrames, const size_t NumFrames, const size_t NumRingChannels)
+	{
+		const size_t NumDeviceChannels = (size_t)InputParams_.channelCount;
+		SampleT *pScratch = reinterpret_cast<SampleT *>(vReadScratch_.data());
+		bool Complete = true;
+		for(size_t Frame = 0; Frame < NumFrames; Frame += kBlockingChunkFrames) {
+			const size_t ChunkFrames = min(kBlockingChunkFrames, NumFrames - Frame);
+			// As in the callback, the settings are held for one chunk, so that a setter waits for it to finish.
+			ParamMailbox<StreamParams, 2>::Guard pParams(Params_, kCallbackReader);
+			RoutingMatrix *pRouting = pParams->pInputRouting;
+			if((pRouting ? (size_t)pRouting->NumDestinations() : NumDeviceChannels) != NumRingChannels) {
+				// The routing changed the frame size during the read: the rest would not fit the caller's frames.
+				memset(pFrames + Frame * NumRingChannels, 0, (NumFrames - Frame) * NumRingChannels * sizeof(float));
+				return false;
+			}
+			float *pDest = pFrames + Frame * NumRingChannels;
+			// Unrouted float frames go straight to the caller.
+			SampleT *pDevice = (is_same<SampleT, float>::value && !pRouting) ? reinterpret_cast<SampleT *>(pDest) : pScratch;
+			Complete &= ReadStream(pDevice, ChunkFrames);
+			if(pParams->pInputMeter)
+				pParams->pInputMeter->Process(pDevice, ChunkFrames);
+			if(pParams->pCaptureRing)
+				pParams->pCaptureRing->Write(pDevice, ChunkFrames);
+			if(pRouting)
+				pRouting->Process(pDevice, pDest, ChunkFrames);
+			else if(pDevice != reinterpret_cast<SampleT *>(pDest))
+				ConvertSamples(pDevice, pDest, ChunkFrames * NumDeviceChannels);
+		}
+		return Complete;
+	}
+
+	template<typename SampleT>
+	bool AudIO::WriteConverted(const float *pFrames, const size_t NumFrames, const size_t NumRingChannels)
+	{
+		const size_t NumDeviceChannels = (size_t)OutputParams_.channelCount;
+		SampleT *pScratch = reinterpret_cast<SampleT *>(vWriteScratch_.data());
+		bool Complete = true;
+		for(size_t Frame = 0; Frame < NumFrames; Frame += kBlockingChunkFrames) {
+			const size_t ChunkFrames = min(kBlockingChunkFrames, NumFrames - Frame);
+			ParamMailbox<StreamParams, 2>::Guard pParams(Params_, kBlockingWriter);
+			RoutingMatrix *pRouting = pParams->pOutputRouting;
+			if((pRouting ? (size_t)pRouting->NumSources() : NumDeviceChannels) != NumRingChannels)
+				return false;
+			const float *pSource = pFrames + Frame * NumRingChannels;
+			const SampleT *pDevice = pScratch;
+			if(pRouting)
+				pRouting->Process(pSource, pScratch, ChunkFrames);
+			else if(is_same<SampleT, float>::value)
+				pDevice = reinterpret_cast<const SampleT *>(pSource);
+			else
+				ConvertSamples(pSource, pScratch, ChunkFrames * NumDeviceChannels);
+			Complete &= WriteStream(pDevice, ChunkFrames);
+		}
+		return Complete;
+	}
+
+	size_t AudIO::BlockingReadChannels()
+	{
+		ParamMailbox<StreamParams, 2>::Guard pParams(Params_, kCallbackReader);
+		return pParams->pInputRouting ? (size_t)pParams->pInputRouting->NumDestinations() : (size_t)InputParams_.channelCount;
+	}
+
+	size_t AudIO::BlockingWriteChannels()
+	{
+		ParamMailbox<StreamParams, 2>::Guard pParams(Params_, kBlockingWriter);
+		return pParams->pOutputRouting ? (size_t)pParams->pOutputRouting->NumSources() : (size_t)OutputParams_.channelCount;
+	}
+
+	bool AudIO::Read(float *pFrames, const size_t NumFrames)
+	{
+		if((Mode_ != IOMode::Blocking) || !pPaStream_ || (Binding_.Type() == IOType::Output))
+			throw Exception("Read requires an open input stream in blocking mode");
+		if(SampleFormat_ == paInt16)
+			return ReadConverted<int16_t>(pFrames, NumFrames, BlockingReadChannels());
+		return ReadConverted<float>(pFrames, NumFrames, BlockingReadChannels());
+	}
+
+	bool AudIO::Read(QuickBuffer<float> &Ring, const size_t NumFrames)
+	{
+		if((Mode_ != IOMode::Blocking) || !pPaStream_ || (Binding_.Type() == IOType::Output))
+			throw Exception("Read requires an open input stream in blocking mode");
+		const size_t NumRingChannels = BlockingReadChannels();
+		const size_t NumItems = NumFrames * NumRingChannels;
+		float *pWrite = Ring.WriteReserve(NumItems);
+		if(!pWrite) {
+			InputRingOverflowCount_.fetch_add(1, memory_order_relaxed);
+			return false;
+		}
+		const bool Complete = (SampleFormat_ == paInt16) ? ReadConverted<int16_t>(pWrite, NumFrames, NumRingChannels) : ReadConverted<float>(pWrite, NumFrames, NumRingChannels);
+		Ring.WriteCommit(NumItems);
+		return Complete;
+	}
+
+	bool AudIO::Write(const float *pFrames, const size_t NumFrames)
+	{
+		if((Mode_ != IOMode::Blocking) || !pPaStream_ || (Binding_.Type() == IOType::Input))
+			throw Exception("Write requires an open output stream in blocking mode");
+		if(SampleFormat_ == paInt16)
+			return WriteConverted<int16_t>(pFrames, NumFrames, BlockingWriteChannels());
+		return WriteConverted<float>(pFrames, NumFrames, BlockingWriteChannels());
+	}
+
+	bool AudIO::Write(QuickBuffer<float> &Ring, const size_t NumFrames)
+	{
+		if((Mode_ != IOMode::Blocking) || !pPaStream_ || (Binding_.Type() == IOType::Input))
+			throw Exception("Write requires an open output stream in blocking mode");
+		// The ring may split the frames into two contiguous segments.
+		const size_t NumChannels = BlockingWriteChannels();
+		size_t Remaining = NumFrames;
+		bool Complete = true;
+		for(int Segment = 0; (Segment < 2) && (Remaining > 0); Segment++) {
+			size_t Available = 0;
+			const float *pRead = Ring.ReadAcquire(Available, Remaining * NumChannels);
+			if(!pRead)
+				break;
+			const size_t ThisWrite = min(Available / NumChannels, Remaining);
+			if(ThisWrite == 0)
+				break;
+			Complete &= (SampleFormat_ == paInt16) ? WriteConverted<int16_t>(pRead, ThisWrite, NumChannels) : WriteConverted<float>(pRead, ThisWrite, NumChannels);
+			Ring.ReadRelease(ThisWrite * NumChannels);
+			Remaining -= ThisWrite;
+		}
+		if(Remaining > 0) {
+			OutputRingUnderflowCount_.fetch_add(1, memory_order_relaxed);
+			return false;
+		}
+		return Complete;
+	}
+
+	long AudIO::ReadAvailable() const
+	{
+		const long Frames = Pa_GetStreamReadAvailable(pPaStream_);
+		if(Frames < 0)
+			throw Exception("PortAudio error when querying the frames available to read: " + PaErrorString((PaError)Frames));
+		return Frames;
+	}
+
+	long AudIO::WriteAvailable() const
+	{
+		const long Frames = Pa_GetStreamWriteAvailable(pPaStream_);
+		if(Frames < 0)
+			throw Exception("PortAudio error when querying the frames available to write: " + PaErrorString((PaError)Frames));
+		return Frames;
+	}
+
+	PaStreamCallback *AudIO::Callback() const
+	{
+		if(SampleFormat_ == paInt16)
+			return CallbackFor<int16_t>(Binding_.Type(), InputParams_.channelCount, OutputParams_.channelCount);
+		return CallbackFor<float>(Binding_.Type(), InputParams_.channelCount, OutputParams_.channelCount);
+	}
+
 	double AudIO::SampleRate_Hz() const
 	{
 		return SampleRate_Hz_;
@@ -271,8 +1063,8 @@ namespace Audaptr
 #ifdef paAsioUseChannelSelectors
 	void AudIO::ShowAsioControlPanel(void *hWindow)
 	{
-		if(Binding_.System_ == "ASIO")
-			PaError iPaErr = PaAsio_ShowControlPanel(Binding_.DeviceIndex_, hWindow);
+		if(Binding_.SystemName() == "ASIO")
+			PaError iPaErr = PaAsio_ShowControlPanel(Binding_.DeviceIndex(), hWindow);
 	}
 #endif
 
@@ -285,9 +1077,9 @@ namespace Audaptr
 	{
 		Status_.clear();
 		const PaStreamInfo *pStreamInfo = Pa_GetStreamInfo(pPaStream_);
-		if((Binding_.Type_ == IOType::Input) || (Binding_.Type_ == IOType::Duplex)) {
+		if((Binding_.Type() == IOType::Input) || (Binding_.Type() == IOType::Duplex)) {
 			Status_ += "Input: " + string(Pa_GetDeviceInfo(InputParams_.device)->name) + " open: " + to_string_precision(1e-3 * (double)SampleRate_Hz_, 3) + "kHz, latency: " +
-				to_string_precision(1e3 * Latency_s_, 4) + "ms, Input overflows: " + to_string(InputOverflowCount_) + ", Output overflows: " + to_string(OutputOverflowCount_);
+				to_string_precision(1e3 * Latency_s_, 4) + "ms, Input overflows: " + to_string(InputOverflowCount_.load()) + ", Output overflows: " + to_string(OutputOverflowCount_.load());
 		}
 	}
 
@@ -310,7 +1102,6 @@ namespace Audaptr
 		AsioOutputStreamInfo_.channelSelectors = AsioOutputChannels_.data();
 		pHostParams_ = (void *)&AsioOutputStreamInfo_;
 	}
-#endif
 
 	void AudIO::SetWinMmeStreamParams()
 	{
@@ -323,5 +1114,6 @@ namespace Audaptr
 		WinMmmeStreamInfo.deviceCount
 		pHostParams_ = (void *)&WinMmmeStreamInfo;*/
 	}
+#endif
 
 }
@@ -1,10 +1,45 @@
 #pragma once
 
 #include "Audaptr.h"
+#include "AudioRuntime.h"
 #include "Binding.h"
+#include "BlockPool.h"
+#include "CallbackRecorder.h"
+#include "CaptureRing.h"
+#include "ChannelShards.h"
+#include "LevelMeter.h"
+#include "ParamMailbox.h"
+#include "RealTime.h"
+#include "RoutingMatrix.h"
+#include "RtLog.h"
 
 namespace Audaptr
 {
+	/// @brief Lifecycle state of an AudIO stream
+	enum class StreamState
+	{
+		Closed,
+		Open,
+		Running,
+		Stopped,
+		Finished	///< The stream ended by itself, e.g. its buffer was closed or the device failed
+	};
+
+	/// @brief How an AudIO exchanges samples with the device
+	enum class IOMode
+	{
+		Callback,	///< PortAudio calls back on its own thread, which exchanges samples through InBuffer() and OutBuffer()
+		Blocking	///< The application's thread calls Read() and Write(), which wait until the device supplies or takes the frames
+	};
+
+	/// @brief What the device plays for the frames that the output ring cannot supply
+	enum class UnderrunPolicy
+	{
+		Zero,		///< Silence
+		Fade,		///< Fade the last frame played out to silence, and fade back in when data returns
+		RepeatLast	///< Repeat the most recent frames played while fading them out, and fade back in when data returns
+	};
+
 	class AudIO
 	{
 	public:
@@ -17,7 +52,10 @@ namespace Audaptr
 		/// @param DeviceToUse Device to which the AudIO instance will be bound
 		AudIO(const Binding& DeviceToUse);
 
-		/// @brief Bind to a device and specify necessary parameters for the I/O
+		/// @brief Destructor, closing the device if it is open
+		~AudIO();
+
+		/// @brief Bind to a device and specify necessary parameters for the I/O. The device must be closed.
 		/// @param DeviceToUse Device to which the I/O device will be bound
 		/// @param Latency_s Latency [seconds]
 		/// @param NumInputChannels Number of input channels required
@@ -37,6 +75,13 @@ namespace Audaptr
 		/// Close the audio device
 		bool Close();
 
+		/// @brief Apply a new latency (and the current ring settings), restarting the stream if it was running. If the
+		/// latency is unchanged, the open stream is kept and only the rings are rebuilt; otherwise the stream is closed,
+		/// re-bound and re-opened, with PortAudio initialised throughout. Data in the rings is lost.
+		/// @param Latency_s Latency [seconds]
+		/// @return true if the stream was re-opened (and restarted if it was running)
+		bool Reopen(const double Latency_s);
+
 		/// @brief Flag indicating whether the stream has been started
 		/// @return true if the stream has been started
 		bool Started()
@@ -46,6 +91,98 @@ namespace Audaptr
 
 		double Latency_s();
 
+		/// @brief Latency requested in the last call to Bind
+		/// @return The requested latency [seconds]
+		double RequestedLatency_s() const { return RequestedLatency_s_; }
+
+		/// @brief Capacity of a ring holding a given duration of audio, as a whole power-of-2 number of frames
+		/// @param NumChannels Number of interleaved channels
+		/// @param SampleRate_Hz Sample rate [hertz]
+		/// @param Latency_s Duration of audio the ring should hold [seconds]
+		/// @return The ring capacity [samples]
+		static size_t RingCapacity(const int NumChannels, const double SampleRate_Hz, const double Latency_s);
+
+		/// @brief Set the duration of audio held by each ring, applied by the next call to Bind
+		/// @param RingLatency_s Ring duration [seconds]; zero derives it from the latency and the ring headroom
+		void SetRingLatency_s(const double RingLatency_s);
+
+		/// @brief Set the ring duration as a multiple of the requested latency, applied by the next call to Bind
+		/// @param Headroom Multiple of the requested latency (at least 1)
+		void SetRingHeadroom(const double Headroom);
+
+		/// @brief Ring duration as a multiple of the requested latency
+		double RingHeadroom() const { return RingHeadroom_; }
+
+		/// @brief Count of input overflows (device or ring) since the stream was opened
+		int InputOverflows() const { return InputOverflowCount_.load(std::memory_order_relaxed); }
+
+		/// @brief Count of output underflows (device or ring) since the stream was opened
+		int OutputOverflows() const { return OutputOverflowCount_.load(std::memory_order_relaxed); }
+
+		/// @brief Count of input overflows caused by the consumer not draining InBuffer() in time
+		int InputRingOverflows() const { return InputRingOverflowCount_.load(std::memory_order_relaxed); }
+
+		/// @brief Count of output underflows caused by the producer not filling OutBuffer() in time
+		int OutputRingUnderflows() const { return OutputRingUnderflowCount_.load(std::memory_order_relaxed); }
+
+		/// @brief Count of callbacks or blocking reads in which the device reported an input underflow or overflow
+		int InputDeviceXruns() const { return InputDeviceXrunCount_.load(std::memory_order_relaxed); }
+
+		/// @brief Count of callbacks or blocking writes in which the device reported an output underflow or overflow
+		int OutputDeviceXruns() const { return OutputDeviceXrunCount_.load(std::memory_order_relaxed); }
+
+		/// @brief Total number of output frames concealed because OutBuffer() ran dry
+		uint64_t OutputUnderrunFrames() const { return OutputUnderrunFrames_.load(std::memory_order_relaxed); }
+
+		/// @brief Length of the longest completed run of concealed output frames
+		uint64_t LongestOutputUnderrun() const { return LongestOutputUnderrun_.load(std::memory_order_relaxed); }
+
+		/// @brief Select what is played when OutBuffer() runs dry; may be changed while the stream runs
+		/// @param Policy Concealment of the missing frames (UnderrunPolicy::Zero by default)
+		void SetOutputUnderrunPolicy(const UnderrunPolicy Policy);
+
+		/// @brief What is played when OutBuffer() runs dry
+		UnderrunPolicy OutputUnderrunPolicy() const { return OutputUnderrunPolicy_; }
+
+		/// @brief Hold the output silent after Start() until OutBuffer() holds a given duration of audio, so that
+		/// the first blocks do not underrun. May be changed while the stream runs; it applies from the next Start().
+		/// @param Priming_s Duration to pre-roll [seconds], capped at half the ring; zero starts playing at once
+		void SetOutputPriming_s(const double Priming_s);
+
+		/// @brief Duration of audio pre-rolled before the output starts playing [seconds]
+		double OutputPriming_s() const { return OutputPriming_s_; }
+
+		/// @brief Flag indicating whether the output has been primed since the last Start()
+		bool OutputPrimed() const { return OutputPrimed_.load(std::memory_order_acquire); }
+
+		/// @brief Reset all overflow and underflow counts
+		void ResetOverflowCounts();
+
+		/// @brief The binding in use
+		const Binding& BoundDevice() const { return Binding_; }
+
+		/// @brief Number of input channels bound
+		int NumInputChannels() const { return InputParams_.channelCount; }
+
+		/// @brief Number of output channels bound
+		int NumOutputChannels() const { return OutputParams_.channelCount; }
+
+		/// @brief Number of interleaved channels in InBuffer(): the destinations of the input routing, if any,
+		/// otherwise the input channels bound
+		int NumInputRingChannels() const { return pInputRouting_ ? pInputRouting_->NumDestinations() : InputParams_.channelCount; }
+
+		/// @brief Number of interleaved channels in OutBuffer(): the sources of the output routing, if any,
+		/// otherwise the output channels bound
+		int NumOutputRingChannels() const { return pOutputRouting_ ? pOutputRouting_->NumSources() : OutputParams_.channelCount; }
+
+		/// @brief Current lifecycle state; safe to call from any thread
+		StreamState State() const { return State_.load(std::memory_order_acquire); }
+
+		/// @brief Register a notifier to be told of every state change, e.g. an EventFdNotifier in an epoll loop.
+		/// It is called on the thread making the change, which for Finished is the audio thread.
+		/// @param pNotifier Notifier that must outlive the registration, or nullptr to remove it
+		void SetStateNotifier(BufferNotifier* pNotifier) { pStateNotifier_.store(pNotifier, std::memory_order_release); }
+
 		/// @brief Obtain the status of the AudIO device
 		/// @return Status of the AudIO device, represented as a string
 		const std::string Status()
@@ -53,6 +190,60 @@ namespace Audaptr
 			return Status_;
 		}
 
+		/// @brief Set the sample format exchanged with the device, applied by the next call to Bind.
+		/// The buffers always hold 32-bit floats; 16-bit integer samples are converted in the callback.
+		/// @param Format paFloat32 (default) or paInt16
+		void SetSampleFormat(const PaSampleFormat Format);
+
+		/// @brief Obtain the sample format exchanged with the device
+		PaSampleFormat SampleFormat() const { return SampleFormat_; }
+
+		/// @brief Select callback or blocking I/O, applied by the next call to Open. Both share the Bind, Open, Start,
+		/// Stop and Close lifecycle; in blocking mode no callback runs, and Read() and Write() transfer the frames.
+		/// @param Mode IOMode::Callback (default) or IOMode::Blocking
+		void SetIOMode(const IOMode Mode);
+
+		/// @brief Obtain the I/O mode
+		IOMode Mode() const { return Mode_; }
+
+		/// @brief Read frames from a started blocking-mode stream, waiting until they have all arrived. The input meter
+		/// and routing apply as in callback mode, so each frame holds NumInputRingChannels() channels. In blocking mode,
+		/// the meter and routing may only be changed by the thread calling Read, or while the stream is stopped.
+		/// @param pFrames Destination of NumFrames interleaved frames
+		/// @param NumFrames Number of frames to read
+		/// @return false if the device overflowed (input was lost) before this read
+		bool Read(float* pFrames, const size_t NumFrames);
+
+		/// @brief Read frames from a started blocking-mode stream directly into space reserved in a ring
+		/// @param Ring Ring that receives NumFrames frames of NumInputRingChannels() channels, e.g. InBuffer()
+		/// @param NumFrames Number of frames to read
+		/// @return false if the device overflowed, or if the ring lacked the space (in which case nothing is read)
+		bool Read(QuickBuffer<float>& Ring, const size_t NumFrames);
+
+		/// @brief Write frames to a started blocking-mode stream, waiting until the device has taken them all.
+		/// The output routing applies as in callback mode, so each frame holds NumOutputRingChannels() channels.
+		/// @param pFrames Source of NumFrames interleaved frames
+		/// @param NumFrames Number of frames to write
+		/// @return false if the device underflowed (silence was played) before this write
+		bool Write(const float* pFrames, const size_t NumFrames);
+
+		/// @brief Write frames to a started blocking-mode stream directly from a ring
+		/// @param Ring Ring holding frames of NumOutputRingChannels() channels, e.g. OutBuffer()
+		/// @param NumFrames Number of frames to write
+		/// @return false if the device underflowed, or if the ring held fewer frames (in which case those are written)
+		bool Write(QuickBuffer<float>& Ring, const size_t NumFrames);
+
+		/// @brief Number of frames that Read() can obtain without waiting
+		long ReadAvailable() const;
+
+		/// @brief Number of frames that Write() can accept without waiting
+		long WriteAvailable() const;
+
+		/// @brief Obtain the stream callback for the current binding, channel counts and sample format.
+		/// Common channel counts (1, 2, 8 and 32) select an instantiation specialised at compile time.
+		/// @return The callback passed to PortAudio when the stream is opened (with this AudIO as user data)
+		PaStreamCallback* Callback() const;
+
 		/// @brief Obtain the currently bound sample rate
 		/// @return The sample rate [hertz]
 		double SampleRate_Hz() const;
@@ -70,7 +261,8 @@ namespace Audaptr
 			pHostParams_ = nullptr;
 		}
 
-		/// @brief Access the AudIO device input buffer
+		/// @brief Access the AudIO device input buffer. Besides blocking or polling, a StreamTask may await it with
+		/// Readable() (QuickBufferCoro.h), so that one thread can consume many devices.
 		/// @return The buffer associated with input samples
 		inline QuickBuffer<float>& InBuffer()
 		{
@@ -84,6 +276,103 @@ namespace Audaptr
 			return OutputBuffer_;
 		}
 
+		/// @brief Apply a real-time configuration to the calling thread, typically a consumer of InBuffer() or a
+		/// producer for OutBuffer(), and lock and pre-fault the buffer memory as requested.
+		/// Buffers are only pre-faulted while the stream is stopped, since pre-faulting overwrites their contents.
+		/// @param Config Requested scheduling policy, CPU affinity and memory handling
+		/// @return Outcome of each step
+		RealTimeReport ConfigureRealTime(const RealTimeConfig& Config);
+
+		/// @brief Meter the device input inside the stream callback, while the samples are in cache.
+		/// The meter's channel count must match the input channels bound. It may be replaced while the stream runs;
+		/// once this returns, the callback no longer uses the previous meter, which may then be destroyed.
+		/// @param pMeter Meter that must outlive its use by the stream, or nullptr to stop metering
+		void SetInputMeter(LevelMeter* pMeter);
+
+		/// @brief The meter attached to the input, if any
+		const LevelMeter* InputMeter() const { return pInputMeter_; }
+
+		/// @brief Record the device input into a persistent black box inside the stream callback (or Read() in
+		/// blocking mode), whether or not InBuffer() has room. The ring's channel count and sample format must match
+		/// the input bound. It may be replaced while the stream runs; once this returns, the stream no longer uses the
+		/// previous ring, which may then be destroyed.
+		/// @param pRing Ring that must outlive its use by the stream, or nullptr to stop recording
+		void SetCaptureRing(CaptureRing* pRing);
+
+		/// @brief The black box recording the input, if any
+		CaptureRing* InputCapture() const { return pCaptureRing_; }
+
+		/// @brief Deliver the input as whole blocks instead of through InBuffer(): the stream callback fills blocks
+		/// taken from a pool (converted and routed as for InBuffer()) and queues references to them, so consumers
+		/// may keep blocks without copying them out. A device buffer larger than a block fills several blocks.
+		/// If no block is free, or the queue is full, the input is dropped and counted as a ring overflow.
+		/// The pool's channel count must match that of InBuffer(). The transport may be replaced while the stream
+		/// runs; once this returns, the callback no longer uses the previous pool and queue.
+		/// @param pPool Pool of blocks, or nullptr to return to InBuffer()
+		/// @param pQueue Queue to which filled blocks are pushed; the callback is its only producer
+		void SetInputBlocks(BlockPool* pPool, BlockQueue* pQueue);
+
+		/// @brief The pool delivering the input in blocks, if any
+		BlockPool* InputBlockPool() const { return pInputBlockPool_; }
+
+		/// @brief Deliver the input to groups of channels instead of through InBuffer(), so that each of several
+		/// consumer threads reads only the channels it processes: the stream callback gathers every group (converted
+		/// and routed as for InBuffer()) into its own ring. A group whose ring is full drops the device buffer, which
+		/// is counted as a ring overflow. Ignored while input blocks are set (see SetInputBlocks).
+		/// The shards' channel count must match that of InBuffer(). They may be replaced while the stream runs; once
+		/// this returns, the callback no longer uses the previous shards. The stream does not close their rings.
+		/// @param pShards Shards that must outlive their use by the stream, or nullptr to return to InBuffer()
+		void SetInputShards(ChannelShards* pShards);
+
+		/// @brief The groups of channels receiving the input, if any
+		ChannelShards* InputShards() const { return pInputShards_; }
+
+		/// @brief Record the arrival time, frame count and status flags of every stream callback, to replay the
+		/// driver's cadence offline (see CallbackTrace). A session starts in the recording whenever the stream opens,
+		/// or straight away if it is open already. Blocking mode has no callbacks to record. A recorder serves one
+		/// stream at a time; once this returns, the callback no longer uses the previous recorder.
+		/// @param pRecorder Recorder that must outlive its use by the stream, or nullptr to stop recording
+		void SetCallbackRecorder(CallbackRecorder* pRecorder);
+
+		/// @brief The recorder of the stream callbacks, if any
+		CallbackRecorder* GetCallbackRecorder() const { return pCallbackRecorder_; }
+
+		/// @brief Pass the messages of the stream callback (ring overflows and underruns, unexpected status flags, the
+		/// stream finishing) to a logger, which formats them on its own thread. The callback writes them to a
+		/// real-time-safe log, without allocating or formatting; they are dropped while no logger is set.
+		/// @param pLogger Logger, or nullptr to stop logging. The device and the logger may be destroyed in either order;
+		/// messages written after the logger is gone are dropped.
+		void SetLogger(RtLogger* pLogger);
+
+		/// @brief Log written by the stream callback, e.g. for its count of dropped messages
+		const RtLog& CallbackLog() const { return Log_; }
+
+		/// @brief Route the device input through a matrix inside the stream callback, so that only the selected or
+		/// mixed channels are written to InBuffer(). The matrix sources are the input channels bound, and its
+		/// destinations are the channels of InBuffer(); the ring is resized accordingly.
+		/// While the device is open, only a matrix of the same dimensions may replace the current one; once this
+		/// returns, the callback no longer uses the previous matrix.
+		/// @param pRouting Matrix that must outlive its use by the stream, or nullptr to pass all channels through
+		void SetInputRouting(RoutingMatrix* pRouting);
+
+		/// @brief Route OutBuffer() through a matrix onto the device outputs inside the stream callback. The matrix
+		/// sources are the channels of OutBuffer(), and its destinations are the output channels bound; the ring is
+		/// resized accordingly. While the device is open, only a matrix of the same dimensions may replace the current
+		/// one; once this returns, the callback no longer uses the previous matrix.
+		/// @param pRouting Matrix that must outlive its use by the stream, or nullptr to pass all channels through
+		void SetOutputRouting(RoutingMatrix* pRouting);
+
+		/// @brief The routing of the device input, if any
+		RoutingMatrix* InputRouting() const { return pInputRouting_; }
+
+		/// @brief The routing onto the device outputs, if any
+		RoutingMatrix* OutputRouting() const { return pOutputRouting_; }
+
+		/// @brief Reallocate the input and output buffers with a specific allocator (e.g. huge pages or an arena).
+		/// Only valid while the device is closed.
+		/// @param pAllocator Allocator for the buffer storage; it must outlive the AudIO instance. nullptr selects the heap.
+		void SetBufferAllocator(BufferAllocator* pAllocator);
+
 #ifdef paAsioUseChannelSelectors
 		/// @param[in] hWindow Handle to main application window, where hwnd is of type HWND (cast to void*)
 		void ShowAsioControlPanel(void* hWindow);
@@ -140,21 +429,244 @@ namespace Audaptr
 		QuickBuffer<float> OutputBuffer_;
 
 		/// Flag indicating the count of input buffer overflows that have occurred
-		int InputOverflowCount_;
+		std::atomic_int InputOverflowCount_;
 
 		/// Flag indicating the count of input buffer overflows that have occurred
-		int OutputOverflowCount_;
+		std::atomic_int OutputOverflowCount_;
+
+		/// Count of input overflows caused by a full input ring (a subset of InputOverflowCount_)
+		std::atomic_int InputRingOverflowCount_{0};
+
+		/// Count of output underflows caused by an empty output ring (a subset of OutputOverflowCount_)
+		std::atomic_int OutputRingUnderflowCount_{0};
+
+		/// Count of input underflows and overflows reported by the device
+		std::atomic_int InputDeviceXrunCount_{0};
+
+		/// Count of output underflows and overflows reported by the device
+		std::atomic_int OutputDeviceXrunCount_{0};
+
+		/// Total number of output frames concealed
+		std::atomic<uint64_t> OutputUnderrunFrames_{0};
+
+		/// Longest completed run of concealed output frames
+		std::atomic<uint64_t> LongestOutputUnderrun_{0};
+
+		/// Concealment of missing output frames, as last set
+		UnderrunPolicy OutputUnderrunPolicy_ = UnderrunPolicy::Zero;
+
+		/// Output pre-roll duration, as last set [seconds]
+		double OutputPriming_s_ = 0.0;
+
+		/// Flag indicating that the output ring reached the priming threshold since the last Start()
+		std::atomic<bool> OutputPrimed_{false};
+
+		/// Number of output frames of crossfade into and out of concealment
+		static constexpr size_t kFadeFrames = 128;
+
+		/// Number of recent output frames kept for UnderrunPolicy::RepeatLast
+		static constexpr size_t kHistoryFrames = 1024;
+
+		/// Most recent output frames played, as a circular buffer of kHistoryFrames; owned by the stream callback
+		std::vector<float> vOutputHistory_;
+
+		/// Next frame of vOutputHistory_ to be written
+		size_t HistoryPos_ = 0;
+
+		/// Number of valid frames in vOutputHistory_
+		size_t HistoryFrames_ = 0;
+
+		/// Number of frames concealed in the current underrun, or zero while data flows
+		size_t ConcealedFrames_ = 0;
+
+		/// Frames faded in since the last underrun ended, up to kFadeFrames once the fade is complete
+		size_t FadeInPos_ = kFadeFrames;
+
+		/// Concealed frames before conversion to the device format
+		std::vector<float> vConcealScratch_;
 
 		double SampleRate_Hz_ = -1.0;
 
 		double Latency_s_ = 0.0;
 
+		/// Latency requested in the last call to Bind [seconds]
+		double RequestedLatency_s_ = 0.0;
+
+		/// Duration of audio held by each ring [seconds]; zero derives it from the latency and RingHeadroom_
+		double RingLatency_s_ = 0.0;
+
+		/// Ring duration as a multiple of the requested latency, when RingLatency_s_ is zero
+		double RingHeadroom_ = 8.0;
+
+		/// Shortest ring duration, so that very low latencies still tolerate some consumer jitter [seconds]
+		static constexpr double kMinRingLatency_s = 0.02;
+
+		/// Device sample format (paFloat32 or paInt16); the buffers always hold 32-bit floats
+		PaSampleFormat SampleFormat_ = paFloat32;
+
+		/// Callback or blocking I/O
+		IOMode Mode_ = IOMode::Callback;
+
+		/// Number of frames converted or routed at a time by blocking reads and writes
+		static constexpr size_t kBlockingChunkFrames = 256;
+
+		/// Device frames of a blocking read, before conversion or routing
+		std::vector<char> vReadScratch_;
+
+		/// Device frames of a blocking write, after conversion or routing
+		std::vector<char> vWriteScratch_;
+
+		/// Blocking read of device frames; false if the input overflowed
+		bool ReadStream(void* pFrames, const size_t NumFrames);
+
+		/// Blocking write of device frames; false if the output underflowed
+		bool WriteStream(const void* pFrames, const size_t NumFrames);
+
+		/// Blocking read in chunks, converting from SampleT and routing as the settings of each chunk say
+		/// @param NumRingChannels Channels per frame of pFrames; the read stops if the routing changes it
+		template<typename SampleT>
+		bool ReadConverted(float* pFrames, const size_t NumFrames, const size_t NumRingChannels);
+
+		/// Blocking write in chunks, routing and converting to SampleT as the settings of each chunk say
+		/// @param NumRingChannels Channels per frame of pFrames; the write stops if the routing changes it
+		template<typename SampleT>
+		bool WriteConverted(const float* pFrames, const size_t NumFrames, const size_t NumRingChannels);
+
+		/// Channels per frame read by Read(), as the published settings say
+		size_t BlockingReadChannels();
+
+		/// Channels per frame written by Write(), as the published settings say
+		size_t BlockingWriteChannels();
+
+		/// Meter of the device input, or nullptr
+		LevelMeter* pInputMeter_ = nullptr;
+
+		/// Routing from the device input to the input ring, or nullptr
+		RoutingMatrix* pInputRouting_ = nullptr;
+
+		/// Black box recording the device input, or nullptr
+		CaptureRing* pCaptureRing_ = nullptr;
+
+		/// Check that a capture ring suits the input bound
+		void CheckCaptureRing(const CaptureRing& Ring) const;
+
+		/// Pool and queue delivering the input in blocks, or nullptr
+		BlockPool* pInputBlockPool_ = nullptr;
+
+		BlockQueue* pInputBlockQueue_ = nullptr;
+
+		/// Check that a block pool suits the channels of the input ring
+		void CheckInputBlocks(const BlockPool& Pool) const;
+
+		/// Index of the next input frame delivered in blocks; owned by the stream callback
+		uint64_t InputBlockFrame_ = 0;
+
+		/// Groups of channels receiving the input, or nullptr
+		ChannelShards* pInputShards_ = nullptr;
+
+		/// Check that channel shards suit the channels of the input ring
+		void CheckInputShards(const ChannelShards& Shards) const;
+
+		/// Recorder of the stream callbacks, or nullptr
+		CallbackRecorder* pCallbackRecorder_ = nullptr;
+
+		/// Start a session of the callback recorder for the stream opened
+		void BeginCallbackSession();
+
+		/// Messages of the stream callback; the callback (and then the stream-finished callback) is its only writer
+		RtLog Log_;
+
+		/// Count device xruns, and log status flags other than output priming
+		void NoteStatusFlags(const PaStreamCallbackFlags StatusFlags) noexcept;
+
+		/// Routing from the output ring to the device output, or nullptr
+		RoutingMatrix* pOutputRouting_ = nullptr;
+
+		/// Size the rings for the ring channel counts, sample rate and requested latency
+		void SizeRings();
+
+		/// Open the rings the binding's type uses
+		void OpenRings();
+
+		/// Settings read by the stream callback that may change while the stream runs
+		struct StreamParams
+		{
+			LevelMeter* pInputMeter = nullptr;
+
+			RoutingMatrix* pInputRouting = nullptr;
+
+			RoutingMatrix* pOutputRouting = nullptr;
+
+			CaptureRing* pCaptureRing = nullptr;
+
+			BlockPool* pInputBlockPool = nullptr;
+
+			BlockQueue* pInputBlockQueue = nullptr;
+
+			ChannelShards* pInputShards = nullptr;
+
+			CallbackRecorder* pCallbackRecorder = nullptr;
+
+			UnderrunPolicy OutputUnderrun = UnderrunPolicy::Zero;
+
+			/// Output frames to pre-roll after Start()
+			size_t OutputPrimingFrames = 0;
+		};
+
+		/// Mailbox reader of the stream callback, or of blocking reads (there is no callback in blocking mode)
+		static constexpr size_t kCallbackReader = 0;
+
+		/// Mailbox reader of blocking writes, which may run alongside blocking reads
+		static constexpr size_t kBlockingWriter = 1;
+
+		/// Settings as seen by the stream callback and blocking reads and writes; the members above are the control
+		/// thread's copy
+		ParamMailbox<StreamParams, 2> Params_;
+
+		/// Pass the control thread's settings to the stream callback, and wait until it has let go of the old ones
+		void PublishParams();
+
+		/// Fill the device output buffer from the output ring, priming and concealing underruns as configured
+		template<int Channels, typename SampleT>
+		void RenderOutput(const StreamParams& Params, SampleT* pDest, const size_t NumFrames, const PaStreamCallbackFlags StatusFlags) noexcept;
+
+		/// Fill blocks with the device input, converted and routed, and queue them
+		template<int Channels, typename SampleT>
+		void DeliverInputBlocks(const StreamParams& Params, const SampleT* pInput, const size_t NumFrames, const size_t NumChannels, const PaStreamCallbackFlags StatusFlags) noexcept;
+
+		/// Gather the device input, converted and routed, into the ring of each group of channels
+		template<typename SampleT>
+		void DeliverInputShards(const StreamParams& Params, const SampleT* pInput, const size_t NumFrames, const PaStreamCallbackFlags StatusFlags) noexcept;
+
+		/// Keep the frames just played for concealment, and fade them in after an underrun
+		template<typename SampleT>
+		void TrackOutput(const UnderrunPolicy Policy, SampleT* pFrames, const size_t NumFrames, const size_t NumChannels) noexcept;
+
+		/// Fill missing frames according to the underrun policy
+		template<typename SampleT>
+		void ConcealOutput(const UnderrunPolicy Policy, SampleT* pFrames, const size_t NumFrames, const size_t NumChannels) noexcept;
+
+		/// Lifecycle state
+		std::atomic<StreamState> State_{StreamState::Closed};
+
+		/// Receiver of state change notifications
+		std::atomic<BufferNotifier*> pStateNotifier_{nullptr};
+
+		/// Publish a state change and notify its receiver
+		void SetState(const StreamState State);
+
+		/// Called by PortAudio when the stream has ended, possibly on the audio thread
+		static void StreamFinishedCallback(void* pUserData);
+
 	protected:
-		friend static int InputPaCallback(const void* pInputBuffer, void* pOutputBuffer, unsigned long FramesPerBuffer, const PaStreamCallbackTimeInfo* pTimeInfo, PaStreamCallbackFlags StatusFlags, void* pUserData);
+		template<int Channels, typename SampleT>
+		friend int InputPaCallback(const void* pInputBuffer, void* pOutputBuffer, unsigned long FramesPerBuffer, const PaStreamCallbackTimeInfo* pTimeInfo, PaStreamCallbackFlags StatusFlags, void* pUserData);
 
-		friend static int OutputPaCallback(const void* pInputBuffer, void* pOutputBuffer, unsigned long FramesPerBuffer, const PaStreamCallbackTimeInfo* pTimeInfo, PaStreamCallbackFlags StatusFlags, void* pUserData);
+		template<int Channels, typename SampleT>
+		friend int OutputPaCallback(const void* pInputBuffer, void* pOutputBuffer, unsigned long FramesPerBuffer, const PaStreamCallbackTimeInfo* pTimeInfo, PaStreamCallbackFlags StatusFlags, void* pUserData);
 
-		friend static int DuplexPaCallback(const void* pInputBuffer, void* pOutputBuffer, unsigned long FramesPerBuffer, const PaStreamCallbackTimeInfo* pTimeInfo, PaStreamCallbackFlags StatusFlags, void* pUserData);
+		template<int Channels, typename SampleT>
+		friend int DuplexPaCallback(const void* pInputBuffer, void* pOutputBuffer, unsigned long FramesPerBuffer, const PaStreamCallbackTimeInfo* pTimeInfo, PaStreamCallbackFlags StatusFlags, void* pUserData);
 
 
 		template<typename T>
@@ -168,7 +680,7 @@ namespace Audaptr
 
 		Binding Binding_;
 
-		/// Flag incremented upon a successful call to Pa_Initialize
+		/// Flag incremented upon taking a reference on PortAudio from the AudioRuntime
 		int PaInitFlag_ = 0;
 
 		/// Pointer to a PortAudio stream
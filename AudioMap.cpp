@@ -1,7 +1,9 @@
+#include <algorithm>
 #include <set>
 #include <string>
 
 #include "AudioMap.h"
+#include "AudioRuntime.h"
 
 using namespace std;
 
@@ -23,7 +25,8 @@ namespace Audaptr
 
 	void AudioMap::MapAudioSystem()
 	{
-		PaError iPaErr = Pa_Initialize();
+		// Share the PortAudio initialisation of any open streams, rather than re-initialising the host APIs.
+		PaError iPaErr = AudioRuntime::Instance().Acquire();
 		int iDefaultInputDevice = (int)Pa_GetDefaultInputDevice(), iDefaultOutputDevice = (int)Pa_GetDefaultOutputDevice();
 		if(iPaErr)
 			throw Exception("Audio API error while initialising: " + PaErrorString(iPaErr));
@@ -43,47 +46,50 @@ namespace Audaptr
 						OutStreamParams.device = iDevice;
 						OutStreamParams.hostApiSpecificStreamInfo = nullptr;
 						OutStreamParams.sampleFormat = paFloat32;
-						vector<double> vdSampleRates_Hz;
+						// The device is described once; its bindings share the descriptor.
+						const uint32_t DeviceId = DeviceRegistry::Register(Pa_GetHostApiInfo(iApiId)->name, DeviceInfo.name, DeviceInfo, iDevice);
+						const SampleRateSet DefaultRate = SampleRateSet::Of({DeviceInfo.defaultSampleRate}, DeviceInfo.defaultSampleRate);
+						uint32_t SampleRateBits = 0;
 						if(DeviceInfo.maxInputChannels > 0) {
-							for(auto dSampleRate_Hz : StandardSampleRates_Hz) {
-								if(Pa_IsFormatSupported(&InStreamParams, nullptr, dSampleRate_Hz) == (PaError)0)
-									vdSampleRates_Hz.push_back(dSampleRate_Hz);
+							for(size_t i = 0; i < StandardSampleRates_Hz.size(); i++) {
+								if(Pa_IsFormatSupported(&InStreamParams, nullptr, StandardSampleRates_Hz[i]) == (PaError)0)
+									SampleRateBits |= 1u << i;
 							}
-							if(!vdSampleRates_Hz.empty()) {
-								Bindings_.emplace_back(Pa_GetHostApiInfo(iApiId)->name, DeviceInfo.name, IOType::Input, DeviceInfo, vdSampleRates_Hz, iDevice);
+							if(SampleRateBits) {
+								Bindings_.emplace_back(DeviceId, IOType::Input, SampleRateSet(SampleRateBits));
 								if(iDevice == iDefaultInputDevice)
-									DefaultInputDevice_ = Binding(Pa_GetHostApiInfo(iApiId)->name, DeviceInfo.name, IOType::Input, DeviceInfo, {DeviceInfo.defaultSampleRate}, iDevice);
+									DefaultInputDevice_ = Binding(DeviceId, IOType::Input, DefaultRate);
 							}
 						}
 						InStreamParams.channelCount = 0;
 						OutStreamParams.channelCount = DeviceInfo.maxOutputChannels;
-						vdSampleRates_Hz.clear();
+						SampleRateBits = 0;
 						if(DeviceInfo.maxOutputChannels > 0) {
-							for(auto dSampleRate_Hz : StandardSampleRates_Hz) {
-								if(Pa_IsFormatSupported(nullptr, &OutStreamParams, dSampleRate_Hz) == (PaError)0)
-									vdSampleRates_Hz.push_back(dSampleRate_Hz);
+							for(size_t i = 0; i < StandardSampleRates_Hz.size(); i++) {
+								if(Pa_IsFormatSupported(nullptr, &OutStreamParams, StandardSampleRates_Hz[i]) == (PaError)0)
+									SampleRateBits |= 1u << i;
 							}
-							if(!vdSampleRates_Hz.empty()) {
-								Bindings_.emplace_back(Pa_GetHostApiInfo(iApiId)->name, DeviceInfo.name, IOType::Output, DeviceInfo, vdSampleRates_Hz, iDevice);
+							if(SampleRateBits) {
+								Bindings_.emplace_back(DeviceId, IOType::Output, SampleRateSet(SampleRateBits));
 								if(iDevice == iDefaultOutputDevice)
-									DefaultOutputDevice_ = Binding(Pa_GetHostApiInfo(iApiId)->name, DeviceInfo.name, IOType::Output, DeviceInfo, {DeviceInfo.defaultSampleRate}, iDevice);
+									DefaultOutputDevice_ = Binding(DeviceId, IOType::Output, DefaultRate);
 							}
 						}
 						if((DeviceInfo.maxInputChannels > 0) && (DeviceInfo.maxOutputChannels > 0)) {
 							InStreamParams.channelCount = DeviceInfo.maxInputChannels;
-							vdSampleRates_Hz.clear();
-							for(auto dSampleRate_Hz : StandardSampleRates_Hz) {
-								if(Pa_IsFormatSupported(nullptr, &OutStreamParams, dSampleRate_Hz) == (PaError)0)
-									vdSampleRates_Hz.push_back(dSampleRate_Hz);
+							SampleRateBits = 0;
+							for(size_t i = 0; i < StandardSampleRates_Hz.size(); i++) {
+								if(Pa_IsFormatSupported(nullptr, &OutStreamParams, StandardSampleRates_Hz[i]) == (PaError)0)
+									SampleRateBits |= 1u << i;
 							}
-							if(!vdSampleRates_Hz.empty())
-								Bindings_.emplace_back(Pa_GetHostApiInfo(iApiId)->name, DeviceInfo.name, IOType::Duplex, DeviceInfo, vdSampleRates_Hz, iDevice);
+							if(SampleRateBits)
+								Bindings_.emplace_back(DeviceId, IOType::Duplex, SampleRateSet(SampleRateBits));
 						}
 					}
 				}
 			}
 		}
-		Pa_Terminate();
+		AudioRuntime::Instance().Release();
 	}
 
 	AudioMap AudioMap::System(const vector<string> &vstrSystems) const
@@ -93,7 +99,7 @@ namespace Audaptr
 			return *this;
 		for(auto &&TestBinding : Bindings_) {
 			for(auto &&TestSystem : vstrSystems) {
-				if(StringContains(TestBinding.System_, TestSystem))
+				if(StringContains(TestBinding.SystemName(), TestSystem))
 					ToReturn.Bindings_.emplace_back(TestBinding);
 			}
 		}
@@ -113,7 +119,7 @@ namespace Audaptr
 			return *this;
 		for(auto &&TestBinding : Bindings_) {
 			for(auto &&TestDevice : vstrDevices) {
-				if(StringContains(TestBinding.Device_, TestDevice))
+				if(StringContains(TestBinding.DeviceName(), TestDevice))
 					ToReturn.Bindings_.emplace_back(TestBinding);
 			}
 		}
@@ -132,17 +138,27 @@ namespace Audaptr
 		AudioMap ToReturn;
 		if(vdSampleRates_Hz.empty())
 			return *this;
+		// Standard rates are matched as one mask; a non-standard rate can only be a device's default. The first rate
+		// requested that a binding supports becomes its preferred rate.
+		uint32_t Wanted = 0;
 		for(auto &&TestSampleRate : vdSampleRates_Hz) {
-			for(auto &&TestBinding : Bindings_) {
-				auto iterSampleRate = std::find(TestBinding.SampleRates_Hz_.begin(), TestBinding.SampleRates_Hz_.end(), TestSampleRate);
-				if(iterSampleRate != TestBinding.SampleRates_Hz_.end()) {
-					if(std::find(ToReturn.Bindings_.begin(), ToReturn.Bindings_.end(), TestBinding) == ToReturn.Bindings_.end()) {
-						ToReturn.Bindings_.emplace_back(TestBinding);
-						ToReturn.Bindings_.back().SampleRates_Hz_.clear();
+			const int iIndex = SampleRateSet::StandardIndex(TestSampleRate);
+			if(iIndex >= 0)
+				Wanted |= 1u << iIndex;
+		}
+		for(auto &&TestBinding : Bindings_) {
+			uint32_t BindingWanted = Wanted;
+			if(std::find(vdSampleRates_Hz.begin(), vdSampleRates_Hz.end(), TestBinding.DefaultSampleRate_Hz()) != vdSampleRates_Hz.end())
+				BindingWanted |= SampleRateSet::kDeviceDefault;
+			const SampleRateSet Matched = TestBinding.SampleRateBits() & SampleRateSet(BindingWanted);
+			if(!Matched.Empty()) {
+				ToReturn.Bindings_.emplace_back(TestBinding);
+				ToReturn.Bindings_.back().SampleRates_ = Matched;
+				for(auto &&TestSampleRate : vdSampleRates_Hz)
+					if(Matched.Contains(TestSampleRate, TestBinding.DefaultSampleRate_Hz())) {
+						ToReturn.Bindings_.back().SetPreferredSampleRate(TestSampleRate);
+						break;
 					}
-					ToReturn.Bindings_.back().SampleRates_Hz_.emplace_back(TestSampleRate);
-					continue;
-				}
 			}
 		}
 		return ToReturn;
@@ -158,7 +174,7 @@ namespace Audaptr
 	{
 		AudioMap ToReturn;
 		for(auto &&TestBinding : Bindings_)
-			if(TestBinding.Type_ == Type)
+			if(TestBinding.Type() == Type)
 				ToReturn.Bindings_.emplace_back(TestBinding);
 		return ToReturn;
 	}
@@ -177,7 +193,7 @@ namespace Audaptr
 	{
 		std::set<std::string> setResult;
 		for(auto &&x : Bindings_)
-			setResult.insert(x.System_);
+			setResult.insert(x.SystemName());
 		return std::vector<std::string>(setResult.begin(), setResult.end());
 	}
 
@@ -185,7 +201,7 @@ namespace Audaptr
 	{
 		std::set<std::string> setResult;
 		for(auto &&x : Bindings_)
-			setResult.insert(x.Device_);
+			setResult.insert(x.DeviceName());
 		return std::vector<std::string>(setResult.begin(), setResult.end());
 	}
 
@@ -193,7 +209,7 @@ namespace Audaptr
 	{
 		std::set<double> setResult;
 		for(auto &&x : Bindings_)
-			for(auto &&SampleRate : x.SampleRates_Hz_)
+			for(auto &&SampleRate : x.SampleRates())
 				setResult.insert(SampleRate);
 		return std::vector<double>(setResult.begin(), setResult.end());
 	}
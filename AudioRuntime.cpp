@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <exception>
+#include <thread>
+
+#include "AudIO.h"
+#include "AudioRuntime.h"
+
+using namespace std;
+
+namespace Audaptr
+{
+	AudioRuntime &AudioRuntime::Instance()
+	{
+		static AudioRuntime Runtime;
+		return Runtime;
+	}
+
+	AudioRuntime::~AudioRuntime()
+	{
+		if(Initialised_)
+			Pa_Terminate();
+	}
+
+	PaError AudioRuntime::Acquire()
+	{
+		lock_guard<mutex> Lock(PaMutex_);
+		if(!Initialised_) {
+			const PaError iPaErr = Pa_Initialize();
+			if(iPaErr)
+				return iPaErr;
+			Initialised_ = true;
+		}
+		References_++;
+		return paNoError;
+	}
+
+	void AudioRuntime::Release()
+	{
+		lock_guard<mutex> Lock(PaMutex_);
+		if(References_ <= 0)
+			return;
+		if((--References_ == 0) && !KeepWarm_ && Initialised_) {
+			Pa_Terminate();
+			Initialised_ = false;
+		}
+	}
+
+	int AudioRuntime::References() const
+	{
+		lock_guard<mutex> Lock(PaMutex_);
+		return References_;
+	}
+
+	bool AudioRuntime::Initialised() const
+	{
+		lock_guard<mutex> Lock(PaMutex_);
+		return Initialised_;
+	}
+
+	void AudioRuntime::SetKeepWarm(const bool KeepWarm)
+	{
+		lock_guard<mutex> Lock(PaMutex_);
+		KeepWarm_ = KeepWarm;
+		if(!KeepWarm_ && (References_ == 0) && Initialised_) {
+			Pa_Terminate();
+			Initialised_ = false;
+		}
+	}
+
+	bool AudioRuntime::Shutdown()
+	{
+		lock_guard<mutex> Lock(PaMutex_);
+		if((References_ == 0) && Initialised_) {
+			Pa_Terminate();
+			Initialised_ = false;
+		}
+		return !Initialised_;
+	}
+
+	vector<AudIO *> AudioRuntime::Streams() const
+	{
+		lock_guard<mutex> Lock(StreamsMutex_);
+		return vStreams_;
+	}
+
+	size_t AudioRuntime::NumStreams() const
+	{
+		lock_guard<mutex> Lock(StreamsMutex_);
+		return vStreams_.size();
+	}
+
+	void AudioRuntime::Register(AudIO *pStream)
+	{
+		lock_guard<mutex> Lock(StreamsMutex_);
+		if(find(vStreams_.begin(), vStreams_.end(), pStream) == vStreams_.end())
+			vStreams_.push_back(pStream);
+	}
+
+	void AudioRuntime::Unregister(AudIO *pStream)
+	{
+		lock_guard<mutex> Lock(StreamsMutex_);
+		vStreams_.erase(remove(vStreams_.begin(), vStreams_.end(), pStream), vStreams_.end());
+	}
+
+	template<typename Operation>
+	size_t AudioRuntime::ForEachParallel(const vector<AudIO *> &vStreams, Operation Op)
+	{
+		vector<thread> vThreads;
+		vector<exception_ptr> vErrors(vStreams.size());
+		vector<char> vSucceeded(vStreams.size(), 0);
+		vThreads.reserve(vStreams.size());
+		for(size_t n = 0; n < vStreams.size(); n++) {
+			vThreads.emplace_back([&, n]() {
+				try {
+					vSucceeded[n] = Op(*vStreams[n]) ? 1 : 0;
+				}
+				catch(...) {
+					vErrors[n] = current_exception();
+				}
+			});
+		}
+		for(thread &Thread : vThreads)
+			Thread.join();
+		for(const exception_ptr &pError : vErrors)
+			if(pError)
+				rethrow_exception(pError);
+		return (size_t)count(vSucceeded.begin(), vSucceeded.end(), 1);
+	}
+
+	size_t AudioRuntime::StartAll()
+	{
+		lock_guard<mutex> Lock(StreamsMutex_);
+		vector<AudIO *> vStopped;
+		for(AudIO *pStream : vStreams_)
+			if(!pStream->Started())
+				vStopped.push_back(pStream);
+		return ForEachParallel(vStopped, [](AudIO &Stream) { return Stream.Start(); });
+	}
+
+	size_t AudioRuntime::StopAll()
+	{
+		lock_guard<mutex> Lock(StreamsMutex_);
+		vector<AudIO *> vRunning;
+		for(AudIO *pStream : vStreams_)
+			if(pStream->Started())
+				vRunning.push_back(pStream);
+		return ForEachParallel(vRunning, [](AudIO &Stream) { return Stream.Stop(); });
+	}
+
+}
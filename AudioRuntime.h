@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+#include <portaudio.h>
+
+namespace Audaptr
+{
+	class AudIO;
+
+	/// @brief Process-wide owner of the PortAudio lifetime and registry of open AudIO streams.
+	/// PortAudio is initialised by the first Acquire() and, by default, kept initialised after the last Release(),
+	/// so that opening, re-opening or mapping devices does not re-initialise every host API each time; call Shutdown()
+	/// (or let the process exit) to terminate it. Only the library is kept warm: a closed stream's device handle is
+	/// released, and AudIO::Reopen() keeps a stream open only when its latency is unchanged. All members are
+	/// thread-safe.
+	class AudioRuntime
+	{
+	public:
+		/// @brief The runtime of the process
+		static AudioRuntime& Instance();
+
+		AudioRuntime(const AudioRuntime&) = delete;
+		AudioRuntime& operator=(const AudioRuntime&) = delete;
+
+		/// @brief Take a reference on PortAudio, initialising it if necessary
+		/// @return paNoError, or the error raised by Pa_Initialize (in which case no reference is taken)
+		PaError Acquire();
+
+		/// @brief Drop a reference taken by Acquire(), terminating PortAudio after the last one unless kept warm
+		void Release();
+
+		/// @brief Number of references held
+		int References() const;
+
+		/// @brief Flag indicating whether PortAudio is currently initialised
+		bool Initialised() const;
+
+		/// @brief Keep PortAudio initialised while no references are held (the default), or terminate it as soon as
+		/// the last reference is dropped
+		void SetKeepWarm(const bool KeepWarm);
+
+		/// @brief Terminate PortAudio if no references are held, e.g. to rescan the devices on the next Acquire()
+		/// @return true if PortAudio is no longer initialised
+		bool Shutdown();
+
+		/// @brief Snapshot of the streams currently open
+		std::vector<AudIO*> Streams() const;
+
+		/// @brief Number of streams currently open
+		size_t NumStreams() const;
+
+		/// @brief Start every open stream that is not running, each on its own thread, so that host APIs that are slow
+		/// to start do not serialise. Streams may not be closed by other threads meanwhile; exceptions are rethrown
+		/// once all streams have been handled.
+		/// @return Number of streams started
+		size_t StartAll();
+
+		/// @brief Stop every running stream, each on its own thread
+		/// @return Number of streams stopped
+		size_t StopAll();
+
+	protected:
+		friend class AudIO;
+
+		AudioRuntime() = default;
+
+		~AudioRuntime();
+
+		/// Record a stream that was opened
+		void Register(AudIO* pStream);
+
+		/// Forget a stream that was closed
+		void Unregister(AudIO* pStream);
+
+		/// Apply an operation to many streams in parallel; returns the number for which it succeeded
+		template<typename Operation>
+		size_t ForEachParallel(const std::vector<AudIO*>& vStreams, Operation Op);
+
+		/// Guards the PortAudio lifetime
+		mutable std::mutex PaMutex_;
+
+		int References_ = 0;
+
+		bool Initialised_ = false;
+
+		bool KeepWarm_ = true;
+
+		/// Guards the registry, and is held while streams are started or stopped in parallel
+		mutable std::mutex StreamsMutex_;
+
+		std::vector<AudIO*> vStreams_;
+	};
+
+}
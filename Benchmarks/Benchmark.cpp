@@ -0,0 +1,335 @@
+// Benchmarks for QuickBuffer, FastSemaphore, the AudIO stream callbacks and the lossless capture encoder.
+// Results are written as JSON (to stdout, or to the file given with --out) so they can be compared across releases.
+//
+// Build together with the library sources and PortAudio, e.g.:
+//   g++ -O2 -std=c++17 -pthread -I.. Benchmark.cpp ../*.cpp -lportaudio -o Benchmark
+// Add -DQUICKBUFFER_NO_INDEX_CACHE to measure QuickBuffer without its cached indices, for comparison.
+// Usage:
+//   Benchmark [--quick] [--out results.json]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AudIO.h"
+#include "FastSemaphore.h"
+#include "LosslessEncoder.h"
+#include "QuickBuffer.h"
+#include "RealTime.h"
+
+using namespace std;
+using namespace Audaptr;
+
+namespace
+{
+	using Clock = chrono::steady_clock;
+
+	uint64_t Now_ns()
+	{
+		return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+	}
+
+	/// Summary of a set of timing samples [nanoseconds]
+	struct Percentiles
+	{
+		double P50 = 0.0, P90 = 0.0, P99 = 0.0, P999 = 0.0, Max = 0.0, Mean = 0.0;
+
+		explicit Percentiles(vector<uint64_t> vSamples)
+		{
+			if(vSamples.empty())
+				return;
+			sort(vSamples.begin(), vSamples.end());
+			auto At = [&](double Fraction) { return (double)vSamples[min(vSamples.size() - 1, (size_t)(Fraction * (double)vSamples.size()))]; };
+			P50 = At(0.5);
+			P90 = At(0.9);
+			P99 = At(0.99);
+			P999 = At(0.999);
+			Max = (double)vSamples.back();
+			double Sum = 0.0;
+			for(auto Sample : vSamples)
+				Sum += (double)Sample;
+			Mean = Sum / (double)vSamples.size();
+		}
+
+		string Json() const
+		{
+			ostringstream Out;
+			Out << "\"p50_ns\": " << P50 << ", \"p90_ns\": " << P90 << ", \"p99_ns\": " << P99 << ", \"p999_ns\": " << P999
+				<< ", \"max_ns\": " << Max << ", \"mean_ns\": " << Mean;
+			return Out.str();
+		}
+	};
+
+	/// Thread placement for producer/consumer pairs
+	struct Placement
+	{
+		string Name;
+		vector<int> ProducerCpus;
+		vector<int> ConsumerCpus;
+	};
+
+	void Pin(const vector<int> &Cpus)
+	{
+		if(Cpus.empty())
+			return;
+		RealTimeConfig Config;
+		Config.Policy = SchedulingPolicy::Unchanged;
+		Config.Cpus = Cpus;
+		Config.LockMemory = false;
+		Config.PrefaultBuffers = false;
+		RealTimeReport Report;
+		ConfigureCurrentThread(Config, Report);
+	}
+
+	/// SPSC throughput: the producer writes blocks of BlockSize items as fast as possible; the consumer drains them.
+	string SpscThroughput(size_t BlockSize, size_t TotalItems, const Placement &Where)
+	{
+		QuickBuffer<float> Buffer(65536);
+		Buffer.Prefault();
+		Buffer.Open();
+		atomic_bool Go{false};
+		thread Consumer([&]() {
+			Pin(Where.ConsumerCpus);
+			while(!Go.load(memory_order_acquire)) {}
+			size_t Read = 0, Available = 0;
+			volatile float Sink = 0.0f;
+			while(Read < TotalItems) {
+				const float *pRead = Buffer.ReadAcquire(Available);
+				if(!pRead)
+					continue;
+				Sink = pRead[Available - 1];
+				Buffer.ReadRelease(Available);
+				Read += Available;
+			}
+			(void)Sink;
+		});
+		Pin(Where.ProducerCpus);
+		const auto Begin = Clock::now();
+		Go.store(true, memory_order_release);
+		for(size_t Written = 0; Written < TotalItems; Written += BlockSize) {
+			float *pWrite;
+			while(!(pWrite = Buffer.WriteReserve(BlockSize))) {}
+			pWrite[0] = (float)Written;
+			Buffer.WriteCommit(BlockSize);
+		}
+		Consumer.join();
+		const double Elapsed_s = chrono::duration<double>(Clock::now() - Begin).count();
+		Buffer.Close();
+		ostringstream Out;
+		Out << "{\"benchmark\": \"spsc_throughput\", \"placement\": \"" << Where.Name << "\", \"block\": " << BlockSize
+			<< ", \"items_per_s\": " << (double)TotalItems / Elapsed_s << ", \"ns_per_block\": " << 1e9 * Elapsed_s * (double)BlockSize / (double)TotalItems << "}";
+		return Out.str();
+	}
+
+	/// Handoff latency: the producer writes timestamped blocks at intervals; the consumer records the delay to receipt.
+	string HandoffLatency(bool Blocking, size_t BlockSize, size_t NumBlocks, const Placement &Where)
+	{
+		QuickBuffer<uint64_t> Buffer(16384);
+		Buffer.Prefault();
+		Buffer.Open();
+		vector<uint64_t> vLatencies;
+		vLatencies.reserve(NumBlocks);
+		thread Consumer([&]() {
+			Pin(Where.ConsumerCpus);
+			size_t Available = 0;
+			for(size_t n = 0; n < NumBlocks; n++) {
+				const uint64_t *pRead;
+				if(Blocking)
+					pRead = Buffer.WaitReadAcquire(Available);
+				else
+					while(!(pRead = Buffer.ReadAcquire(Available))) {}
+				if(!pRead)
+					break;
+				vLatencies.push_back(Now_ns() - pRead[0]);
+				Buffer.ReadRelease(min(Available, BlockSize));
+			}
+		});
+		Pin(Where.ProducerCpus);
+		for(size_t n = 0; n < NumBlocks; n++) {
+			// Leave the consumer time to go idle (or to sleep, in blocking mode) between blocks.
+			const auto Until = Clock::now() + chrono::microseconds(50);
+			while(Clock::now() < Until) {}
+			uint64_t *pWrite;
+			while(!(pWrite = Buffer.WriteReserve(BlockSize))) {}
+			pWrite[0] = Now_ns();
+			Buffer.WriteCommit(BlockSize);
+		}
+		Consumer.join();
+		Buffer.Close();
+		ostringstream Out;
+		Out << "{\"benchmark\": \"handoff_latency\", \"mode\": \"" << (Blocking ? "blocking" : "spin") << "\", \"placement\": \"" << Where.Name
+			<< "\", \"block\": " << BlockSize << ", " << Percentiles(vLatencies).Json() << "}";
+		return Out.str();
+	}
+
+	/// FastSemaphore ping-pong: round-trip time between two threads posting to each other.
+	string SemaphorePingPong(size_t NumRoundTrips, const Placement &Where)
+	{
+		FastSemaphore Ping, Pong;
+		vector<uint64_t> vRoundTrips;
+		vRoundTrips.reserve(NumRoundTrips);
+		thread Responder([&]() {
+			Pin(Where.ConsumerCpus);
+			for(size_t n = 0; n < NumRoundTrips; n++) {
+				Ping.Wait();
+				Pong.Post();
+			}
+		});
+		Pin(Where.ProducerCpus);
+		for(size_t n = 0; n < NumRoundTrips; n++) {
+			const uint64_t Begin = Now_ns();
+			Ping.Post();
+			Pong.Wait();
+			vRoundTrips.push_back(Now_ns() - Begin);
+		}
+		Responder.join();
+		ostringstream Out;
+		Out << "{\"benchmark\": \"semaphore_round_trip\", \"placement\": \"" << Where.Name << "\", " << Percentiles(vRoundTrips).Json() << "}";
+		return Out.str();
+	}
+
+	/// AudIO callback cost: the selected stream callback is driven synthetically, without a device.
+	string CallbackCost(IOType Type, int NumChannels, PaSampleFormat Format, unsigned long FramesPerBuffer, size_t NumCalls)
+	{
+		PaDeviceInfo DeviceInfo{};
+		DeviceInfo.name = "Synthetic";
+		DeviceInfo.maxInputChannels = NumChannels;
+		DeviceInfo.maxOutputChannels = NumChannels;
+		DeviceInfo.defaultLowInputLatency = DeviceInfo.defaultLowOutputLatency = 0.001;
+		DeviceInfo.defaultHighInputLatency = DeviceInfo.defaultHighOutputLatency = 1.0;
+		DeviceInfo.defaultSampleRate = 48000.0;
+		const Binding Synthetic("Synthetic", "Synthetic", Type, DeviceInfo, {48000.0}, 0);
+
+		AudIO Device;
+		Device.SetSampleFormat(Format);
+		Device.Bind(Synthetic, 0.01, (Type != IOType::Output) ? NumChannels : 0, (Type != IOType::Input) ? NumChannels : 0);
+		Device.InBuffer().Open();
+		Device.OutBuffer().Open();
+		PaStreamCallback *pCallback = Device.Callback();
+
+		const size_t NumSamples = FramesPerBuffer * (size_t)NumChannels;
+		const size_t SampleBytes = (Format == paInt16) ? sizeof(int16_t) : sizeof(float);
+		vector<char> vDeviceIn(NumSamples * SampleBytes, 0), vDeviceOut(NumSamples * SampleBytes, 0);
+		vector<uint64_t> vTimes;
+		vTimes.reserve(NumCalls);
+		size_t Available = 0;
+		for(size_t n = 0; n < NumCalls; n++) {
+			// Keep the output ring supplied and the input ring drained, outside the timed region.
+			// Write silence, since uninitialised memory may hold denormals that would distort the timing.
+			if(float *pWrite = Device.OutBuffer().WriteReserve(NumSamples)) {
+				fill(pWrite, pWrite + NumSamples, 0.0f);
+				Device.OutBuffer().WriteCommit(NumSamples);
+			}
+			while(Device.InBuffer().ReadAcquire(Available))
+				Device.InBuffer().ReadRelease(Available);
+			const uint64_t Begin = Now_ns();
+			pCallback(vDeviceIn.data(), vDeviceOut.data(), FramesPerBuffer, nullptr, 0, &Device);
+			vTimes.push_back(Now_ns() - Begin);
+		}
+		Device.InBuffer().Close();
+		Device.OutBuffer().Close();
+		ostringstream Out;
+		Out << "{\"benchmark\": \"callback\", \"type\": \"" << IOTypeNames[(size_t)Type] << "\", \"channels\": " << NumChannels
+			<< ", \"format\": \"" << ((Format == paInt16) ? "int16" : "float32") << "\", \"frames\": " << FramesPerBuffer << ", "
+			<< Percentiles(vTimes).Json() << "}";
+		return Out.str();
+	}
+
+	/// Lossless capture throughput: a multichannel recording (tones with a little noise) is encoded to a file, and
+	/// the encoding rate is reported as a multiple of real time.
+	string LosslessEncode(int NumChannels, double Duration_s)
+	{
+		const double SampleRate_Hz = 48000.0;
+		const size_t NumFrames = (size_t)(Duration_s * SampleRate_Hz);
+		vector<float> vFrames(NumFrames * (size_t)NumChannels);
+		mt19937 Generator(1);
+		normal_distribution<float> Noise(0.0f, 1e-3f);
+		for(size_t n = 0; n < NumFrames; n++)
+			for(int Channel = 0; Channel < NumChannels; Channel++)
+				vFrames[n * NumChannels + Channel] = 0.3f * sinf(0.001f * (float)(Channel + 1) * (float)n) + Noise(Generator);
+
+		const string strPath = "Benchmark.capture";
+		const auto Begin = Clock::now();
+		double Ratio;
+		{
+			LosslessEncoder Encoder(strPath, NumChannels, SampleRate_Hz);
+			Encoder.Encode(vFrames.data(), NumFrames);
+			Encoder.Finish();
+			Ratio = Encoder.CompressionRatio();
+		}
+		const double Elapsed_s = chrono::duration<double>(Clock::now() - Begin).count();
+		remove(strPath.c_str());
+		ostringstream Out;
+		Out << "{\"benchmark\": \"lossless_encode\", \"channels\": " << NumChannels << ", \"duration_s\": " << Duration_s
+			<< ", \"realtime_factor\": " << Duration_s / Elapsed_s << ", \"ratio\": " << Ratio << "}";
+		return Out.str();
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	bool bQuick = false;
+	string strOut;
+	for(int n = 1; n < argc; n++) {
+		const string strArg(argv[n]);
+		if(strArg == "--quick")
+			bQuick = true;
+		else if((strArg == "--out") && (n + 1 < argc))
+			strOut = argv[++n];
+		else {
+			cerr << "Usage: " << argv[0] << " [--quick] [--out results.json]" << endl;
+			return 1;
+		}
+	}
+	const size_t Scale = bQuick ? 1 : 10;
+
+	vector<Placement> vPlacements{{"unpinned", {}, {}}, {"same_core", {0}, {0}}};
+	if(thread::hardware_concurrency() > 1)
+		vPlacements.push_back({"cross_core", {0}, {1}});
+
+	vector<string> vResults;
+	for(auto &&Where : vPlacements) {
+		for(size_t BlockSize : {8, 32, 128, 512, 2048})
+			vResults.push_back(SpscThroughput(BlockSize, Scale * (size_t)4'000'000, Where));
+		// Spinning consumers sharing a core with the producer would only measure the scheduler quantum.
+		if(Where.Name != "same_core")
+			vResults.push_back(HandoffLatency(false, 32, Scale * 2'000, Where));
+		vResults.push_back(HandoffLatency(true, 32, Scale * 2'000, Where));
+		vResults.push_back(SemaphorePingPong(Scale * 5'000, Where));
+	}
+	for(IOType Type : {IOType::Input, IOType::Output, IOType::Duplex})
+		for(int NumChannels : {1, 2, 8, 32, 5})
+			for(PaSampleFormat Format : {paFloat32, paInt16})
+				for(unsigned long Frames : {32ul, 256ul})
+					vResults.push_back(CallbackCost(Type, NumChannels, Format, Frames, Scale * 20'000));
+	for(int NumChannels : {2, 8, 64})
+		vResults.push_back(LosslessEncode(NumChannels, (double)Scale));
+
+	ostringstream Json;
+#ifdef QUICKBUFFER_NO_INDEX_CACHE
+	const bool IndexCache = false;
+#else
+	const bool IndexCache = true;
+#endif
+	Json << "{\n  \"portaudio\": \"" << PortAudioVersion() << "\",\n  \"hardware_concurrency\": " << thread::hardware_concurrency()
+		 << ",\n  \"index_cache\": " << (IndexCache ? "true" : "false")
+		 << ",\n  \"results\": [\n";
+	for(size_t n = 0; n < vResults.size(); n++)
+		Json << "    " << vResults[n] << ((n + 1 < vResults.size()) ? ",\n" : "\n");
+	Json << "  ]\n}\n";
+	if(strOut.empty())
+		cout << Json.str();
+	else
+		ofstream(strOut) << Json.str();
+	return 0;
+}
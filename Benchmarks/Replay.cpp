@@ -0,0 +1,220 @@
+// Replay of a recorded callback cadence (see AudIO::SetCallbackRecorder) through the AudIO stream callbacks and
+// their rings, to try ring sizes and consumer costs against the timing of a real driver, without the device.
+// A consumer thread drains InBuffer() and a producer thread fills OutBuffer(), each spending a configurable time
+// per block on simulated processing; the callback is driven with the recorded frame counts and status flags, in
+// real time or accelerated. Results are written as JSON (to stdout, or to the file given with --out).
+//
+// Build together with the library sources and PortAudio, e.g.:
+//   g++ -O2 -std=c++17 -pthread -I.. Replay.cpp ../*.cpp -lportaudio -o Replay
+// Usage:
+//   Replay trace [--session n] [--speed factor] [--latency seconds] [--block frames] [--work microseconds]
+//          [--out results.json]
+// --speed 0 drives the callbacks back to back. Only the cadence is accelerated: the simulated processing still
+// takes --work microseconds per block, so acceleration also stresses the consumers.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AudIO.h"
+#include "CallbackRecorder.h"
+#include "QuickBuffer.h"
+
+using namespace std;
+using namespace Audaptr;
+
+namespace
+{
+	using Clock = chrono::steady_clock;
+
+	/// Summary of a set of timing samples [nanoseconds]
+	struct Percentiles
+	{
+		double P50 = 0.0, P99 = 0.0, P999 = 0.0, Max = 0.0, Mean = 0.0;
+
+		explicit Percentiles(vector<uint64_t> vSamples)
+		{
+			if(vSamples.empty())
+				return;
+			sort(vSamples.begin(), vSamples.end());
+			auto At = [&](double Fraction) { return (double)vSamples[min(vSamples.size() - 1, (size_t)(Fraction * (double)vSamples.size()))]; };
+			P50 = At(0.5);
+			P99 = At(0.99);
+			P999 = At(0.999);
+			Max = (double)vSamples.back();
+			double Sum = 0.0;
+			for(auto Sample : vSamples)
+				Sum += (double)Sample;
+			Mean = Sum / (double)vSamples.size();
+		}
+
+		string Json() const
+		{
+			ostringstream Out;
+			Out << "{\"p50_ns\": " << P50 << ", \"p99_ns\": " << P99 << ", \"p999_ns\": " << P999 << ", \"max_ns\": " << Max
+				<< ", \"mean_ns\": " << Mean << "}";
+			return Out.str();
+		}
+	};
+
+	/// Simulated processing: spin for the given time, as a consumer busy with real work would
+	void Work(const chrono::nanoseconds Duration)
+	{
+		const Clock::time_point End = Clock::now() + Duration;
+		while(Clock::now() < End) {
+		}
+	}
+
+	struct Options
+	{
+		string Trace;
+		size_t Session = 0;
+		double Speed = 1.0;
+		double Latency_s = 0.01;
+		size_t BlockFrames = 256;
+		double Work_us = 0.0;
+		string Out;
+	};
+
+	string Run(const Options &Opts)
+	{
+		const CallbackTrace Trace(Opts.Trace);
+		const CallbackSession &Session = Trace.Session(Opts.Session);
+		const bool HasInput = Session.Type != IOType::Output, HasOutput = Session.Type != IOType::Input;
+
+		PaDeviceInfo DeviceInfo{};
+		DeviceInfo.name = "Replay";
+		DeviceInfo.maxInputChannels = Session.NumInputChannels;
+		DeviceInfo.maxOutputChannels = Session.NumOutputChannels;
+		DeviceInfo.defaultLowInputLatency = DeviceInfo.defaultLowOutputLatency = 0.001;
+		DeviceInfo.defaultHighInputLatency = DeviceInfo.defaultHighOutputLatency = 1.0;
+		DeviceInfo.defaultSampleRate = Session.SampleRate_Hz;
+		const Binding Replayed("Replay", "Replay", Session.Type, DeviceInfo, {Session.SampleRate_Hz}, 0);
+
+		AudIO Device;
+		Device.SetSampleFormat(Session.SampleFormat);
+		Device.Bind(Replayed, Opts.Latency_s, Session.NumInputChannels, Session.NumOutputChannels);
+		Device.InBuffer().Open();
+		Device.OutBuffer().Open();
+		PaStreamCallback *pCallback = Device.Callback();
+
+		// Block time spent on simulated processing, scaled to the frames actually handled
+		const double Work_ns_per_frame = Opts.Work_us * 1000.0 / (double)Opts.BlockFrames;
+		atomic<bool> Stop{false};
+		thread Consumer, Producer;
+		if(HasInput)
+			Consumer = thread([&] {
+				QuickBuffer<float> &Ring = Device.InBuffer();
+				const size_t NumChannels = (size_t)Device.NumInputRingChannels();
+				size_t Available = 0;
+				while(const float *pRead = Ring.WaitReadAcquire(Available)) {
+					(void)pRead;
+					const size_t NumFrames = min(Available / NumChannels, Opts.BlockFrames);
+					Work(chrono::nanoseconds((int64_t)(Work_ns_per_frame * (double)NumFrames)));
+					Ring.ReadRelease(NumFrames * NumChannels);
+				}
+			});
+		if(HasOutput)
+			Producer = thread([&] {
+				QuickBuffer<float> &Ring = Device.OutBuffer();
+				const size_t NumItems = Opts.BlockFrames * (size_t)Device.NumOutputRingChannels();
+				while(float *pWrite = Ring.WaitWrite(NumItems)) {
+					Work(chrono::nanoseconds((int64_t)(Work_ns_per_frame * (double)Opts.BlockFrames)));
+					fill(pWrite, pWrite + NumItems, 0.0f);
+					Ring.WriteCommit(NumItems);
+					if(Stop.load(memory_order_relaxed))
+						break;
+				}
+			});
+
+		uint32_t MaxFrames = 0;
+		for(const CallbackRecord &Record : Session.vRecords)
+			MaxFrames = max(MaxFrames, Record.NumFrames);
+		const size_t SampleBytes = (Session.SampleFormat == paInt16) ? sizeof(int16_t) : sizeof(float);
+		vector<char> vDeviceIn((size_t)MaxFrames * (size_t)Session.NumInputChannels * SampleBytes, 0);
+		vector<char> vDeviceOut((size_t)MaxFrames * (size_t)Session.NumOutputChannels * SampleBytes, 0);
+		vector<uint64_t> vCosts;
+		vCosts.reserve(Session.vRecords.size());
+		uint64_t NumFrames = 0, NumFlagged = 0;
+		const Clock::time_point Begin = Clock::now();
+		const vector<uint64_t> vLateness = Trace.Replay(Opts.Session, [&](const CallbackRecord &Record) {
+			const Clock::time_point Called = Clock::now();
+			pCallback(vDeviceIn.data(), vDeviceOut.data(), Record.NumFrames, nullptr, Record.StatusFlags, &Device);
+			vCosts.push_back((uint64_t)chrono::duration_cast<chrono::nanoseconds>(Clock::now() - Called).count());
+			NumFrames += Record.NumFrames;
+			NumFlagged += Record.StatusFlags ? 1 : 0;
+		}, Opts.Speed);
+		const double Elapsed_s = chrono::duration<double>(Clock::now() - Begin).count();
+		Stop.store(true, memory_order_relaxed);
+		Device.InBuffer().Close();
+		Device.OutBuffer().Close();
+		if(Consumer.joinable())
+			Consumer.join();
+		if(Producer.joinable())
+			Producer.join();
+
+		vector<uint64_t> vIntervals;
+		for(size_t n = 1; n < Session.vRecords.size(); n++)
+			vIntervals.push_back(Session.vRecords[n].Time_ns - Session.vRecords[n - 1].Time_ns);
+		ostringstream Out;
+		Out << "{\n  \"trace\": \"" << Opts.Trace << "\", \"session\": " << Opts.Session << ", \"type\": \"" << IOTypeNames[(size_t)Session.Type]
+			<< "\", \"sample_rate\": " << Session.SampleRate_Hz << ", \"input_channels\": " << Session.NumInputChannels
+			<< ", \"output_channels\": " << Session.NumOutputChannels << ",\n  \"speed\": " << Opts.Speed << ", \"latency_s\": " << Opts.Latency_s
+			<< ", \"block_frames\": " << Opts.BlockFrames << ", \"work_us\": " << Opts.Work_us << ",\n  \"callbacks\": " << Session.vRecords.size()
+			<< ", \"frames\": " << NumFrames << ", \"recorded_flags\": " << NumFlagged << ", \"elapsed_s\": " << Elapsed_s
+			<< ",\n  \"input_ring_overflows\": " << Device.InputRingOverflows() << ", \"output_ring_underflows\": " << Device.OutputRingUnderflows()
+			<< ",\n  \"recorded_interval\": " << Percentiles(vIntervals).Json() << ",\n  \"lateness\": " << Percentiles(vLateness).Json()
+			<< ",\n  \"callback_cost\": " << Percentiles(vCosts).Json() << "\n}\n";
+		return Out.str();
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	Options Opts;
+	bool bUsage = false;
+	for(int n = 1; (n < argc) && !bUsage; n++) {
+		const string strArg(argv[n]);
+		const bool HasValue = n + 1 < argc;
+		if((strArg == "--session") && HasValue)
+			Opts.Session = stoul(argv[++n]);
+		else if((strArg == "--speed") && HasValue)
+			Opts.Speed = stod(argv[++n]);
+		else if((strArg == "--latency") && HasValue)
+			Opts.Latency_s = stod(argv[++n]);
+		else if((strArg == "--block") && HasValue)
+			Opts.BlockFrames = max<size_t>(1, stoul(argv[++n]));
+		else if((strArg == "--work") && HasValue)
+			Opts.Work_us = stod(argv[++n]);
+		else if((strArg == "--out") && HasValue)
+			Opts.Out = argv[++n];
+		else if(Opts.Trace.empty() && (strArg[0] != '-'))
+			Opts.Trace = strArg;
+		else
+			bUsage = true;
+	}
+	if(bUsage || Opts.Trace.empty()) {
+		cerr << "Usage: " << argv[0] << " trace [--session n] [--speed factor] [--latency seconds] [--block frames] [--work microseconds] [--out results.json]" << endl;
+		return 1;
+	}
+	try {
+		const string Json = Run(Opts);
+		if(Opts.Out.empty())
+			cout << Json;
+		else
+			ofstream(Opts.Out) << Json;
+	}
+	catch(const exception &Error) {
+		cerr << Error.what() << endl;
+		return 1;
+	}
+	return 0;
+}
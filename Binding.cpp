@@ -1,34 +1,195 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
 #include "Binding.h"
 
 namespace Audaptr
 {
+	namespace
+	{
+		/// Descriptors are held in fixed chunks that never move, so lookups need no lock
+		constexpr uint32_t kChunkBits = 6;
+		constexpr uint32_t kChunkSize = 1u << kChunkBits;
+		constexpr uint32_t kMaxChunks = 256;
+
+		struct Registry
+		{
+			Registry()
+			{
+				Append("", "", PaDeviceInfo{}, -1);
+			}
+
+			/// Add a descriptor; the caller holds Mutex
+			uint32_t Append(const std::string &strSystem, const std::string &strDevice, const PaDeviceInfo &DeviceInfo, const int iDeviceIndex)
+			{
+				const uint32_t Id = Count.load(std::memory_order_relaxed);
+				if(Id >= kChunkSize * kMaxChunks)
+					throw Exception("Too many audio devices registered");
+				DeviceDescriptor *pChunk = Chunks[Id >> kChunkBits].load(std::memory_order_relaxed);
+				if(!pChunk) {
+					pChunk = new DeviceDescriptor[kChunkSize];
+					Chunks[Id >> kChunkBits].store(pChunk, std::memory_order_release);
+				}
+				DeviceDescriptor &Descriptor = pChunk[Id & (kChunkSize - 1)];
+				Descriptor.System = strSystem;
+				Descriptor.Device = strDevice;
+				Descriptor.DeviceInfo = DeviceInfo;
+				Descriptor.DeviceInfo.name = Descriptor.Device.c_str();
+				Descriptor.DeviceIndex = iDeviceIndex;
+				Count.store(Id + 1, std::memory_order_release);
+				return Id;
+			}
+
+			const DeviceDescriptor &At(const uint32_t Id) const
+			{
+				return Chunks[Id >> kChunkBits].load(std::memory_order_acquire)[Id & (kChunkSize - 1)];
+			}
+
+			std::mutex Mutex;
+
+			std::array<std::atomic<DeviceDescriptor*>, kMaxChunks> Chunks{};
+
+			std::atomic<uint32_t> Count{0};
+		};
+
+		/// Never destroyed, as bindings with static storage may outlive it otherwise
+		Registry &TheRegistry()
+		{
+			static Registry *pInstance = new Registry;
+			return *pInstance;
+		}
+
+		bool SameDevice(const DeviceDescriptor &Descriptor, const std::string &strSystem, const std::string &strDevice, const PaDeviceInfo &DeviceInfo, const int iDeviceIndex)
+		{
+			const PaDeviceInfo &Info = Descriptor.DeviceInfo;
+			return (Descriptor.DeviceIndex == iDeviceIndex) && (Descriptor.System == strSystem) && (Descriptor.Device == strDevice) &&
+				(Info.hostApi == DeviceInfo.hostApi) && (Info.maxInputChannels == DeviceInfo.maxInputChannels) &&
+				(Info.maxOutputChannels == DeviceInfo.maxOutputChannels) && (Info.defaultLowInputLatency == DeviceInfo.defaultLowInputLatency) &&
+				(Info.defaultLowOutputLatency == DeviceInfo.defaultLowOutputLatency) && (Info.defaultHighInputLatency == DeviceInfo.defaultHighInputLatency) &&
+				(Info.defaultHighOutputLatency == DeviceInfo.defaultHighOutputLatency) && (Info.defaultSampleRate == DeviceInfo.defaultSampleRate);
+		}
+	}
+
+	SampleRateSet SampleRateSet::Of(const std::vector<double> &vdSampleRates_Hz, const double DeviceDefault_Hz)
+	{
+		uint32_t Bits = 0;
+		for(auto dSampleRate_Hz : vdSampleRates_Hz) {
+			const int iBit = Bit(dSampleRate_Hz, DeviceDefault_Hz);
+			if(iBit >= 0)
+				Bits |= 1u << iBit;
+			else
+				throw Exception("Unsupported sample rate " + std::to_string(dSampleRate_Hz) + " Hz");
+		}
+		return SampleRateSet(Bits);
+	}
+
+	int SampleRateSet::StandardIndex(const double SampleRate_Hz)
+	{
+		auto iterRate = std::find(StandardSampleRates_Hz.begin(), StandardSampleRates_Hz.end(), SampleRate_Hz);
+		return (iterRate == StandardSampleRates_Hz.end()) ? -1 : (int)(iterRate - StandardSampleRates_Hz.begin());
+	}
+
+	int SampleRateSet::Bit(const double SampleRate_Hz, const double DeviceDefault_Hz)
+	{
+		const int iIndex = StandardIndex(SampleRate_Hz);
+		if(iIndex >= 0)
+			return iIndex;
+		return (SampleRate_Hz == DeviceDefault_Hz) ? (int)StandardSampleRates_Hz.size() : -1;
+	}
+
+	double SampleRateSet::Rate(const int iBit, const double DeviceDefault_Hz)
+	{
+		return ((size_t)iBit < StandardSampleRates_Hz.size()) ? StandardSampleRates_Hz[iBit] : DeviceDefault_Hz;
+	}
+
+	bool SampleRateSet::Contains(const double SampleRate_Hz, const double DeviceDefault_Hz) const
+	{
+		const int iBit = Bit(SampleRate_Hz, DeviceDefault_Hz);
+		return (iBit >= 0) && (Bits_ & (1u << iBit));
+	}
+
+	std::vector<double> SampleRateSet::Rates(const double DeviceDefault_Hz) const
+	{
+		std::vector<double> vdSampleRates_Hz;
+		for(size_t i = 0; i < StandardSampleRates_Hz.size(); i++)
+			if(Bits_ & (1u << i))
+				vdSampleRates_Hz.push_back(StandardSampleRates_Hz[i]);
+		if(Bits_ & kDeviceDefault)
+			vdSampleRates_Hz.insert(std::lower_bound(vdSampleRates_Hz.begin(), vdSampleRates_Hz.end(), DeviceDefault_Hz), DeviceDefault_Hz);
+		return vdSampleRates_Hz;
+	}
+
+	double SampleRateSet::Lowest(const double DeviceDefault_Hz) const
+	{
+		const uint32_t Standard = Bits_ & (kDeviceDefault - 1);
+		double dLowest_Hz = 0.0;
+		for(size_t i = 0; i < StandardSampleRates_Hz.size(); i++)
+			if(Standard & (1u << i)) {
+				dLowest_Hz = StandardSampleRates_Hz[i];
+				break;
+			}
+		if((Bits_ & kDeviceDefault) && ((dLowest_Hz == 0.0) || (DeviceDefault_Hz < dLowest_Hz)))
+			dLowest_Hz = DeviceDefault_Hz;
+		return dLowest_Hz;
+	}
+
+	uint32_t DeviceRegistry::Register(const std::string &strSystem, const std::string &strDevice, const PaDeviceInfo &DeviceInfo, const int iDeviceIndex)
+	{
+		Registry &Devices = TheRegistry();
+		std::lock_guard<std::mutex> Lock(Devices.Mutex);
+		const uint32_t Count = Devices.Count.load(std::memory_order_relaxed);
+		for(uint32_t Id = 0; Id < Count; Id++)
+			if(SameDevice(Devices.At(Id), strSystem, strDevice, DeviceInfo, iDeviceIndex))
+				return Id;
+		return Devices.Append(strSystem, strDevice, DeviceInfo, iDeviceIndex);
+	}
+
+	const DeviceDescriptor &DeviceRegistry::Get(const uint32_t Id)
+	{
+		return TheRegistry().At(Id);
+	}
+
+	size_t DeviceRegistry::Size()
+	{
+		return TheRegistry().Count.load(std::memory_order_acquire);
+	}
+
 	Binding::Binding(std::string strSystem, std::string strDevice, IOType Type, PaDeviceInfo DeviceInfo, std::vector<double> vdSampleRates_Hz, const int iDeviceIndex) :
-		System_(strSystem), Device_(strDevice), Type_(Type), SampleRates_Hz_(vdSampleRates_Hz), DeviceIndex_(iDeviceIndex)
+		DeviceId_(DeviceRegistry::Register(strSystem, strDevice, DeviceInfo, iDeviceIndex)), Type_(Type),
+		SampleRates_(SampleRateSet::Of(vdSampleRates_Hz, DeviceInfo.defaultSampleRate))
+	{
+		// The rates are listed in order of preference, as AudIO opens at the first.
+		if(!vdSampleRates_Hz.empty())
+			PreferredRate_ = (uint8_t)SampleRateSet::Bit(vdSampleRates_Hz.front(), DeviceInfo.defaultSampleRate);
+	}
+
+	Binding::Binding(const uint32_t DeviceId, const IOType Type, const SampleRateSet SampleRates) :
+		DeviceId_(DeviceId), Type_(Type), SampleRates_(SampleRates)
 	{
-		DeviceInfo_ = DeviceInfo;
-		DefaultSampleRate_Hz_ = DeviceInfo.defaultSampleRate;
 	}
 
 	bool Binding::operator==(const Binding &Another) const
 	{
-		return (System_ == Another.System_) && (Device_ == Another.Device_) && (Type_ == Another.Type_) &&
-			(SampleRates_Hz_ == Another.SampleRates_Hz_) && (DefaultSampleRate_Hz_ == Another.DefaultSampleRate_Hz_) &&
-			(DeviceIndex_ == Another.DeviceIndex_) && (Latency_s_ == Another.Latency_s_);
+		return (DeviceId_ == Another.DeviceId_) && (Type_ == Another.Type_) && (SampleRates_ == Another.SampleRates_) &&
+			(PreferredSampleRate_Hz() == Another.PreferredSampleRate_Hz()) && (Latency_s_ == Another.Latency_s_);
 	}
 
 	const std::string &Binding::SystemName() const
 	{
-		return System_;
+		return Descriptor().System;
 	}
 
 	const std::string &Binding::DeviceName() const
 	{
-		return Device_;
+		return Descriptor().Device;
 	}
 
 	const int Binding::DeviceIndex() const
 	{
-		return DeviceIndex_;
+		return Descriptor().DeviceIndex;
 	}
 
 	const IOType Binding::Type() const
@@ -41,45 +202,76 @@ namespace Audaptr
 		return TypeStrings[(size_t)Type_];
 	}
 
-	const std::vector<double> &Binding::SampleRates() const
+	std::vector<double> Binding::SampleRates() const
+	{
+		return SampleRates_.Rates(DefaultSampleRate_Hz());
+	}
+
+	bool Binding::SupportsSampleRate(const double SampleRate_Hz) const
+	{
+		return SampleRates_.Contains(SampleRate_Hz, DefaultSampleRate_Hz());
+	}
+
+	double Binding::PreferredSampleRate_Hz() const
+	{
+		if((PreferredRate_ != kNoPreference) && (SampleRates_.Bits() & (1u << PreferredRate_)))
+			return SampleRateSet::Rate(PreferredRate_, DefaultSampleRate_Hz());
+		return SampleRates_.Lowest(DefaultSampleRate_Hz());
+	}
+
+	void Binding::SetPreferredSampleRate(const double SampleRate_Hz)
+	{
+		if(!SupportsSampleRate(SampleRate_Hz))
+			throw Exception("Sample rate " + std::to_string(SampleRate_Hz) + " Hz is not supported by " + DeviceName());
+		PreferredRate_ = (uint8_t)SampleRateSet::Bit(SampleRate_Hz, DefaultSampleRate_Hz());
+	}
+
+	double Binding::DefaultSampleRate_Hz() const
+	{
+		return Descriptor().DeviceInfo.defaultSampleRate;
+	}
+
+	const PaDeviceInfo &Binding::DeviceInfo() const
 	{
-		return SampleRates_Hz_;
+		return Descriptor().DeviceInfo;
 	}
 
 	int Binding::MaxInputChannels() const
 	{
-		return DeviceInfo_.maxInputChannels;
+		return DeviceInfo().maxInputChannels;
 	}
 
 	int Binding::MaxOutputChannels() const
 	{
-		return DeviceInfo_.maxOutputChannels;
+		return DeviceInfo().maxOutputChannels;
 	}
 
 	double Binding::MinLatency_s() const
 	{
+		const PaDeviceInfo &Info = DeviceInfo();
 		switch(Type_) {
 		case IOType::Input:
-			return DeviceInfo_.defaultLowInputLatency;
+			return Info.defaultLowInputLatency;
 		case IOType::Output:
-			return DeviceInfo_.defaultLowOutputLatency;
+			return Info.defaultLowOutputLatency;
 		case IOType::Duplex:
-			return std::max(DeviceInfo_.defaultLowInputLatency, DeviceInfo_.defaultLowOutputLatency);
+			return std::max(Info.defaultLowInputLatency, Info.defaultLowOutputLatency);
 		}
-		return std::max(DeviceInfo_.defaultLowInputLatency, DeviceInfo_.defaultLowOutputLatency);
+		return std::max(Info.defaultLowInputLatency, Info.defaultLowOutputLatency);
 	}
 
 	double Binding::MaxLatency_s() const
 	{
+		const PaDeviceInfo &Info = DeviceInfo();
 		switch(Type_) {
 		case IOType::Input:
-			return DeviceInfo_.defaultHighInputLatency;
+			return Info.defaultHighInputLatency;
 		case IOType::Output:
-			return DeviceInfo_.defaultHighOutputLatency;
+			return Info.defaultHighOutputLatency;
 		case IOType::Duplex:
-			return std::min(DeviceInfo_.defaultHighInputLatency, DeviceInfo_.defaultHighOutputLatency);
+			return std::min(Info.defaultHighInputLatency, Info.defaultHighOutputLatency);
 		}
-		return std::min(DeviceInfo_.defaultHighInputLatency, DeviceInfo_.defaultHighOutputLatency);
+		return std::min(Info.defaultHighInputLatency, Info.defaultHighOutputLatency);
 	}
 
 }
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstdint>
+#include <type_traits>
+
 #include <portaudio.h>
 #ifdef _MSC_VER
 #include <pa_asio.h>
@@ -9,23 +12,119 @@
 
 namespace Audaptr
 {
+	/// @brief Set of sample rates, as one bit per entry of StandardSampleRates_Hz, and one more standing for the
+	/// device's own default rate where that is not standard. Set operations are bitwise.
+	class SampleRateSet
+	{
+	public:
+		/// @brief Bit standing for the device's default sample rate, where it is not one of StandardSampleRates_Hz
+		static constexpr uint32_t kDeviceDefault = 1u << StandardSampleRates_Hz.size();
+
+		constexpr SampleRateSet() = default;
+
+		constexpr explicit SampleRateSet(const uint32_t Bits) : Bits_(Bits) {}
+
+		/// @brief Set of sample rates
+		/// @param vdSampleRates_Hz Sample rates; one that is not standard is kept only if it is the device default
+		/// @param DeviceDefault_Hz Default sample rate of the device
+		static SampleRateSet Of(const std::vector<double> &vdSampleRates_Hz, const double DeviceDefault_Hz = 0.0);
+
+		/// @brief Index of a rate in StandardSampleRates_Hz, or -1 if it is not standard
+		static int StandardIndex(const double SampleRate_Hz);
+
+		/// @brief Bit standing for a rate, or -1 if it is neither standard nor the device default
+		static int Bit(const double SampleRate_Hz, const double DeviceDefault_Hz = 0.0);
+
+		/// @brief Rate a bit stands for
+		static double Rate(const int iBit, const double DeviceDefault_Hz = 0.0);
+
+		/// @brief Flag indicating whether a rate is in the set
+		bool Contains(const double SampleRate_Hz, const double DeviceDefault_Hz = 0.0) const;
+
+		/// @brief Sample rates in the set, in ascending order
+		std::vector<double> Rates(const double DeviceDefault_Hz = 0.0) const;
+
+		/// @brief Lowest sample rate in the set, or zero if it is empty
+		double Lowest(const double DeviceDefault_Hz = 0.0) const;
+
+		constexpr uint32_t Bits() const { return Bits_; }
+
+		constexpr bool Empty() const { return Bits_ == 0; }
+
+		constexpr SampleRateSet operator &(const SampleRateSet Another) const { return SampleRateSet(Bits_ & Another.Bits_); }
+
+		constexpr SampleRateSet operator |(const SampleRateSet Another) const { return SampleRateSet(Bits_ | Another.Bits_); }
+
+		constexpr bool operator ==(const SampleRateSet Another) const { return Bits_ == Another.Bits_; }
+
+	private:
+		uint32_t Bits_ = 0;
+	};
+
+	/// @brief Metadata of an audio device, held once by the DeviceRegistry and shared by every binding of the device
+	struct DeviceDescriptor
+	{
+		/// @brief Audio system name
+		std::string System;
+
+		/// @brief Audio device name
+		std::string Device;
+
+		/// @brief PortAudio device information; its name points at Device, so it stays valid after PortAudio terminates
+		PaDeviceInfo DeviceInfo;
+
+		/// @brief Index associated with the device
+		int DeviceIndex;
+	};
+
+	/// @brief Process-wide, append-only registry of device descriptors, so that a Binding need only hold an
+	/// identifier. Registering the same device again returns the identifier it already has. Descriptors are never
+	/// removed, so a reference to one stays valid, and looking one up takes no lock.
+	class DeviceRegistry
+	{
+	public:
+		/// @brief Identifier of the empty descriptor, that of a default-constructed Binding
+		static constexpr uint32_t kNone = 0;
+
+		/// @brief Register a device, or find it if registered already
+		/// @return Identifier of the device's descriptor
+		static uint32_t Register(const std::string &strSystem, const std::string &strDevice, const PaDeviceInfo &DeviceInfo, const int iDeviceIndex);
+
+		/// @brief Descriptor registered under an identifier
+		static const DeviceDescriptor &Get(const uint32_t Id);
+
+		/// @brief Number of descriptors registered
+		static size_t Size();
+	};
+
 	/// @brief Class describing binding of an audio stream to a particular system, device, sample rate, format etc.
+	/// A binding is a small, trivially copyable handle: the device metadata is shared through the DeviceRegistry,
+	/// and the supported sample rates are a SampleRateSet.
 	class Binding
 	{
 	public:
 		Binding() = default;
 
-		/// @brief Audio stream binding
+		/// @brief Audio stream binding, registering its device
 		/// @param strSystem Audio system name
 		/// @param strDevice Audio device name
 		/// @param Type Audio stream type (input, output, duplex, any)
 		/// @param DeviceInfo PortAudio descriptor for the device
-		/// @param vdSampleRates_Hz Sample rates supported
+		/// @param vdSampleRates_Hz Sample rates supported; only standard rates and the device's default are kept
 		/// @param iDeviceIndex Index associated with the device
 		Binding(std::string strSystem, std::string strDevice, IOType Type, PaDeviceInfo DeviceInfo, std::vector<double> vdSampleRates_Hz, const int iDeviceIndex);
 
+		/// @brief Audio stream binding of a registered device
+		/// @param DeviceId Identifier of the device in the DeviceRegistry
+		/// @param Type Audio stream type (input, output, duplex, any)
+		/// @param SampleRates Sample rates supported
+		Binding(const uint32_t DeviceId, const IOType Type, const SampleRateSet SampleRates);
+
 		bool operator ==(const Binding &Another) const;
 
+		/// @brief Descriptor of the device
+		const DeviceDescriptor &Descriptor() const { return DeviceRegistry::Get(DeviceId_); }
+
 		/// @brief The audio system name
 		const std::string &SystemName() const;
 
@@ -35,13 +134,35 @@ namespace Audaptr
 		/// @brief The device index
 		const int DeviceIndex() const;
 
+		/// @brief Identifier of the device in the DeviceRegistry
+		uint32_t DeviceId() const { return DeviceId_; }
+
 		const IOType Type() const;
 
 		/// @brief String description of the stream type
 		const std::string &TypeName() const;
 
-		/// @brief Vector of supported sample rates
-		const std::vector<double> &SampleRates() const;
+		/// @brief Vector of supported sample rates, in ascending order
+		std::vector<double> SampleRates() const;
+
+		/// @brief Set of supported sample rates
+		SampleRateSet SampleRateBits() const { return SampleRates_; }
+
+		/// @brief Flag indicating whether a sample rate is supported
+		bool SupportsSampleRate(const double SampleRate_Hz) const;
+
+		/// @brief Preferred sample rate, at which a stream opens: the first rate given when the binding was made or
+		/// filtered, or the lowest supported if that is no longer supported. Zero if no rate is supported.
+		double PreferredSampleRate_Hz() const;
+
+		/// @brief Make a supported sample rate the preferred one
+		void SetPreferredSampleRate(const double SampleRate_Hz);
+
+		/// @brief Default sample rate of the device
+		double DefaultSampleRate_Hz() const;
+
+		/// @brief PortAudio device information
+		const PaDeviceInfo &DeviceInfo() const;
 
 		/// @brief Maximum number of input channels
 		int MaxInputChannels() const;
@@ -58,29 +179,25 @@ namespace Audaptr
 		/// @brief Supported types
 		static const std::vector<std::string> TypeStrings;
 
-		/// @brief PortAudio device information
-		PaDeviceInfo DeviceInfo_;
-
-		/// @brief System name
-		std::string System_;
-
-		/// @brief Device name
-		std::string Device_;
+		/// @brief Identifier of the device descriptor
+		uint32_t DeviceId_ = DeviceRegistry::kNone;
 
 		/// @brief Device type (input, output, duplex, any)
-		IOType Type_;
+		IOType Type_ = IOType::Input;
 
-		/// @brief  Suported sample rates
-		std::vector<double> SampleRates_Hz_;
+		/// @brief Suported sample rates
+		SampleRateSet SampleRates_;
 
-		/// @brief Default sample rate
-		double DefaultSampleRate_Hz_ = 0.0;
+		/// @brief No preferred sample rate; the lowest supported is used
+		static constexpr uint8_t kNoPreference = 0xff;
 
-		/// @brief Device index
-		int DeviceIndex_ = -1;
+		/// @brief Bit of the preferred sample rate in SampleRates_, or kNoPreference
+		uint8_t PreferredRate_ = kNoPreference;
 
 		/// @brief Current latency
 		double Latency_s_ = 0.0;
 	};
 
+	static_assert(std::is_trivially_copyable_v<Binding>, "A binding must stay a trivially copyable handle");
+
 }
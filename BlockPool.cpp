@@ -0,0 +1,41 @@
+#include <string>
+
+#include "Audaptr.h"
+#include "BlockPool.h"
+
+using namespace std;
+
+namespace Audaptr
+{
+	BlockPool::BlockPool(const size_t NumBlocks, const size_t FramesPerBlock, const int NumChannels, BufferAllocator *pAllocator) :
+		NumBlocks_(NumBlocks), FramesPerBlock_(FramesPerBlock), NumChannels_(NumChannels), pAllocator_(pAllocator ? pAllocator : &BufferAllocator::Default())
+	{
+		if((NumBlocks < 1) || (FramesPerBlock < 1) || (NumChannels < 1))
+			throw Exception("A block pool requires at least one block, one frame and one channel");
+		if(NumBlocks > 0xfffffffeu)
+			throw Exception("A block pool of " + to_string(NumBlocks) + " blocks is too large");
+
+		// Each block starts on a cache line, so that blocks used by different threads never share one.
+		const size_t Stride = (FramesPerBlock * NumChannels * sizeof(float) + 63) / 64 * 64;
+		Bytes_ = Stride * NumBlocks;
+		pStorage_ = static_cast<float *>(pAllocator_->Allocate(Bytes_, 64));
+		pBlocks_.reset(new AudioBlock[NumBlocks]);
+		pNext_.reset(new atomic<uint32_t>[NumBlocks]);
+		for(size_t Index = 0; Index < NumBlocks; Index++) {
+			AudioBlock &Block = pBlocks_[Index];
+			Block.pFrames_ = reinterpret_cast<float *>(reinterpret_cast<uint8_t *>(pStorage_) + Index * Stride);
+			Block.pPool_ = this;
+			Block.Index_ = (uint32_t)Index;
+			// The free stack starts in order, with the first block on top.
+			pNext_[Index].store((Index + 1 < NumBlocks) ? (uint32_t)(Index + 2) : 0, memory_order_relaxed);
+		}
+		FreeHead_.store(1, memory_order_release);
+		NumFree_.store(NumBlocks, memory_order_relaxed);
+	}
+
+	BlockPool::~BlockPool()
+	{
+		pAllocator_->Deallocate(pStorage_, Bytes_);
+	}
+
+}
@@ -0,0 +1,314 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+
+#include "BufferAllocator.h"
+#include "QuickBuffer.h"
+
+namespace Audaptr
+{
+	class BlockPool;
+
+	/// @brief Fixed-size block of interleaved frames belonging to a BlockPool, handed between threads by BlockRef
+	class alignas(64) AudioBlock
+	{
+	public:
+		AudioBlock(const AudioBlock&) = delete;
+		AudioBlock& operator=(const AudioBlock&) = delete;
+
+		float* Frames() noexcept { return pFrames_; }
+
+		const float* Frames() const noexcept { return pFrames_; }
+
+		/// @brief Number of frames filled
+		size_t NumFrames() const noexcept { return NumFrames_; }
+
+		/// @brief Number of frames the block can hold
+		size_t Capacity() const noexcept;
+
+		int NumChannels() const noexcept;
+
+		/// @brief Index of the first frame in the stream that filled the block
+		uint64_t FirstFrame() const noexcept { return FirstFrame_; }
+
+		/// @brief Record what the block holds; for the thread that filled it, before the block is shared
+		void SetFrames(const size_t NumFrames, const uint64_t FirstFrame) noexcept
+		{
+			NumFrames_ = NumFrames;
+			FirstFrame_ = FirstFrame;
+		}
+
+	private:
+		friend class BlockPool;
+		friend class BlockRef;
+
+		AudioBlock() = default;
+
+		float* pFrames_ = nullptr;
+
+		size_t NumFrames_ = 0;
+
+		uint64_t FirstFrame_ = 0;
+
+		BlockPool* pPool_ = nullptr;
+
+		uint32_t Index_ = 0;
+
+		std::atomic<uint32_t> RefCount_{0};
+	};
+
+	/// @brief Counted reference to an AudioBlock. Copies share the block, which returns to its pool when the last
+	/// reference is released; neither copying nor releasing blocks or allocates, so references may be dropped on a
+	/// real-time thread.
+	class BlockRef
+	{
+	public:
+		BlockRef() noexcept = default;
+
+		BlockRef(const BlockRef& Other) noexcept : pBlock_(Other.pBlock_)
+		{
+			if(pBlock_)
+				pBlock_->RefCount_.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		BlockRef(BlockRef&& Other) noexcept : pBlock_(Other.pBlock_) { Other.pBlock_ = nullptr; }
+
+		BlockRef& operator=(BlockRef Other) noexcept
+		{
+			std::swap(pBlock_, Other.pBlock_);
+			return *this;
+		}
+
+		~BlockRef() { Reset(); }
+
+		/// @brief Release the reference, returning the block to its pool if it was the last
+		inline void Reset() noexcept;
+
+		explicit operator bool() const noexcept { return pBlock_ != nullptr; }
+
+		AudioBlock* operator->() const noexcept { return pBlock_; }
+
+		AudioBlock& operator*() const noexcept { return *pBlock_; }
+
+		AudioBlock* Get() const noexcept { return pBlock_; }
+
+		/// @brief Give up the reference without releasing it, e.g. to pass it through a queue of pointers
+		AudioBlock* Detach() noexcept
+		{
+			AudioBlock* pBlock = pBlock_;
+			pBlock_ = nullptr;
+			return pBlock;
+		}
+
+		/// @brief Take over a reference given up by Detach()
+		static BlockRef Adopt(AudioBlock* pBlock) noexcept
+		{
+			BlockRef Ref;
+			Ref.pBlock_ = pBlock;
+			return Ref;
+		}
+
+	private:
+		AudioBlock* pBlock_ = nullptr;
+	};
+
+	/// @brief Preallocated pool of cache-aligned, reference-counted audio blocks, as an alternative to QuickBuffer
+	/// for consumers that keep whole blocks for a while (e.g. queued for analysis, sending or deferred writing):
+	/// a block is filled once and shared by reference, so nothing is copied out and memory stays bounded.
+	/// Free blocks are kept on a lockfree stack, so any thread may acquire or release blocks without blocking or
+	/// allocating. All blocks must have been released when the pool is destroyed.
+	class BlockPool
+	{
+	public:
+		/// @brief Constructor
+		/// @param NumBlocks Number of blocks
+		/// @param FramesPerBlock Number of frames each block can hold
+		/// @param NumChannels Number of interleaved channels per frame
+		/// @param pAllocator Allocator for the block storage; it must outlive the pool. nullptr selects the heap.
+		BlockPool(const size_t NumBlocks, const size_t FramesPerBlock, const int NumChannels, BufferAllocator* pAllocator = nullptr);
+
+		~BlockPool();
+
+		BlockPool(const BlockPool&) = delete;
+		BlockPool& operator=(const BlockPool&) = delete;
+
+		size_t NumBlocks() const { return NumBlocks_; }
+
+		size_t FramesPerBlock() const { return FramesPerBlock_; }
+
+		int NumChannels() const { return NumChannels_; }
+
+		/// @brief Take a free block, empty and referenced once
+		/// @return The block, or an empty reference if every block is in use
+		inline BlockRef Acquire() noexcept
+		{
+			uint64_t Head = FreeHead_.load(std::memory_order_acquire);
+			for(;;) {
+				const uint32_t Top = (uint32_t)Head;
+				if(!Top) {
+					Exhausted_.fetch_add(1, std::memory_order_relaxed);
+					return BlockRef();
+				}
+				// The tag in the high word changes on every update, so a stale head cannot be swapped back in.
+				const uint64_t Next = ((Head >> 32) + 1) << 32 | pNext_[Top - 1].load(std::memory_order_relaxed);
+				if(FreeHead_.compare_exchange_weak(Head, Next, std::memory_order_acquire, std::memory_order_acquire))
+					break;
+			}
+			NumFree_.fetch_sub(1, std::memory_order_relaxed);
+			AudioBlock& Block = pBlocks_[(uint32_t)Head - 1];
+			Block.NumFrames_ = 0;
+			Block.RefCount_.store(1, std::memory_order_relaxed);
+			return BlockRef::Adopt(&Block);
+		}
+
+		/// @brief Number of blocks not in use; approximate while other threads acquire or release blocks
+		size_t NumFree() const { return NumFree_.load(std::memory_order_relaxed); }
+
+		/// @brief Number of times Acquire() found no free block
+		uint64_t Exhausted() const { return Exhausted_.load(std::memory_order_relaxed); }
+
+	protected:
+		friend class BlockRef;
+
+		/// Return a block whose last reference was released
+		inline void Recycle(AudioBlock& Block) noexcept
+		{
+			uint64_t Head = FreeHead_.load(std::memory_order_relaxed);
+			uint64_t New;
+			do {
+				pNext_[Block.Index_].store((uint32_t)Head, std::memory_order_relaxed);
+				New = ((Head >> 32) + 1) << 32 | (Block.Index_ + 1);
+			} while(!FreeHead_.compare_exchange_weak(Head, New, std::memory_order_release, std::memory_order_relaxed));
+			NumFree_.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		size_t NumBlocks_;
+
+		size_t FramesPerBlock_;
+
+		int NumChannels_;
+
+		BufferAllocator* pAllocator_;
+
+		float* pStorage_ = nullptr;
+
+		size_t Bytes_ = 0;
+
+		std::unique_ptr<AudioBlock[]> pBlocks_;
+
+		/// Next free block of each free block, counting from 1; zero ends the stack
+		std::unique_ptr<std::atomic<uint32_t>[]> pNext_;
+
+		/// Update tag in the high word, top free block (counting from 1, zero if none) in the low word
+		alignas(64) std::atomic<uint64_t> FreeHead_{0};
+
+		std::atomic<size_t> NumFree_{0};
+
+		std::atomic<uint64_t> Exhausted_{0};
+	};
+
+	inline void BlockRef::Reset() noexcept
+	{
+		if(!pBlock_)
+			return;
+		if(pBlock_->RefCount_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			pBlock_->pPool_->Recycle(*pBlock_);
+		pBlock_ = nullptr;
+	}
+
+	inline size_t AudioBlock::Capacity() const noexcept { return pPool_->FramesPerBlock(); }
+
+	inline int AudioBlock::NumChannels() const noexcept { return pPool_->NumChannels(); }
+
+	/// @brief Lockfree single-producer, single-consumer queue of block references, e.g. from the stream callback to
+	/// a consumer thread. It is a QuickBuffer of block pointers, so a consumer may block on it or register a
+	/// BufferNotifier in the same way. Closing queues an end marker behind the blocks rather than discarding them,
+	/// and references still queued are released when the queue is destroyed.
+	class BlockQueue
+	{
+	public:
+		/// @brief Constructor, opening the queue
+		/// @param Capacity Number of blocks the queue can hold
+		explicit BlockQueue(const size_t Capacity) : Queue_(Capacity + 2) { Queue_.Open(); }
+
+		~BlockQueue()
+		{
+			size_t Available = 0;
+			while(AudioBlock** ppSlot = Queue_.ReadAcquire(Available)) {
+				BlockRef::Adopt(*ppSlot).Reset();
+				Queue_.ReadRelease(1);
+			}
+		}
+
+		BlockQueue(const BlockQueue&) = delete;
+		BlockQueue& operator=(const BlockQueue&) = delete;
+
+		/// @brief Queue a block. Only one thread may push.
+		/// @param Block Reference passed to the queue; left with the caller if the queue is full
+		/// @return false if the queue is full
+		inline bool Push(BlockRef& Block) noexcept
+		{
+			// One slot is kept for the end marker. Single items never wait for contiguous space.
+			if(Queue_.WritableCount() < 2)
+				return false;
+			AudioBlock** ppSlot = Queue_.WriteReserve(1);
+			if(!ppSlot)
+				return false;
+			*ppSlot = Block.Detach();
+			Queue_.WriteCommit(1);
+			return true;
+		}
+
+		/// @brief Take the oldest block, if any. Only one thread may pop.
+		/// @return false if the queue is empty, or closed and drained
+		inline bool Pop(BlockRef& Block) noexcept
+		{
+			size_t Available = 0;
+			return Take(Queue_.ReadAcquire(Available), Block);
+		}
+
+		/// @brief Take the oldest block, waiting until one arrives
+		/// @return false once the queue is closed and drained
+		inline bool WaitPop(BlockRef& Block) noexcept
+		{
+			size_t Available = 0;
+			return Take(Queue_.WaitReadAcquire(Available), Block);
+		}
+
+		/// @brief Number of blocks queued (and the end marker, once closed)
+		size_t Size() const noexcept { return Queue_.ReadableCount(); }
+
+		/// @brief Queue the end marker, after which the consumer sees no more blocks. Only valid on the producer's
+		/// thread, or once the producer has stopped (e.g. after AudIO::SetInputBlocks(nullptr, nullptr)).
+		void Close() noexcept
+		{
+			if(AudioBlock** ppSlot = Queue_.WriteReserve(1)) {
+				*ppSlot = nullptr;
+				Queue_.WriteCommit(1);
+			}
+		}
+
+		/// @brief Register a notifier to be told once a block is queued, as QuickBuffer::NotifyWhenReadable()
+		bool NotifyWhenReadable(BufferNotifier& Notifier) noexcept { return Queue_.NotifyWhenReadable(Notifier); }
+
+		bool CancelReadableNotify() noexcept { return Queue_.CancelReadableNotify(); }
+
+	private:
+		/// Take a block from the slot read, leaving the end marker in place
+		inline bool Take(AudioBlock** ppSlot, BlockRef& Block) noexcept
+		{
+			if(!ppSlot || !*ppSlot)
+				return false;
+			Block = BlockRef::Adopt(*ppSlot);
+			Queue_.ReadRelease(1);
+			return true;
+		}
+
+		QuickBuffer<AudioBlock*> Queue_;
+	};
+
+}
@@ -0,0 +1,277 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+/// @brief Interface for the storage behind a QuickBuffer.
+/// Allocation only takes place when a buffer is constructed or resized, never on the hot path.
+class BufferAllocator {
+public:
+    virtual ~BufferAllocator() = default;
+
+    /// @brief Allocate storage
+    /// @param Bytes Number of bytes required
+    /// @param Alignment Required alignment [bytes]; a power of 2
+    /// @return Pointer to the storage; throws std::bad_alloc on failure
+    virtual void* Allocate(size_t Bytes, size_t Alignment) = 0;
+
+    /// @brief Release storage obtained from Allocate
+    /// @param p Pointer returned by Allocate
+    /// @param Bytes Number of bytes requested from Allocate
+    virtual void Deallocate(void* p, size_t Bytes) noexcept = 0;
+
+    /// @brief Default allocator, using the aligned heap
+    static BufferAllocator& Default();
+};
+
+/// @brief Allocator using the aligned heap (aligned_alloc / _aligned_malloc)
+class HeapAllocator : public BufferAllocator {
+public:
+    void* Allocate(size_t Bytes, size_t Alignment) override
+    {
+        // aligned_alloc requires the size to be a multiple of the alignment.
+        const size_t Rounded = ((Bytes + Alignment - 1) / Alignment) * Alignment;
+#ifdef _MSC_VER
+        void* p = _aligned_malloc(Rounded, Alignment);
+#else
+        void* p = aligned_alloc(Alignment, Rounded);
+#endif
+        if(!p)
+            throw std::bad_alloc();
+        return p;
+    }
+
+    void Deallocate(void* p, size_t) noexcept override
+    {
+#ifdef _MSC_VER
+        _aligned_free(p);
+#else
+        free(p);
+#endif
+    }
+};
+
+inline BufferAllocator& BufferAllocator::Default()
+{
+    static HeapAllocator Allocator;
+    return Allocator;
+}
+
+/// @brief Huge page usage for a PageAllocator
+enum class HugePages {
+    None,           ///< Regular pages
+    Transparent,    ///< Request transparent huge pages (Linux madvise); silently falls back to regular pages
+    Explicit        ///< Reserved huge pages (Linux MAP_HUGETLB, Windows MEM_LARGE_PAGES); falls back to transparent
+};
+
+/// @brief Placement and paging policy for a PageAllocator
+struct AllocationPolicy {
+    /// @brief Node of the calling thread, for NumaNode
+    static constexpr int kCurrentNode = -2;
+
+    /// @brief Huge page usage
+    HugePages Pages = HugePages::None;
+
+    /// @brief Touch every page at allocation, so that no page faults occur on first use
+    bool Prefault = true;
+
+    /// @brief Lock the pages into RAM (mlock / VirtualLock)
+    bool Lock = false;
+
+    /// @brief NUMA node on which to place the pages: -1 for no preference, kCurrentNode for the calling thread's node
+    int NumaNode = -1;
+};
+
+/// @brief Allocator mapping whole pages directly from the operating system, according to an AllocationPolicy.
+/// Failures of optional steps (huge pages, locking, NUMA placement) do not fail the allocation; they are recorded
+/// in the flags returned by the accessors, which describe the most recent allocation.
+class PageAllocator : public BufferAllocator {
+    static constexpr size_t kHugePageSize = (size_t)2 << 20;
+public:
+    explicit PageAllocator(const AllocationPolicy& Policy = AllocationPolicy()) : Policy_(Policy) {}
+
+    void* Allocate(size_t Bytes, size_t Alignment) override
+    {
+        const size_t Mapped = MappedSize(Bytes);
+        HugePagesUsed_ = false;
+        Locked_ = false;
+        NumaPlaced_ = false;
+        void* p = nullptr;
+#ifdef _WIN32
+        if(Policy_.Pages == HugePages::Explicit) {
+            p = VirtualAlloc(nullptr, Mapped, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+            HugePagesUsed_ = (p != nullptr);
+        }
+        if(!p && (Policy_.NumaNode >= 0)) {
+            p = VirtualAllocExNuma(GetCurrentProcess(), nullptr, Mapped, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, (DWORD)Policy_.NumaNode);
+            NumaPlaced_ = (p != nullptr);
+        }
+        if(!p)
+            p = VirtualAlloc(nullptr, Mapped, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        if(!p)
+            throw std::bad_alloc();
+#else
+#ifdef MAP_HUGETLB
+        if(Policy_.Pages == HugePages::Explicit) {
+            p = mmap(nullptr, Mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if(p == MAP_FAILED)
+                p = nullptr;
+            HugePagesUsed_ = (p != nullptr);
+        }
+#endif
+        if(!p) {
+            p = mmap(nullptr, Mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(p == MAP_FAILED)
+                throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+            if(Policy_.Pages != HugePages::None)
+                HugePagesUsed_ = (madvise(p, Mapped, MADV_HUGEPAGE) == 0);
+#endif
+        }
+#ifdef __linux__
+        // Bind before the first touch, so that the pages are faulted in on the requested node.
+        int Node = Policy_.NumaNode;
+        if(Node == AllocationPolicy::kCurrentNode) {
+            unsigned Cpu = 0, CurrentNode = 0;
+            Node = (syscall(SYS_getcpu, &Cpu, &CurrentNode, nullptr) == 0) ? (int)CurrentNode : -1;
+        }
+        if((Node >= 0) && (Node < (int)(8 * sizeof(unsigned long)))) {
+            const unsigned long NodeMask = 1ul << Node;
+            constexpr int kMpolPreferred = 1;
+            NumaPlaced_ = (syscall(SYS_mbind, p, Mapped, kMpolPreferred, &NodeMask, 8 * sizeof(NodeMask), 0) == 0);
+        }
+#endif
+#endif
+        if(Policy_.Prefault) {
+            volatile char* pByte = static_cast<volatile char*>(p);
+            for(size_t n = 0; n < Mapped; n += kPageSize)
+                pByte[n] = 0;
+        }
+        if(Policy_.Lock) {
+#ifdef _WIN32
+            Locked_ = VirtualLock(p, Mapped) != 0;
+#else
+            Locked_ = (mlock(p, Mapped) == 0);
+#endif
+        }
+        (void)Alignment; // Pages are aligned well beyond any vector width.
+        return p;
+    }
+
+    void Deallocate(void* p, size_t Bytes) noexcept override
+    {
+        if(!p)
+            return;
+#ifdef _WIN32
+        (void)Bytes;
+        VirtualFree(p, 0, MEM_RELEASE);
+#else
+        // Unmapping also unlocks the pages.
+        munmap(p, MappedSize(Bytes));
+#endif
+    }
+
+    /// @brief Flag indicating whether huge pages back the most recent allocation
+    bool HugePagesUsed() const { return HugePagesUsed_; }
+
+    /// @brief Flag indicating whether the most recent allocation is locked into RAM
+    bool Locked() const { return Locked_; }
+
+    /// @brief Flag indicating whether the most recent allocation was placed on the requested NUMA node
+    bool NumaPlaced() const { return NumaPlaced_; }
+
+private:
+    static constexpr size_t kPageSize = 4096;
+
+    size_t MappedSize(size_t Bytes) const
+    {
+        const size_t Granule = (Policy_.Pages == HugePages::None) ? kPageSize : kHugePageSize;
+        return ((Bytes + Granule - 1) / Granule) * Granule;
+    }
+
+    AllocationPolicy Policy_;
+
+    bool HugePagesUsed_ = false;
+
+    bool Locked_ = false;
+
+    bool NumaPlaced_ = false;
+};
+
+/// @brief Allocator placing buffers consecutively in a preallocated region (arena), e.g. so that all the rings of a
+/// stream share huge pages. Storage is only reclaimed when the most recent allocation is released, or on Reset().
+class ArenaAllocator : public BufferAllocator {
+public:
+    /// @brief Constructor, given a region owned by the caller
+    /// @param pRegion Start of the region
+    /// @param Bytes Size of the region [bytes]
+    ArenaAllocator(void* pRegion, size_t Bytes) : pRegion_(static_cast<char*>(pRegion)), Bytes_(Bytes) {}
+
+    /// @brief Constructor, obtaining the region from another allocator (e.g. a huge-page PageAllocator)
+    /// @param Bytes Size of the region [bytes]
+    /// @param Upstream Allocator from which the region is obtained; it must outlive the arena
+    ArenaAllocator(size_t Bytes, BufferAllocator& Upstream)
+        : pRegion_(static_cast<char*>(Upstream.Allocate(Bytes, 64))), Bytes_(Bytes), pUpstream_(&Upstream)
+    {
+    }
+
+    ~ArenaAllocator()
+    {
+        if(pUpstream_)
+            pUpstream_->Deallocate(pRegion_, Bytes_);
+    }
+
+    ArenaAllocator(const ArenaAllocator&) = delete;
+    ArenaAllocator& operator=(const ArenaAllocator&) = delete;
+
+    void* Allocate(size_t Bytes, size_t Alignment) override
+    {
+        size_t Used = Used_.load(std::memory_order_relaxed);
+        size_t Begin, End;
+        do {
+            const uintptr_t Address = reinterpret_cast<uintptr_t>(pRegion_) + Used;
+            Begin = Used + (size_t)((Alignment - (Address % Alignment)) % Alignment);
+            End = Begin + Bytes;
+            if(End > Bytes_)
+                throw std::bad_alloc();
+        } while(!Used_.compare_exchange_weak(Used, End, std::memory_order_relaxed));
+        return pRegion_ + Begin;
+    }
+
+    void Deallocate(void* p, size_t Bytes) noexcept override
+    {
+        // Rewind if this was the most recent allocation.
+        size_t End = (size_t)(static_cast<char*>(p) - pRegion_) + Bytes;
+        Used_.compare_exchange_strong(End, (size_t)(static_cast<char*>(p) - pRegion_), std::memory_order_relaxed);
+    }
+
+    /// @brief Release every allocation at once; no buffer may still be using the arena
+    void Reset() noexcept { Used_.store(0, std::memory_order_relaxed); }
+
+    /// @brief Number of bytes in use, including alignment padding
+    size_t Used() const noexcept { return Used_.load(std::memory_order_relaxed); }
+
+private:
+    char* pRegion_;
+
+    size_t Bytes_;
+
+    BufferAllocator* pUpstream_ = nullptr;
+
+    std::atomic_size_t Used_{0};
+};
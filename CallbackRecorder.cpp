@@ -0,0 +1,236 @@
+#include <cstring>
+
+#include "CallbackRecorder.h"
+
+using namespace std;
+
+namespace Audaptr
+{
+	// File layout, little-endian throughout:
+	//   header   "AUDC", u16 version, u16 reserved
+	//   session  u32 0xffffffff, u32 0xffffffff, u8 type, u8 format (0 float32, 1 int16), u16 input channels,
+	//            u16 output channels, u16 reserved, f64 sample rate
+	//   records  u32 nanoseconds since the previous record (or the start of the session), u32 status flags in the
+	//            low 5 bits and frames above them
+	// A gap too long for one record is spread over records without frames or flags, which mark no callback, so the
+	// session marker can never be mistaken for a record.
+	static constexpr uint32_t kFileMagic = 0x43445541;		// "AUDC"
+	static constexpr uint32_t kSessionMarker = 0xffffffffu;
+	static constexpr uint16_t kVersion = 1;
+	static constexpr size_t kHeaderBytes = 8;
+	static constexpr size_t kSessionBytes = 24;
+	static constexpr size_t kRecordBytes = 8;
+	static constexpr unsigned kFlagBits = 5;
+	static constexpr uint32_t kMaxInterval_ns = 0xffffffffu;
+	// One less than fits, so that no record matches the session marker
+	static constexpr uint32_t kMaxFrames = (0xffffffffu >> kFlagBits) - 1;
+
+	static inline void Put16(uint8_t *p, const uint16_t Value) { for(int n = 0; n < 2; n++) p[n] = (uint8_t)(Value >> (8 * n)); }
+
+	static inline void Put32(uint8_t *p, const uint32_t Value) { for(int n = 0; n < 4; n++) p[n] = (uint8_t)(Value >> (8 * n)); }
+
+	static inline void Put64(uint8_t *p, const uint64_t Value) { for(int n = 0; n < 8; n++) p[n] = (uint8_t)(Value >> (8 * n)); }
+
+	static inline uint16_t Get16(const uint8_t *p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+
+	static inline uint32_t Get32(const uint8_t *p)
+	{
+		uint32_t Value = 0;
+		for(int n = 3; n >= 0; n--)
+			Value = (Value << 8) | p[n];
+		return Value;
+	}
+
+	static inline uint64_t Get64(const uint8_t *p) { return (uint64_t)Get32(p) | ((uint64_t)Get32(p + 4) << 32); }
+
+	static inline uint64_t SteadyNow_ns()
+	{
+		return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	CallbackRecorder::CallbackRecorder(const string &Path, const size_t Capacity, const double FlushInterval_s) :
+		Records_(Capacity + 1)
+	{
+		if(Capacity < 1)
+			throw Exception("A callback recorder requires room for at least one record");
+		if(!(FlushInterval_s > 0.0))
+			throw Exception("A callback recorder requires a positive flush interval");
+		File_.open(Path, ios::binary | ios::trunc);
+		if(!File_)
+			throw Exception("Could not create " + Path);
+		uint8_t Header[kHeaderBytes] = {};
+		Put32(Header, kFileMagic);
+		Put16(Header + 4, kVersion);
+		Write(Header, sizeof(Header));
+		File_.flush();
+		Records_.Open();
+		Writer_ = thread([this, FlushInterval_s]() {
+			unique_lock<mutex> Lock(Mutex_);
+			while(!Wake_.wait_for(Lock, chrono::duration<double>(FlushInterval_s), [this] { return Quit_; })) {
+				try {
+					DrainLocked();
+				}
+				catch(...) {
+					// Kept for Flush() to rethrow; the records then pile up in the ring and are dropped.
+					pWriteError_ = current_exception();
+					return;
+				}
+			}
+		});
+	}
+
+	CallbackRecorder::~CallbackRecorder()
+	{
+		{
+			lock_guard<mutex> Lock(Mutex_);
+			Quit_ = true;
+		}
+		Wake_.notify_all();
+		Writer_.join();
+		try {
+			lock_guard<mutex> Lock(Mutex_);
+			if(!pWriteError_)
+				DrainLocked();
+		}
+		catch(...) {
+		}
+	}
+
+	void CallbackRecorder::Begin(const IOType Type, const int NumInputChannels, const int NumOutputChannels, const double SampleRate_Hz, const PaSampleFormat SampleFormat)
+	{
+		lock_guard<mutex> Lock(Mutex_);
+		if(pWriteError_)
+			rethrow_exception(pWriteError_);
+		// Whatever the previous stream left in the ring belongs to its session.
+		DrainLocked();
+		uint8_t Session[kSessionBytes] = {};
+		Put32(Session, kSessionMarker);
+		Put32(Session + 4, kSessionMarker);
+		Session[8] = (uint8_t)Type;
+		Session[9] = (SampleFormat == paInt16) ? 1 : 0;
+		Put16(Session + 10, (uint16_t)NumInputChannels);
+		Put16(Session + 12, (uint16_t)NumOutputChannels);
+		uint64_t RateBits;
+		memcpy(&RateBits, &SampleRate_Hz, sizeof(RateBits));
+		Put64(Session + 16, RateBits);
+		Write(Session, sizeof(Session));
+		File_.flush();
+		Previous_ns_ = SteadyNow_ns();
+		InSession_ = true;
+	}
+
+	void CallbackRecorder::Flush()
+	{
+		lock_guard<mutex> Lock(Mutex_);
+		if(pWriteError_)
+			rethrow_exception(pWriteError_);
+		DrainLocked();
+	}
+
+	void CallbackRecorder::DrainLocked()
+	{
+		uint8_t Buffer[256 * kRecordBytes];
+		size_t Used = 0;
+		uint64_t NumWritten = 0;
+		size_t Available = 0;
+		while(const CallbackRecord *pRecords = Records_.ReadAcquire(Available)) {
+			for(size_t n = 0; n < Available; n++) {
+				// Records outside a session have nothing to be replayed against.
+				if(!InSession_)
+					continue;
+				uint64_t Interval_ns = (pRecords[n].Time_ns > Previous_ns_) ? pRecords[n].Time_ns - Previous_ns_ : 0;
+				Previous_ns_ = max(Previous_ns_, pRecords[n].Time_ns);
+				for(;;) {
+					if(Used == sizeof(Buffer)) {
+						Write(Buffer, Used);
+						Used = 0;
+					}
+					const uint32_t Step_ns = (uint32_t)min<uint64_t>(Interval_ns, kMaxInterval_ns);
+					const bool Last = (Step_ns == Interval_ns);
+					const uint32_t Frames = Last ? min(pRecords[n].NumFrames, kMaxFrames) : 0;
+					Put32(Buffer + Used, Step_ns);
+					Put32(Buffer + Used + 4, (Frames << kFlagBits) | (Last ? pRecords[n].StatusFlags & ((1u << kFlagBits) - 1) : 0));
+					Used += kRecordBytes;
+					Interval_ns -= Step_ns;
+					if(Last)
+						break;
+				}
+				NumWritten++;
+			}
+			Records_.ReadRelease(Available);
+		}
+		if(Used)
+			Write(Buffer, Used);
+		File_.flush();
+		Recorded_.fetch_add(NumWritten, memory_order_relaxed);
+	}
+
+	void CallbackRecorder::Write(const void *pData, const size_t NumBytes)
+	{
+		File_.write((const char *)pData, (streamsize)NumBytes);
+		if(!File_)
+			throw Exception("Could not write the callback recording");
+	}
+
+	CallbackTrace::CallbackTrace(const string &Path)
+	{
+		ifstream File(Path, ios::binary);
+		if(!File)
+			throw Exception("Could not open " + Path);
+		const vector<uint8_t> vData((istreambuf_iterator<char>(File)), istreambuf_iterator<char>());
+		if((vData.size() < kHeaderBytes) || (Get32(vData.data()) != kFileMagic))
+			throw Exception(Path + " is not a callback recording");
+		if(Get16(vData.data() + 4) != kVersion)
+			throw Exception(Path + " has unsupported version " + to_string(Get16(vData.data() + 4)));
+
+		size_t Offset = kHeaderBytes;
+		uint64_t Time_ns = 0;
+		while(Offset + kRecordBytes <= vData.size()) {
+			const uint8_t *p = vData.data() + Offset;
+			if((Get32(p) == kSessionMarker) && (Get32(p + 4) == kSessionMarker)) {
+				if(Offset + kSessionBytes > vData.size())
+					break;
+				CallbackSession Session;
+				Session.Type = (IOType)p[8];
+				Session.SampleFormat = p[9] ? paInt16 : paFloat32;
+				Session.NumInputChannels = Get16(p + 10);
+				Session.NumOutputChannels = Get16(p + 12);
+				const uint64_t RateBits = Get64(p + 16);
+				memcpy(&Session.SampleRate_Hz, &RateBits, sizeof(RateBits));
+				vSessions_.push_back(move(Session));
+				Time_ns = 0;
+				Offset += kSessionBytes;
+				continue;
+			}
+			if(vSessions_.empty())
+				throw Exception(Path + " holds callbacks outside any session");
+			const uint32_t Packed = Get32(p + 4);
+			Time_ns += Get32(p);
+			if(Packed >> kFlagBits)
+				vSessions_.back().vRecords.push_back(CallbackRecord{Time_ns, Packed >> kFlagBits, Packed & ((1u << kFlagBits) - 1)});
+			Offset += kRecordBytes;
+		}
+	}
+
+	vector<uint64_t> CallbackTrace::Replay(const size_t Index, const function<void(const CallbackRecord &)> &Handler, const double Speed) const
+	{
+		if(Speed < 0.0)
+			throw Exception("The replay speed cannot be negative");
+		const vector<CallbackRecord> &vRecords = Session(Index).vRecords;
+		vector<uint64_t> vLateness;
+		vLateness.reserve(vRecords.size());
+		const chrono::steady_clock::time_point Start = chrono::steady_clock::now();
+		for(const CallbackRecord &Record : vRecords) {
+			uint64_t Late_ns = 0;
+			if(Speed > 0.0) {
+				const chrono::steady_clock::time_point Due = Start + chrono::nanoseconds((int64_t)((double)Record.Time_ns / Speed));
+				this_thread::sleep_until(Due);
+				Late_ns = (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - Due).count();
+			}
+			Handler(Record);
+			vLateness.push_back(Late_ns);
+		}
+		return vLateness;
+	}
+
+}
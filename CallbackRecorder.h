@@ -0,0 +1,154 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <portaudio.h>
+
+#include "Audaptr.h"
+#include "QuickBuffer.h"
+
+namespace Audaptr
+{
+	/// @brief One stream callback, as recorded by a CallbackRecorder; trivial, so that it can pass through a QuickBuffer
+	struct CallbackRecord
+	{
+		/// @brief Arrival time of the callback, from the start of the session [nanoseconds]
+		uint64_t Time_ns;
+
+		/// @brief Number of frames the driver asked for
+		uint32_t NumFrames;
+
+		/// @brief PortAudio status flags passed to the callback (paInputOverflow and so on)
+		uint32_t StatusFlags;
+	};
+
+	/// @brief Stream that a recorded session of callbacks belongs to
+	struct CallbackSession
+	{
+		IOType Type = IOType::Input;
+
+		int NumInputChannels = 0;
+
+		int NumOutputChannels = 0;
+
+		double SampleRate_Hz = 0.0;
+
+		PaSampleFormat SampleFormat = paFloat32;
+
+		std::vector<CallbackRecord> vRecords;
+	};
+
+	/// @brief Compact recording of the cadence of a stream's callbacks in production (see AudIO::SetCallbackRecorder):
+	/// the arrival time, frame count and status flags of every callback, in 8 bytes each. The callback only stores
+	/// a record in a preallocated ring; a writing thread appends the records to the file every flush interval, so
+	/// the recorder may stay on for long runs. A record that finds the ring full is dropped and counted.
+	/// Each time a stream opens, a new session starts in the file; CallbackTrace reads the sessions back and replays
+	/// their cadence, e.g. to drive AudIO's callbacks offline (see Benchmarks/Replay.cpp).
+	class CallbackRecorder
+	{
+	public:
+		/// @brief Constructor, creating the file and starting the writing thread
+		/// @param Path Path of the file to write
+		/// @param Capacity Number of records the ring holds; it need only hold the callbacks of one flush interval
+		/// @param FlushInterval_s Period of the writing thread [seconds]
+		CallbackRecorder(const std::string& Path, const size_t Capacity = 1 << 14, const double FlushInterval_s = 0.5);
+
+		/// @brief Destructor, writing whatever remains and closing the file
+		~CallbackRecorder();
+
+		CallbackRecorder(const CallbackRecorder&) = delete;
+		CallbackRecorder& operator=(const CallbackRecorder&) = delete;
+
+		/// @brief Start a new session, for a stream about to run; called by AudIO as the stream opens. Rethrows any
+		/// error the writing thread met.
+		void Begin(const IOType Type, const int NumInputChannels, const int NumOutputChannels, const double SampleRate_Hz, const PaSampleFormat SampleFormat);
+
+		/// @brief Record a callback arriving now. Only one thread (the stream callback) may record; it never blocks,
+		/// allocates or makes a system call.
+		inline void Record(const unsigned long NumFrames, const PaStreamCallbackFlags StatusFlags) noexcept
+		{
+			const uint64_t Now_ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+			CallbackRecord* pRecord = Records_.WriteReserve(1);
+			if(!pRecord) {
+				Dropped_.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			*pRecord = CallbackRecord{Now_ns, (uint32_t)NumFrames, (uint32_t)StatusFlags};
+			Records_.WriteCommit(1);
+		}
+
+		/// @brief Write the records so far to the file now, rather than at the next flush interval. Rethrows any
+		/// error the writing thread met.
+		void Flush();
+
+		/// @brief Number of callbacks written to the file; safe to call from any thread
+		uint64_t NumRecorded() const { return Recorded_.load(std::memory_order_relaxed); }
+
+		/// @brief Number of callbacks dropped because the ring was full
+		uint64_t Dropped() const { return Dropped_.load(std::memory_order_relaxed); }
+
+	protected:
+		/// Append the records in the ring to the file; called with Mutex_ held
+		void DrainLocked();
+
+		void Write(const void* pData, const size_t NumBytes);
+
+		std::ofstream File_;
+
+		QuickBuffer<CallbackRecord> Records_;
+
+		/// Arrival time of the previous record written, or of the start of the session [nanoseconds]
+		uint64_t Previous_ns_ = 0;
+
+		bool InSession_ = false;
+
+		std::atomic<uint64_t> Recorded_{0};
+
+		std::atomic<uint64_t> Dropped_{0};
+
+		std::exception_ptr pWriteError_;
+
+		std::mutex Mutex_;
+
+		std::condition_variable Wake_;
+
+		bool Quit_ = false;
+
+		std::thread Writer_;
+	};
+
+	/// @brief Callbacks recorded by a CallbackRecorder, loaded from its file
+	class CallbackTrace
+	{
+	public:
+		/// @brief Constructor, loading every session of a file; a file cut short keeps its whole records
+		/// @param Path Path of the file to read
+		explicit CallbackTrace(const std::string& Path);
+
+		size_t NumSessions() const { return vSessions_.size(); }
+
+		const CallbackSession& Session(const size_t Index) const { return vSessions_.at(Index); }
+
+		/// @brief Call a handler for every callback of a session, with the recorded cadence
+		/// @param Index Session to replay
+		/// @param Handler Called for each callback, on the calling thread
+		/// @param Speed Factor by which the cadence is accelerated: 1 replays in real time, 0 replays without waiting
+		/// @return Lateness of each call behind its scheduled time [nanoseconds]; zero when not waiting
+		std::vector<uint64_t> Replay(const size_t Index, const std::function<void(const CallbackRecord&)>& Handler, const double Speed = 1.0) const;
+
+	protected:
+		std::vector<CallbackSession> vSessions_;
+	};
+
+}
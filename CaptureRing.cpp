@@ -0,0 +1,369 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#include "Audaptr.h"
+#include "CaptureRing.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace Audaptr
+{
+	static constexpr uint32_t kRingMagic = 0x52425541;	// "AUBR"
+	static constexpr uint16_t kRingVersion = 1;
+
+	/// Offset of the circular region in the file; the header has the first page to itself
+	static constexpr size_t kDataOffset = 4096;
+
+	struct CaptureRing::Header
+	{
+		uint32_t Magic;
+
+		uint16_t Version;
+
+		uint16_t NumChannels;
+
+		uint32_t BytesPerSample;
+
+		uint32_t Unused;
+
+		double SampleRate_Hz;
+
+		uint64_t CapacityFrames;
+
+		/// Frames written, including those being written; a crash between the two counters loses the slots in between
+		alignas(64) atomic<uint64_t> Reserved;
+
+		/// Frames written in full
+		alignas(64) atomic<uint64_t> Committed;
+	};
+
+	static_assert(sizeof(atomic<uint64_t>) == sizeof(uint64_t) && atomic<uint64_t>::is_always_lock_free, "The ring counters must be plain lockfree words, as they are shared through the file.");
+
+	CaptureRing::CaptureRing(const string &Path, const int NumChannels, const double SampleRate_Hz, const double Capacity_s, const PaSampleFormat SampleFormat) :
+		NumChannels_(NumChannels), SampleRate_Hz_(SampleRate_Hz), SampleFormat_(SampleFormat)
+	{
+		if((NumChannels < 1) || (NumChannels > 0xffff))
+			throw Exception("A capture ring requires between 1 and 65535 channels");
+		if(!(SampleRate_Hz > 0.0) || !(Capacity_s > 0.0))
+			throw Exception("A capture ring requires a positive sample rate and capacity");
+		if((SampleFormat != paFloat32) && (SampleFormat != paInt16))
+			throw Exception("Sample format not supported: only 32-bit float and 16-bit integer are available");
+		BytesPerSample_ = (SampleFormat == paInt16) ? sizeof(int16_t) : sizeof(float);
+		CapacityFrames_ = (uint64_t)ceil(Capacity_s * SampleRate_Hz);
+		Map(Path, true);
+
+		Header *pHeader = new(pHeader_) Header();
+		pHeader->Version = kRingVersion;
+		pHeader->NumChannels = (uint16_t)NumChannels_;
+		pHeader->BytesPerSample = (uint32_t)BytesPerSample_;
+		pHeader->SampleRate_Hz = SampleRate_Hz_;
+		pHeader->CapacityFrames = CapacityFrames_;
+		pHeader->Reserved.store(0, memory_order_relaxed);
+		pHeader->Committed.store(0, memory_order_relaxed);
+		// The magic number goes last, so that a file cut short while being set up is never taken for a ring.
+		atomic_thread_fence(memory_order_release);
+		pHeader->Magic = kRingMagic;
+	}
+
+	CaptureRing::CaptureRing(const string &Path)
+	{
+		Map(Path, false);
+		const uint64_t Committed = pHeader_->Committed.load(memory_order_acquire);
+		const uint64_t Reserved = pHeader_->Reserved.load(memory_order_relaxed);
+		// Frames that were being written when the process died are replaced by silence, so that the counters agree
+		// again before anything more is written.
+		if(Reserved > Committed) {
+			const uint64_t First = max(Committed, (Reserved > CapacityFrames_) ? Reserved - CapacityFrames_ : 0);
+			for(uint64_t Frame = First; Frame < Reserved; Frame++)
+				memset(pData_ + (size_t)(Frame % CapacityFrames_) * FrameBytes(), 0, FrameBytes());
+			pHeader_->Committed.store(Reserved, memory_order_release);
+		}
+	}
+
+	CaptureRing::~CaptureRing()
+	{
+		Unmap();
+	}
+
+	void CaptureRing::Map(const string &Path, const bool Create)
+	{
+		size_t FileBytes = kDataOffset + (size_t)CapacityFrames_ * FrameBytes();
+#ifdef _WIN32
+		HANDLE hFile = CreateFileA(Path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, Create ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if(hFile == INVALID_HANDLE_VALUE)
+			throw Exception("Could not open " + Path);
+		hFile_ = hFile;
+		if(!Create) {
+			LARGE_INTEGER Size;
+			if(!GetFileSizeEx(hFile, &Size)) {
+				Unmap();
+				throw Exception("Could not open " + Path);
+			}
+			FileBytes = (size_t)Size.QuadPart;
+		}
+		if(FileBytes < kDataOffset) {
+			Unmap();
+			throw Exception(Path + " is not a capture ring");
+		}
+		hMapping_ = CreateFileMappingA(hFile, nullptr, PAGE_READWRITE, (DWORD)((uint64_t)FileBytes >> 32), (DWORD)FileBytes, nullptr);
+		void *p = hMapping_ ? MapViewOfFile(hMapping_, FILE_MAP_ALL_ACCESS, 0, 0, FileBytes) : nullptr;
+		if(!p) {
+			Unmap();
+			throw Exception("Could not map " + Path);
+		}
+#else
+		Fd_ = open(Path.c_str(), Create ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDWR, 0644);
+		if(Fd_ < 0)
+			throw Exception("Could not open " + Path);
+		if(Create) {
+			if(ftruncate(Fd_, (off_t)FileBytes) != 0) {
+				Unmap();
+				throw Exception("Could not size " + Path);
+			}
+#ifdef __linux__
+			// Reserve the blocks now, so that a full disk fails here rather than faulting the stream callback.
+			if(posix_fallocate(Fd_, 0, (off_t)FileBytes) != 0) {
+				Unmap();
+				throw Exception("Could not reserve " + to_string(FileBytes) + " bytes for " + Path);
+			}
+#endif
+		}
+		else {
+			struct stat Status;
+			if(fstat(Fd_, &Status) != 0) {
+				Unmap();
+				throw Exception("Could not open " + Path);
+			}
+			FileBytes = (size_t)Status.st_size;
+		}
+		if(FileBytes < kDataOffset) {
+			Unmap();
+			throw Exception(Path + " is not a capture ring");
+		}
+		void *p = mmap(nullptr, FileBytes, PROT_READ | PROT_WRITE, MAP_SHARED, Fd_, 0);
+		if(p == MAP_FAILED) {
+			Unmap();
+			throw Exception("Could not map " + Path);
+		}
+#endif
+		MappedBytes_ = FileBytes;
+		pHeader_ = static_cast<Header *>(p);
+		pData_ = static_cast<uint8_t *>(p) + kDataOffset;
+		if(Create)
+			return;
+
+		// Check an existing ring against its own description.
+		const Header &Existing = *pHeader_;
+		if((Existing.Magic != kRingMagic) || (Existing.Version != kRingVersion) || !Existing.NumChannels || !Existing.CapacityFrames ||
+			((Existing.BytesPerSample != sizeof(float)) && (Existing.BytesPerSample != sizeof(int16_t))) || !(Existing.SampleRate_Hz > 0.0)) {
+			Unmap();
+			throw Exception(Path + " is not a capture ring");
+		}
+		NumChannels_ = Existing.NumChannels;
+		SampleRate_Hz_ = Existing.SampleRate_Hz;
+		BytesPerSample_ = Existing.BytesPerSample;
+		SampleFormat_ = (BytesPerSample_ == sizeof(int16_t)) ? paInt16 : paFloat32;
+		CapacityFrames_ = Existing.CapacityFrames;
+		if(MappedBytes_ < kDataOffset + CapacityFrames_ * FrameBytes()) {
+			Unmap();
+			throw Exception(Path + " is shorter than its capture ring");
+		}
+	}
+
+	void CaptureRing::Unmap() noexcept
+	{
+#ifdef _WIN32
+		if(pHeader_)
+			UnmapViewOfFile(pHeader_);
+		if(hMapping_)
+			CloseHandle(hMapping_);
+		if(hFile_)
+			CloseHandle(hFile_);
+		hMapping_ = nullptr;
+		hFile_ = nullptr;
+#else
+		if(pHeader_)
+			munmap(pHeader_, MappedBytes_);
+		if(Fd_ >= 0)
+			close(Fd_);
+		Fd_ = -1;
+#endif
+		pHeader_ = nullptr;
+		pData_ = nullptr;
+		MappedBytes_ = 0;
+	}
+
+	void CaptureRing::Write(const void *pFrames, size_t NumFrames) noexcept
+	{
+		const size_t Bytes = FrameBytes();
+		const uint8_t *pSrc = static_cast<const uint8_t *>(pFrames);
+		uint64_t Head = pHeader_->Committed.load(memory_order_relaxed);
+		const uint64_t End = Head + NumFrames;
+		// Only the last CapacityFrames_ of an oversized block can be kept.
+		if(NumFrames > CapacityFrames_) {
+			pSrc += (NumFrames - CapacityFrames_) * Bytes;
+			Head = End - CapacityFrames_;
+			NumFrames = (size_t)CapacityFrames_;
+		}
+		// Announce the slots about to be overwritten before touching them, as a SeqLock writer does.
+		pHeader_->Reserved.store(End, memory_order_relaxed);
+		atomic_thread_fence(memory_order_release);
+		const size_t Slot = (size_t)(Head % CapacityFrames_);
+		const size_t ToEnd = min(NumFrames, (size_t)CapacityFrames_ - Slot);
+		memcpy(pData_ + Slot * Bytes, pSrc, ToEnd * Bytes);
+		if(ToEnd < NumFrames)
+			memcpy(pData_, pSrc + ToEnd * Bytes, (NumFrames - ToEnd) * Bytes);
+		pHeader_->Committed.store(End, memory_order_release);
+	}
+
+	uint64_t CaptureRing::FramesWritten() const
+	{
+		return pHeader_->Committed.load(memory_order_acquire);
+	}
+
+	uint64_t CaptureRing::OldestFrame() const
+	{
+		const uint64_t Reserved = pHeader_->Reserved.load(memory_order_acquire);
+		return (Reserved > CapacityFrames_) ? Reserved - CapacityFrames_ : 0;
+	}
+
+	static inline void PutLE(uint8_t *p, const uint64_t Value, const int NumBytes)
+	{
+		for(int n = 0; n < NumBytes; n++)
+			p[n] = (uint8_t)(Value >> (8 * n));
+	}
+
+	uint64_t CaptureRing::Snapshot(const string &Path, uint64_t FirstFrame, uint64_t NumFrames) const
+	{
+		// Clip the range to the frames held now.
+		const uint64_t Written = FramesWritten();
+		const uint64_t Oldest = OldestFrame();
+		const uint64_t End = min(Written, (NumFrames > Written - min(FirstFrame, Written)) ? Written : FirstFrame + NumFrames);
+		FirstFrame = max(FirstFrame, Oldest);
+		NumFrames = (End > FirstFrame) ? End - FirstFrame : 0;
+		const size_t Bytes = FrameBytes();
+		const uint64_t DataBytes = NumFrames * Bytes;
+		if(DataBytes > 0xffffffffu - 64)
+			throw Exception("A snapshot of " + to_string(NumFrames) + " frames is too large for a WAV file");
+
+		// WAV header: 16-bit PCM, or IEEE float with the fact chunk that it requires.
+		const bool IsFloat = (SampleFormat_ == paFloat32);
+		uint8_t Wav[58] = {};
+		const size_t WavBytes = IsFloat ? 58 : 44;
+		memcpy(Wav, "RIFF", 4);
+		PutLE(Wav + 4, WavBytes - 8 + DataBytes, 4);
+		memcpy(Wav + 8, "WAVEfmt ", 8);
+		PutLE(Wav + 16, IsFloat ? 18 : 16, 4);
+		PutLE(Wav + 20, IsFloat ? 3 : 1, 2);
+		PutLE(Wav + 22, (uint64_t)NumChannels_, 2);
+		PutLE(Wav + 24, (uint64_t)lround(SampleRate_Hz_), 4);
+		PutLE(Wav + 28, (uint64_t)lround(SampleRate_Hz_) * Bytes, 4);
+		PutLE(Wav + 32, Bytes, 2);
+		PutLE(Wav + 34, 8 * BytesPerSample_, 2);
+		uint8_t *p = Wav + 36;
+		if(IsFloat) {
+			p += 2;	// cbSize
+			memcpy(p, "fact", 4);
+			PutLE(p + 4, 4, 4);
+			PutLE(p + 8, NumFrames, 4);
+			p += 12;
+		}
+		memcpy(p, "data", 4);
+		PutLE(p + 4, DataBytes, 4);
+
+		// Copy at most two contiguous runs of the ring, in the kernel where possible.
+		const size_t Slot = (size_t)(FirstFrame % CapacityFrames_);
+		const size_t ToEnd = (size_t)min(NumFrames, CapacityFrames_ - Slot);
+		const size_t Runs[2][2] = {{Slot, ToEnd}, {0, (size_t)NumFrames - ToEnd}};
+		bool Copied = true;
+#ifdef _WIN32
+		ofstream File(Path, ios::binary | ios::trunc);
+		Copied = (bool)File.write((const char *)Wav, (streamsize)WavBytes);
+		for(const auto &Run : Runs)
+			if(Copied && Run[1])
+				Copied = (bool)File.write((const char *)pData_ + Run[0] * Bytes, (streamsize)(Run[1] * Bytes));
+		File.close();
+		Copied = Copied && !File.fail();
+#else
+		const int Out = open(Path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if(Out < 0)
+			throw Exception("Could not create " + Path);
+		auto WriteAll = [Out](const uint8_t *pSrc, size_t Count) {
+			while(Count > 0) {
+				const ssize_t Done = write(Out, pSrc, Count);
+				if(Done <= 0)
+					return false;
+				pSrc += Done;
+				Count -= (size_t)Done;
+			}
+			return true;
+		};
+		Copied = WriteAll(Wav, WavBytes);
+		for(const auto &Run : Runs) {
+			size_t Remaining = Run[1] * Bytes;
+			if(!Copied || !Remaining)
+				continue;
+			off_t Offset = (off_t)(kDataOffset + Run[0] * Bytes);
+#ifdef __linux__
+			// The page cache moves the data straight from the ring file to the snapshot.
+			while(Remaining > 0) {
+				const ssize_t Done = copy_file_range(Fd_, &Offset, Out, nullptr, Remaining, 0);
+				if(Done <= 0)
+					break;
+				Remaining -= (size_t)Done;
+			}
+#endif
+			// Otherwise (or if the file systems cannot copy between them) write from the mapping.
+			if(Remaining > 0)
+				Copied = WriteAll(reinterpret_cast<const uint8_t *>(pHeader_) + Offset, Remaining);
+		}
+		Copied = (close(Out) == 0) && Copied;
+#endif
+		if(!Copied) {
+			remove(Path.c_str());
+			throw Exception("Could not write the snapshot " + Path);
+		}
+		// Reject the snapshot if the capture reached the oldest frames while they were being copied.
+		atomic_thread_fence(memory_order_acquire);
+		if(NumFrames && (OldestFrame() > FirstFrame)) {
+			remove(Path.c_str());
+			throw Exception("The capture overwrote the frames of snapshot " + Path + " while they were copied");
+		}
+		return NumFrames;
+	}
+
+	uint64_t CaptureRing::SnapshotLast(const string &Path, const double Duration_s) const
+	{
+		const uint64_t NumFrames = (uint64_t)ceil(max(Duration_s, 0.0) * SampleRate_Hz_);
+		const uint64_t Written = FramesWritten();
+		return Snapshot(Path, (Written > NumFrames) ? Written - NumFrames : 0, NumFrames);
+	}
+
+	void CaptureRing::Sync(const bool Wait) const
+	{
+#ifdef _WIN32
+		FlushViewOfFile(pHeader_, MappedBytes_);
+		if(Wait)
+			FlushFileBuffers(hFile_);
+#else
+		msync(pHeader_, MappedBytes_, Wait ? MS_SYNC : MS_ASYNC);
+#endif
+	}
+
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <portaudio.h>
+
+namespace Audaptr
+{
+	/// @brief Persistent "black box" of the most recent input: a file-backed, memory-mapped circular region that an
+	/// AudIO stream writes continuously (see AudIO::SetCaptureRing), holding the last Capacity_s() of device frames.
+	/// The mapping is shared with the file, so whatever the stream wrote survives a crash of the process, and a small
+	/// header (written with the same ordering as a SeqLock) tells a later reader which frames are intact.
+	/// Snapshot() copies a range of frames to a standalone WAV file without stopping the capture, using in-kernel
+	/// copies from the ring file where the platform supports them.
+	/// Frames are stored exactly as the device delivers them (32-bit float or 16-bit integer), so that writing a block
+	/// costs a single memcpy (two when it wraps around the end of the region).
+	class CaptureRing
+	{
+	public:
+		/// @brief Constructor, creating (or truncating) the ring file
+		/// @param Path Path of the ring file
+		/// @param NumChannels Number of interleaved channels; that of the device input it records
+		/// @param SampleRate_Hz Sample rate of the frames [hertz]
+		/// @param Capacity_s Duration of the history kept [seconds]
+		/// @param SampleFormat paFloat32 (default) or paInt16; that of the device input it records
+		CaptureRing(const std::string& Path, const int NumChannels, const double SampleRate_Hz, const double Capacity_s, const PaSampleFormat SampleFormat = paFloat32);
+
+		/// @brief Constructor, opening an existing ring file, e.g. to recover the history after a crash. Frames that a
+		/// crash left partly written are replaced by silence, and any further frames are appended to the history.
+		/// @param Path Path of the ring file
+		explicit CaptureRing(const std::string& Path);
+
+		/// @brief Destructor, unmapping the ring; the file and its contents remain
+		~CaptureRing();
+
+		CaptureRing(const CaptureRing&) = delete;
+		CaptureRing& operator=(const CaptureRing&) = delete;
+
+		int NumChannels() const { return NumChannels_; }
+
+		double SampleRate_Hz() const { return SampleRate_Hz_; }
+
+		PaSampleFormat SampleFormat() const { return SampleFormat_; }
+
+		/// @brief Number of frames the ring holds
+		uint64_t CapacityFrames() const { return CapacityFrames_; }
+
+		/// @brief Duration of the history kept [seconds]
+		double Capacity_s() const { return (double)CapacityFrames_ / SampleRate_Hz_; }
+
+		/// @brief Append device frames, overwriting the oldest. Only one thread (the stream callback) may write;
+		/// it never blocks, allocates or makes a system call.
+		/// @param pFrames Interleaved frames in the ring's sample format
+		/// @param NumFrames Number of frames
+		void Write(const void* pFrames, size_t NumFrames) noexcept;
+
+		/// @brief Number of frames written since the ring file was created; safe to call from any thread
+		uint64_t FramesWritten() const;
+
+		/// @brief Index of the oldest frame still intact; safe to call from any thread
+		uint64_t OldestFrame() const;
+
+		/// @brief Copy frames to a standalone WAV file while the capture continues. Safe to call from any thread
+		/// other than the writer.
+		/// @param Path Path of the WAV file to write
+		/// @param FirstFrame Index of the first frame wanted (see FramesWritten)
+		/// @param NumFrames Number of frames wanted
+		/// @return Number of frames copied: the part of the range that is still held, which may be fewer than
+		/// requested. Throws if the capture overwrote the frames while they were being copied.
+		uint64_t Snapshot(const std::string& Path, uint64_t FirstFrame, uint64_t NumFrames) const;
+
+		/// @brief Copy the most recent frames to a standalone WAV file, as Snapshot()
+		/// @param Path Path of the WAV file to write
+		/// @param Duration_s Length of history wanted, up to the present [seconds]
+		/// @return Number of frames copied
+		uint64_t SnapshotLast(const std::string& Path, const double Duration_s) const;
+
+		/// @brief Ask the operating system to write the ring back to its file, e.g. to also survive a power failure.
+		/// Not for the writer's thread.
+		/// @param Wait Flag requesting that this wait until the data is on disk
+		void Sync(const bool Wait = false) const;
+
+	protected:
+		/// Layout of the first page of the ring file
+		struct Header;
+
+		void Map(const std::string& Path, const bool Create);
+
+		void Unmap() noexcept;
+
+		size_t FrameBytes() const { return (size_t)NumChannels_ * BytesPerSample_; }
+
+		int NumChannels_ = 0;
+
+		double SampleRate_Hz_ = 0.0;
+
+		PaSampleFormat SampleFormat_ = paFloat32;
+
+		size_t BytesPerSample_ = sizeof(float);
+
+		uint64_t CapacityFrames_ = 0;
+
+		Header* pHeader_ = nullptr;
+
+		/// Start of the circular region, one page into the mapping
+		uint8_t* pData_ = nullptr;
+
+		size_t MappedBytes_ = 0;
+
+#ifdef _WIN32
+		void* hFile_ = nullptr;
+
+		void* hMapping_ = nullptr;
+#else
+		int Fd_ = -1;
+#endif
+	};
+
+}
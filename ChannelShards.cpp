@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <string>
+
+#include "Audaptr.h"
+#include "ChannelShards.h"
+#include "RoutingMatrix.h"
+#include "SampleConvert.h"
+
+using namespace std;
+
+namespace Audaptr
+{
+	// Contiguous groups of channels whose sizes differ by at most one
+	static vector<vector<int>> EvenGroups(const int NumChannels, const int NumShards)
+	{
+		if((NumShards < 1) || (NumShards > NumChannels))
+			throw Exception("Channel shards require between 1 and " + to_string(NumChannels) + " groups");
+		vector<vector<int>> Groups((size_t)NumShards);
+		int Channel = 0;
+		for(int Shard = 0; Shard < NumShards; Shard++) {
+			const int Width = NumChannels / NumShards + ((Shard < NumChannels % NumShards) ? 1 : 0);
+			for(int n = 0; n < Width; n++)
+				Groups[(size_t)Shard].push_back(Channel++);
+		}
+		return Groups;
+	}
+
+	ChannelShards::ChannelShards(const int NumChannels, const int NumShards, const size_t RingFrames) :
+		ChannelShards(NumChannels, EvenGroups(NumChannels, NumShards), RingFrames)
+	{
+	}
+
+	ChannelShards::ChannelShards(const int NumChannels, const vector<vector<int>> &Groups, const size_t RingFrames) :
+		NumChannels_(NumChannels), vScratch_(kChunkFrames * (size_t)max(NumChannels, 1))
+	{
+		if(NumChannels < 1)
+			throw Exception("Channel shards require at least one channel");
+		if(Groups.empty() || (RingFrames < 1))
+			throw Exception("Channel shards require at least one group and one frame per ring");
+		for(const vector<int> &Group : Groups) {
+			if(Group.empty())
+				throw Exception("Every channel group requires at least one channel");
+			for(const int Channel : Group)
+				if((Channel < 0) || (Channel >= NumChannels))
+					throw Exception("Channel " + to_string(Channel) + " of a group is not among the " + to_string(NumChannels) + " channels delivered");
+			// One slot is always left free by the ring.
+			vShards_.emplace_back(make_unique<Shard>(RingFrames * Group.size() + 1));
+			vShards_.back()->vIndices.assign(Group.begin(), Group.end());
+			vShards_.back()->Ring.Open();
+		}
+	}
+
+	void ChannelShards::Close() noexcept
+	{
+		for(unique_ptr<Shard> &pShard : vShards_)
+			pShard->Ring.Close();
+	}
+
+	void ChannelShards::Open() noexcept
+	{
+		for(unique_ptr<Shard> &pShard : vShards_)
+			pShard->Ring.Open();
+	}
+
+	bool ChannelShards::Reserve(const size_t NumFrames) noexcept
+	{
+		// A group takes a device buffer whole or not at all, so its consumer never sees a partial buffer.
+		bool Complete = true;
+		for(unique_ptr<Shard> &pShard : vShards_) {
+			pShard->pWrite = pShard->Ring.WriteReserve(NumFrames * pShard->vIndices.size());
+			if(!pShard->pWrite) {
+				pShard->Overflows.fetch_add(1, memory_order_relaxed);
+				Complete = false;
+			}
+		}
+		return Complete;
+	}
+
+	void ChannelShards::Gather(const float *pFrames, const size_t Offset, const size_t NumFrames) noexcept
+	{
+		for(unique_ptr<Shard> &pShard : vShards_) {
+			const size_t Width = pShard->vIndices.size();
+			if(pShard->pWrite)
+				GatherChannels(pFrames, (size_t)NumChannels_, pShard->pWrite + Offset * Width, Width, pShard->vIndices.data(), NumFrames);
+		}
+	}
+
+	void ChannelShards::Commit(const size_t NumFrames) noexcept
+	{
+		for(unique_ptr<Shard> &pShard : vShards_)
+			if(pShard->pWrite)
+				pShard->Ring.WriteCommit(NumFrames * pShard->vIndices.size());
+	}
+
+	bool ChannelShards::Write(const float *pFrames, const size_t NumFrames) noexcept
+	{
+		const bool Complete = Reserve(NumFrames);
+		for(size_t Frame = 0; Frame < NumFrames; Frame += kChunkFrames)
+			Gather(pFrames + Frame * (size_t)NumChannels_, Frame, min(kChunkFrames, NumFrames - Frame));
+		Commit(NumFrames);
+		return Complete;
+	}
+
+	template<typename SampleT>
+	bool ChannelShards::WriteChunked(RoutingMatrix *pRouting, const SampleT *pFrames, const size_t NumSrcChannels, const size_t NumFrames) noexcept
+	{
+		const bool Complete = Reserve(NumFrames);
+		for(size_t Frame = 0; Frame < NumFrames; Frame += kChunkFrames) {
+			const size_t ChunkFrames = min(kChunkFrames, NumFrames - Frame);
+			if(pRouting)
+				pRouting->Process(pFrames + Frame * NumSrcChannels, vScratch_.data(), ChunkFrames);
+			else
+				ConvertSamples(pFrames + Frame * NumSrcChannels, vScratch_.data(), ChunkFrames * NumSrcChannels);
+			Gather(vScratch_.data(), Frame, ChunkFrames);
+		}
+		Commit(NumFrames);
+		return Complete;
+	}
+
+	bool ChannelShards::Write(const int16_t *pFrames, const size_t NumFrames) noexcept
+	{
+		return WriteChunked<int16_t>(nullptr, pFrames, (size_t)NumChannels_, NumFrames);
+	}
+
+	bool ChannelShards::Write(RoutingMatrix &Routing, const float *pFrames, const size_t NumFrames) noexcept
+	{
+		return WriteChunked<float>(&Routing, pFrames, (size_t)Routing.NumSources(), NumFrames);
+	}
+
+	bool ChannelShards::Write(RoutingMatrix &Routing, const int16_t *pFrames, const size_t NumFrames) noexcept
+	{
+		return WriteChunked<int16_t>(&Routing, pFrames, (size_t)Routing.NumSources(), NumFrames);
+	}
+
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "QuickBuffer.h"
+
+namespace Audaptr
+{
+	class RoutingMatrix;
+
+	/// @brief Interleaved input split into groups of channels, each with its own single-producer, single-consumer
+	/// ring, so that K consumer threads can each process a subset of a wide input (e.g. 128 channels) while reading
+	/// only their own channels. The stream callback (see AudIO::SetInputShards) gathers each group out of the
+	/// device frames with GatherChannels(), a chunk of frames at a time so that the frames stay in cache while every
+	/// group is gathered from them.
+	/// A group that has no room for a whole device buffer drops it, without affecting the other groups.
+	class ChannelShards
+	{
+	public:
+		/// @brief Constructor, splitting the channels into contiguous groups whose sizes differ by at most one
+		/// @param NumChannels Number of interleaved channels delivered
+		/// @param NumShards Number of groups
+		/// @param RingFrames Number of frames each group's ring can hold
+		ChannelShards(const int NumChannels, const int NumShards, const size_t RingFrames);
+
+		/// @brief Constructor, with explicit groups
+		/// @param NumChannels Number of interleaved channels delivered
+		/// @param Groups Channels of each group, in the order they are interleaved in its ring; a channel may belong
+		/// to several groups, or to none
+		/// @param RingFrames Number of frames each group's ring can hold
+		ChannelShards(const int NumChannels, const std::vector<std::vector<int>>& Groups, const size_t RingFrames);
+
+		ChannelShards(const ChannelShards&) = delete;
+		ChannelShards& operator=(const ChannelShards&) = delete;
+
+		int NumChannels() const { return NumChannels_; }
+
+		size_t NumShards() const { return vShards_.size(); }
+
+		/// @brief Ring of a group, holding interleaved frames of its channels; its consumer is the only reader
+		QuickBuffer<float>& Ring(const size_t Shard) { return vShards_[Shard]->Ring; }
+
+		/// @brief Input channels of a group, in ring order
+		const std::vector<int32_t>& Channels(const size_t Shard) const { return vShards_[Shard]->vIndices; }
+
+		/// @brief Number of device buffers a group dropped because its ring was full
+		uint64_t Overflows(const size_t Shard) const { return vShards_[Shard]->Overflows.load(std::memory_order_relaxed); }
+
+		/// @brief Close every ring, waking consumers blocked on them; the rings' contents are discarded
+		void Close() noexcept;
+
+		/// @brief Reopen every ring, empty
+		void Open() noexcept;
+
+		/// @brief Deliver interleaved frames of NumChannels() channels to every group. Only one thread (the stream
+		/// callback) may write; it never blocks or allocates.
+		/// @return false if any group dropped the frames
+		bool Write(const float* pFrames, size_t NumFrames) noexcept;
+
+		/// @brief Deliver interleaved 16-bit frames, converting them to floating point
+		bool Write(const int16_t* pFrames, size_t NumFrames) noexcept;
+
+		/// @brief Route interleaved frames, and deliver the NumChannels() destinations of the routing
+		bool Write(RoutingMatrix& Routing, const float* pFrames, size_t NumFrames) noexcept;
+
+		/// @brief Route interleaved 16-bit frames, and deliver the destinations of the routing
+		bool Write(RoutingMatrix& Routing, const int16_t* pFrames, size_t NumFrames) noexcept;
+
+	protected:
+		/// Number of frames gathered from at a time
+		static constexpr size_t kChunkFrames = 64;
+
+		struct alignas(64) Shard
+		{
+			explicit Shard(const size_t Size) : Ring(Size) {}
+
+			QuickBuffer<float> Ring;
+
+			/// Input channel of each ring channel
+			std::vector<int32_t> vIndices;
+
+			/// Space reserved in the ring for the frames being written, or nullptr if the ring is full
+			float* pWrite = nullptr;
+
+			std::atomic<uint64_t> Overflows{0};
+		};
+
+		/// Reserve room for the frames in every ring
+		bool Reserve(const size_t NumFrames) noexcept;
+
+		/// Gather a chunk of float frames into the space reserved, starting at frame Offset
+		void Gather(const float* pFrames, const size_t Offset, const size_t NumFrames) noexcept;
+
+		void Commit(const size_t NumFrames) noexcept;
+
+		/// Convert or route chunks into the scratch buffer, and gather them
+		template<typename SampleT>
+		bool WriteChunked(RoutingMatrix* pRouting, const SampleT* pFrames, const size_t NumSrcChannels, const size_t NumFrames) noexcept;
+
+		int NumChannels_;
+
+		std::vector<std::unique_ptr<Shard>> vShards_;
+
+		std::vector<float> vScratch_;
+	};
+
+}
@@ -0,0 +1,397 @@
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include "Audaptr.h"
+#include "Convolver.h"
+
+using namespace std;
+
+namespace Audaptr
+{
+	struct Convolver::Kernel
+	{
+		uint64_t Id = 0;
+
+		/// Flag indicating that one response serves every channel
+		bool Shared = false;
+
+		/// Spectra of the partitions of each level, partition after partition, channel after channel
+		struct Partitions
+		{
+			size_t NumPartitions = 0;
+
+			vector<float> vRe, vIm;
+		};
+
+		vector<Partitions> vLevels;
+	};
+
+	struct Convolver::Level
+	{
+		Level(const size_t Index, const int NumChannels, const size_t Size, const size_t Offset, const size_t NumPartitions) :
+			Index(Index), Size(Size), NumBins(Size + 1), Offset(Offset), NumPartitions(NumPartitions), Fft(2 * Size),
+			vInput((size_t)NumChannels * 2 * Size), vFdlRe((size_t)NumChannels * NumPartitions * (Size + 1)),
+			vFdlIm(vFdlRe.size()), vAccRe(Size + 1), vAccIm(Size + 1), vOld(2 * Size), vNew(2 * Size) {}
+
+		/// Position among the levels, and so among the partitions of a kernel
+		size_t Index;
+
+		/// Partition length [frames]
+		size_t Size;
+
+		size_t NumBins;
+
+		/// Start of the level's part of the responses [frames]
+		size_t Offset;
+
+		size_t NumPartitions;
+
+		RealFft Fft;
+
+		/// Last two periods of input of each channel, for overlap-save
+		vector<float> vInput;
+
+		/// Spectra of the last NumPartitions periods of input, channel after channel
+		vector<float> vFdlRe, vFdlIm;
+
+		/// Slot of the delay line holding the newest spectrum
+		size_t FdlPos = 0;
+
+		vector<float> vAccRe, vAccIm;
+
+		/// Outputs of the old and new kernels during a crossfade
+		vector<float> vOld, vNew;
+
+		// Kernels and crossfade, as scheduled by the processing thread
+		const Kernel* pOld = nullptr;
+
+		const Kernel* pNew = nullptr;
+
+		bool Fading = false;
+
+		size_t FadePos = 0;
+
+		// Tail only: input staged and output produced, alternately in each half, channel after channel
+		vector<float> vStage[2], vResult[2];
+
+		/// Frames staged in the current half
+		size_t Filled = 0;
+
+		uint64_t JobsStarted = 0;
+
+		/// Number of jobs whose output has been taken
+		uint64_t JobsCollected = 0;
+
+		atomic<uint64_t> JobsDone{0};
+
+		/// Job in progress; written before Start is posted
+		Job Work;
+
+		FastSemaphore Start;
+
+		FastSemaphore Done;
+
+		atomic<bool> Quit{false};
+
+		thread Worker;
+	};
+
+	Convolver::Convolver(const int NumChannels, const ConvolverConfig &Config) :
+		NumChannels_(NumChannels), Config_(Config)
+	{
+		const size_t BlockFrames = Config_.BlockFrames;
+		if(NumChannels < 1)
+			throw Exception("A convolver requires at least one channel");
+		if((BlockFrames < 2) || (BlockFrames & (BlockFrames - 1)))
+			throw Exception("The convolver block length of " + to_string(BlockFrames) + " frames is not a power of 2");
+		if(!Config_.MaxResponseFrames)
+			throw Exception("The longest impulse response must hold at least one frame");
+
+		// The head is convolved in blocks up to where the first tail level begins. A tail level with partitions of
+		// Size frames starts a period once Size frames have arrived and needs the result one block before the
+		// next period is complete, so it begins 2 * Size - BlockFrames into the response; with each level four times
+		// larger than the last, that leaves seven partitions for the head and six for every level but the last.
+		size_t Size = BlockFrames, Offset = 0;
+		for(;;) {
+			const size_t NextSize = 4 * Size, NextOffset = 2 * NextSize - BlockFrames;
+			if((NextSize <= Config_.MaxPartitionFrames) && (Config_.MaxResponseFrames > NextOffset)) {
+				vLevels_.emplace_back(make_unique<Level>(vLevels_.size(), NumChannels_, Size, Offset, (NextOffset - Offset) / Size));
+				Size = NextSize;
+				Offset = NextOffset;
+			}
+			else {
+				const size_t Remaining = (Config_.MaxResponseFrames > Offset) ? Config_.MaxResponseFrames - Offset : 1;
+				vLevels_.emplace_back(make_unique<Level>(vLevels_.size(), NumChannels_, Size, Offset, (Remaining + Size - 1) / Size));
+				break;
+			}
+		}
+
+		vBlockIn_.resize((size_t)NumChannels_ * BlockFrames);
+		vBlockOut_.resize(vBlockIn_.size());
+		vPlanarIn_.resize(vBlockIn_.size());
+		vPlanarOut_.resize(vBlockIn_.size());
+		for(size_t Index = 1; Index < vLevels_.size(); Index++) {
+			Level &Stage = *vLevels_[Index];
+			for(int Half = 0; Half < 2; Half++) {
+				Stage.vStage[Half].resize((size_t)NumChannels_ * Stage.Size);
+				Stage.vResult[Half].resize((size_t)NumChannels_ * Stage.Size);
+			}
+		}
+		for(size_t Index = 1; Index < vLevels_.size(); Index++)
+			vLevels_[Index]->Worker = thread(&Convolver::TailLoop, this, ref(*vLevels_[Index]));
+	}
+
+	Convolver::~Convolver()
+	{
+		for(size_t Index = 1; Index < vLevels_.size(); Index++) {
+			Level &Stage = *vLevels_[Index];
+			Stage.Quit.store(true, memory_order_relaxed);
+			Stage.Start.Post();
+			Stage.Worker.join();
+		}
+	}
+
+	void Convolver::SetImpulseResponses(const vector<vector<float>> &Responses)
+	{
+		if((Responses.size() != 1) && (Responses.size() != (size_t)NumChannels_))
+			throw Exception("Expected 1 or " + to_string(NumChannels_) + " impulse responses, not " + to_string(Responses.size()));
+		size_t Longest = 0;
+		for(const vector<float> &Response : Responses)
+			Longest = max(Longest, Response.size());
+		if(Longest > Config_.MaxResponseFrames)
+			throw Exception("The impulse response of " + to_string(Longest) + " frames exceeds the limit of " + to_string(Config_.MaxResponseFrames));
+
+		auto pKernel = make_unique<Kernel>();
+		pKernel->Id = NextId_++;
+		pKernel->Shared = (Responses.size() == 1);
+		pKernel->vLevels.resize(vLevels_.size());
+		for(size_t Index = 0; Index < vLevels_.size(); Index++) {
+			const Level &Stage = *vLevels_[Index];
+			Kernel::Partitions &Parts = pKernel->vLevels[Index];
+			if(Longest <= Stage.Offset)
+				continue;
+			Parts.NumPartitions = min(Stage.NumPartitions, (Longest - Stage.Offset + Stage.Size - 1) / Stage.Size);
+			Parts.vRe.resize(Responses.size() * Parts.NumPartitions * Stage.NumBins);
+			Parts.vIm.resize(Parts.vRe.size());
+			RealFft Fft(2 * Stage.Size);
+			vector<float> vSegment(2 * Stage.Size);
+			for(size_t Channel = 0; Channel < Responses.size(); Channel++) {
+				const vector<float> &Response = Responses[Channel];
+				for(size_t Part = 0; Part < Parts.NumPartitions; Part++) {
+					// Each partition is zero-padded to the transform length.
+					fill(vSegment.begin(), vSegment.end(), 0.0f);
+					const size_t First = Stage.Offset + Part * Stage.Size;
+					if(First < Response.size())
+						copy(Response.begin() + First, Response.begin() + min(Response.size(), First + Stage.Size), vSegment.begin());
+					const size_t Bin = (Channel * Parts.NumPartitions + Part) * Stage.NumBins;
+					Fft.Forward(vSegment.data(), &Parts.vRe[Bin], &Parts.vIm[Bin]);
+				}
+			}
+		}
+
+		pPending_.store(pKernel.get(), memory_order_release);
+		vKernels_.emplace_back(std::move(pKernel));
+		// Free the kernels that the processing thread has finished fading out of; the newest is always kept.
+		const uint64_t OldestInUse = OldestInUse_.load(memory_order_acquire);
+		vKernels_.erase(remove_if(vKernels_.begin(), vKernels_.end() - 1, [&](const unique_ptr<Kernel> &pOld) { return pOld->Id < OldestInUse; }), vKernels_.end() - 1);
+	}
+
+	void Convolver::SetImpulseResponse(const vector<float> &Response)
+	{
+		SetImpulseResponses({Response});
+	}
+
+	void Convolver::Process(const float *pIn, float *pOut, size_t NumFrames) noexcept
+	{
+		const size_t BlockFrames = Config_.BlockFrames;
+		while(NumFrames > 0) {
+			// The input is taken before the output is written, so the two may share a buffer.
+			const size_t Count = min(NumFrames, BlockFrames - BlockPos_), Samples = Count * NumChannels_;
+			const size_t Pos = BlockPos_ * NumChannels_;
+			memcpy(&vBlockIn_[Pos], pIn, Samples * sizeof(float));
+			memcpy(pOut, &vBlockOut_[Pos], Samples * sizeof(float));
+			pIn += Samples;
+			pOut += Samples;
+			NumFrames -= Count;
+			BlockPos_ += Count;
+			if(BlockPos_ == BlockFrames) {
+				ProcessBlock();
+				BlockPos_ = 0;
+			}
+		}
+	}
+
+	void Convolver::ProcessBlock() noexcept
+	{
+		const size_t BlockFrames = Config_.BlockFrames;
+		if(!Fading_) {
+			const Kernel *pPending = pPending_.load(memory_order_acquire);
+			if(pPending != pTarget_) {
+				pTarget_ = pPending;
+				Fading_ = true;
+				// Responses set before anything is processed apply at once.
+				FadeFrames_ = Frames_ ? max(Config_.CrossfadeFrames, (size_t)1) : 0;
+			}
+		}
+
+		for(int Channel = 0; Channel < NumChannels_; Channel++) {
+			float *pPlanar = &vPlanarIn_[(size_t)Channel * BlockFrames];
+			for(size_t Frame = 0; Frame < BlockFrames; Frame++)
+				pPlanar[Frame] = vBlockIn_[Frame * NumChannels_ + Channel];
+		}
+
+		RunLevel(*vLevels_[0], vPlanarIn_.data(), vPlanarOut_.data(), Schedule(*vLevels_[0]));
+
+		for(size_t Index = 1; Index < vLevels_.size(); Index++) {
+			Level &Stage = *vLevels_[Index];
+			// The output of the period starting at frame n is added from frame n + 2 * Size - BlockFrames.
+			const uint64_t Lead = 2 * Stage.Size - BlockFrames;
+			if(Frames_ >= Lead) {
+				const size_t Pos = (size_t)((Frames_ - Lead) % Stage.Size);
+				if(!Pos) {
+					if(Stage.JobsDone.load(memory_order_acquire) <= Stage.JobsCollected)
+						LateJobs_.fetch_add(1, memory_order_relaxed);
+					Stage.Done.Wait();
+					Stage.JobsCollected++;
+				}
+				const float *pResult = Stage.vResult[(Stage.JobsCollected - 1) & 1].data();
+				for(int Channel = 0; Channel < NumChannels_; Channel++) {
+					const float *pSrc = pResult + (size_t)Channel * Stage.Size + Pos;
+					float *pDst = &vPlanarOut_[(size_t)Channel * BlockFrames];
+					for(size_t Frame = 0; Frame < BlockFrames; Frame++)
+						pDst[Frame] += pSrc[Frame];
+				}
+			}
+
+			float *pStage = Stage.vStage[Stage.JobsStarted & 1].data();
+			for(int Channel = 0; Channel < NumChannels_; Channel++)
+				memcpy(pStage + (size_t)Channel * Stage.Size + Stage.Filled, &vPlanarIn_[(size_t)Channel * BlockFrames], BlockFrames * sizeof(float));
+			Stage.Filled += BlockFrames;
+			if(Stage.Filled == Stage.Size) {
+				// The previous period was collected in this very block, so at most one is ever in progress.
+				Stage.Work = Schedule(Stage);
+				Stage.JobsStarted++;
+				Stage.Filled = 0;
+				Stage.Start.Post();
+			}
+		}
+
+		for(int Channel = 0; Channel < NumChannels_; Channel++) {
+			const float *pPlanar = &vPlanarOut_[(size_t)Channel * BlockFrames];
+			for(size_t Frame = 0; Frame < BlockFrames; Frame++)
+				vBlockOut_[Frame * NumChannels_ + Channel] = pPlanar[Frame];
+		}
+		Frames_ += BlockFrames;
+
+		if(Fading_) {
+			// The old kernel may be freed once no level fades from it and no period in progress still uses it.
+			bool Finished = true;
+			for(size_t Index = 0; Index < vLevels_.size(); Index++) {
+				const Level &Stage = *vLevels_[Index];
+				if((Stage.pNew != pTarget_) || Stage.Fading)
+					Finished = false;
+				else if((Index > 0) && (Stage.JobsStarted > Stage.JobsCollected) && Stage.Work.Fading)
+					Finished = false;
+			}
+			if(Finished) {
+				Fading_ = false;
+				OldestInUse_.store(pTarget_->Id, memory_order_release);
+			}
+		}
+	}
+
+	Convolver::Job Convolver::Schedule(Level &Stage) noexcept
+	{
+		if(Stage.pNew != pTarget_) {
+			Stage.pOld = Stage.pNew;
+			Stage.pNew = pTarget_;
+			Stage.FadePos = 0;
+			Stage.Fading = (FadeFrames_ > 0);
+		}
+		Job Work;
+		Work.pNew = Stage.pNew;
+		if(Stage.Fading) {
+			Work.pOld = Stage.pOld;
+			Work.Fading = true;
+			Work.FadePos = Stage.FadePos;
+			Work.FadeFrames = FadeFrames_;
+			Stage.FadePos += Stage.Size;
+			if(Stage.FadePos >= FadeFrames_) {
+				Stage.Fading = false;
+				Stage.pOld = nullptr;
+			}
+		}
+		return Work;
+	}
+
+	void Convolver::RunLevel(Level &Stage, const float *pInput, float *pOutput, const Job &Work) noexcept
+	{
+		const size_t Size = Stage.Size;
+		for(int Channel = 0; Channel < NumChannels_; Channel++) {
+			// Overlap-save: transform the last two periods, of which the newest is kept in the output.
+			float *pHistory = &Stage.vInput[(size_t)Channel * 2 * Size];
+			memcpy(pHistory, pHistory + Size, Size * sizeof(float));
+			memcpy(pHistory + Size, pInput + (size_t)Channel * Size, Size * sizeof(float));
+			const size_t Slot = ((size_t)Channel * Stage.NumPartitions + Stage.FdlPos) * Stage.NumBins;
+			Stage.Fft.Forward(pHistory, &Stage.vFdlRe[Slot], &Stage.vFdlIm[Slot]);
+
+			float *pDst = pOutput + (size_t)Channel * Size;
+			if(!Work.Fading) {
+				if(Work.pNew) {
+					Convolve(Stage, Channel, *Work.pNew, Stage.vNew.data());
+					memcpy(pDst, Stage.vNew.data() + Size, Size * sizeof(float));
+				}
+				else
+					fill(pDst, pDst + Size, 0.0f);
+				continue;
+			}
+			// Silence stands in for a missing kernel, so that the first responses fade in.
+			if(Work.pOld)
+				Convolve(Stage, Channel, *Work.pOld, Stage.vOld.data());
+			else
+				fill(Stage.vOld.begin(), Stage.vOld.end(), 0.0f);
+			if(Work.pNew)
+				Convolve(Stage, Channel, *Work.pNew, Stage.vNew.data());
+			else
+				fill(Stage.vNew.begin(), Stage.vNew.end(), 0.0f);
+			const float *pOld = Stage.vOld.data() + Size, *pNew = Stage.vNew.data() + Size;
+			const float Step = 1.0f / (float)Work.FadeFrames;
+			for(size_t Frame = 0; Frame < Size; Frame++) {
+				const float Gain = min((float)(Work.FadePos + Frame) * Step, 1.0f);
+				pDst[Frame] = pOld[Frame] + Gain * (pNew[Frame] - pOld[Frame]);
+			}
+		}
+		Stage.FdlPos = (Stage.FdlPos + 1) % Stage.NumPartitions;
+	}
+
+	void Convolver::Convolve(Level &Stage, const int Channel, const Kernel &Response, float *pTime) noexcept
+	{
+		const Kernel::Partitions &Parts = Response.vLevels[Stage.Index];
+		const size_t NumBins = Stage.NumBins, NumPartitions = Stage.NumPartitions;
+		fill(Stage.vAccRe.begin(), Stage.vAccRe.end(), 0.0f);
+		fill(Stage.vAccIm.begin(), Stage.vAccIm.end(), 0.0f);
+		const size_t KernelChannel = Response.Shared ? 0 : (size_t)Channel;
+		// Partition p of the response meets the input spectrum of p periods ago.
+		for(size_t Part = 0; Part < Parts.NumPartitions; Part++) {
+			const size_t Slot = ((size_t)Channel * NumPartitions + (Stage.FdlPos + NumPartitions - Part) % NumPartitions) * NumBins;
+			const size_t Bin = (KernelChannel * Parts.NumPartitions + Part) * NumBins;
+			ComplexMultiplyAccumulate(&Stage.vFdlRe[Slot], &Stage.vFdlIm[Slot], &Parts.vRe[Bin], &Parts.vIm[Bin], Stage.vAccRe.data(), Stage.vAccIm.data(), NumBins);
+		}
+		Stage.Fft.Inverse(Stage.vAccRe.data(), Stage.vAccIm.data(), pTime);
+	}
+
+	void Convolver::TailLoop(Level &Stage) noexcept
+	{
+		for(;;) {
+			Stage.Start.Wait();
+			if(Stage.Quit.load(memory_order_relaxed))
+				return;
+			const int Half = (int)(Stage.JobsDone.load(memory_order_relaxed) & 1);
+			RunLevel(Stage, Stage.vStage[Half].data(), Stage.vResult[Half].data(), Stage.Work);
+			Stage.JobsDone.fetch_add(1, memory_order_release);
+			Stage.Done.Post();
+		}
+	}
+
+}
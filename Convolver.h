@@ -0,0 +1,157 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "FastSemaphore.h"
+#include "Fft.h"
+
+namespace Audaptr
+{
+	/// @brief Settings for a Convolver
+	struct ConvolverConfig
+	{
+		/// @brief Block length, and so the latency [frames]; a power of 2, typically AudIO's frames per buffer
+		size_t BlockFrames = 256;
+
+		/// @brief Longest impulse response accepted [frames]
+		size_t MaxResponseFrames = 96000;
+
+		/// @brief Largest partition used for the tail of a response [frames]; larger partitions cost less per frame
+		/// but take longer per transform
+		size_t MaxPartitionFrames = 16384;
+
+		/// @brief Duration of the crossfade when the impulse responses are replaced during processing [frames]
+		size_t CrossfadeFrames = 4096;
+	};
+
+	/// @brief Low-latency multichannel convolution with long impulse responses (e.g. room and speaker correction of
+	/// each output channel before it is written to AudIO::OutBuffer()), with a latency of exactly one block.
+	/// Responses are split into non-uniform partitions: the head, in partitions of one block, is convolved on the
+	/// processing thread in every block, and the tail, in partitions four times larger at each level, is convolved
+	/// by one background thread per level, which is given a whole partition period to finish. Every level keeps a
+	/// frequency-domain delay line of input spectra, so each block costs one transform pair and a complex
+	/// multiply-accumulate per partition.
+	/// Responses may be replaced at any time from one control thread: the new partitions are transformed there, and
+	/// the processing thread crossfades from the old responses to the new ones without blocking or allocating.
+	class Convolver
+	{
+	public:
+		/// @brief Constructor, starting the tail threads
+		/// @param NumChannels Number of interleaved channels
+		/// @param Config Convolution settings
+		Convolver(const int NumChannels, const ConvolverConfig& Config = ConvolverConfig());
+
+		/// @brief Destructor, stopping the tail threads
+		~Convolver();
+
+		Convolver(const Convolver&) = delete;
+		Convolver& operator=(const Convolver&) = delete;
+
+		int NumChannels() const { return NumChannels_; }
+
+		const ConvolverConfig& Config() const { return Config_; }
+
+		/// @brief Delay from input to output [frames]: one block
+		size_t LatencyFrames() const { return Config_.BlockFrames; }
+
+		/// @brief Number of partition sizes, including the head
+		size_t NumLevels() const { return vLevels_.size(); }
+
+		/// @brief Set the impulse response of every channel. Only one control thread may set responses; the change
+		/// is picked up by the next block processed, and crossfaded in unless nothing has been processed yet.
+		/// @param Responses One response per channel, or a single response applied to every channel
+		void SetImpulseResponses(const std::vector<std::vector<float>>& Responses);
+
+		/// @brief Set the same impulse response for every channel, as SetImpulseResponses()
+		void SetImpulseResponse(const std::vector<float>& Response);
+
+		/// @brief Convolve interleaved frames; the output lags the input by LatencyFrames(). Only one thread (the
+		/// processing thread) may call this; it never allocates, and waits only if a tail thread misses its deadline.
+		/// @param pIn Interleaved input frames
+		/// @param pOut Interleaved output frames; may be the same as pIn
+		/// @param NumFrames Number of frames
+		void Process(const float* pIn, float* pOut, size_t NumFrames) noexcept;
+
+		/// @brief Number of tail convolutions that had not finished when their output was needed
+		uint64_t LateJobs() const { return LateJobs_.load(std::memory_order_relaxed); }
+
+	protected:
+		/// Partitioned spectra of a set of impulse responses
+		struct Kernel;
+
+		/// One partition size, with its delay line, and for the tail its thread
+		struct Level;
+
+		/// Kernels to convolve one period of a level with, and where it stands in a crossfade between them
+		struct Job
+		{
+			const Kernel* pOld = nullptr;
+
+			const Kernel* pNew = nullptr;
+
+			bool Fading = false;
+
+			/// Frames of the crossfade elapsed at the first output frame
+			size_t FadePos = 0;
+
+			size_t FadeFrames = 0;
+		};
+
+		/// Convolve one block or period of input with a level, in the thread that owns the level
+		void RunLevel(Level& Stage, const float* pInput, float* pOutput, const Job& Work) noexcept;
+
+		/// Accumulate the spectrum of one channel's convolution with a kernel, and return to the time domain
+		void Convolve(Level& Stage, const int Channel, const Kernel& Response, float* pTime) noexcept;
+
+		/// Set the kernels for the next period of a level, starting or advancing its crossfade
+		Job Schedule(Level& Stage) noexcept;
+
+		void ProcessBlock() noexcept;
+
+		void TailLoop(Level& Stage) noexcept;
+
+		int NumChannels_;
+
+		ConvolverConfig Config_;
+
+		std::vector<std::unique_ptr<Level>> vLevels_;
+
+		/// Input and output of the current block, interleaved; the output is that of the previous block
+		std::vector<float> vBlockIn_, vBlockOut_;
+
+		/// Current block, one channel after another
+		std::vector<float> vPlanarIn_, vPlanarOut_;
+
+		/// Position in the current block
+		size_t BlockPos_ = 0;
+
+		/// Number of frames processed, in whole blocks
+		uint64_t Frames_ = 0;
+
+		/// Kernels set and not yet freed; owned by the control thread
+		std::vector<std::unique_ptr<Kernel>> vKernels_;
+
+		uint64_t NextId_ = 1;
+
+		/// Kernel most recently set
+		std::atomic<const Kernel*> pPending_{nullptr};
+
+		/// Identifier of the oldest kernel the processing thread and the tail threads may still use
+		std::atomic<uint64_t> OldestInUse_{0};
+
+		/// Kernel the levels are fading towards, or have reached; owned by the processing thread
+		const Kernel* pTarget_ = nullptr;
+
+		bool Fading_ = false;
+
+		size_t FadeFrames_ = 0;
+
+		std::atomic<uint64_t> LateJobs_{0};
+	};
+
+}
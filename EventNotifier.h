@@ -0,0 +1,100 @@
+#pragma once
+#include "QuickBuffer.h"
+#include <atomic>
+#include <cstdint>
+#include <system_error>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+/// @brief Notifier backed by a file descriptor (an eventfd on Linux, else a pipe), so that QuickBuffers and AudIO
+/// state changes can join an existing poll/epoll loop. Fd() becomes readable once notified.
+/// Notifications are coalesced: only the first one after a Drain() issues a system call, so a callback costs at most
+/// one write per registration, however many buffers share the notifier. Typical use from the loop thread:
+///     Notifier.Drain();
+///     ... consume Buffer ...
+///     if(!Buffer.NotifyWhenReadable(Notifier, BlockSize))
+///         ... data is already available: consume again instead of returning to epoll ...
+class EventFdNotifier : public BufferNotifier {
+public:
+    EventFdNotifier()
+    {
+#ifdef __linux__
+        ReadFd_ = WriteFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if(ReadFd_ < 0)
+            throw std::system_error(errno, std::generic_category(), "eventfd");
+#else
+        int Fds[2];
+        if(pipe(Fds) != 0)
+            throw std::system_error(errno, std::generic_category(), "pipe");
+        for(int Fd : Fds) {
+            fcntl(Fd, F_SETFL, fcntl(Fd, F_GETFL) | O_NONBLOCK);
+            fcntl(Fd, F_SETFD, FD_CLOEXEC);
+        }
+        ReadFd_ = Fds[0];
+        WriteFd_ = Fds[1];
+#endif
+    }
+
+    ~EventFdNotifier()
+    {
+        close(ReadFd_);
+        if(WriteFd_ != ReadFd_)
+            close(WriteFd_);
+    }
+
+    EventFdNotifier(const EventFdNotifier&) = delete;
+    EventFdNotifier& operator=(const EventFdNotifier&) = delete;
+
+    /// @brief File descriptor to watch for readability (EPOLLIN / POLLIN)
+    int Fd() const noexcept { return ReadFd_; }
+
+    /// @brief Make Fd() readable, unless it already is. Safe on real-time threads: never blocks.
+    void Notify() noexcept override
+    {
+        if(Pending_.exchange(true, std::memory_order_acq_rel))
+            return;
+#ifdef __linux__
+        const uint64_t One = 1;
+        ssize_t Written = write(WriteFd_, &One, sizeof(One));
+#else
+        const char One = 1;
+        ssize_t Written = write(WriteFd_, &One, sizeof(One));
+#endif
+        (void)Written; // A full pipe or counter is already readable.
+    }
+
+    /// @brief Clear the readiness of Fd(), before examining the buffers or state that it watches.
+    /// State published before a notification is visible once this returns, even if that notification was coalesced.
+    void Drain() noexcept
+    {
+#ifdef __linux__
+        uint64_t Count;
+        ssize_t Read = read(ReadFd_, &Count, sizeof(Count));
+        (void)Read;
+#else
+        char Bytes[64];
+        while(read(ReadFd_, Bytes, sizeof(Bytes)) > 0) {}
+#endif
+        // Clear the flag only after emptying the descriptor, so that a notification in between is never lost:
+        // either it wrote after the read, or its effects are visible through this exchange.
+        Pending_.exchange(false, std::memory_order_acq_rel);
+    }
+
+    /// @brief Flag indicating whether a notification has arrived since the last Drain()
+    bool Pending() const noexcept { return Pending_.load(std::memory_order_acquire); }
+
+private:
+    int ReadFd_ = -1;
+
+    int WriteFd_ = -1;
+
+    std::atomic_bool Pending_{false};
+};
+
+#endif
@@ -3,6 +3,8 @@
 #include <condition_variable>
 #include <mutex>
 
+#include "Trace.h"
+
 /// @brief Fast semaphore class that relies on ordered access to atomics where possible
 class FastSemaphore {
     class Semaphore {
@@ -18,6 +20,7 @@ class FastSemaphore {
 
         inline void Wait() noexcept
         {
+            AUDAPTR_TRACE_SCOPE("FastSemaphore::Park");
             std::unique_lock<std::mutex> Lock(Mutex_);
             CondVar_.wait(Lock, [&]() { return Count_ != 0; });
             --Count_;
@@ -0,0 +1,253 @@
+#include <cmath>
+#include <cstring>
+
+#include "Audaptr.h"
+#include "Fft.h"
+#include "SampleConvert.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define AUDAPTR_AVX2 1
+#endif
+
+using namespace std;
+
+namespace Audaptr
+{
+	// The butterflies are written once against these few operations on a vector of kLanes floats.
+#if defined(AUDAPTR_AVX2)
+	typedef __m256 VecF;
+	static constexpr size_t kLanes = 8;
+	static inline VecF Load(const float *p) { return _mm256_loadu_ps(p); }
+	static inline void Store(float *p, const VecF v) { _mm256_storeu_ps(p, v); }
+	static inline VecF Set1(const float x) { return _mm256_set1_ps(x); }
+	static inline VecF Add(const VecF a, const VecF b) { return _mm256_add_ps(a, b); }
+	static inline VecF Sub(const VecF a, const VecF b) { return _mm256_sub_ps(a, b); }
+	static inline VecF Mul(const VecF a, const VecF b) { return _mm256_mul_ps(a, b); }
+#elif defined(AUDAPTR_SSE2)
+	typedef __m128 VecF;
+	static constexpr size_t kLanes = 4;
+	static inline VecF Load(const float *p) { return _mm_loadu_ps(p); }
+	static inline void Store(float *p, const VecF v) { _mm_storeu_ps(p, v); }
+	static inline VecF Set1(const float x) { return _mm_set1_ps(x); }
+	static inline VecF Add(const VecF a, const VecF b) { return _mm_add_ps(a, b); }
+	static inline VecF Sub(const VecF a, const VecF b) { return _mm_sub_ps(a, b); }
+	static inline VecF Mul(const VecF a, const VecF b) { return _mm_mul_ps(a, b); }
+#elif defined(AUDAPTR_NEON)
+	typedef float32x4_t VecF;
+	static constexpr size_t kLanes = 4;
+	static inline VecF Load(const float *p) { return vld1q_f32(p); }
+	static inline void Store(float *p, const VecF v) { vst1q_f32(p, v); }
+	static inline VecF Set1(const float x) { return vdupq_n_f32(x); }
+	static inline VecF Add(const VecF a, const VecF b) { return vaddq_f32(a, b); }
+	static inline VecF Sub(const VecF a, const VecF b) { return vsubq_f32(a, b); }
+	static inline VecF Mul(const VecF a, const VecF b) { return vmulq_f32(a, b); }
+#else
+	typedef float VecF;
+	static constexpr size_t kLanes = 1;
+	static inline VecF Load(const float *p) { return *p; }
+	static inline void Store(float *p, const VecF v) { *p = v; }
+	static inline VecF Set1(const float x) { return x; }
+	static inline VecF Add(const VecF a, const VecF b) { return a + b; }
+	static inline VecF Sub(const VecF a, const VecF b) { return a - b; }
+	static inline VecF Mul(const VecF a, const VecF b) { return a * b; }
+#endif
+#if defined(AUDAPTR_AVX2) || defined(AUDAPTR_SSE2) || defined(AUDAPTR_NEON)
+	// Scalar operations for the lanes left over
+	static inline float Add(const float a, const float b) { return a + b; }
+	static inline float Sub(const float a, const float b) { return a - b; }
+	static inline float Mul(const float a, const float b) { return a * b; }
+#endif
+
+	static constexpr double kTwoPi = 6.283185307179586476925286766559;
+
+	vector<float> MakeWindow(const WindowType Type, const size_t Length)
+	{
+		vector<float> vWindow(Length, 1.0f);
+		for(size_t n = 0; n < Length; n++) {
+			const double Phase = kTwoPi * (double)n / (double)Length;
+			switch(Type) {
+			case WindowType::Hann: vWindow[n] = (float)(0.5 - 0.5 * cos(Phase)); break;
+			case WindowType::Hamming: vWindow[n] = (float)(0.54 - 0.46 * cos(Phase)); break;
+			case WindowType::Blackman: vWindow[n] = (float)(0.42 - 0.5 * cos(Phase) + 0.08 * cos(2.0 * Phase)); break;
+			default: break;
+			}
+		}
+		return vWindow;
+	}
+
+	void ComplexMultiplyAccumulate(const float *pARe, const float *pAIm, const float *pBRe, const float *pBIm, float *pAccRe, float *pAccIm, const size_t NumBins) noexcept
+	{
+		size_t n = 0;
+		for(; n + kLanes <= NumBins; n += kLanes) {
+			const VecF ARe = Load(pARe + n), AIm = Load(pAIm + n), BRe = Load(pBRe + n), BIm = Load(pBIm + n);
+			Store(pAccRe + n, Add(Load(pAccRe + n), Sub(Mul(ARe, BRe), Mul(AIm, BIm))));
+			Store(pAccIm + n, Add(Load(pAccIm + n), Add(Mul(ARe, BIm), Mul(AIm, BRe))));
+		}
+		for(; n < NumBins; n++) {
+			pAccRe[n] += pARe[n] * pBRe[n] - pAIm[n] * pBIm[n];
+			pAccIm[n] += pARe[n] * pBIm[n] + pAIm[n] * pBRe[n];
+		}
+	}
+
+	// Radix-4 butterfly of one lane group: a, b, c and d are a quarter of the stage length apart at the source, and
+	// the four results are Stride apart at the destination.
+	template<typename V>
+	static inline void Butterfly4(const V ar, const V ai, const V br, const V bi, const V cr, const V ci, const V dr, const V di, const V (&w)[6], V (&yr)[4], V (&yi)[4])
+	{
+		const V ApCr = Add(ar, cr), ApCi = Add(ai, ci), AmCr = Sub(ar, cr), AmCi = Sub(ai, ci);
+		const V BpDr = Add(br, dr), BpDi = Add(bi, di), BmDr = Sub(br, dr), BmDi = Sub(bi, di);
+		yr[0] = Add(ApCr, BpDr);
+		yi[0] = Add(ApCi, BpDi);
+		// (a - c) - j(b - d), (a + c) - (b + d) and (a - c) + j(b - d), each rotated by its twiddle
+		const V T1r = Add(AmCr, BmDi), T1i = Sub(AmCi, BmDr);
+		const V T2r = Sub(ApCr, BpDr), T2i = Sub(ApCi, BpDi);
+		const V T3r = Sub(AmCr, BmDi), T3i = Add(AmCi, BmDr);
+		yr[1] = Sub(Mul(T1r, w[0]), Mul(T1i, w[1]));
+		yi[1] = Add(Mul(T1r, w[1]), Mul(T1i, w[0]));
+		yr[2] = Sub(Mul(T2r, w[2]), Mul(T2i, w[3]));
+		yi[2] = Add(Mul(T2r, w[3]), Mul(T2i, w[2]));
+		yr[3] = Sub(Mul(T3r, w[4]), Mul(T3i, w[5]));
+		yi[3] = Add(Mul(T3r, w[5]), Mul(T3i, w[4]));
+	}
+
+	RealFft::RealFft(const size_t Size) :
+		Size_(Size)
+	{
+		if((Size < 4) || (Size & (Size - 1)))
+			throw Exception("FFT size " + to_string(Size) + " is not a power of 2 of at least 4");
+		const size_t Half = Size / 2;
+		for(size_t n = Half; n >= 4; n /= 4)
+			for(size_t p = 0; p < n / 4; p++)
+				for(size_t k = 1; k <= 3; k++) {
+					const double Angle = -kTwoPi * (double)(k * p) / (double)n;
+					vStageRe_.push_back((float)cos(Angle));
+					vStageIm_.push_back((float)sin(Angle));
+				}
+		vSplitRe_.resize(Half);
+		vSplitIm_.resize(Half);
+		for(size_t k = 0; k < Half; k++) {
+			const double Angle = -kTwoPi * (double)k / (double)Size;
+			vSplitRe_[k] = (float)cos(Angle);
+			vSplitIm_[k] = (float)sin(Angle);
+		}
+		vRe_.resize(Half);
+		vIm_.resize(Half);
+		vScratchRe_.resize(Half);
+		vScratchIm_.resize(Half);
+	}
+
+	void RealFft::Transform(float *pRe, float *pIm) noexcept
+	{
+		const size_t Half = Size_ / 2;
+		float *pSrcRe = pRe, *pSrcIm = pIm;
+		float *pDstRe = vScratchRe_.data(), *pDstIm = vScratchIm_.data();
+		const float *pTwRe = vStageRe_.data(), *pTwIm = vStageIm_.data();
+		size_t Stride = 1, n = Half;
+		for(; n >= 4; n /= 4, Stride *= 4) {
+			const size_t Quarter = n / 4;
+			for(size_t p = 0; p < Quarter; p++, pTwRe += 3, pTwIm += 3) {
+				const size_t a = Stride * p, b = a + Stride * Quarter, c = b + Stride * Quarter, d = c + Stride * Quarter;
+				const size_t y = 4 * Stride * p;
+				size_t q = 0;
+				if(Stride >= kLanes) {
+					const VecF w[6] = {Set1(pTwRe[0]), Set1(pTwIm[0]), Set1(pTwRe[1]), Set1(pTwIm[1]), Set1(pTwRe[2]), Set1(pTwIm[2])};
+					for(; q + kLanes <= Stride; q += kLanes) {
+						VecF yr[4], yi[4];
+						Butterfly4(Load(pSrcRe + a + q), Load(pSrcIm + a + q), Load(pSrcRe + b + q), Load(pSrcIm + b + q),
+							Load(pSrcRe + c + q), Load(pSrcIm + c + q), Load(pSrcRe + d + q), Load(pSrcIm + d + q), w, yr, yi);
+						for(size_t k = 0; k < 4; k++) {
+							Store(pDstRe + y + k * Stride + q, yr[k]);
+							Store(pDstIm + y + k * Stride + q, yi[k]);
+						}
+					}
+				}
+				const float w[6] = {pTwRe[0], pTwIm[0], pTwRe[1], pTwIm[1], pTwRe[2], pTwIm[2]};
+				for(; q < Stride; q++) {
+					float yr[4], yi[4];
+					Butterfly4(pSrcRe[a + q], pSrcIm[a + q], pSrcRe[b + q], pSrcIm[b + q], pSrcRe[c + q], pSrcIm[c + q], pSrcRe[d + q], pSrcIm[d + q], w, yr, yi);
+					for(size_t k = 0; k < 4; k++) {
+						pDstRe[y + k * Stride + q] = yr[k];
+						pDstIm[y + k * Stride + q] = yi[k];
+					}
+				}
+			}
+			swap(pSrcRe, pDstRe);
+			swap(pSrcIm, pDstIm);
+		}
+		// An odd power of 2 leaves one radix-2 stage, whose twiddles are all 1.
+		if(n == 2) {
+			size_t q = 0;
+			for(; q + kLanes <= Stride; q += kLanes) {
+				const VecF ar = Load(pSrcRe + q), ai = Load(pSrcIm + q), br = Load(pSrcRe + Stride + q), bi = Load(pSrcIm + Stride + q);
+				Store(pDstRe + q, Add(ar, br));
+				Store(pDstIm + q, Add(ai, bi));
+				Store(pDstRe + Stride + q, Sub(ar, br));
+				Store(pDstIm + Stride + q, Sub(ai, bi));
+			}
+			for(; q < Stride; q++) {
+				const float ar = pSrcRe[q], ai = pSrcIm[q], br = pSrcRe[Stride + q], bi = pSrcIm[Stride + q];
+				pDstRe[q] = ar + br;
+				pDstIm[q] = ai + bi;
+				pDstRe[Stride + q] = ar - br;
+				pDstIm[Stride + q] = ai - bi;
+			}
+			swap(pSrcRe, pDstRe);
+			swap(pSrcIm, pDstIm);
+		}
+		if(pSrcRe != pRe) {
+			memcpy(pRe, pSrcRe, Half * sizeof(float));
+			memcpy(pIm, pSrcIm, Half * sizeof(float));
+		}
+	}
+
+	void RealFft::Forward(const float *pSignal, float *pRe, float *pIm) noexcept
+	{
+		const size_t Half = Size_ / 2;
+		float *pZr = vRe_.data(), *pZi = vIm_.data();
+		// Pack even samples as real parts and odd samples as imaginary parts.
+		for(size_t k = 0; k < Half; k++) {
+			pZr[k] = pSignal[2 * k];
+			pZi[k] = pSignal[2 * k + 1];
+		}
+		Transform(pZr, pZi);
+
+		// Separate the transforms of the even and odd samples, E and O, and combine them as E + W^k O.
+		pRe[0] = pZr[0] + pZi[0];
+		pIm[0] = 0.0f;
+		pRe[Half] = pZr[0] - pZi[0];
+		pIm[Half] = 0.0f;
+		for(size_t k = 1; k < Half; k++) {
+			const float Cr = pZr[Half - k], Ci = -pZi[Half - k];
+			const float Er = 0.5f * (pZr[k] + Cr), Ei = 0.5f * (pZi[k] + Ci);
+			const float Or = 0.5f * (pZi[k] - Ci), Oi = -0.5f * (pZr[k] - Cr);
+			const float Wr = vSplitRe_[k], Wi = vSplitIm_[k];
+			pRe[k] = Er + Wr * Or - Wi * Oi;
+			pIm[k] = Ei + Wr * Oi + Wi * Or;
+		}
+	}
+
+	void RealFft::Inverse(const float *pRe, const float *pIm, float *pSignal) noexcept
+	{
+		const size_t Half = Size_ / 2;
+		float *pZr = vRe_.data(), *pZi = vIm_.data();
+		// Recover E and O from the spectrum, and pack them as E + jO.
+		for(size_t k = 0; k < Half; k++) {
+			const float Cr = pRe[Half - k], Ci = -pIm[Half - k];
+			const float Er = 0.5f * (pRe[k] + Cr), Ei = 0.5f * (pIm[k] + Ci);
+			const float Dr = 0.5f * (pRe[k] - Cr), Di = 0.5f * (pIm[k] - Ci);
+			const float Wr = vSplitRe_[k], Wi = vSplitIm_[k];
+			const float Or = Dr * Wr + Di * Wi, Oi = Di * Wr - Dr * Wi;
+			pZr[k] = Er - Oi;
+			pZi[k] = Ei + Or;
+		}
+		// Exchanging the real and imaginary parts turns the forward transform into the inverse.
+		Transform(pZi, pZr);
+		const float Scale = 1.0f / (float)Half;
+		for(size_t k = 0; k < Half; k++) {
+			pSignal[2 * k] = pZr[k] * Scale;
+			pSignal[2 * k + 1] = pZi[k] * Scale;
+		}
+	}
+
+}
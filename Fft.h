@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace Audaptr
+{
+	/// @brief Analysis window shapes
+	enum class WindowType
+	{
+		Rectangular,
+		Hann,
+		Hamming,
+		Blackman
+	};
+
+	/// @brief Build a periodic window, as suits overlapping transforms
+	/// @param Type Window shape
+	/// @param Length Number of samples
+	/// @return The window samples
+	std::vector<float> MakeWindow(const WindowType Type, const size_t Length);
+
+	/// @brief Accumulate the products of two spectra held as separate real and imaginary parts:
+	/// Acc += A * B, element by element. Vectorised with AVX2, SSE2 or NEON where available.
+	/// @param pARe Real parts of A
+	/// @param pAIm Imaginary parts of A
+	/// @param pBRe Real parts of B
+	/// @param pBIm Imaginary parts of B
+	/// @param pAccRe Real parts of the accumulator
+	/// @param pAccIm Imaginary parts of the accumulator
+	/// @param NumBins Number of complex values
+	void ComplexMultiplyAccumulate(const float* pARe, const float* pAIm, const float* pBRe, const float* pBIm, float* pAccRe, float* pAccIm, const size_t NumBins) noexcept;
+
+	/// @brief Fast Fourier transform of real signals whose length is a power of 2 (at least 4).
+	/// The signal is packed into a complex sequence of half the length, transformed by radix-4 (and a final radix-2)
+	/// Stockham stages, which need no bit reversal and keep every inner loop contiguous for vectorisation, and then
+	/// split into the spectrum of the real signal. Spectra are held as separate real and imaginary parts of
+	/// Size() / 2 + 1 bins each.
+	/// The twiddle factors are computed once by the constructor. Each transform uses the object's own scratch, so one
+	/// object serves one thread at a time.
+	class RealFft
+	{
+	public:
+		/// @brief Constructor
+		/// @param Size Transform length; a power of 2, at least 4
+		explicit RealFft(const size_t Size);
+
+		RealFft(const RealFft&) = delete;
+		RealFft& operator=(const RealFft&) = delete;
+
+		size_t Size() const { return Size_; }
+
+		/// @brief Number of bins in a spectrum
+		size_t NumBins() const { return Size_ / 2 + 1; }
+
+		/// @brief Transform a signal into its spectrum (unnormalised)
+		/// @param pSignal Size() samples
+		/// @param pRe Destination of NumBins() real parts
+		/// @param pIm Destination of NumBins() imaginary parts
+		void Forward(const float* pSignal, float* pRe, float* pIm) noexcept;
+
+		/// @brief Transform a spectrum back into a signal, scaled so that Inverse(Forward(x)) reproduces x
+		/// @param pRe NumBins() real parts
+		/// @param pIm NumBins() imaginary parts
+		/// @param pSignal Destination of Size() samples
+		void Inverse(const float* pRe, const float* pIm, float* pSignal) noexcept;
+
+	protected:
+		/// Complex transform of Size() / 2 values held in vRe_ and vIm_; the swapped-part trick makes it an inverse
+		void Transform(float* pRe, float* pIm) noexcept;
+
+		size_t Size_;
+
+		/// Twiddle factors of each radix-4 stage: three per butterfly group, real and imaginary parts apart
+		std::vector<float> vStageRe_, vStageIm_;
+
+		/// Twiddle factors splitting the packed transform into the real spectrum
+		std::vector<float> vSplitRe_, vSplitIm_;
+
+		/// Packed signal and its transform, and the Stockham ping-pong scratch
+		std::vector<float> vRe_, vIm_, vScratchRe_, vScratchIm_;
+	};
+
+}
@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <cmath>
+
+#include "LatencyTuner.h"
+
+using namespace std;
+
+namespace Audaptr
+{
+	LatencyTuner::LatencyTuner(AudIO &Device, const LatencyTunerConfig &Config) :
+		Device_(Device), Config_(Config)
+	{
+		const Binding &Bound = Device_.BoundDevice();
+		MinLatency_s_ = (Config_.MinLatency_s > 0.0) ? max(Config_.MinLatency_s, Bound.MinLatency_s()) : Bound.MinLatency_s();
+		MaxLatency_s_ = (Config_.MaxLatency_s > 0.0) ? min(Config_.MaxLatency_s, Bound.MaxLatency_s()) : Bound.MaxLatency_s();
+		if(MaxLatency_s_ < MinLatency_s_)
+			throw Exception("Latency range for tuning is empty");
+		Latency_s_ = Device_.RequestedLatency_s();
+		DeviceGlitches_ = Device_.InputDeviceXruns() + Device_.OutputDeviceXruns();
+		RingGlitches_ = Device_.InputRingOverflows() + Device_.OutputRingUnderflows();
+		StableSince_ = chrono::steady_clock::now();
+	}
+
+	bool LatencyTuner::Converged() const
+	{
+		if(StableLatency_s_ <= 0.0)
+			return false;
+		if(StableLatency_s_ <= MinLatency_s_)
+			return true;
+		return (GlitchLatency_s_ > 0.0) && (StableLatency_s_ <= Config_.ConvergenceRatio * GlitchLatency_s_);
+	}
+
+	bool LatencyTuner::Update()
+	{
+		const int DeviceGlitches = Device_.InputDeviceXruns() + Device_.OutputDeviceXruns();
+		const int RingGlitches = Device_.InputRingOverflows() + Device_.OutputRingUnderflows();
+		const auto Now = chrono::steady_clock::now();
+
+		// The consumer or producer could not keep up: allow it more slack, without changing the device latency.
+		if(RingGlitches > RingGlitches_) {
+			RingGlitches_ = RingGlitches;
+			const double Headroom = min(2.0 * Device_.RingHeadroom(), Config_.MaxRingHeadroom);
+			if(Headroom > Device_.RingHeadroom()) {
+				Device_.SetRingHeadroom(Headroom);
+				return Restart(Latency_s_);
+			}
+		}
+
+		// The device glitched at this latency: raise the lower bound and move up.
+		if(DeviceGlitches > DeviceGlitches_) {
+			DeviceGlitches_ = DeviceGlitches;
+			GlitchLatency_s_ = max(GlitchLatency_s_, Latency_s_);
+			if(StableLatency_s_ <= GlitchLatency_s_)
+				StableLatency_s_ = 0.0;
+			double Next;
+			if(StableLatency_s_ <= 0.0)
+				Next = Latency_s_ * Config_.Increase;
+			else if(Converged())
+				Next = StableLatency_s_;
+			else
+				Next = sqrt(GlitchLatency_s_ * StableLatency_s_);
+			Next = min(Next, MaxLatency_s_);
+			if(Next <= Latency_s_) {
+				StableSince_ = Now;
+				return false;
+			}
+			return Restart(Next);
+		}
+
+		// No glitches for long enough: lower the upper bound and move down.
+		if(chrono::duration<double>(Now - StableSince_).count() >= Config_.StableInterval_s) {
+			StableLatency_s_ = (StableLatency_s_ > 0.0) ? min(StableLatency_s_, Latency_s_) : Latency_s_;
+			StableSince_ = Now;
+			if(Converged())
+				return (Latency_s_ != StableLatency_s_) ? Restart(StableLatency_s_) : false;
+			const double Next = max((GlitchLatency_s_ > 0.0) ? sqrt(GlitchLatency_s_ * StableLatency_s_) : Latency_s_ * Config_.Decrease, MinLatency_s_);
+			return (Next < Latency_s_) ? Restart(Next) : false;
+		}
+		return false;
+	}
+
+	bool LatencyTuner::Restart(double Latency_s)
+	{
+		Latency_s_ = Latency_s;
+		StableSince_ = chrono::steady_clock::now();
+		// Counts restart from zero when the stream is opened.
+		DeviceGlitches_ = 0;
+		RingGlitches_ = 0;
+		return Device_.Reopen(Latency_s);
+	}
+
+}
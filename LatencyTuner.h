@@ -0,0 +1,87 @@
+#pragma once
+
+#include <chrono>
+
+#include "AudIO.h"
+
+namespace Audaptr
+{
+	/// @brief Settings for a LatencyTuner
+	struct LatencyTunerConfig
+	{
+		/// @brief Lowest latency to try [seconds]; zero selects the binding's minimum
+		double MinLatency_s = 0.0;
+
+		/// @brief Highest latency to try [seconds]; zero selects the binding's maximum
+		double MaxLatency_s = 0.0;
+
+		/// @brief Factor applied to the latency after glitches, while no glitch-free latency is known
+		double Increase = 2.0;
+
+		/// @brief Factor applied to the latency after a glitch-free interval, while no glitching latency is known
+		double Decrease = 0.7;
+
+		/// @brief Duration without glitches after which a latency is considered stable [seconds]
+		double StableInterval_s = 10.0;
+
+		/// @brief Ratio between the lowest stable and the highest glitching latency at which the search stops
+		double ConvergenceRatio = 1.1;
+
+		/// @brief Largest ring headroom (ring duration as a multiple of the latency) to grow to
+		double MaxRingHeadroom = 64.0;
+	};
+
+	/// @brief Searches for the lowest latency at which an AudIO stream runs without glitches on the host.
+	/// Device overflows and underflows lower the bound on the latency; ring overflows (the consumer did not drain
+	/// InBuffer() in time) and ring underflows (OutBuffer() was not filled in time) instead enlarge the rings.
+	/// Each change is applied by restarting the stream, so data is lost across a retune.
+	/// The device must have been bound, opened and started; Update() is called periodically from a control thread.
+	class LatencyTuner
+	{
+	public:
+		/// @brief Constructor
+		/// @param Device The device to tune; it must outlive the tuner
+		/// @param Config Tuning settings
+		LatencyTuner(AudIO& Device, const LatencyTunerConfig& Config = LatencyTunerConfig());
+
+		/// @brief Examine the counters since the previous call and retune the stream if warranted
+		/// @return true if the stream was restarted with a new latency or ring capacity
+		bool Update();
+
+		/// @brief Flag indicating whether the search has converged
+		bool Converged() const;
+
+		/// @brief Latency currently requested of the device [seconds]
+		double Latency_s() const { return Latency_s_; }
+
+		/// @brief Lowest latency known to be glitch-free [seconds], or zero if none is known yet
+		double StableLatency_s() const { return StableLatency_s_; }
+
+		/// @brief Highest latency known to glitch [seconds], or zero if none is known yet
+		double GlitchLatency_s() const { return GlitchLatency_s_; }
+
+	protected:
+		bool Restart(double Latency_s);
+
+		AudIO& Device_;
+
+		LatencyTunerConfig Config_;
+
+		double Latency_s_;
+
+		double MinLatency_s_;
+
+		double MaxLatency_s_;
+
+		double StableLatency_s_ = 0.0;
+
+		double GlitchLatency_s_ = 0.0;
+
+		int DeviceGlitches_ = 0;
+
+		int RingGlitches_ = 0;
+
+		std::chrono::steady_clock::time_point StableSince_;
+	};
+
+}
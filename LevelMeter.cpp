@@ -0,0 +1,252 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "Audaptr.h"
+#include "LevelMeter.h"
+#include "SampleConvert.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define AUDAPTR_AVX2 1
+#endif
+
+using namespace std;
+
+namespace Audaptr
+{
+	static inline float ToFloat(const float Sample) { return Sample; }
+
+	static inline float ToFloat(const int16_t Sample) { return (float)Sample * (1.0f / kInt16Scale); }
+
+	// Accumulate the peak magnitude, sum of squares and clip count of a run of samples.
+	static void SampleStats(const float *pSamples, const size_t NumSamples, const float ClipLevel, float &Peak, double &SumSquares, uint32_t &Clips)
+	{
+		size_t n = 0;
+		float Max = Peak, Sum = 0.0f;
+		uint32_t NumClipped = 0;
+#if defined(AUDAPTR_AVX2)
+		const __m256 SignMask = _mm256_set1_ps(-0.0f), Clip = _mm256_set1_ps(ClipLevel);
+		__m256 vMax = _mm256_setzero_ps(), vSum = _mm256_setzero_ps();
+		__m256i vClipped = _mm256_setzero_si256();
+		for(; n < (NumSamples & ~(size_t)7); n += 8) {
+			const __m256 Samples = _mm256_loadu_ps(pSamples + n);
+			const __m256 Magnitudes = _mm256_andnot_ps(SignMask, Samples);
+			vMax = _mm256_max_ps(vMax, Magnitudes);
+			vSum = _mm256_add_ps(vSum, _mm256_mul_ps(Samples, Samples));
+			// Comparison lanes are all ones (-1) where clipped.
+			vClipped = _mm256_sub_epi32(vClipped, _mm256_castps_si256(_mm256_cmp_ps(Magnitudes, Clip, _CMP_GE_OQ)));
+		}
+		alignas(32) float Maxima[8], Sums[8];
+		alignas(32) uint32_t Counts[8];
+		_mm256_store_ps(Maxima, vMax);
+		_mm256_store_ps(Sums, vSum);
+		_mm256_store_si256(reinterpret_cast<__m256i *>(Counts), vClipped);
+		for(int Lane = 0; Lane < 8; Lane++) {
+			Max = max(Max, Maxima[Lane]);
+			Sum += Sums[Lane];
+			NumClipped += Counts[Lane];
+		}
+#elif defined(AUDAPTR_SSE2)
+		const __m128 SignMask = _mm_set1_ps(-0.0f), Clip = _mm_set1_ps(ClipLevel);
+		__m128 vMax = _mm_setzero_ps(), vSum = _mm_setzero_ps();
+		__m128i vClipped = _mm_setzero_si128();
+		for(; n < (NumSamples & ~(size_t)3); n += 4) {
+			const __m128 Samples = _mm_loadu_ps(pSamples + n);
+			const __m128 Magnitudes = _mm_andnot_ps(SignMask, Samples);
+			vMax = _mm_max_ps(vMax, Magnitudes);
+			vSum = _mm_add_ps(vSum, _mm_mul_ps(Samples, Samples));
+			vClipped = _mm_sub_epi32(vClipped, _mm_castps_si128(_mm_cmpge_ps(Magnitudes, Clip)));
+		}
+		alignas(16) float Maxima[4], Sums[4];
+		alignas(16) uint32_t Counts[4];
+		_mm_store_ps(Maxima, vMax);
+		_mm_store_ps(Sums, vSum);
+		_mm_store_si128(reinterpret_cast<__m128i *>(Counts), vClipped);
+		for(int Lane = 0; Lane < 4; Lane++) {
+			Max = max(Max, Maxima[Lane]);
+			Sum += Sums[Lane];
+			NumClipped += Counts[Lane];
+		}
+#elif defined(AUDAPTR_NEON)
+		const float32x4_t Clip = vdupq_n_f32(ClipLevel);
+		float32x4_t vMax = vdupq_n_f32(0.0f), vSum = vdupq_n_f32(0.0f);
+		uint32x4_t vClipped = vdupq_n_u32(0);
+		for(; n < (NumSamples & ~(size_t)3); n += 4) {
+			const float32x4_t Samples = vld1q_f32(pSamples + n);
+			const float32x4_t Magnitudes = vabsq_f32(Samples);
+			vMax = vmaxq_f32(vMax, Magnitudes);
+			vSum = vmlaq_f32(vSum, Samples, Samples);
+			// Comparison lanes are all ones where clipped.
+			vClipped = vsubq_u32(vClipped, vcgeq_f32(Magnitudes, Clip));
+		}
+		Max = max(Max, vmaxvq_f32(vMax));
+		Sum += vaddvq_f32(vSum);
+		NumClipped += vaddvq_u32(vClipped);
+#endif
+		for(; n < NumSamples; n++) {
+			const float Magnitude = fabsf(pSamples[n]);
+			Max = max(Max, Magnitude);
+			Sum += pSamples[n] * pSamples[n];
+			NumClipped += (Magnitude >= ClipLevel) ? 1 : 0;
+		}
+		Peak = Max;
+		SumSquares += (double)Sum;
+		Clips += NumClipped;
+	}
+
+	// Largest magnitude of a run of samples interpolated at the three fractional phases. pSamples must be preceded
+	// by NumTaps - 1 samples of history.
+	template<size_t NumTaps>
+	static float InterpolatedPeak(const float *pSamples, const size_t NumSamples, const float (&Phases)[3][NumTaps])
+	{
+		size_t n = 0;
+		float Max = 0.0f;
+#if defined(AUDAPTR_AVX2)
+		const __m256 SignMask = _mm256_set1_ps(-0.0f);
+		__m256 vMax = _mm256_setzero_ps();
+		for(; n < (NumSamples & ~(size_t)7); n += 8)
+			for(size_t Phase = 0; Phase < 3; Phase++) {
+				__m256 Sum = _mm256_setzero_ps();
+				for(size_t Tap = 0; Tap < NumTaps; Tap++)
+					Sum = _mm256_add_ps(Sum, _mm256_mul_ps(_mm256_broadcast_ss(&Phases[Phase][Tap]), _mm256_loadu_ps(pSamples + n - Tap)));
+				vMax = _mm256_max_ps(vMax, _mm256_andnot_ps(SignMask, Sum));
+			}
+		alignas(32) float Maxima[8];
+		_mm256_store_ps(Maxima, vMax);
+		for(int Lane = 0; Lane < 8; Lane++)
+			Max = max(Max, Maxima[Lane]);
+#elif defined(AUDAPTR_SSE2)
+		const __m128 SignMask = _mm_set1_ps(-0.0f);
+		__m128 vMax = _mm_setzero_ps();
+		for(; n < (NumSamples & ~(size_t)3); n += 4)
+			for(size_t Phase = 0; Phase < 3; Phase++) {
+				__m128 Sum = _mm_setzero_ps();
+				for(size_t Tap = 0; Tap < NumTaps; Tap++)
+					Sum = _mm_add_ps(Sum, _mm_mul_ps(_mm_set1_ps(Phases[Phase][Tap]), _mm_loadu_ps(pSamples + n - Tap)));
+				vMax = _mm_max_ps(vMax, _mm_andnot_ps(SignMask, Sum));
+			}
+		alignas(16) float Maxima[4];
+		_mm_store_ps(Maxima, vMax);
+		for(int Lane = 0; Lane < 4; Lane++)
+			Max = max(Max, Maxima[Lane]);
+#elif defined(AUDAPTR_NEON)
+		float32x4_t vMax = vdupq_n_f32(0.0f);
+		for(; n < (NumSamples & ~(size_t)3); n += 4)
+			for(size_t Phase = 0; Phase < 3; Phase++) {
+				float32x4_t Sum = vdupq_n_f32(0.0f);
+				for(size_t Tap = 0; Tap < NumTaps; Tap++)
+					Sum = vmlaq_n_f32(Sum, vld1q_f32(pSamples + n - Tap), Phases[Phase][Tap]);
+				vMax = vmaxq_f32(vMax, vabsq_f32(Sum));
+			}
+		Max = vmaxvq_f32(vMax);
+#endif
+		for(; n < NumSamples; n++)
+			for(size_t Phase = 0; Phase < 3; Phase++) {
+				float Sum = 0.0f;
+				for(size_t Tap = 0; Tap < NumTaps; Tap++)
+					Sum += Phases[Phase][Tap] * pSamples[n - Tap];
+				Max = max(Max, fabsf(Sum));
+			}
+		return Max;
+	}
+
+	LevelMeter::LevelMeter(const int NumChannels, const double SampleRate_Hz, const LevelMeterConfig &Config) :
+		NumChannels_(NumChannels), Config_(Config)
+	{
+		if(NumChannels <= 0)
+			throw Exception("A level meter requires at least one channel");
+		if((SampleRate_Hz <= 0.0) || (Config.Window_s <= 0.0))
+			throw Exception("A level meter requires a positive sample rate and window");
+		WindowFrames_ = max((size_t)1, (size_t)lround(Config.Window_s * SampleRate_Hz));
+		vChannels_.resize((size_t)NumChannels);
+		pPublished_.reset(new SeqLock<ChannelLevels>[(size_t)NumChannels]);
+
+		// Windowed-sinc interpolator: tap k of phase p weights the sample (k + p/4 - kTaps/2) periods from the point
+		// interpolated. Each phase is normalised to unity gain at DC.
+		const double Pi = 3.14159265358979323846, HalfSpan = (double)kTaps / 2.0;
+		for(size_t Phase = 0; Phase < 3; Phase++) {
+			double Sum = 0.0;
+			double Coefficients[kTaps];
+			for(size_t Tap = 0; Tap < kTaps; Tap++) {
+				const double Distance = HalfSpan - (double)Tap - (double)(Phase + 1) / 4.0;
+				const double Sinc = sin(Pi * Distance) / (Pi * Distance);
+				const double Window = 0.5 * (1.0 + cos(Pi * Distance / HalfSpan));
+				Coefficients[Tap] = Sinc * Window;
+				Sum += Coefficients[Tap];
+			}
+			for(size_t Tap = 0; Tap < kTaps; Tap++)
+				Phases_[Phase][Tap] = (float)(Coefficients[Tap] / Sum);
+		}
+		memset(Scratch_, 0, sizeof(Scratch_));
+	}
+
+	void LevelMeter::Process(const float *pFrames, const size_t NumFrames) noexcept
+	{
+		ProcessFrames(pFrames, NumFrames);
+	}
+
+	void LevelMeter::Process(const int16_t *pFrames, const size_t NumFrames) noexcept
+	{
+		ProcessFrames(pFrames, NumFrames);
+	}
+
+	template<typename SampleT>
+	void LevelMeter::ProcessFrames(const SampleT *pFrames, size_t NumFrames) noexcept
+	{
+		const size_t NumChannels = (size_t)NumChannels_;
+		float *const pChunk = Scratch_ + (kTaps - 1);
+		while(NumFrames > 0) {
+			const size_t ChunkFrames = min(min(NumFrames, kChunkFrames), WindowFrames_ - FramesInWindow_);
+			for(size_t Channel = 0; Channel < NumChannels; Channel++) {
+				ChannelState &State = vChannels_[Channel];
+				// Deinterleave one channel, so that the kernels run over contiguous samples.
+				const SampleT *pSource = pFrames + Channel;
+				for(size_t n = 0; n < ChunkFrames; n++, pSource += NumChannels)
+					pChunk[n] = ToFloat(*pSource);
+				SampleStats(pChunk, ChunkFrames, Config_.ClipLevel, State.Peak, State.SumSquares, State.Clips);
+				if(Config_.TruePeak) {
+					memcpy(Scratch_, State.History, sizeof(State.History));
+					State.TruePeak = max(State.TruePeak, InterpolatedPeak(pChunk, ChunkFrames, Phases_));
+					// The history overlaps the chunk, so this also holds for chunks shorter than the history.
+					memcpy(State.History, pChunk + ChunkFrames - (kTaps - 1), sizeof(State.History));
+				}
+			}
+			pFrames += ChunkFrames * NumChannels;
+			NumFrames -= ChunkFrames;
+			FramesInWindow_ += ChunkFrames;
+			if(FramesInWindow_ == WindowFrames_)
+				Publish();
+		}
+	}
+
+	void LevelMeter::Publish() noexcept
+	{
+		Windows_++;
+		for(size_t Channel = 0; Channel < vChannels_.size(); Channel++) {
+			ChannelState &State = vChannels_[Channel];
+			ChannelLevels Levels;
+			Levels.Peak = State.Peak;
+			Levels.Rms = (float)sqrt(State.SumSquares / (double)FramesInWindow_);
+			Levels.TruePeak = Config_.TruePeak ? max(State.TruePeak, State.Peak) : State.Peak;
+			Levels.Clips = State.Clips;
+			Levels.Windows = Windows_;
+			pPublished_[Channel].Store(Levels);
+			State.Peak = 0.0f;
+			State.SumSquares = 0.0;
+			State.TruePeak = 0.0f;
+		}
+		FramesInWindow_ = 0;
+	}
+
+	void LevelMeter::Reset()
+	{
+		for(size_t Channel = 0; Channel < vChannels_.size(); Channel++) {
+			vChannels_[Channel] = ChannelState();
+			pPublished_[Channel].Store(ChannelLevels());
+		}
+		FramesInWindow_ = 0;
+		Windows_ = 0;
+	}
+
+}
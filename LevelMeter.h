@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "SeqLock.h"
+
+namespace Audaptr
+{
+	/// @brief Settings for a LevelMeter
+	struct LevelMeterConfig
+	{
+		/// @brief Duration over which levels are integrated before being published [seconds]
+		double Window_s = 0.05;
+
+		/// @brief Magnitude at or above which a sample counts as clipped (by default the 16-bit full scale)
+		float ClipLevel = 32767.0f / 32768.0f;
+
+		/// @brief Compute the 4x oversampled true peak (about three times the cost of peak and RMS alone)
+		bool TruePeak = true;
+	};
+
+	/// @brief Levels of one channel over the most recent window
+	struct ChannelLevels
+	{
+		/// @brief Largest sample magnitude
+		float Peak = 0.0f;
+
+		/// @brief Root mean square of the samples
+		float Rms = 0.0f;
+
+		/// @brief Largest magnitude of the signal reconstructed at 4x the sample rate (at least Peak)
+		float TruePeak = 0.0f;
+
+		/// @brief Number of clipped samples since the meter was constructed or reset
+		uint32_t Clips = 0;
+
+		/// @brief Number of windows published so far, so that a reader can tell whether the levels are new
+		uint64_t Windows = 0;
+	};
+
+	/// @brief Per-channel peak, RMS, true-peak and clip metering of interleaved audio, intended to run inside the
+	/// stream callback while the samples are in cache. The levels of each window are published through a
+	/// sequence lock, so that any number of readers (e.g. UI threads) may poll them without ever blocking the
+	/// audio thread. Attach to an AudIO with SetInputMeter().
+	class LevelMeter
+	{
+	public:
+		/// @brief Constructor
+		/// @param NumChannels Number of interleaved channels
+		/// @param SampleRate_Hz Sample rate [hertz]
+		/// @param Config Metering settings
+		LevelMeter(const int NumChannels, const double SampleRate_Hz, const LevelMeterConfig& Config = LevelMeterConfig());
+
+		/// @brief Number of channels metered
+		int NumChannels() const { return NumChannels_; }
+
+		/// @brief Levels of a channel over the most recently completed window; safe to call from any thread
+		/// @param Channel Index of the channel
+		ChannelLevels Levels(const int Channel) const { return pPublished_[Channel].Load(); }
+
+		/// @brief Meter a block of interleaved frames. Only one thread (the audio thread) may call this.
+		void Process(const float* pFrames, const size_t NumFrames) noexcept;
+
+		/// @brief Meter a block of interleaved 16-bit frames. Only one thread (the audio thread) may call this.
+		void Process(const int16_t* pFrames, const size_t NumFrames) noexcept;
+
+		/// @brief Discard the current window and the clip counts. Only valid while Process is not being called.
+		void Reset();
+
+	protected:
+		/// Number of taps of each phase of the true-peak interpolator
+		static constexpr size_t kTaps = 12;
+
+		/// Number of frames deinterleaved per channel at a time
+		static constexpr size_t kChunkFrames = 256;
+
+		struct ChannelState
+		{
+			/// Last samples of the previous chunk, feeding the interpolator
+			float History[kTaps - 1] = {};
+
+			float Peak = 0.0f;
+
+			double SumSquares = 0.0;
+
+			float TruePeak = 0.0f;
+
+			uint32_t Clips = 0;
+		};
+
+		template<typename SampleT>
+		void ProcessFrames(const SampleT* pFrames, size_t NumFrames) noexcept;
+
+		void Publish() noexcept;
+
+		int NumChannels_;
+
+		LevelMeterConfig Config_;
+
+		size_t WindowFrames_;
+
+		size_t FramesInWindow_ = 0;
+
+		uint64_t Windows_ = 0;
+
+		std::vector<ChannelState> vChannels_;
+
+		std::unique_ptr<SeqLock<ChannelLevels>[]> pPublished_;
+
+		/// Interpolator coefficients of the three fractional phases (1/4, 2/4 and 3/4), in reverse time order
+		alignas(32) float Phases_[3][kTaps];
+
+		/// One channel of a chunk, preceded by its history
+		alignas(32) float Scratch_[kTaps - 1 + kChunkFrames];
+	};
+
+}
@@ -0,0 +1,643 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "Audaptr.h"
+#include "LosslessEncoder.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+namespace Audaptr
+{
+	// File layout, little-endian throughout:
+	//   header   "AUDL", u16 version, u16 channels, f64 sample rate, u32 block frames
+	//   blocks   "AUDB", u32 frames, u64 first frame, u32 payload bytes per channel, payloads
+	//   index    "AUDI", u32 blocks, { u64 first frame, u64 offset, u32 frames } per block
+	//   trailer  u64 index offset, "AUDE"
+	// A channel payload is a predictor order byte followed by that many raw warm-up samples and Rice coded
+	// residuals in partitions, each led by its own 6-bit parameter; order kVerbatim marks raw samples instead.
+	static constexpr uint32_t kFileMagic = 0x4c445541;		// "AUDL"
+	static constexpr uint32_t kBlockMagic = 0x42445541;		// "AUDB"
+	static constexpr uint32_t kIndexMagic = 0x49445541;		// "AUDI"
+	static constexpr uint32_t kEndMagic = 0x45445541;		// "AUDE"
+	static constexpr uint16_t kVersion = 1;
+	static constexpr size_t kHeaderBytes = 20;
+	static constexpr size_t kBlockHeaderBytes = 16;
+	static constexpr size_t kIndexEntryBytes = 20;
+	static constexpr size_t kTrailerBytes = 12;
+
+	static constexpr int kMaxOrder = 3;
+	static constexpr uint8_t kVerbatim = 0xff;
+	static constexpr size_t kPartitionSamples = 256;
+	static constexpr unsigned kParamBits = 6;
+	static constexpr unsigned kMaxParam = 40;
+	// Quotients from kEscape up are replaced by kEscape ones and the residual in kEscapeBits bits.
+	static constexpr unsigned kEscape = 16;
+	static constexpr unsigned kEscapeBits = 40;
+
+	static inline void Put16(uint8_t *p, const uint16_t Value) { for(int n = 0; n < 2; n++) p[n] = (uint8_t)(Value >> (8 * n)); }
+
+	static inline void Put32(uint8_t *p, const uint32_t Value) { for(int n = 0; n < 4; n++) p[n] = (uint8_t)(Value >> (8 * n)); }
+
+	static inline void Put64(uint8_t *p, const uint64_t Value) { for(int n = 0; n < 8; n++) p[n] = (uint8_t)(Value >> (8 * n)); }
+
+	static inline uint16_t Get16(const uint8_t *p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+
+	static inline uint32_t Get32(const uint8_t *p)
+	{
+		uint32_t Value = 0;
+		for(int n = 3; n >= 0; n--)
+			Value = (Value << 8) | p[n];
+		return Value;
+	}
+
+	static inline uint64_t Get64(const uint8_t *p) { return (uint64_t)Get32(p) | ((uint64_t)Get32(p + 4) << 32); }
+
+	// Map the bits of a float onto integers in the same order as the floats, so that prediction works on the
+	// values while every bit pattern (including -0 and NaNs) survives.
+	static inline int32_t FloatToOrdered(const float Sample)
+	{
+		uint32_t Bits;
+		memcpy(&Bits, &Sample, sizeof(Bits));
+		return (Bits & 0x80000000u) ? -(int32_t)(Bits & 0x7fffffffu) - 1 : (int32_t)Bits;
+	}
+
+	static inline float OrderedToFloat(const int32_t Value)
+	{
+		const uint32_t Bits = (Value < 0) ? ((uint32_t)(-(Value + 1)) | 0x80000000u) : (uint32_t)Value;
+		float Sample;
+		memcpy(&Sample, &Bits, sizeof(Sample));
+		return Sample;
+	}
+
+	static inline int64_t Predict(const int32_t *x, const size_t i, const int Order)
+	{
+		switch(Order) {
+		case 1: return x[i - 1];
+		case 2: return 2 * (int64_t)x[i - 1] - x[i - 2];
+		case 3: return 3 * ((int64_t)x[i - 1] - x[i - 2]) + x[i - 3];
+		default: return 0;
+		}
+	}
+
+	static inline uint64_t ZigZag(const int64_t Value) { return ((uint64_t)Value << 1) ^ (uint64_t)(Value >> 63); }
+
+	static inline int64_t UnZigZag(const uint64_t Value) { return (int64_t)(Value >> 1) ^ -(int64_t)(Value & 1); }
+
+	static inline unsigned CountTrailingOnes(const uint64_t Bits)
+	{
+		const uint64_t Zeros = ~Bits;
+		if(!Zeros)
+			return 64;
+#if defined(_MSC_VER)
+		unsigned long Index;
+		_BitScanForward64(&Index, Zeros);
+		return (unsigned)Index;
+#else
+		return (unsigned)__builtin_ctzll(Zeros);
+#endif
+	}
+
+	// Appends bits to a byte vector, least significant first.
+	class BitWriter
+	{
+	public:
+		explicit BitWriter(vector<uint8_t> &Out) : Out_(Out) {}
+
+		// Append the low Count bits of Bits (at most 57)
+		inline void Put(const uint64_t Bits, const unsigned Count)
+		{
+			Acc_ |= Bits << Fill_;
+			Fill_ += Count;
+			while(Fill_ >= 8) {
+				Out_.push_back((uint8_t)Acc_);
+				Acc_ >>= 8;
+				Fill_ -= 8;
+			}
+		}
+
+		inline void Flush()
+		{
+			if(Fill_)
+				Out_.push_back((uint8_t)Acc_);
+			Acc_ = 0;
+			Fill_ = 0;
+		}
+
+	private:
+		vector<uint8_t> &Out_;
+
+		uint64_t Acc_ = 0;
+
+		unsigned Fill_ = 0;
+	};
+
+	// Reads bits written by BitWriter, throwing if they run past the end of the payload.
+	class BitReader
+	{
+	public:
+		BitReader(const uint8_t *pData, const size_t NumBytes) : p_(pData), pEnd_(pData + NumBytes) {}
+
+		// Read Count bits (at most 57)
+		inline uint64_t Get(const unsigned Count)
+		{
+			Refill(Count);
+			const uint64_t Bits = Acc_ & ((Count < 64) ? ((1ull << Count) - 1) : ~0ull);
+			Acc_ >>= Count;
+			Fill_ -= Count;
+			return Bits;
+		}
+
+		// Count and consume up to Limit one bits, and the zero that ends them if fewer than Limit
+		inline unsigned Unary(const unsigned Limit)
+		{
+			Refill(Limit + 1, false);
+			const unsigned Ones = min(CountTrailingOnes(Acc_), Limit);
+			const unsigned Used = Ones + ((Ones < Limit) ? 1 : 0);
+			if(Used > Fill_)
+				throw Exception("A lossless block is truncated");
+			Acc_ >>= Used;
+			Fill_ -= Used;
+			return Ones;
+		}
+
+	private:
+		inline void Refill(const unsigned Count, const bool Exact = true)
+		{
+			while((Fill_ <= 56) && (p_ < pEnd_)) {
+				Acc_ |= (uint64_t)*p_++ << Fill_;
+				Fill_ += 8;
+			}
+			if(Exact && (Fill_ < Count))
+				throw Exception("A lossless block is truncated");
+		}
+
+		const uint8_t *p_;
+
+		const uint8_t *pEnd_;
+
+		uint64_t Acc_ = 0;
+
+		unsigned Fill_ = 0;
+	};
+
+	// Encode one channel of interleaved frames.
+	static void EncodeChannel(const float *pFrames, const size_t NumChannels, const size_t Channel, const size_t NumFrames, vector<uint8_t> &Out)
+	{
+		thread_local vector<int32_t> vSamples;
+		thread_local vector<uint64_t> vResiduals;
+		vSamples.resize(NumFrames);
+		int32_t *x = vSamples.data();
+		for(size_t i = 0; i < NumFrames; i++)
+			x[i] = FloatToOrdered(pFrames[i * NumChannels + Channel]);
+
+		// Choose the fixed predictor leaving the smallest residuals.
+		int Order = 0;
+		if(NumFrames > (size_t)kMaxOrder) {
+			int64_t Cost[kMaxOrder + 1] = {};
+			for(size_t i = kMaxOrder; i < NumFrames; i++) {
+				const int64_t e0 = x[i], e1 = e0 - x[i - 1], e2 = e1 - ((int64_t)x[i - 1] - x[i - 2]);
+				const int64_t e3 = e2 - ((int64_t)x[i - 1] - 2 * (int64_t)x[i - 2] + x[i - 3]);
+				Cost[0] += (e0 < 0) ? -e0 : e0;
+				Cost[1] += (e1 < 0) ? -e1 : e1;
+				Cost[2] += (e2 < 0) ? -e2 : e2;
+				Cost[3] += (e3 < 0) ? -e3 : e3;
+			}
+			for(int n = 1; n <= kMaxOrder; n++)
+				if(Cost[n] < Cost[Order])
+					Order = n;
+		}
+		const size_t Warmup = min((size_t)Order, NumFrames);
+		vResiduals.resize(NumFrames);
+		uint64_t *r = vResiduals.data();
+		for(size_t i = Warmup; i < NumFrames; i++)
+			r[i] = ZigZag(x[i] - Predict(x, i, Order));
+
+		Out.clear();
+		Out.push_back((uint8_t)Order);
+		BitWriter Bits(Out);
+		for(size_t i = 0; i < Warmup; i++)
+			Bits.Put((uint32_t)x[i], 32);
+		for(size_t Begin = Warmup; Begin < NumFrames; Begin += kPartitionSamples) {
+			const size_t End = min(Begin + kPartitionSamples, NumFrames);
+			uint64_t Sum = 0;
+			for(size_t i = Begin; i < End; i++)
+				Sum += r[i];
+			unsigned k = 0;
+			while((k < kMaxParam) && (((uint64_t)(End - Begin) << k) < Sum))
+				k++;
+			Bits.Put(k, kParamBits);
+			const uint64_t Mask = (1ull << k) - 1;
+			for(size_t i = Begin; i < End; i++) {
+				const uint64_t q = r[i] >> k;
+				if(q < kEscape)
+					Bits.Put(((r[i] & Mask) << (q + 1)) | ((1ull << q) - 1), (unsigned)q + 1 + k);
+				else {
+					Bits.Put((1ull << kEscape) - 1, kEscape);
+					Bits.Put(r[i], kEscapeBits);
+				}
+			}
+		}
+		Bits.Flush();
+
+		// Incompressible (e.g. noise-like) channels are stored as they are.
+		if(Out.size() > 1 + NumFrames * sizeof(float)) {
+			Out.resize(1 + NumFrames * sizeof(float));
+			Out[0] = kVerbatim;
+			for(size_t i = 0; i < NumFrames; i++)
+				Put32(&Out[1 + i * sizeof(float)], (uint32_t)x[i]);
+		}
+	}
+
+	// Decode one channel into interleaved frames.
+	static void DecodeChannel(const uint8_t *pPayload, const size_t NumBytes, const size_t NumChannels, const size_t Channel, const size_t NumFrames, float *pFrames)
+	{
+		if(NumBytes < 1)
+			throw Exception("A lossless block is truncated");
+		const uint8_t Order = pPayload[0];
+		if(Order == kVerbatim) {
+			if(NumBytes < 1 + NumFrames * sizeof(float))
+				throw Exception("A lossless block is truncated");
+			for(size_t i = 0; i < NumFrames; i++)
+				pFrames[i * NumChannels + Channel] = OrderedToFloat((int32_t)Get32(pPayload + 1 + i * sizeof(float)));
+			return;
+		}
+		if(Order > kMaxOrder)
+			throw Exception("A lossless block has an unknown predictor order " + to_string(Order));
+
+		thread_local vector<int32_t> vSamples;
+		vSamples.resize(NumFrames);
+		int32_t *x = vSamples.data();
+		BitReader Bits(pPayload + 1, NumBytes - 1);
+		const size_t Warmup = min((size_t)Order, NumFrames);
+		for(size_t i = 0; i < Warmup; i++)
+			x[i] = (int32_t)(uint32_t)Bits.Get(32);
+		for(size_t Begin = Warmup; Begin < NumFrames; Begin += kPartitionSamples) {
+			const size_t End = min(Begin + kPartitionSamples, NumFrames);
+			const unsigned k = (unsigned)Bits.Get(kParamBits);
+			if(k > kMaxParam)
+				throw Exception("A lossless block has an invalid Rice parameter");
+			for(size_t i = Begin; i < End; i++) {
+				const unsigned q = Bits.Unary(kEscape);
+				const uint64_t Residual = (q < kEscape) ? (((uint64_t)q << k) | Bits.Get(k)) : Bits.Get(kEscapeBits);
+				x[i] = (int32_t)(UnZigZag(Residual) + Predict(x, i, Order));
+			}
+		}
+		for(size_t i = 0; i < NumFrames; i++)
+			pFrames[i * NumChannels + Channel] = OrderedToFloat(x[i]);
+	}
+
+	LosslessEncoder::LosslessEncoder(const string &Path, const int NumChannels, const double SampleRate_Hz, const LosslessEncoderConfig &Config) :
+		NumChannels_(NumChannels), SampleRate_Hz_(SampleRate_Hz), Config_(Config), Pool_(Config.NumWorkers, (size_t)max(NumChannels, 1))
+	{
+		if((NumChannels < 1) || (NumChannels > 0xffff))
+			throw Exception("A lossless encoder requires between 1 and 65535 channels");
+		if(!(SampleRate_Hz > 0.0))
+			throw Exception("A lossless encoder requires a positive sample rate");
+		if((Config_.BlockFrames < 1) || (Config_.BlockFrames > 0xffffffffu))
+			throw Exception("A lossless encoder requires a block of at least one frame");
+		File_.open(Path, ios::binary | ios::trunc);
+		if(!File_)
+			throw Exception("Could not create " + Path);
+
+		uint8_t Header[kHeaderBytes];
+		Put32(Header, kFileMagic);
+		Put16(Header + 4, kVersion);
+		Put16(Header + 6, (uint16_t)NumChannels_);
+		uint64_t RateBits;
+		memcpy(&RateBits, &SampleRate_Hz_, sizeof(RateBits));
+		Put64(Header + 8, RateBits);
+		Put32(Header + 16, (uint32_t)Config_.BlockFrames);
+		Write(Header, sizeof(Header));
+
+		vStaged_.resize(Config_.BlockFrames * NumChannels_);
+		vPayloads_.resize(NumChannels_);
+		for(vector<uint8_t> &Payload : vPayloads_)
+			Payload.reserve(1 + Config_.BlockFrames * sizeof(float));
+	}
+
+	LosslessEncoder::~LosslessEncoder()
+	{
+		try {
+			Finish();
+		}
+		catch(...) {
+		}
+	}
+
+	void LosslessEncoder::Encode(const float *pFrames, size_t NumFrames)
+	{
+		if(Draining())
+			throw Exception("Frames cannot be encoded directly while a buffer is being drained");
+		if(Finished_)
+			throw Exception("The lossless capture is finished");
+		while(NumFrames > 0) {
+			// Whole blocks are encoded straight from the caller's frames.
+			if(!StagedFrames_ && (NumFrames >= Config_.BlockFrames)) {
+				EncodeBlock(pFrames, Config_.BlockFrames);
+				pFrames += Config_.BlockFrames * NumChannels_;
+				NumFrames -= Config_.BlockFrames;
+				continue;
+			}
+			const size_t Taken = Stage(pFrames, NumFrames);
+			pFrames += Taken * NumChannels_;
+			NumFrames -= Taken;
+		}
+	}
+
+	size_t LosslessEncoder::Stage(const float *pFrames, const size_t NumFrames)
+	{
+		const size_t Taken = min(NumFrames, Config_.BlockFrames - StagedFrames_);
+		memcpy(&vStaged_[StagedFrames_ * NumChannels_], pFrames, Taken * NumChannels_ * sizeof(float));
+		StagedFrames_ += Taken;
+		if(StagedFrames_ == Config_.BlockFrames) {
+			EncodeBlock(vStaged_.data(), StagedFrames_);
+			StagedFrames_ = 0;
+		}
+		return Taken;
+	}
+
+	void LosslessEncoder::Start(QuickBuffer<float> &Source)
+	{
+		if(Draining())
+			throw Exception("The lossless encoder is already draining a buffer");
+		if(Finished_)
+			throw Exception("The lossless capture is finished");
+		StopDraining_.store(false, memory_order_relaxed);
+		pDrainError_ = nullptr;
+		Drainer_ = thread(&LosslessEncoder::DrainLoop, this, &Source);
+	}
+
+	void LosslessEncoder::Stop()
+	{
+		if(!Draining())
+			return;
+		StopDraining_.store(true, memory_order_release);
+		DrainWake_.Post();
+		Drainer_.join();
+		if(pDrainError_) {
+			exception_ptr pError = pDrainError_;
+			pDrainError_ = nullptr;
+			rethrow_exception(pError);
+		}
+	}
+
+	void LosslessEncoder::DrainLoop(QuickBuffer<float> *pSource)
+	{
+		QuickBuffer<float> &Source = *pSource;
+		const size_t BlockSamples = Config_.BlockFrames * NumChannels_;
+		// A buffer that cannot hold two blocks might never offer a whole one (the writer may stall on the wrap first),
+		// so it is staged as soon as any frames arrive.
+		const size_t WaitSamples = (Source.Size() >= 2 * BlockSamples) ? BlockSamples : NumChannels_;
+		try {
+			for(;;) {
+				size_t Available = 0;
+				const float *pRead = Source.ReadAcquire(Available, BlockSamples);
+				const size_t NumFrames = pRead ? Available / NumChannels_ : 0;
+				if(NumFrames >= Config_.BlockFrames) {
+					if(!StagedFrames_) {
+						EncodeBlock(pRead, Config_.BlockFrames);
+						Source.ReadRelease(BlockSamples);
+					}
+					else
+						Source.ReadRelease(Stage(pRead, NumFrames) * NumChannels_);
+					continue;
+				}
+				// Wait for a whole block (any frames of a small buffer), unless stopping, or the data only falls short by
+				// wrapping around the buffer.
+				const bool Stopping = StopDraining_.load(memory_order_acquire);
+				if(!Stopping && Source.NotifyWhenReadable(Notifier_, WaitSamples)) {
+					DrainWake_.Wait();
+					continue;
+				}
+				if(NumFrames > 0) {
+					Source.ReadRelease(Stage(pRead, NumFrames) * NumChannels_);
+					continue;
+				}
+				if(Stopping || !Source.IsOpen())
+					break;
+			}
+		}
+		catch(...) {
+			pDrainError_ = current_exception();
+		}
+		Source.CancelReadableNotify();
+	}
+
+	void LosslessEncoder::Finish()
+	{
+		if(Finished_)
+			return;
+		Stop();
+		if(StagedFrames_) {
+			EncodeBlock(vStaged_.data(), StagedFrames_);
+			StagedFrames_ = 0;
+		}
+		Finished_ = true;
+
+		vector<uint8_t> Index(8 + vIndex_.size() * kIndexEntryBytes + kTrailerBytes);
+		Put32(&Index[0], kIndexMagic);
+		Put32(&Index[4], (uint32_t)vIndex_.size());
+		uint8_t *p = &Index[8];
+		for(const IndexEntry &Entry : vIndex_) {
+			Put64(p, Entry.FirstFrame);
+			Put64(p + 8, Entry.Offset);
+			Put32(p + 16, Entry.NumFrames);
+			p += kIndexEntryBytes;
+		}
+		Put64(p, Offset_);
+		Put32(p + 8, kEndMagic);
+		Write(Index.data(), Index.size());
+		File_.close();
+		if(File_.fail())
+			throw Exception("Could not complete the lossless capture");
+	}
+
+	double LosslessEncoder::CompressionRatio() const
+	{
+		const uint64_t Written = BytesWritten();
+		return Written ? (double)RawBytes_.load(memory_order_relaxed) / (double)Written : 0.0;
+	}
+
+	void LosslessEncoder::Write(const void *pData, const size_t NumBytes)
+	{
+		File_.write((const char *)pData, (streamsize)NumBytes);
+		if(!File_)
+			throw Exception("Could not write the lossless capture");
+		Offset_ += NumBytes;
+		BytesWritten_.fetch_add(NumBytes, memory_order_relaxed);
+	}
+
+	void LosslessEncoder::EncodeBlock(const float *pFrames, const size_t NumFrames)
+	{
+		const auto Begin = chrono::steady_clock::now();
+
+		// Each channel is encoded into its own payload, so the channels need no scratch per thread.
+		Pool_.Run((size_t)NumChannels_, [&](const size_t Channel, const size_t) {
+			EncodeChannel(pFrames, NumChannels_, Channel, NumFrames, vPayloads_[Channel]);
+		});
+
+		const uint64_t FirstFrame = FramesEncoded();
+		vector<uint8_t> Header(kBlockHeaderBytes + NumChannels_ * sizeof(uint32_t));
+		Put32(&Header[0], kBlockMagic);
+		Put32(&Header[4], (uint32_t)NumFrames);
+		Put64(&Header[8], FirstFrame);
+		for(int Channel = 0; Channel < NumChannels_; Channel++)
+			Put32(&Header[kBlockHeaderBytes + Channel * sizeof(uint32_t)], (uint32_t)vPayloads_[Channel].size());
+		const uint64_t Offset = Offset_;
+		Write(Header.data(), Header.size());
+		for(const vector<uint8_t> &Payload : vPayloads_)
+			Write(Payload.data(), Payload.size());
+		vIndex_.push_back({FirstFrame, Offset, (uint32_t)NumFrames});
+
+		LosslessBlockStats Stats;
+		Stats.FirstFrame = FirstFrame;
+		Stats.NumFrames = (uint32_t)NumFrames;
+		Stats.RawBytes = NumFrames * NumChannels_ * sizeof(float);
+		Stats.EncodedBytes = Offset_ - Offset;
+		Stats.Encode_s = chrono::duration<double>(chrono::steady_clock::now() - Begin).count();
+		LastBlock_.Store(Stats);
+		RawBytes_.fetch_add(Stats.RawBytes, memory_order_relaxed);
+		FramesEncoded_.fetch_add(NumFrames, memory_order_relaxed);
+	}
+
+	LosslessDecoder::LosslessDecoder(const string &Path)
+	{
+		File_.open(Path, ios::binary);
+		if(!File_)
+			throw Exception("Could not open " + Path);
+		File_.seekg(0, ios::end);
+		const uint64_t FileSize = (uint64_t)File_.tellg();
+
+		uint8_t Header[kHeaderBytes];
+		if(FileSize < kHeaderBytes)
+			throw Exception(Path + " is not a lossless capture");
+		ReadAt(0, Header, sizeof(Header));
+		if(Get32(Header) != kFileMagic)
+			throw Exception(Path + " is not a lossless capture");
+		if(Get16(Header + 4) != kVersion)
+			throw Exception(Path + " has unsupported version " + to_string(Get16(Header + 4)));
+		NumChannels_ = Get16(Header + 6);
+		const uint64_t RateBits = Get64(Header + 8);
+		memcpy(&SampleRate_Hz_, &RateBits, sizeof(SampleRate_Hz_));
+		if(!NumChannels_)
+			throw Exception(Path + " is not a lossless capture");
+
+		// Use the index if the capture was finished, otherwise walk the blocks.
+		bool Indexed = false;
+		if(FileSize >= kHeaderBytes + 8 + kTrailerBytes) {
+			uint8_t Trailer[kTrailerBytes];
+			ReadAt(FileSize - kTrailerBytes, Trailer, sizeof(Trailer));
+			const uint64_t IndexOffset = Get64(Trailer);
+			if((Get32(Trailer + 8) == kEndMagic) && (IndexOffset >= kHeaderBytes) && (IndexOffset + 8 + kTrailerBytes <= FileSize)) {
+				vector<uint8_t> Index((size_t)(FileSize - kTrailerBytes - IndexOffset));
+				ReadAt(IndexOffset, Index.data(), Index.size());
+				const size_t NumBlocks = Get32(&Index[4]);
+				if((Get32(&Index[0]) == kIndexMagic) && (Index.size() == 8 + NumBlocks * kIndexEntryBytes)) {
+					vIndex_.resize(NumBlocks);
+					for(size_t Block = 0; Block < NumBlocks; Block++) {
+						const uint8_t *p = &Index[8 + Block * kIndexEntryBytes];
+						vIndex_[Block] = {Get64(p), Get64(p + 8), Get32(p + 16)};
+					}
+					Indexed = true;
+				}
+			}
+		}
+		if(!Indexed)
+			ScanBlocks(FileSize);
+		if(!vIndex_.empty())
+			NumFrames_ = vIndex_.back().FirstFrame + vIndex_.back().NumFrames;
+		Loaded_ = vIndex_.size();
+	}
+
+	void LosslessDecoder::ReadAt(const uint64_t Offset, void *pData, const size_t NumBytes)
+	{
+		File_.clear();
+		File_.seekg((streamoff)Offset);
+		File_.read((char *)pData, (streamsize)NumBytes);
+		if((size_t)File_.gcount() != NumBytes)
+			throw Exception("Could not read the lossless capture");
+	}
+
+	void LosslessDecoder::ScanBlocks(const uint64_t FileSize)
+	{
+		const size_t SizesBytes = NumChannels_ * sizeof(uint32_t);
+		vector<uint8_t> Header(kBlockHeaderBytes + SizesBytes);
+		uint64_t Offset = kHeaderBytes;
+		uint64_t NextFrame = 0;
+		while(Offset + Header.size() <= FileSize) {
+			ReadAt(Offset, Header.data(), Header.size());
+			if(Get32(&Header[0]) != kBlockMagic)
+				break;
+			const uint32_t NumFrames = Get32(&Header[4]);
+			const uint64_t FirstFrame = Get64(&Header[8]);
+			uint64_t End = Offset + Header.size();
+			for(int Channel = 0; Channel < NumChannels_; Channel++)
+				End += Get32(&Header[kBlockHeaderBytes + Channel * sizeof(uint32_t)]);
+			// A block cut short by the end of the capture is dropped.
+			if((End > FileSize) || (FirstFrame != NextFrame))
+				break;
+			vIndex_.push_back({FirstFrame, Offset, NumFrames});
+			NextFrame = FirstFrame + NumFrames;
+			Offset = End;
+		}
+	}
+
+	void LosslessDecoder::LoadBlock(const size_t Block)
+	{
+		const IndexEntry &Entry = vIndex_[Block];
+		const size_t SizesBytes = NumChannels_ * sizeof(uint32_t);
+		vector<uint8_t> Header(kBlockHeaderBytes + SizesBytes);
+		ReadAt(Entry.Offset, Header.data(), Header.size());
+		if((Get32(&Header[0]) != kBlockMagic) || (Get32(&Header[4]) != Entry.NumFrames))
+			throw Exception("Block " + to_string(Block) + " of the lossless capture is corrupt");
+		uint64_t PayloadBytes = 0;
+		for(int Channel = 0; Channel < NumChannels_; Channel++)
+			PayloadBytes += Get32(&Header[kBlockHeaderBytes + Channel * sizeof(uint32_t)]);
+		vPayload_.resize((size_t)PayloadBytes);
+		ReadAt(Entry.Offset + Header.size(), vPayload_.data(), vPayload_.size());
+
+		// Mark the block unloaded until it decodes in full.
+		Loaded_ = vIndex_.size();
+		vBlock_.resize((size_t)Entry.NumFrames * NumChannels_);
+		const uint8_t *p = vPayload_.data();
+		for(int Channel = 0; Channel < NumChannels_; Channel++) {
+			const uint32_t NumBytes = Get32(&Header[kBlockHeaderBytes + Channel * sizeof(uint32_t)]);
+			DecodeChannel(p, NumBytes, NumChannels_, Channel, Entry.NumFrames, vBlock_.data());
+			p += NumBytes;
+		}
+		Loaded_ = Block;
+	}
+
+	void LosslessDecoder::Seek(const uint64_t Frame)
+	{
+		if(Frame > NumFrames_)
+			throw Exception("Frame " + to_string(Frame) + " is beyond the end of the lossless capture");
+		Position_ = Frame;
+	}
+
+	size_t LosslessDecoder::Read(float *pFrames, const size_t NumFrames)
+	{
+		size_t Done = 0;
+		while((Done < NumFrames) && (Position_ < NumFrames_)) {
+			size_t Block = Loaded_;
+			if((Block >= vIndex_.size()) || (Position_ < vIndex_[Block].FirstFrame) || (Position_ >= vIndex_[Block].FirstFrame + vIndex_[Block].NumFrames)) {
+				const auto Next = upper_bound(vIndex_.begin(), vIndex_.end(), Position_, [](const uint64_t Frame, const IndexEntry &Entry) { return Frame < Entry.FirstFrame; });
+				Block = (size_t)(Next - vIndex_.begin()) - 1;
+				LoadBlock(Block);
+			}
+			const IndexEntry &Entry = vIndex_[Block];
+			const size_t Offset = (size_t)(Position_ - Entry.FirstFrame);
+			const size_t Count = min(NumFrames - Done, (size_t)Entry.NumFrames - Offset);
+			memcpy(pFrames + Done * NumChannels_, &vBlock_[Offset * NumChannels_], Count * NumChannels_ * sizeof(float));
+			Done += Count;
+			Position_ += Count;
+		}
+		return Done;
+	}
+
+}
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FastSemaphore.h"
+#include "QuickBuffer.h"
+#include "SeqLock.h"
+#include "TaskPool.h"
+
+namespace Audaptr
+{
+	/// @brief Settings for a LosslessEncoder
+	struct LosslessEncoderConfig
+	{
+		/// @brief Number of frames per block. Blocks are decoded independently, so this is also the seek granularity.
+		size_t BlockFrames = 4096;
+
+		/// @brief Number of worker threads encoding channels alongside the encoding thread; zero selects one less
+		/// than the hardware concurrency
+		size_t NumWorkers = 0;
+	};
+
+	/// @brief Size and cost of one encoded block
+	struct LosslessBlockStats
+	{
+		/// @brief Index of the first frame of the block
+		uint64_t FirstFrame = 0;
+
+		uint32_t NumFrames = 0;
+
+		/// @brief Size of the block as 32-bit floats [bytes]
+		uint64_t RawBytes = 0;
+
+		/// @brief Size of the block in the file, including its header [bytes]
+		uint64_t EncodedBytes = 0;
+
+		/// @brief Time taken to encode and write the block [seconds]
+		double Encode_s = 0.0;
+
+		/// @brief Compression ratio of the block (raw size over encoded size)
+		double Ratio() const { return EncodedBytes ? (double)RawBytes / (double)EncodedBytes : 0.0; }
+	};
+
+	/// @brief Lossless encoder of interleaved 32-bit float audio into a seekable framed file, for long captures.
+	/// Each channel of a block is mapped bit-exactly onto ordered integers, whitened by the best of four fixed
+	/// polynomial predictors, and Rice coded in partitions with their own parameters; the channels of a block are
+	/// encoded in parallel on a TaskPool. Blocks are self-contained, and an index written by Finish()
+	/// makes the file seekable (LosslessDecoder rebuilds it by scanning if the capture was cut short).
+	/// Frames are supplied either by Encode(), or by a background thread draining a QuickBuffer such as
+	/// AudIO::InBuffer() after Start().
+	class LosslessEncoder
+	{
+	public:
+		/// @brief Constructor, creating the file
+		/// @param Path Path of the file to write
+		/// @param NumChannels Number of interleaved channels
+		/// @param SampleRate_Hz Sample rate recorded in the file [hertz]
+		/// @param Config Encoding settings
+		LosslessEncoder(const std::string& Path, const int NumChannels, const double SampleRate_Hz, const LosslessEncoderConfig& Config = LosslessEncoderConfig());
+
+		/// @brief Destructor, stopping any draining and finishing the file
+		~LosslessEncoder();
+
+		LosslessEncoder(const LosslessEncoder&) = delete;
+		LosslessEncoder& operator=(const LosslessEncoder&) = delete;
+
+		/// @brief Encode frames, buffering any partial block. Not valid while draining a buffer.
+		/// @param pFrames Interleaved frames
+		/// @param NumFrames Number of frames
+		void Encode(const float* pFrames, size_t NumFrames);
+
+		/// @brief Start a thread draining a buffer into the file, whole blocks at a time, until Stop() is called or
+		/// the buffer is closed and empty. Full contiguous blocks are encoded in place, without a copy; the frames of a
+		/// buffer too small to hold two blocks are staged into blocks as they arrive.
+		/// @param Source Buffer of interleaved frames, written a whole number of frames at a time; the caller must
+		/// keep it alive until Stop()
+		void Start(QuickBuffer<float>& Source);
+
+		/// @brief Stop draining, after encoding whatever the buffer holds. Rethrows any error met while draining.
+		void Stop();
+
+		/// @brief Flag indicating whether a buffer is being drained
+		bool Draining() const { return Drainer_.joinable(); }
+
+		/// @brief Encode any partial block, write the index and close the file. Implied by the destructor.
+		void Finish();
+
+		int NumChannels() const { return NumChannels_; }
+
+		/// @brief Number of frames encoded so far; safe to call from any thread
+		uint64_t FramesEncoded() const { return FramesEncoded_.load(std::memory_order_relaxed); }
+
+		/// @brief Number of bytes written so far; safe to call from any thread
+		uint64_t BytesWritten() const { return BytesWritten_.load(std::memory_order_relaxed); }
+
+		/// @brief Overall compression ratio so far (raw size over encoded size)
+		double CompressionRatio() const;
+
+		/// @brief Statistics of the most recently written block; safe to call from any thread
+		LosslessBlockStats LastBlock() const { return LastBlock_.Load(); }
+
+	protected:
+		/// Receives readiness notifications from the drained buffer
+		class DrainNotifier : public BufferNotifier
+		{
+		public:
+			explicit DrainNotifier(FastSemaphore& Wake) : Wake_(Wake) {}
+
+			void Notify() noexcept override { Wake_.Post(); }
+
+		private:
+			FastSemaphore& Wake_;
+		};
+
+		/// Location of a block in the file
+		struct IndexEntry
+		{
+			uint64_t FirstFrame;
+
+			uint64_t Offset;
+
+			uint32_t NumFrames;
+		};
+
+		void EncodeBlock(const float* pFrames, const size_t NumFrames);
+
+		void Write(const void* pData, const size_t NumBytes);
+
+		void DrainLoop(QuickBuffer<float>* pSource);
+
+		/// Append whole frames to the partial block, encoding it once full; returns the number of frames taken
+		size_t Stage(const float* pFrames, const size_t NumFrames);
+
+		int NumChannels_;
+
+		double SampleRate_Hz_;
+
+		LosslessEncoderConfig Config_;
+
+		std::ofstream File_;
+
+		uint64_t Offset_ = 0;
+
+		std::vector<IndexEntry> vIndex_;
+
+		/// Partial block, as interleaved frames
+		std::vector<float> vStaged_;
+
+		size_t StagedFrames_ = 0;
+
+		/// Encoded payload of each channel of the current block
+		std::vector<std::vector<uint8_t>> vPayloads_;
+
+		std::atomic<uint64_t> FramesEncoded_{0};
+
+		std::atomic<uint64_t> BytesWritten_{0};
+
+		std::atomic<uint64_t> RawBytes_{0};
+
+		SeqLock<LosslessBlockStats> LastBlock_;
+
+		/// Encodes the channels of each block
+		TaskPool Pool_;
+
+		// Draining
+		std::thread Drainer_;
+
+		std::atomic<bool> StopDraining_{false};
+
+		std::exception_ptr pDrainError_;
+
+		FastSemaphore DrainWake_;
+
+		DrainNotifier Notifier_{DrainWake_};
+
+		bool Finished_ = false;
+	};
+
+	/// @brief Decoder of files written by LosslessEncoder, with random access by frame
+	class LosslessDecoder
+	{
+	public:
+		/// @brief Constructor, opening the file and loading (or, for a file that was not finished, rebuilding) its index
+		/// @param Path Path of the file to read
+		explicit LosslessDecoder(const std::string& Path);
+
+		int NumChannels() const { return NumChannels_; }
+
+		double SampleRate_Hz() const { return SampleRate_Hz_; }
+
+		/// @brief Number of frames in the file
+		uint64_t NumFrames() const { return NumFrames_; }
+
+		/// @brief Number of blocks in the file
+		size_t NumBlocks() const { return vIndex_.size(); }
+
+		/// @brief Move the read position
+		/// @param Frame Index of the next frame to read
+		void Seek(const uint64_t Frame);
+
+		/// @brief Index of the next frame to read
+		uint64_t Position() const { return Position_; }
+
+		/// @brief Decode frames from the read position
+		/// @param pFrames Destination of up to NumFrames interleaved frames
+		/// @param NumFrames Number of frames wanted
+		/// @return Number of frames decoded, fewer than NumFrames only at the end of the file
+		size_t Read(float* pFrames, const size_t NumFrames);
+
+	protected:
+		struct IndexEntry
+		{
+			uint64_t FirstFrame;
+
+			uint64_t Offset;
+
+			uint32_t NumFrames;
+		};
+
+		/// Rebuild the index by walking the block headers
+		void ScanBlocks(const uint64_t FileSize);
+
+		void ReadAt(const uint64_t Offset, void* pData, const size_t NumBytes);
+
+		void LoadBlock(const size_t Block);
+
+		std::ifstream File_;
+
+		int NumChannels_ = 0;
+
+		double SampleRate_Hz_ = 0.0;
+
+		uint64_t NumFrames_ = 0;
+
+		uint64_t Position_ = 0;
+
+		std::vector<IndexEntry> vIndex_;
+
+		/// Block currently decoded, or NumBlocks() if none
+		size_t Loaded_ = 0;
+
+		std::vector<float> vBlock_;
+
+		std::vector<uint8_t> vPayload_;
+	};
+
+}
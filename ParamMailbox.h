@@ -0,0 +1,233 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/// @brief Triple buffer passing the latest value of a (possibly large) parameter set from one control thread to one
+/// real-time thread. Neither side ever waits or allocates: the writer fills a spare copy and swaps it in, and the
+/// reader swaps the newest copy out, so that each side always owns one copy outright and intermediate values may be
+/// skipped. Assigning T is the writer's cost, so T may own memory (e.g. a vector of gains) provided the assignment
+/// does not reallocate once the sizes settle.
+/// @tparam T The type of value passed
+template<typename T> class TripleBuffer {
+#if((defined(_MSVC_LANG) && _MSVC_LANG >= 201703L) || __cplusplus >= 201703L)
+    static constexpr size_t kCacheLineSize{std::hardware_destructive_interference_size};
+#else
+    static constexpr size_t kCacheLineSize{64};
+#endif
+    // Set in the shared index when its copy has not yet been taken by the reader
+    static constexpr uint8_t kNew = 4;
+public:
+    TripleBuffer() : TripleBuffer(T()) {}
+
+    explicit TripleBuffer(const T& Value) { Reset(Value); }
+
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    /// @brief Set all copies to a value, discarding anything unread. Only valid while neither side is in use.
+    void Reset(const T& Value)
+    {
+        for(Slot& Copy : Slots_)
+            Copy.Value = Value;
+        WriteIdx_ = 0;
+        Shared_.store(1, std::memory_order_relaxed);
+        ReadIdx_ = 2;
+    }
+
+    /// @brief Publish a value. Only one thread may store.
+    inline void Store(const T& Value)
+    {
+        Slots_[WriteIdx_].Value = Value;
+        WriteIdx_ = Shared_.exchange(WriteIdx_ | kNew, std::memory_order_acq_rel) & ~kNew;
+    }
+
+    /// @brief Take the newest published value, if one arrived since the last update. Only one thread may update.
+    /// @return true if Read() now returns a newer value
+    inline bool Update() noexcept
+    {
+        if(!(Shared_.load(std::memory_order_relaxed) & kNew))
+            return false;
+        ReadIdx_ = Shared_.exchange(ReadIdx_, std::memory_order_acq_rel) & ~kNew;
+        return true;
+    }
+
+    /// @brief The value taken by the last update; it stays valid and unchanged until the next update
+    inline const T& Read() const noexcept { return Slots_[ReadIdx_].Value; }
+
+    /// @brief Take the newest published value, if any, and read it
+    inline const T& Load() noexcept
+    {
+        Update();
+        return Read();
+    }
+
+private:
+    struct alignas(kCacheLineSize) Slot {
+        T Value;
+    };
+
+    Slot Slots_[3];
+
+    /// Copy owned by the writer
+    alignas(kCacheLineSize) uint8_t WriteIdx_;
+
+    /// Copy in transit, with kNew set if it has not been read
+    alignas(kCacheLineSize) std::atomic<uint8_t> Shared_;
+
+    /// Copy owned by the reader
+    alignas(kCacheLineSize) uint8_t ReadIdx_;
+};
+
+/// @brief Single small parameter (e.g. a gain or a flag) exchanged through one lockfree atomic word, so that any
+/// number of threads may load and store it without waiting. Larger values belong in a TripleBuffer or a SeqLock.
+/// @tparam T The type of value exchanged. It must be trivially copyable and lockfree as a std::atomic.
+template<typename T> class AtomicSnapshot {
+    static_assert(std::is_trivially_copyable<T>::value, "The snapshot type T must be trivially copyable.");
+    static_assert(std::atomic<T>::is_always_lock_free, "The snapshot type T must be lockfree; use TripleBuffer or SeqLock instead.");
+public:
+    AtomicSnapshot() : Value_(T()) {}
+
+    explicit AtomicSnapshot(const T& Value) : Value_(Value) {}
+
+    AtomicSnapshot(const AtomicSnapshot&) = delete;
+    AtomicSnapshot& operator=(const AtomicSnapshot&) = delete;
+
+    inline void Store(const T& Value) noexcept { Value_.store(Value, std::memory_order_release); }
+
+    inline T Load() const noexcept { return Value_.load(std::memory_order_acquire); }
+
+private:
+    std::atomic<T> Value_;
+};
+
+/// @brief Mailbox handing immutable parameter sets from one control thread to real-time threads, with the old
+/// sets reclaimed on the control thread once no reader can see them. Each reader guards the set it uses with its
+/// own hazard pointer between Acquire() and Release(), so it never blocks, allocates or frees; the writer
+/// allocates each new set, and frees the retired ones in Collect(), which Publish() calls.
+/// Use it where a value is too costly to copy on every change, or where the writer must know when the readers have
+/// finished with an old value (e.g. before destroying an object that the old value points to).
+/// @tparam T The type of parameter set
+/// @tparam NumReaders Number of reader threads, each identified by an index below NumReaders
+template<typename T, size_t NumReaders = 1> class ParamMailbox {
+#if((defined(_MSVC_LANG) && _MSVC_LANG >= 201703L) || __cplusplus >= 201703L)
+    static constexpr size_t kCacheLineSize{std::hardware_destructive_interference_size};
+#else
+    static constexpr size_t kCacheLineSize{64};
+#endif
+    static_assert(NumReaders > 0, "A mailbox needs at least one reader.");
+public:
+    /// @brief Acquire() and Release() for a scope, so that the set is released if the reader throws
+    class Guard {
+    public:
+        Guard(ParamMailbox& Mailbox, const size_t Reader = 0) noexcept :
+            Mailbox_(Mailbox), Reader_(Reader), pValue_(Mailbox.Acquire(Reader)) {}
+
+        ~Guard() { Mailbox_.Release(Reader_); }
+
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+        const T* operator->() const noexcept { return pValue_; }
+
+        const T& operator*() const noexcept { return *pValue_; }
+
+    private:
+        ParamMailbox& Mailbox_;
+        const size_t Reader_;
+        const T* pValue_;
+    };
+
+    /// @brief Constructor
+    /// @param pInitial Initial parameter set, which must not be null
+    explicit ParamMailbox(std::unique_ptr<T> pInitial) : pCurrent_(pInitial.release()) {}
+
+    ParamMailbox() : ParamMailbox(std::make_unique<T>()) {}
+
+    ParamMailbox(const ParamMailbox&) = delete;
+    ParamMailbox& operator=(const ParamMailbox&) = delete;
+
+    /// @brief Destructor. The readers must have released their sets.
+    ~ParamMailbox()
+    {
+        for(T* pRetired : vRetired_)
+            delete pRetired;
+        delete pCurrent_.load(std::memory_order_relaxed);
+    }
+
+    /// @brief Replace the parameter set, retiring the previous one. Only one thread may publish.
+    /// @param pValue New parameter set, which must not be null
+    void Publish(std::unique_ptr<T> pValue)
+    {
+        vRetired_.push_back(pCurrent_.exchange(pValue.release(), std::memory_order_seq_cst));
+        Collect();
+    }
+
+    /// @brief Free the retired sets that no reader can be using. Only valid on the publishing thread.
+    /// @return true if no retired set remains
+    bool Collect()
+    {
+        const T* pHazards[NumReaders];
+        for(size_t Reader = 0; Reader < NumReaders; Reader++)
+            pHazards[Reader] = Hazards_[Reader].pValue.load(std::memory_order_seq_cst);
+        size_t NumKept = 0;
+        for(T* pRetired : vRetired_) {
+            if(std::find(pHazards, pHazards + NumReaders, pRetired) != pHazards + NumReaders)
+                vRetired_[NumKept++] = pRetired;
+            else
+                delete pRetired;
+        }
+        vRetired_.resize(NumKept);
+        return NumKept == 0;
+    }
+
+    /// @brief Wait until the readers have released every retired set, so that whatever they refer to may be destroyed.
+    /// Only valid on the publishing thread; it returns at once if no reader is between Acquire and Release.
+    void Synchronize()
+    {
+        while(!Collect())
+            std::this_thread::yield();
+    }
+
+    /// @brief The parameter set last published, as seen by the writer
+    const T& Current() const { return *pCurrent_.load(std::memory_order_relaxed); }
+
+    /// @brief Obtain the current parameter set and protect it from reclamation until Release. Only one thread at a
+    /// time may acquire as each reader; it retries only if a set is published at the same moment.
+    /// @param Reader Index of the reader
+    inline const T* Acquire(const size_t Reader = 0) noexcept
+    {
+        T* pValue = pCurrent_.load(std::memory_order_acquire);
+        for(;;) {
+            Hazards_[Reader].pValue.store(pValue, std::memory_order_seq_cst);
+            // The set is safe once it is seen to be current after the hazard was published.
+            T* pCheck = pCurrent_.load(std::memory_order_seq_cst);
+            if(pCheck == pValue)
+                return pValue;
+            pValue = pCheck;
+        }
+    }
+
+    /// @brief Allow the set obtained by Acquire to be reclaimed
+    /// @param Reader Index of the reader
+    inline void Release(const size_t Reader = 0) noexcept { Hazards_[Reader].pValue.store(nullptr, std::memory_order_release); }
+
+private:
+    struct alignas(kCacheLineSize) Hazard {
+        /// Set in use by the reader, or nullptr
+        std::atomic<const T*> pValue{nullptr};
+    };
+
+    std::atomic<T*> pCurrent_;
+
+    Hazard Hazards_[NumReaders];
+
+    /// Sets replaced but not yet freed; owned by the writer
+    std::vector<T*> vRetired_;
+};
@@ -0,0 +1,377 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "ProcessGraph.h"
+
+using namespace std;
+
+namespace Audaptr
+{
+	// Number of unsuccessful attempts to find work before a worker parks.
+	static constexpr int kSpinLimit = 64;
+
+	ProcessGraph::ProcessGraph(const size_t FramesPerBlock, size_t NumWorkers) :
+		FramesPerBlock_(FramesPerBlock), NumWorkers_(NumWorkers)
+	{
+		if(FramesPerBlock_ == 0)
+			throw Exception("Number of frames per block should be greater than zero");
+		if(NumWorkers_ == 0)
+			NumWorkers_ = max(1u, thread::hardware_concurrency());
+	}
+
+	ProcessGraph::~ProcessGraph()
+	{
+		Stop();
+	}
+
+	size_t ProcessGraph::AddNode(unique_ptr<ProcessNode> pNode)
+	{
+		if(Running())
+			throw Exception("Nodes cannot be added to a running graph");
+		if(!pNode)
+			throw Exception("Node should not be null");
+		auto pState = make_unique<NodeState>();
+		pState->Inputs.resize(pNode->InputChannels_.size(), nullptr);
+		pState->Outputs.resize(pNode->OutputChannels_.size());
+		pState->InputPtrs.resize(pNode->InputChannels_.size(), nullptr);
+		pState->OutputPtrs.resize(pNode->OutputChannels_.size(), nullptr);
+		pState->External = pNode->InputChannels_.empty();
+		pState->pNode = std::move(pNode);
+		Nodes_.emplace_back(std::move(pState));
+		return Nodes_.size() - 1;
+	}
+
+	void ProcessGraph::Connect(size_t FromNode, size_t FromPort, size_t ToNode, size_t ToPort, size_t CapacityBlocks)
+	{
+		if(Running())
+			throw Exception("Nodes cannot be connected in a running graph");
+		if((FromNode >= Nodes_.size()) || (ToNode >= Nodes_.size()))
+			throw Exception("Node identifier out of range");
+		NodeState &From = *Nodes_[FromNode], &To = *Nodes_[ToNode];
+		if((FromPort >= From.Outputs.size()) || (ToPort >= To.Inputs.size()))
+			throw Exception("Port index out of range");
+		if(To.Inputs[ToPort])
+			throw Exception("Input port is already connected");
+		const size_t Channels = From.pNode->OutputChannels_[FromPort];
+		if(Channels != To.pNode->InputChannels_[ToPort])
+			throw Exception("Channel count mismatch between connected ports");
+
+		// A whole number of blocks keeps every block contiguous; one spare block, since a full QuickBuffer holds one free item.
+		auto pEdge = make_unique<Edge>();
+		pEdge->pOwned = make_unique<QuickBuffer<float>>((max<size_t>(CapacityBlocks, 1) + 1) * FramesPerBlock_ * Channels);
+		pEdge->pBuffer = pEdge->pOwned.get();
+		pEdge->Channels = Channels;
+		From.Outputs[FromPort].push_back(pEdge.get());
+		To.Inputs[ToPort] = pEdge.get();
+		if(find(From.Neighbours.begin(), From.Neighbours.end(), &To) == From.Neighbours.end())
+			From.Neighbours.push_back(&To);
+		if(find(To.Neighbours.begin(), To.Neighbours.end(), &From) == To.Neighbours.end())
+			To.Neighbours.push_back(&From);
+		Edges_.emplace_back(std::move(pEdge));
+	}
+
+	void ProcessGraph::ConnectInput(QuickBuffer<float> &Source, size_t ToNode, size_t ToPort)
+	{
+		if(Running())
+			throw Exception("Nodes cannot be connected in a running graph");
+		if(ToNode >= Nodes_.size())
+			throw Exception("Node identifier out of range");
+		NodeState &To = *Nodes_[ToNode];
+		if(ToPort >= To.Inputs.size())
+			throw Exception("Port index out of range");
+		if(To.Inputs[ToPort])
+			throw Exception("Input port is already connected");
+		auto pEdge = make_unique<Edge>();
+		pEdge->pBuffer = &Source;
+		pEdge->Channels = To.pNode->InputChannels_[ToPort];
+		pEdge->vStaging.resize(FramesPerBlock_ * pEdge->Channels);
+		To.Inputs[ToPort] = pEdge.get();
+		To.External = true;
+		Edges_.emplace_back(std::move(pEdge));
+	}
+
+	void ProcessGraph::ConnectOutput(size_t FromNode, size_t FromPort, QuickBuffer<float> &Sink)
+	{
+		if(Running())
+			throw Exception("Nodes cannot be connected in a running graph");
+		if(FromNode >= Nodes_.size())
+			throw Exception("Node identifier out of range");
+		NodeState &From = *Nodes_[FromNode];
+		if(FromPort >= From.Outputs.size())
+			throw Exception("Port index out of range");
+		auto pEdge = make_unique<Edge>();
+		pEdge->pBuffer = &Sink;
+		pEdge->Channels = From.pNode->OutputChannels_[FromPort];
+		From.Outputs[FromPort].push_back(pEdge.get());
+		From.External = true;
+		Edges_.emplace_back(std::move(pEdge));
+	}
+
+	void ProcessGraph::SetRealTimeConfig(const RealTimeConfig &Config)
+	{
+		if(Running())
+			throw Exception("The real-time configuration cannot be changed while the graph is running");
+		pRealTimeConfig_ = make_unique<RealTimeConfig>(Config);
+	}
+
+	void ProcessGraph::Start()
+	{
+		if(Running())
+			return;
+		for(auto &&pState : Nodes_) {
+			for(size_t Port = 0; Port < pState->Inputs.size(); Port++)
+				if(!pState->Inputs[Port])
+					throw Exception("Input port " + to_string(Port) + " of node is not connected");
+			for(size_t Port = 0; Port < pState->Outputs.size(); Port++)
+				if(pState->Outputs[Port].empty())
+					throw Exception("Output port " + to_string(Port) + " of node is not connected");
+			pState->Queued.store(false, memory_order_relaxed);
+		}
+		for(auto &&pEdge : Edges_) {
+			if(pEdge->pOwned) {
+				if(pRealTimeConfig_ && pRealTimeConfig_->PrefaultBuffers)
+					pEdge->pOwned->Prefault();
+				pEdge->pOwned->Open();
+			}
+		}
+
+		// Each node is queued at most once, so a deque never holds more than the number of nodes.
+		Deques_.clear();
+		for(size_t Worker = 0; Worker < NumWorkers_; Worker++)
+			Deques_.emplace_back(make_unique<WorkStealingDeque<NodeState *>>(max<size_t>(Nodes_.size(), 1)));
+		Running_.store(true, memory_order_release);
+		Pending_.store(true, memory_order_release);
+		WorkerReports_.assign(NumWorkers_, RealTimeReport());
+		for(size_t Worker = 0; Worker < NumWorkers_; Worker++)
+			Workers_.emplace_back(&ProcessGraph::WorkerLoop, this, Worker);
+		for(size_t Worker = 0; Worker < NumWorkers_; Worker++)
+			WorkersConfigured_.Wait();
+	}
+
+	void ProcessGraph::Stop()
+	{
+		if(!Running_.exchange(false))
+			return;
+		for(size_t Worker = 0; Worker < Workers_.size(); Worker++)
+			Wake_.Post();
+		for(auto &&Worker : Workers_)
+			Worker.join();
+		Workers_.clear();
+		for(auto &&pEdge : Edges_)
+			if(pEdge->pOwned)
+				pEdge->pOwned->Close();
+	}
+
+	void ProcessGraph::Notify() noexcept
+	{
+		Pending_.store(true, memory_order_release);
+		Wake();
+	}
+
+	NodeStats ProcessGraph::Stats(size_t Node) const
+	{
+		if(Node >= Nodes_.size())
+			throw Exception("Node identifier out of range");
+		const NodeState &State = *Nodes_[Node];
+		NodeStats ToReturn;
+		ToReturn.Blocks = State.Blocks.load(memory_order_relaxed);
+		ToReturn.ProcessTime_s = 1e-9 * (double)State.Time_ns.load(memory_order_relaxed);
+		ToReturn.MaxBlockTime_s = 1e-9 * (double)State.MaxTime_ns.load(memory_order_relaxed);
+		return ToReturn;
+	}
+
+	void ProcessGraph::ResetStats()
+	{
+		for(auto &&pState : Nodes_) {
+			pState->Blocks.store(0, memory_order_relaxed);
+			pState->Time_ns.store(0, memory_order_relaxed);
+			pState->MaxTime_ns.store(0, memory_order_relaxed);
+		}
+	}
+
+	void ProcessGraph::Wake() noexcept
+	{
+		// Pairs with the fence in WorkerLoop, so that either the sleeper sees the new work or it is counted here.
+		atomic_thread_fence(memory_order_seq_cst);
+		if(Sleepers_.load(memory_order_relaxed) > 0)
+			Wake_.Post();
+	}
+
+	bool ProcessGraph::AnyWork() const
+	{
+		if(Pending_.load(memory_order_acquire))
+			return true;
+		for(auto &&pDeque : Deques_)
+			if(!pDeque->Empty())
+				return true;
+		return false;
+	}
+
+	bool ProcessGraph::FindWork(size_t Worker, NodeState *&pState)
+	{
+		if(Deques_[Worker]->Pop(pState))
+			return true;
+		// Steal from the other workers, starting with the neighbour, to spread contention.
+		for(size_t n = 1; n < NumWorkers_; n++)
+			if(Deques_[(Worker + n) % NumWorkers_]->Steal(pState))
+				return true;
+		return false;
+	}
+
+	void ProcessGraph::WorkerLoop(size_t Worker)
+	{
+		AUDAPTR_TRACE_THREAD("ProcessGraph worker");
+		if(pRealTimeConfig_) {
+			RealTimeConfig Config = *pRealTimeConfig_;
+			if(!Config.Cpus.empty())
+				Config.Cpus = {Config.Cpus[Worker % Config.Cpus.size()]};
+			ConfigureCurrentThread(Config, WorkerReports_[Worker]);
+			if(Config.LockMemory && (Worker == 0))
+				LockProcessMemory(WorkerReports_[Worker]);
+		}
+		WorkersConfigured_.Post();
+
+		int Spins = 0;
+		while(Running_.load(memory_order_acquire)) {
+			NodeState *pState = nullptr;
+			if(FindWork(Worker, pState)) {
+				Spins = 0;
+				const bool Ran = RunNode(*pState);
+				pState->Queued.store(false, memory_order_release);
+				// Running the node may have made it, its producers or its consumers ready.
+				// A node that could not run is rescheduled by a neighbour or by Notify() once it makes progress.
+				if(Ran)
+					TrySchedule(Worker, *pState);
+				for(auto &&pNeighbour : pState->Neighbours)
+					TrySchedule(Worker, *pNeighbour);
+				continue;
+			}
+			if(Pending_.exchange(false, memory_order_acq_rel)) {
+				Spins = 0;
+				for(auto &&pNode : Nodes_)
+					if(pNode->External)
+						TrySchedule(Worker, *pNode);
+				continue;
+			}
+			if(++Spins < kSpinLimit) {
+				this_thread::yield();
+				continue;
+			}
+			Spins = 0;
+			Sleepers_.fetch_add(1, memory_order_relaxed);
+			atomic_thread_fence(memory_order_seq_cst);
+			if(!AnyWork() && Running_.load(memory_order_acquire))
+				Wake_.Wait();
+			Sleepers_.fetch_sub(1, memory_order_relaxed);
+		}
+	}
+
+	bool ProcessGraph::Ready(const NodeState &State) const
+	{
+		for(auto &&pEdge : State.Inputs)
+			if(pEdge->pBuffer->ReadableCount() + pEdge->Staged.load(memory_order_relaxed) < FramesPerBlock_ * pEdge->Channels)
+				return false;
+		for(auto &&vpEdges : State.Outputs)
+			for(auto &&pEdge : vpEdges)
+				if(pEdge->pBuffer->WritableCount() < FramesPerBlock_ * pEdge->Channels)
+					return false;
+		return true;
+	}
+
+	void ProcessGraph::TrySchedule(size_t Worker, NodeState &State)
+	{
+		if(!Ready(State) || State.Queued.exchange(true, memory_order_acq_rel))
+			return;
+		if(Deques_[Worker]->Push(&State))
+			Wake();
+		else
+			State.Queued.store(false, memory_order_release);
+	}
+
+	const float *ProcessGraph::AcquireInput(Edge &In)
+	{
+		const size_t NumItems = FramesPerBlock_ * In.Channels;
+		size_t Staged = In.Staged.load(memory_order_relaxed);
+		size_t Available = 0;
+		const float *pRead = nullptr;
+		if(!Staged) {
+			pRead = In.pBuffer->ReadAcquire(Available, NumItems);
+			if(pRead && (Available >= NumItems))
+				return pRead;
+			// Internal edges are written in whole blocks, so only an external ring can leave a short tail.
+			if(!pRead || In.pOwned)
+				return nullptr;
+		}
+		// Copy the tail and the wrapped start, as QuickBuffer::Read does; what is copied stays staged across retries.
+		while(Staged < NumItems) {
+			if(!pRead)
+				pRead = In.pBuffer->ReadAcquire(Available, NumItems - Staged);
+			if(!pRead) {
+				In.Staged.store(Staged, memory_order_relaxed);
+				return nullptr;
+			}
+			const size_t Count = min(Available, NumItems - Staged);
+			memcpy(In.vStaging.data() + Staged, pRead, Count * sizeof(float));
+			In.pBuffer->ReadRelease(Count);
+			Staged += Count;
+			pRead = nullptr;
+		}
+		In.Staged.store(Staged, memory_order_relaxed);
+		return In.vStaging.data();
+	}
+
+	bool ProcessGraph::RunNode(NodeState &State)
+	{
+		// Acquire contiguous regions on every edge; if any is unavailable the node is retried once it is rescheduled.
+		for(size_t Port = 0; Port < State.Inputs.size(); Port++) {
+			Edge &In = *State.Inputs[Port];
+			const float *pRead = AcquireInput(In);
+			if(!pRead)
+				return false;
+			State.InputPtrs[Port] = pRead;
+		}
+		for(size_t Port = 0; Port < State.Outputs.size(); Port++) {
+			for(auto &&pEdge : State.Outputs[Port]) {
+				float *pWrite = pEdge->pBuffer->WriteReserve(FramesPerBlock_ * pEdge->Channels);
+				if(!pWrite)
+					return false;
+				// The first edge receives the node output; further fan-out edges are copied from it.
+				if(pEdge == State.Outputs[Port].front())
+					State.OutputPtrs[Port] = pWrite;
+			}
+		}
+
+		const auto Begin = chrono::steady_clock::now();
+		{
+			AUDAPTR_TRACE_SCOPE("ProcessGraph node");
+			State.pNode->Process(State.InputPtrs.data(), State.OutputPtrs.data(), FramesPerBlock_);
+		}
+		const uint64_t Time_ns = (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - Begin).count();
+
+		for(size_t Port = 0; Port < State.Outputs.size(); Port++) {
+			const auto &vpEdges = State.Outputs[Port];
+			const size_t NumItems = FramesPerBlock_ * vpEdges.front()->Channels;
+			for(size_t n = 1; n < vpEdges.size(); n++) {
+				memcpy(vpEdges[n]->pBuffer->WriteReserve(NumItems), State.OutputPtrs[Port], NumItems * sizeof(float));
+				vpEdges[n]->pBuffer->WriteCommit(NumItems);
+			}
+			vpEdges.front()->pBuffer->WriteCommit(NumItems);
+		}
+		for(auto &&pEdge : State.Inputs) {
+			// A staged block has already been released from the ring.
+			if(pEdge->Staged.load(memory_order_relaxed))
+				pEdge->Staged.store(0, memory_order_relaxed);
+			else
+				pEdge->pBuffer->ReadRelease(FramesPerBlock_ * pEdge->Channels);
+		}
+
+		// Only the worker running this node updates its statistics.
+		State.Blocks.store(State.Blocks.load(memory_order_relaxed) + 1, memory_order_relaxed);
+		State.Time_ns.store(State.Time_ns.load(memory_order_relaxed) + Time_ns, memory_order_relaxed);
+		if(Time_ns > State.MaxTime_ns.load(memory_order_relaxed))
+			State.MaxTime_ns.store(Time_ns, memory_order_relaxed);
+		return true;
+	}
+
+}
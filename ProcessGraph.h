@@ -0,0 +1,229 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "Audaptr.h"
+#include "FastSemaphore.h"
+#include "QuickBuffer.h"
+#include "RealTime.h"
+#include "WorkStealingDeque.h"
+
+namespace Audaptr
+{
+	/// @brief Processing statistics gathered for a node in a ProcessGraph
+	struct NodeStats
+	{
+		/// @brief Number of blocks processed
+		uint64_t Blocks = 0;
+
+		/// @brief Total time spent processing [seconds]
+		double ProcessTime_s = 0.0;
+
+		/// @brief Longest time spent processing a single block [seconds]
+		double MaxBlockTime_s = 0.0;
+	};
+
+	/// @brief A processing stage within a ProcessGraph.
+	/// Each node declares a number of interleaved input and output ports, given by their channel counts.
+	/// A node is run whenever a full block is available on every input and a full block may be written to every output.
+	/// A node is never run concurrently with itself, but successive blocks may be processed on different worker threads.
+	class ProcessNode
+	{
+	public:
+		/// @brief Constructor
+		/// @param InputChannels Number of interleaved channels for each input port
+		/// @param OutputChannels Number of interleaved channels for each output port
+		ProcessNode(std::vector<size_t> InputChannels, std::vector<size_t> OutputChannels) :
+			InputChannels_(std::move(InputChannels)), OutputChannels_(std::move(OutputChannels))
+		{
+		}
+
+		virtual ~ProcessNode() = default;
+
+		/// @brief Process one block. Called from a worker thread; do not block.
+		/// @param ppInputs Interleaved samples for each input port
+		/// @param ppOutputs Interleaved samples to be written for each output port
+		/// @param NumFrames Number of frames in the block
+		virtual void Process(const float* const* ppInputs, float* const* ppOutputs, size_t NumFrames) = 0;
+
+		/// @brief Number of channels on each input port
+		const std::vector<size_t>& InputChannels() const { return InputChannels_; }
+
+		/// @brief Number of channels on each output port
+		const std::vector<size_t>& OutputChannels() const { return OutputChannels_; }
+
+	private:
+		friend class ProcessGraph;
+
+		std::vector<size_t> InputChannels_;
+
+		std::vector<size_t> OutputChannels_;
+	};
+
+	/// @brief Graph of processing nodes connected by QuickBuffer edges, executed by a fixed pool of worker threads.
+	/// Ready nodes are queued on per-worker work-stealing deques, so independent branches run in parallel and a
+	/// downstream node usually runs on the worker that produced its input, while its data is still in cache.
+	/// The topology must be built before Start() and may not be changed while the graph is running.
+	class ProcessGraph
+	{
+	public:
+		/// @brief Constructor
+		/// @param FramesPerBlock Number of frames exchanged on every edge per node invocation
+		/// @param NumWorkers Number of worker threads; zero selects the hardware concurrency
+		ProcessGraph(const size_t FramesPerBlock, size_t NumWorkers = 0);
+
+		~ProcessGraph();
+
+		ProcessGraph(const ProcessGraph&) = delete;
+		ProcessGraph& operator=(const ProcessGraph&) = delete;
+
+		/// @brief Add a node to the graph
+		/// @param pNode The node; ownership is transferred to the graph
+		/// @return Identifier of the node within the graph
+		size_t AddNode(std::unique_ptr<ProcessNode> pNode);
+
+		/// @brief Connect an output port of one node to an input port of another.
+		/// An output port may feed several inputs (fan-out); each input port accepts a single connection.
+		/// @param FromNode Producing node
+		/// @param FromPort Output port of the producing node
+		/// @param ToNode Consuming node
+		/// @param ToPort Input port of the consuming node
+		/// @param CapacityBlocks Capacity of the edge, in blocks
+		void Connect(size_t FromNode, size_t FromPort, size_t ToNode, size_t ToPort, size_t CapacityBlocks = 4);
+
+		/// @brief Feed an input port from an external buffer (e.g. AudIO::InBuffer()), which the graph then reads.
+		/// The external buffer must be opened and written by the caller, who should call Notify() after each write.
+		/// Writes may be of any size: a block split by the wrap point of the buffer is copied into a staging block.
+		void ConnectInput(QuickBuffer<float>& Source, size_t ToNode, size_t ToPort);
+
+		/// @brief Drain an output port into an external buffer (e.g. AudIO::OutBuffer()), which the caller then reads.
+		/// The caller should call Notify() after releasing items, so that a stalled node can be resumed.
+		void ConnectOutput(size_t FromNode, size_t FromPort, QuickBuffer<float>& Sink);
+
+		/// @brief Set the real-time configuration applied by each worker thread when the graph starts.
+		/// CPUs listed in the configuration are assigned to workers in turn, one CPU per worker.
+		/// @param Config Requested scheduling policy, CPU affinity and memory handling
+		void SetRealTimeConfig(const RealTimeConfig& Config);
+
+		/// @brief Outcome of the real-time configuration of each worker thread, available after Start()
+		const std::vector<RealTimeReport>& WorkerReports() const { return WorkerReports_; }
+
+		/// @brief Open all internal edges and start the worker threads
+		void Start();
+
+		/// @brief Stop the worker threads and close all internal edges
+		void Stop();
+
+		/// @brief Signal that data has arrived on (or space has been freed in) an external buffer.
+		/// Lockfree; may be called from the audio callback.
+		void Notify() noexcept;
+
+		/// @brief Flag indicating whether the graph is running
+		bool Running() const { return Running_.load(std::memory_order_acquire); }
+
+		/// @brief Number of worker threads
+		size_t NumWorkers() const { return NumWorkers_; }
+
+		/// @brief Processing statistics for a node
+		/// @param Node Identifier of the node
+		NodeStats Stats(size_t Node) const;
+
+		/// @brief Reset the processing statistics of all nodes
+		void ResetStats();
+
+	protected:
+		/// @brief Edge between an output port and an input port
+		struct Edge
+		{
+			std::unique_ptr<QuickBuffer<float>> pOwned;
+			QuickBuffer<float>* pBuffer = nullptr;
+			size_t Channels = 0;
+
+			/// Block of an external input that straddles the wrap point of its ring, gathered into contiguous storage
+			std::vector<float> vStaging;
+
+			/// Items of vStaging already taken from the ring; only the worker running the consuming node writes it
+			std::atomic<size_t> Staged{0};
+		};
+
+		/// @brief Per-node scheduling state
+		struct NodeState
+		{
+			std::unique_ptr<ProcessNode> pNode;
+
+			/// Edge feeding each input port
+			std::vector<Edge*> Inputs;
+
+			/// Edges fed by each output port (fan-out)
+			std::vector<std::vector<Edge*>> Outputs;
+
+			/// Nodes upstream and downstream of this node, re-examined after it runs
+			std::vector<NodeState*> Neighbours;
+
+			/// Scratch pointers handed to ProcessNode::Process
+			std::vector<const float*> InputPtrs;
+			std::vector<float*> OutputPtrs;
+
+			/// Flag set while the node is queued or running
+			std::atomic_bool Queued{false};
+
+			/// Flag indicating the node reads from an external buffer
+			bool External = false;
+
+			std::atomic<uint64_t> Blocks{0};
+			std::atomic<uint64_t> Time_ns{0};
+			std::atomic<uint64_t> MaxTime_ns{0};
+		};
+
+		void WorkerLoop(size_t Worker);
+
+		bool FindWork(size_t Worker, NodeState*& pState);
+
+		bool AnyWork() const;
+
+		bool Ready(const NodeState& State) const;
+
+		void TrySchedule(size_t Worker, NodeState& State);
+
+		bool RunNode(NodeState& State);
+
+		const float* AcquireInput(Edge& In);
+
+		void Wake() noexcept;
+
+		size_t FramesPerBlock_;
+
+		size_t NumWorkers_;
+
+		std::vector<std::unique_ptr<NodeState>> Nodes_;
+
+		std::vector<std::unique_ptr<Edge>> Edges_;
+
+		std::vector<std::unique_ptr<WorkStealingDeque<NodeState*>>> Deques_;
+
+		std::vector<std::thread> Workers_;
+
+		std::atomic_bool Running_{false};
+
+		/// Flag set by Notify() to request a scan of the externally fed nodes
+		std::atomic_bool Pending_{false};
+
+		/// Number of workers parked on Wake_
+		std::atomic_int Sleepers_{0};
+
+		FastSemaphore Wake_;
+
+		/// Real-time configuration applied by the workers, if any
+		std::unique_ptr<RealTimeConfig> pRealTimeConfig_;
+
+		std::vector<RealTimeReport> WorkerReports_;
+
+		/// Posted by each worker once its real-time configuration has been applied
+		FastSemaphore WorkersConfigured_;
+	};
+
+}
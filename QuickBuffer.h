@@ -1,64 +1,87 @@
 #pragma once
+#include "BufferAllocator.h"
 #include "FastSemaphore.h"
+#include "Trace.h"
 #include <atomic>
 #include <cassert>
 #include <cstddef>
 #include <new>
 
+/// @brief Receiver of QuickBuffer readiness (and AudIO state) notifications, e.g. an event loop or a coroutine executor.
+class BufferNotifier {
+public:
+    virtual ~BufferNotifier() = default;
+
+    /// @brief Called once per registration, by the writer after a commit or by the reader after a release, and when
+    /// the buffer is opened or closed. It may run on a real-time thread, so it must neither block nor allocate.
+    virtual void Notify() noexcept = 0;
+};
+
 /// @brief Single Producer, Single Consumer (SPSC) queue with lockfree semantics.
 /// WriteReserve / WriteCommit and ReadAcquire / ReadRelease supply zero-copy access to buffer regions.
 /// Readers and writers may spin-wait on operations. Optional support for blocking and signalling is provided.
 /// A bipartite buffer construction is used to ensure availability of contiguous space.
+/// Storage is obtained from a BufferAllocator, so that huge pages, pre-faulting, locking or an arena may be used.
+/// The producer and consumer each keep a private copy of the other side's index, and only reload the shared index
+/// when the private copy shows too little space or data; define QUICKBUFFER_NO_INDEX_CACHE to always reload it.
+/// Instead of blocking, a thread may register a BufferNotifier to be told when data or space becomes available.
 /// @tparam T The type of element buffered. It must be trivial.
 template<typename T> class QuickBuffer {
     static_assert(std::is_trivial<T>::value, "The buffer element type T must be trivial.");
 
     // 64 bytes is suitable for vectorised AVX-512 operations.
-    static constexpr size_t kAlignment = 16;
+    static constexpr size_t kAlignment = 64;
+    // Smallest page size of the supported platforms
+    static constexpr size_t kPageSize = 4096;
 #if((defined(_MSVC_LANG) && _MSVC_LANG >= 201703L) || __cplusplus >= 201703L)
     static constexpr size_t kCacheLineSize{std::hardware_destructive_interference_size};
 #else
     static constexpr size_t kCacheLineSize{64};
 #endif
 public:
-    explicit QuickBuffer(const size_t Size)
-        : Size_(Size), SignalWriter_(false), SignalReader_(false), ReadIdx_(0), WriteIdx_(0), EndIdx_(0)
+    /// @brief Constructor
+    /// @param Size Capacity of the buffer
+    /// @param pAllocator Allocator for the buffer storage; it must outlive the buffer. nullptr selects the heap.
+    explicit QuickBuffer(const size_t Size, BufferAllocator* pAllocator = nullptr)
+        : Size_(Size), pAllocator_(pAllocator ? pAllocator : &BufferAllocator::Default()), ReadIdx_(0),
+          SignalWriter_(false), WriteIdx_(0), EndIdx_(0), SignalReader_(false)
     {
 		Resize(Size);
     }
 
     ~QuickBuffer()
     {
-        if(pBuffer_) {
-#ifdef _MSC_VER
-            _aligned_free(pBuffer_);
-#else
-            free(pBuffer_);
-#endif
-        }
+        if(pBuffer_)
+            pAllocator_->Deallocate(pBuffer_, Bytes_);
     }
 
+    /// @brief Change the capacity of the buffer, reallocating its storage. The buffer is closed and its contents discarded.
+    /// @param Size New capacity of the buffer
     void Resize(const size_t Size)
 	{
 		Close();
 		if(pBuffer_) {
-#ifdef _MSC_VER
-			_aligned_free(pBuffer_);
-#else
-			free(pBuffer_);
-#endif
+			pAllocator_->Deallocate(pBuffer_, Bytes_);
+			pBuffer_ = nullptr;
 		}
-#ifdef _MSC_VER
-		pBuffer_ = static_cast<T*>(
-			_aligned_malloc((size_t)((Size * sizeof(T)) + (kAlignment - (Size * sizeof(T)) % kAlignment)),
-				kAlignment));
-#else
-		pBuffer_ = static_cast<T*>(
-			aligned_alloc(kAlignment,
-				(size_t)((Size * sizeof(T)) + (kAlignment - (Size * sizeof(T)) % kAlignment))));
-#endif
+		Size_ = Size;
+		Bytes_ = Size * sizeof(T);
+		pBuffer_ = static_cast<T*>(pAllocator_->Allocate(Bytes_, kAlignment));
 	}
 
+    /// @brief Replace the allocator and reallocate the storage with it. The buffer is closed.
+    /// @param pAllocator Allocator for the buffer storage; it must outlive the buffer. nullptr selects the heap.
+    void SetAllocator(BufferAllocator* pAllocator)
+    {
+        Close();
+        if(pBuffer_) {
+            pAllocator_->Deallocate(pBuffer_, Bytes_);
+            pBuffer_ = nullptr;
+        }
+        pAllocator_ = pAllocator ? pAllocator : &BufferAllocator::Default();
+        Resize(Size_);
+    }
+
     /// @brief Open the buffer for reading or writing.
     inline void Open() noexcept
     {
@@ -66,8 +89,11 @@ public:
         ReadIdx_ = 0;
         WriteIdx_ = 0;
         EndIdx_ = 0;
+        ReadIdxCache_ = 0;
+        WriteIdxCache_ = 0;
         NotFull_.Post();
         NotEmpty_.Post();
+        FireNotifiers();
     }
 
     /// @brief Close the buffer and cancel all waiting reads or writes.
@@ -77,14 +103,98 @@ public:
         ReadIdx_ = 0;
         WriteIdx_ = 0;
         EndIdx_ = 0;
+        ReadIdxCache_ = 0;
+        WriteIdxCache_ = 0;
         NotFull_.Post();
         NotEmpty_.Post();
+        FireNotifiers();
     }
 
     /// @brief Indicate whether the buffer is open for operation.
     /// @return true if the buffer is open, else false
     inline bool IsOpen() const noexcept { return Open_.load(std::memory_order_relaxed); }
 
+    /// @brief Capacity of the buffer
+    /// @return The number of items the buffer may hold
+    inline size_t Size() const noexcept { return Size_; }
+
+    /// @brief Start of the data buffer, e.g. for locking it into memory
+    inline const T* Data() const noexcept { return pBuffer_; }
+
+    /// @brief Touch every page of the data buffer, so that the first writes on the hot path do not page-fault.
+    /// Overwrites the buffer contents, so it must only be called while no reader or writer is active.
+    inline void Prefault() noexcept
+    {
+        volatile char* pByte = reinterpret_cast<volatile char*>(pBuffer_);
+        const size_t Bytes = Size_ * sizeof(T);
+        for(size_t n = 0; n < Bytes; n += kPageSize)
+            pByte[n] = 0;
+        if(Bytes)
+            pByte[Bytes - 1] = 0;
+    }
+
+    /// @brief Estimate the number of items available for reading, without acquiring them.
+    /// Safe to call from any thread; the result is a snapshot and only a hint when called concurrently.
+    /// @return Number of items written but not yet released by the reader
+    inline size_t ReadableCount() const noexcept
+    {
+        const size_t w = WriteIdx_.load(std::memory_order_acquire);
+        const size_t r = ReadIdx_.load(std::memory_order_acquire);
+        if(r <= w)
+            return w - r;
+        const size_t i = EndIdx_.load(std::memory_order_relaxed);
+        return ((i > r) ? (i - r) : 0) + w;
+    }
+
+    /// @brief Estimate the number of items free for writing, without reserving them.
+    /// Safe to call from any thread; the result is a snapshot and only a hint when called concurrently.
+    /// @return Number of free items (not necessarily contiguous)
+    inline size_t WritableCount() const noexcept
+    {
+        return FreeSpace(WriteIdx_.load(std::memory_order_acquire), ReadIdx_.load(std::memory_order_acquire));
+    }
+
+    /// @brief Ask for a single notification once at least NumItems may be read, instead of blocking.
+    /// Only the reader may call this. The notification fires on the next commit, which may still leave fewer than
+    /// NumItems readable; the receiver should check again and re-register if necessary.
+    /// @param Notifier Receiver of the notification; it must stay valid until notified or cancelled
+    /// @param NumItems Number of items the reader is waiting for
+    /// @return true if a notification will follow; false if the items are already readable or the buffer is closed
+    inline bool NotifyWhenReadable(BufferNotifier& Notifier, const size_t NumItems = 1) noexcept
+    {
+        pReadNotifier_.store(&Notifier, std::memory_order_relaxed);
+        NotifyReader_.store(true, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(IsOpen() && (ReadableCount() < NumItems))
+            return true;
+        // Withdraw the request, unless the writer has already taken it and is about to notify.
+        return !NotifyReader_.exchange(false, std::memory_order_relaxed);
+    }
+
+    /// @brief Ask for a single notification once a contiguous region of NumItems may be reserved, instead of blocking.
+    /// Only the writer may call this. The notification fires on the next release, which may still leave too little
+    /// contiguous space; the receiver should check again and re-register if necessary.
+    /// @param Notifier Receiver of the notification; it must stay valid until notified or cancelled
+    /// @param NumItems Number of items the writer wishes to reserve
+    /// @return true if a notification will follow; false if the space is already free or the buffer is closed
+    inline bool NotifyWhenWritable(BufferNotifier& Notifier, const size_t NumItems) noexcept
+    {
+        pWriteNotifier_.store(&Notifier, std::memory_order_relaxed);
+        NotifyWriter_.store(true, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(IsOpen() && !WriteReserve(NumItems))
+            return true;
+        return !NotifyWriter_.exchange(false, std::memory_order_relaxed);
+    }
+
+    /// @brief Withdraw a request made with NotifyWhenReadable.
+    /// @return true if withdrawn; false if no request was pending, or its notification is already under way
+    inline bool CancelReadableNotify() noexcept { return NotifyReader_.exchange(false, std::memory_order_relaxed); }
+
+    /// @brief Withdraw a request made with NotifyWhenWritable.
+    /// @return true if withdrawn; false if no request was pending, or its notification is already under way
+    inline bool CancelWritableNotify() noexcept { return NotifyWriter_.exchange(false, std::memory_order_relaxed); }
+
     /// @brief Acquire a contiguous region in the buffer for writing. Block until this space is available.
     /// @param uNumToWrite Required number of items to write
     /// @return Pointer to space acquired for contiguous writing.
@@ -93,7 +203,9 @@ public:
         T* pWrite = WriteReserve(NumToWrite);
         while(!pWrite) {
             // Could not find contiguous free space with required size, so wait until something is available.
-            SignalWriter_.store(true, std::memory_order_release);
+            if((pWrite = ArmWriter(NumToWrite)) != nullptr)
+                break;
+            AUDAPTR_TRACE_SCOPE("QuickBuffer::WaitWrite");
             NotFull_.Wait();
             if(!Open_)
                 return nullptr;
@@ -109,7 +221,7 @@ public:
     inline bool WaitRead(size_t NumToRead, T*& pDest) noexcept
     {
         size_t Available = 0;
-        T* pRead = ReadAcquire(Available);
+        T* pRead = ReadAcquire(Available, NumToRead);
         // Fast path
         if(Available >= NumToRead) {
             // pDest = pRead;
@@ -128,14 +240,14 @@ public:
                     return true;
                 pDest += ThisRead;
             }
-            else {
+            else if(!ArmReader()) {
                 // Could not find free contiguous space with required size, so wait until something is available.
-                SignalReader_.store(true, std::memory_order_release);
+                AUDAPTR_TRACE_SCOPE("QuickBuffer::WaitRead");
                 NotEmpty_.Wait();
                 if(!Open_)
                     return false;
             }
-            pRead = ReadAcquire(Available);
+            pRead = ReadAcquire(Available, NumToRead);
         }
         return false;
     }
@@ -148,7 +260,11 @@ public:
         T* pRead = ReadAcquire(Available);
         while(!pRead) {
             // Could not find free contiguous space with required size; wait until something is available.
-            SignalReader_.store(true, std::memory_order_release);
+            if(ArmReader()) {
+                pRead = ReadAcquire(Available);
+                continue;
+            }
+            AUDAPTR_TRACE_SCOPE("QuickBuffer::WaitReadAcquire");
             NotEmpty_.Wait();
             if(!Open_)
                 return nullptr;
@@ -162,23 +278,17 @@ public:
     /// @return Pointer to space acquired for contiguous writing; nullptr if free space is insufficient.
     inline T* WriteReserve(const size_t NumToWrite) noexcept
     {
-        // Cache write and read indices with necessary memory ordering.
         const size_t w = WriteIdx_.load(std::memory_order_relaxed);
-        const size_t r = ReadIdx_.load(std::memory_order_acquire);
-        const size_t Free = FreeSpace(w, r);
-        const size_t ContigSpace = Size_ - w;
-        const size_t ContigFree = std::min(Free, ContigSpace);
-
-        // If there is contiguous space until the end of the buffer, return that.
-        if(NumToWrite <= ContigFree)
-            return pBuffer_ + w;
-
-        // Else return contiguous space from the beginning of the buffer.
-        if(NumToWrite <= Free - ContigFree) {
-            WriteWrapped_ = true;
-            return pBuffer_;
-        }
-        return nullptr;
+#ifndef QUICKBUFFER_NO_INDEX_CACHE
+        // The cached read index can only lag the reader, so it never overstates the free space. Reload it only
+        // when it shows too little, to keep the reader's cache line out of the producer's hot path.
+        if(T* pWrite = Reserve(NumToWrite, w, ReadIdxCache_))
+            return pWrite;
+        ReadIdxCache_ = ReadIdx_.load(std::memory_order_acquire);
+        return Reserve(NumToWrite, w, ReadIdxCache_);
+#else
+        return Reserve(NumToWrite, w, ReadIdx_.load(std::memory_order_acquire));
+#endif
     }
 
     /// @brief Release items in the buffer, following a write, so that these are available for reading.
@@ -209,19 +319,89 @@ public:
         // Store the indices with adequate memory ordering
         EndIdx_.store(i, std::memory_order_relaxed);
         WriteIdx_.store(w, std::memory_order_release);
-        if(SignalReader_.exchange(false))
+        // Only take the flag (a read-modify-write) when a reader has announced that it waits. The fence orders the
+        // index store before the flag load, pairing with the fence in the waiting reader.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(SignalReader_.load(std::memory_order_relaxed) && SignalReader_.exchange(false, std::memory_order_relaxed))
             NotEmpty_.Post();
+        if(NotifyReader_.load(std::memory_order_relaxed) && NotifyReader_.exchange(false, std::memory_order_acquire))
+            pReadNotifier_.load(std::memory_order_relaxed)->Notify();
     }
 
     /// @brief Request the number of items available for reading.
     /// @param uAvailable The number of items available, if a pointer to available items is returned.
+    /// @param Wanted Number of items the caller would like; fewer may be reported while the writer's index is only
+    /// known from the consumer's cached copy, so a caller that needs a minimum should pass it here.
     /// @return nullptr if no items are available for reading; otherwise, a pointer to the available items.
-    inline T* ReadAcquire(size_t& Available) noexcept
+    inline T* ReadAcquire(size_t& Available, const size_t Wanted = 1) noexcept
     {
-        // Cache read and write indices with necessary memory ordering.
         const size_t r = ReadIdx_.load(std::memory_order_relaxed);
-        const size_t w = WriteIdx_.load(std::memory_order_acquire);
+#ifndef QUICKBUFFER_NO_INDEX_CACHE
+        // The cached write index can only lag the writer, so it never overstates the data available.
+        if(T* pRead = Acquire(Available, r, WriteIdxCache_); pRead && (Available >= Wanted))
+            return pRead;
+        WriteIdxCache_ = WriteIdx_.load(std::memory_order_acquire);
+        return Acquire(Available, r, WriteIdxCache_);
+#else
+        (void)Wanted;
+        return Acquire(Available, r, WriteIdx_.load(std::memory_order_acquire));
+#endif
+    }
 
+    /// @brief Release some number of items after a read operation.
+    /// @param uToRelease Number of items to relase; not necessarily equal to the number specified in ReadAcquire.
+    void ReadRelease(const size_t ToRelease) noexcept
+    {
+        // If the read wrapped, record that and set its index to 0.
+        size_t r;
+        if(ReadWrapped_) {
+            ReadWrapped_ = false;
+            r = 0;
+        }
+        else
+            r = ReadIdx_.load(std::memory_order_relaxed);
+
+        // Increment the read index and wrap to 0 if needed
+        r += ToRelease;
+        if(r == Size_)
+            r = 0;
+
+        // Store the indexes with adequate memory ordering
+        ReadIdx_.store(r, std::memory_order_release);
+        // As in WriteCommit, only take the flag when the writer has announced that it waits.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(SignalWriter_.load(std::memory_order_relaxed) && SignalWriter_.exchange(false, std::memory_order_relaxed))
+            NotFull_.Post();
+        if(NotifyWriter_.load(std::memory_order_relaxed) && NotifyWriter_.exchange(false, std::memory_order_acquire))
+            pWriteNotifier_.load(std::memory_order_relaxed)->Notify();
+    }
+
+private:
+    /// @brief Find contiguous free space for the producer, given a view of the read index
+    inline T* Reserve(const size_t NumToWrite, const size_t w, const size_t r) noexcept
+    {
+        const size_t Free = FreeSpace(w, r);
+        const size_t ContigSpace = Size_ - w;
+        const size_t ContigFree = std::min(Free, ContigSpace);
+
+        // If there is contiguous space until the end of the buffer, return that.
+        if(NumToWrite <= ContigFree) {
+            // A previous reservation that was not committed may have wrapped.
+            WriteWrapped_ = false;
+            return pBuffer_ + w;
+        }
+
+        // Else return contiguous space from the beginning of the buffer.
+        if(NumToWrite <= Free - ContigFree) {
+            WriteWrapped_ = true;
+            return pBuffer_;
+        }
+        return nullptr;
+    }
+
+    /// @brief Find contiguous data for the consumer, given a view of the write index
+    inline T* Acquire(size_t& Available, const size_t r, const size_t w) noexcept
+    {
         // When read and write indexes are equal, the buffer is empty.
         if(r == w)
             return nullptr;
@@ -245,42 +425,53 @@ public:
         return pBuffer_ + r;
     }
 
-    /// @brief Release some number of items after a read operation.
-    /// @param uToRelease Number of items to relase; not necessarily equal to the number specified in ReadAcquire.
-    void ReadRelease(const size_t ToRelease) noexcept
+    /// @brief Announce that the writer is about to wait, then try the reservation once more, in case the reader
+    /// released space before it saw the announcement. A post left over from this race only causes a spurious wakeup.
+    /// @return The reservation if space became available meanwhile, else nullptr
+    inline T* ArmWriter(const size_t NumToWrite) noexcept
     {
-        // If the read wrapped, record that and set its index to 0.
-        size_t r;
-        if(ReadWrapped_) {
-            ReadWrapped_ = false;
-            r = 0;
-        }
-        else
-            r = ReadIdx_.load(std::memory_order_relaxed);
+        SignalWriter_.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return WriteReserve(NumToWrite);
+    }
 
-        // Increment the read index and wrap to 0 if needed
-        r += ToRelease;
-        if(r == Size_)
-            r = 0;
+    /// @brief Announce that the reader is about to wait, then check once more for data, in case the writer committed
+    /// before it saw the announcement. A post left over from this race only causes a spurious wakeup.
+    /// @return true if data arrived meanwhile, so the reader need not wait
+    inline bool ArmReader() noexcept
+    {
+        SignalReader_.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        size_t Available = 0;
+        return ReadAcquire(Available) != nullptr;
+    }
 
-        // Store the indexes with adequate memory ordering
-        ReadIdx_.store(r, std::memory_order_release);
-        if(SignalWriter_.exchange(false))
-            NotFull_.Post();
+    /// @brief Deliver pending notifications, so that registered receivers observe an open or close
+    inline void FireNotifiers() noexcept
+    {
+        if(NotifyReader_.exchange(false, std::memory_order_acq_rel))
+            pReadNotifier_.load(std::memory_order_relaxed)->Notify();
+        if(NotifyWriter_.exchange(false, std::memory_order_acq_rel))
+            pWriteNotifier_.load(std::memory_order_relaxed)->Notify();
     }
 
-private:
     inline size_t FreeSpace(const size_t w, const size_t r) const noexcept
     {
         return (r > w) ? ((r - w) - (size_t)1) : ((Size_ - (w - r)) - (size_t)1);
     }
 
-    /// @brief Size of the data buffer (must be a power-of-2)
-    const size_t Size_{0};
+    /// @brief Size of the data buffer
+    size_t Size_{0};
 
     /// @brief Data buffer
     alignas(kCacheLineSize) T* pBuffer_{nullptr};
 
+    /// @brief Number of bytes allocated for the data buffer
+    size_t Bytes_{0};
+
+    /// @brief Allocator for the data buffer
+    BufferAllocator* pAllocator_;
+
     /// @brief Flag indicating whether the buffer is open
     alignas(kCacheLineSize) std::atomic_bool Open_{false};
 
@@ -290,12 +481,21 @@ private:
     /// @brief Read wrapped flag, used only in the consumer
     alignas(kCacheLineSize) bool ReadWrapped_{false};
 
+    /// @brief Consumer's copy of the write index, refreshed only when it shows too little data
+    size_t WriteIdxCache_{0};
+
     /// @brief Flag set to indicate that the writer should be signalled
     std::atomic_bool SignalWriter_{false};
 
     /// @brief Semaphore indicating to the writer that the buffer is no longer full
     FastSemaphore NotFull_;
 
+    /// @brief Flag set while the writer has asked to be notified of free space
+    std::atomic_bool NotifyWriter_{false};
+
+    /// @brief Receiver of free-space notifications
+    std::atomic<BufferNotifier*> pWriteNotifier_{nullptr};
+
     /// @brief Write index
     alignas(kCacheLineSize) std::atomic_size_t WriteIdx_;
 
@@ -305,9 +505,18 @@ private:
     /// @brief Write wrapped flag, used only in the producer
     alignas(kCacheLineSize) bool WriteWrapped_{false};
 
+    /// @brief Producer's copy of the read index, refreshed only when it shows too little space
+    size_t ReadIdxCache_{0};
+
     /// @brief Flag set to indicate that the reader should be signalled
     std::atomic_bool SignalReader_;
 
     /// @brief Semaphore indicating to the reader that the buffer is no longer empty
     FastSemaphore NotEmpty_;
+
+    /// @brief Flag set while the reader has asked to be notified of data
+    std::atomic_bool NotifyReader_{false};
+
+    /// @brief Receiver of data notifications
+    std::atomic<BufferNotifier*> pReadNotifier_{nullptr};
 };
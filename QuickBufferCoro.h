@@ -0,0 +1,357 @@
+#pragma once
+#if !defined(__cpp_impl_coroutine)
+#error "QuickBufferCoro.h requires C++20 coroutine support."
+#endif
+#include "FastSemaphore.h"
+#include "QuickBuffer.h"
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <span>
+#include <vector>
+
+class StreamAwaiter;
+class StreamExecutor;
+
+/// @brief Coroutine run by a StreamExecutor. It starts once spawned, and its frame is freed when it returns.
+/// Within it, co_await Readable(Buffer, n) and co_await Writable(Buffer, n) suspend the task without blocking the
+/// thread, e.g.
+///     StreamTask Monitor(QuickBuffer<float>& Ring) {
+///         for(std::span<float> Data; !(Data = co_await Readable(Ring, 256)).empty(); Ring.ReadRelease(Data.size()))
+///             Process(Data);
+///     }
+class StreamTask {
+public:
+    struct promise_type {
+        StreamTask get_return_object() noexcept { return StreamTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept;
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept;
+
+        /// @brief Executor running the task, set when spawned
+        StreamExecutor* pExecutor = nullptr;
+
+        /// @brief Awaiter on which the task is suspended, if any
+        StreamAwaiter* pAwaiter = nullptr;
+
+        /// @brief Neighbours in the executor's list of live tasks
+        promise_type* pPrev = nullptr;
+        promise_type* pNext = nullptr;
+    };
+
+    StreamTask(StreamTask&& Other) noexcept : Handle_(Other.Handle_) { Other.Handle_ = nullptr; }
+    StreamTask(const StreamTask&) = delete;
+    StreamTask& operator=(const StreamTask&) = delete;
+
+    /// @brief Destructor; frees the coroutine only if it was never spawned
+    ~StreamTask()
+    {
+        if(Handle_)
+            Handle_.destroy();
+    }
+
+private:
+    friend class StreamExecutor;
+
+    explicit StreamTask(std::coroutine_handle<promise_type> Handle) noexcept : Handle_(Handle) {}
+
+    std::coroutine_handle<promise_type> Handle_;
+};
+
+/// @brief Base of the awaiters that suspend a StreamTask until a buffer notifies.
+/// A notification only queues the awaiter on its executor; readiness is checked again on the executor thread, and
+/// the awaiter registers anew if its condition does not hold yet.
+class StreamAwaiter : public BufferNotifier {
+public:
+    /// @brief Check the condition on the executor thread, registering for another notification if it does not hold
+    /// @return true if the task should be resumed
+    virtual bool Poll() noexcept = 0;
+
+    /// @brief Withdraw a pending registration, when the executor is destroyed with the task still suspended
+    virtual void Cancel() noexcept = 0;
+
+    void Notify() noexcept override;
+
+protected:
+    /// @brief Record the suspending task, before registering with a buffer
+    void Suspend(std::coroutine_handle<StreamTask::promise_type> Handle) noexcept
+    {
+        Handle_ = Handle;
+        Handle.promise().pAwaiter = this;
+    }
+
+private:
+    friend class StreamExecutor;
+
+    std::coroutine_handle<StreamTask::promise_type> Handle_;
+
+    StreamAwaiter* pNext_ = nullptr;
+};
+
+/// @brief Single-threaded executor for StreamTasks, so that one thread can service the buffers of many streams.
+/// Buffers notify it from their real-time threads through a lockfree list, and wake it only when it sleeps.
+/// Spawn, Run and destruction must take place on the same thread; Stop may be called from any thread.
+class StreamExecutor {
+public:
+    StreamExecutor() = default;
+    StreamExecutor(const StreamExecutor&) = delete;
+    StreamExecutor& operator=(const StreamExecutor&) = delete;
+
+    /// @brief Destructor. Unfinished tasks are withdrawn from their buffers and freed; the buffers must not be
+    /// notifying concurrently (e.g. their streams have been stopped).
+    ~StreamExecutor()
+    {
+        while(pTasks_) {
+            StreamTask::promise_type* pTask = pTasks_;
+            pTasks_ = pTask->pNext;
+            if(pTask->pAwaiter)
+                pTask->pAwaiter->Cancel();
+            std::coroutine_handle<StreamTask::promise_type>::from_promise(*pTask).destroy();
+        }
+    }
+
+    /// @brief Take ownership of a task, to be started by Run. Tasks may also spawn other tasks.
+    void Spawn(StreamTask Task)
+    {
+        std::coroutine_handle<StreamTask::promise_type> Handle = Task.Handle_;
+        Task.Handle_ = nullptr;
+        StreamTask::promise_type& Promise = Handle.promise();
+        Promise.pExecutor = this;
+        Promise.pNext = pTasks_;
+        if(pTasks_)
+            pTasks_->pPrev = &Promise;
+        pTasks_ = &Promise;
+        NumTasks_++;
+        vStarting_.push_back(Handle);
+    }
+
+    /// @brief Number of tasks that have not yet finished
+    size_t NumTasks() const noexcept { return NumTasks_; }
+
+    /// @brief Resume tasks as their buffers become ready, until every task has finished or Stop is called.
+    /// An exception escaping a task is rethrown here, after that task has been freed.
+    void Run()
+    {
+        while((NumTasks_ > 0) && !Stopped_.load(std::memory_order_acquire)) {
+            // Start tasks spawned since the last pass, including those spawned by other tasks.
+            while(!vStarting_.empty()) {
+                std::coroutine_handle<StreamTask::promise_type> Handle = vStarting_.back();
+                vStarting_.pop_back();
+                Resume(Handle);
+            }
+
+            StreamAwaiter* pReady = Ready_.exchange(nullptr, std::memory_order_acquire);
+            if(!pReady) {
+                if(NumTasks_ > 0)
+                    Sleep();
+                continue;
+            }
+
+            // Poll in notification order. An awaiter lives in its task's frame, which may be freed once resumed.
+            StreamAwaiter* pOrdered = nullptr;
+            while(pReady) {
+                StreamAwaiter* pNext = pReady->pNext_;
+                pReady->pNext_ = pOrdered;
+                pOrdered = pReady;
+                pReady = pNext;
+            }
+            while(pOrdered) {
+                StreamAwaiter* pAwaiter = pOrdered;
+                pOrdered = pOrdered->pNext_;
+                if(pAwaiter->Poll()) {
+                    pAwaiter->Handle_.promise().pAwaiter = nullptr;
+                    Resume(pAwaiter->Handle_);
+                }
+            }
+        }
+        Stopped_.store(false, std::memory_order_relaxed);
+    }
+
+    /// @brief Make Run return at its next opportunity; callable from any thread
+    void Stop() noexcept
+    {
+        Stopped_.store(true, std::memory_order_release);
+        WakeIfSleeping();
+    }
+
+    /// @brief Queue a notified awaiter for polling; lockfree, and callable from any thread
+    void Schedule(StreamAwaiter& Awaiter) noexcept
+    {
+        StreamAwaiter* pHead = Ready_.load(std::memory_order_relaxed);
+        do
+            Awaiter.pNext_ = pHead;
+        while(!Ready_.compare_exchange_weak(pHead, &Awaiter, std::memory_order_release, std::memory_order_relaxed));
+        WakeIfSleeping();
+    }
+
+private:
+    friend struct StreamTask::promise_type;
+
+    void Resume(std::coroutine_handle<StreamTask::promise_type> Handle)
+    {
+        Handle.resume();
+        if(Error_) {
+            std::exception_ptr Error = Error_;
+            Error_ = nullptr;
+            Stopped_.store(false, std::memory_order_relaxed);
+            std::rethrow_exception(Error);
+        }
+    }
+
+    /// @brief Block until an awaiter is scheduled or Stop is called
+    void Sleep() noexcept
+    {
+        // Announce the sleep, then check once more, pairing with the fence in WakeIfSleeping.
+        Sleeping_.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(!Ready_.load(std::memory_order_relaxed) && !Stopped_.load(std::memory_order_relaxed)) {
+            Wake_.Wait();
+            return;
+        }
+        // Work arrived meanwhile: withdraw the announcement, or absorb the post of a waker that already took it.
+        if(!Sleeping_.exchange(false, std::memory_order_relaxed))
+            Wake_.Wait();
+    }
+
+    void WakeIfSleeping() noexcept
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(Sleeping_.load(std::memory_order_relaxed) && Sleeping_.exchange(false, std::memory_order_relaxed))
+            Wake_.Post();
+    }
+
+    void Finished(StreamTask::promise_type& Promise) noexcept
+    {
+        if(Promise.pPrev)
+            Promise.pPrev->pNext = Promise.pNext;
+        else
+            pTasks_ = Promise.pNext;
+        if(Promise.pNext)
+            Promise.pNext->pPrev = Promise.pPrev;
+        NumTasks_--;
+    }
+
+    /// @brief Awaiters notified since the last pass, most recent first
+    std::atomic<StreamAwaiter*> Ready_{nullptr};
+
+    /// @brief Flag set while Run sleeps, or is about to
+    std::atomic_bool Sleeping_{false};
+
+    std::atomic_bool Stopped_{false};
+
+    /// @brief Semaphore on which Run sleeps
+    FastSemaphore Wake_;
+
+    /// @brief Tasks spawned but not yet started
+    std::vector<std::coroutine_handle<StreamTask::promise_type>> vStarting_;
+
+    /// @brief Live tasks
+    StreamTask::promise_type* pTasks_ = nullptr;
+
+    size_t NumTasks_ = 0;
+
+    std::exception_ptr Error_;
+};
+
+inline std::suspend_never StreamTask::promise_type::final_suspend() noexcept
+{
+    pExecutor->Finished(*this);
+    return {};
+}
+
+inline void StreamTask::promise_type::unhandled_exception() noexcept
+{
+    pExecutor->Error_ = std::current_exception();
+}
+
+inline void StreamAwaiter::Notify() noexcept
+{
+    Handle_.promise().pExecutor->Schedule(*this);
+}
+
+/// @brief Awaiter returned by Readable
+template<typename T> class ReadableAwaiter : public StreamAwaiter {
+public:
+    ReadableAwaiter(QuickBuffer<T>& Buffer, const size_t NumItems) noexcept : Buffer_(Buffer), NumItems_(NumItems) {}
+
+    bool await_ready() const noexcept { return Ready(); }
+
+    bool await_suspend(std::coroutine_handle<StreamTask::promise_type> Handle) noexcept
+    {
+        Suspend(Handle);
+        if(Buffer_.NotifyWhenReadable(*this, NumItems_))
+            return true;
+        Handle.promise().pAwaiter = nullptr;
+        return false;
+    }
+
+    std::span<T> await_resume() noexcept
+    {
+        size_t Available = 0;
+        T* pRead = Buffer_.IsOpen() ? Buffer_.ReadAcquire(Available, NumItems_) : nullptr;
+        return pRead ? std::span<T>(pRead, Available) : std::span<T>();
+    }
+
+    bool Poll() noexcept override { return Ready() || !Buffer_.NotifyWhenReadable(*this, NumItems_); }
+
+    void Cancel() noexcept override { Buffer_.CancelReadableNotify(); }
+
+private:
+    bool Ready() const noexcept { return !Buffer_.IsOpen() || (Buffer_.ReadableCount() >= NumItems_); }
+
+    QuickBuffer<T>& Buffer_;
+
+    size_t NumItems_;
+};
+
+/// @brief Awaiter returned by Writable
+template<typename T> class WritableAwaiter : public StreamAwaiter {
+public:
+    WritableAwaiter(QuickBuffer<T>& Buffer, const size_t NumItems) noexcept : Buffer_(Buffer), NumItems_(NumItems) {}
+
+    bool await_ready() noexcept { return Ready(); }
+
+    bool await_suspend(std::coroutine_handle<StreamTask::promise_type> Handle) noexcept
+    {
+        Suspend(Handle);
+        if(Buffer_.NotifyWhenWritable(*this, NumItems_))
+            return true;
+        Handle.promise().pAwaiter = nullptr;
+        return false;
+    }
+
+    std::span<T> await_resume() noexcept
+    {
+        T* pWrite = Buffer_.IsOpen() ? Buffer_.WriteReserve(NumItems_) : nullptr;
+        return pWrite ? std::span<T>(pWrite, NumItems_) : std::span<T>();
+    }
+
+    bool Poll() noexcept override { return Ready() || !Buffer_.NotifyWhenWritable(*this, NumItems_); }
+
+    void Cancel() noexcept override { Buffer_.CancelWritableNotify(); }
+
+private:
+    bool Ready() noexcept { return !Buffer_.IsOpen() || Buffer_.WriteReserve(NumItems_); }
+
+    QuickBuffer<T>& Buffer_;
+
+    size_t NumItems_;
+};
+
+/// @brief Suspend the calling StreamTask until at least NumItems may be read from a buffer. Only the reader may await.
+/// @return The contiguous readable region, to be released with ReadRelease; it may hold more than NumItems, or fewer
+/// where the data wraps at the end of the buffer. It is empty if the buffer was closed.
+template<typename T> ReadableAwaiter<T> Readable(QuickBuffer<T>& Buffer, const size_t NumItems = 1) noexcept
+{
+    return ReadableAwaiter<T>(Buffer, NumItems);
+}
+
+/// @brief Suspend the calling StreamTask until NumItems contiguous items may be reserved in a buffer. Only the writer
+/// may await.
+/// @return The reserved region of NumItems, to be committed with WriteCommit; empty if the buffer was closed.
+template<typename T> WritableAwaiter<T> Writable(QuickBuffer<T>& Buffer, const size_t NumItems) noexcept
+{
+    return WritableAwaiter<T>(Buffer, NumItems);
+}
@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+#include "RealTime.h"
+
+using namespace std;
+
+namespace Audaptr
+{
+#ifdef __linux__
+	// Not exposed by glibc; layout from the Linux sched_setattr(2) manual page.
+	struct SchedAttr
+	{
+		uint32_t size;
+		uint32_t sched_policy;
+		uint64_t sched_flags;
+		int32_t sched_nice;
+		uint32_t sched_priority;
+		uint64_t sched_runtime;
+		uint64_t sched_deadline;
+		uint64_t sched_period;
+	};
+
+	static constexpr uint32_t kSchedDeadline = 6;
+#endif
+
+	static void AppendStatus(RealTimeReport &Report, const string &strStep, int iError)
+	{
+		if(!Report.Status.empty())
+			Report.Status += "; ";
+#ifdef _WIN32
+		Report.Status += strStep + " failed: error " + to_string(iError);
+#else
+		Report.Status += strStep + " failed: " + strerror(iError);
+#endif
+	}
+
+	void ConfigureCurrentThread(const RealTimeConfig &Config, RealTimeReport &Report)
+	{
+#ifdef _WIN32
+		if(Config.Policy != SchedulingPolicy::Unchanged) {
+			int iPriority = THREAD_PRIORITY_NORMAL;
+			if((Config.Policy == SchedulingPolicy::Fifo) || (Config.Policy == SchedulingPolicy::RoundRobin) || (Config.Policy == SchedulingPolicy::Deadline))
+				iPriority = THREAD_PRIORITY_TIME_CRITICAL;
+			Report.Scheduling = SetThreadPriority(GetCurrentThread(), iPriority) != 0;
+			if(!Report.Scheduling)
+				AppendStatus(Report, "SetThreadPriority", (int)GetLastError());
+		}
+		if(!Config.Cpus.empty()) {
+			DWORD_PTR Mask = 0;
+			for(auto iCpu : Config.Cpus)
+				if((iCpu >= 0) && (iCpu < (int)(8 * sizeof(DWORD_PTR))))
+					Mask |= (DWORD_PTR)1 << iCpu;
+			Report.Affinity = (Mask != 0) && (SetThreadAffinityMask(GetCurrentThread(), Mask) != 0);
+			if(!Report.Affinity)
+				AppendStatus(Report, "SetThreadAffinityMask", (int)GetLastError());
+		}
+#else
+		int iError = 0;
+		switch(Config.Policy) {
+		case SchedulingPolicy::Unchanged:
+			break;
+		case SchedulingPolicy::Normal:
+		case SchedulingPolicy::Fifo:
+		case SchedulingPolicy::RoundRobin: {
+			const int iPolicy = (Config.Policy == SchedulingPolicy::Fifo) ? SCHED_FIFO : (Config.Policy == SchedulingPolicy::RoundRobin) ? SCHED_RR : SCHED_OTHER;
+			sched_param Param{};
+			Param.sched_priority = clamp(Config.Priority, sched_get_priority_min(iPolicy), sched_get_priority_max(iPolicy));
+			iError = pthread_setschedparam(pthread_self(), iPolicy, &Param);
+			break;
+		}
+		case SchedulingPolicy::Deadline: {
+#ifdef __linux__
+			SchedAttr Attr{};
+			Attr.size = sizeof(Attr);
+			Attr.sched_policy = kSchedDeadline;
+			Attr.sched_runtime = (uint64_t)(1e9 * Config.DeadlineRuntime_s);
+			Attr.sched_period = (uint64_t)(1e9 * Config.DeadlinePeriod_s);
+			Attr.sched_deadline = (Config.Deadline_s > 0.0) ? (uint64_t)(1e9 * Config.Deadline_s) : Attr.sched_period;
+			if((Attr.sched_runtime == 0) || (Attr.sched_runtime > Attr.sched_deadline) || (Attr.sched_deadline > Attr.sched_period))
+				iError = EINVAL;
+			else if(syscall(SYS_sched_setattr, 0, &Attr, 0) != 0)
+				iError = errno;
+#else
+			iError = ENOTSUP;
+#endif
+			break;
+		}
+		}
+		if(iError) {
+			Report.Scheduling = false;
+			AppendStatus(Report, "Scheduling", iError);
+		}
+
+		if(!Config.Cpus.empty()) {
+#ifdef __linux__
+			cpu_set_t CpuSet;
+			CPU_ZERO(&CpuSet);
+			for(auto iCpu : Config.Cpus)
+				if((iCpu >= 0) && (iCpu < CPU_SETSIZE))
+					CPU_SET(iCpu, &CpuSet);
+			iError = (CPU_COUNT(&CpuSet) > 0) ? pthread_setaffinity_np(pthread_self(), sizeof(CpuSet), &CpuSet) : EINVAL;
+#else
+			iError = ENOTSUP;
+#endif
+			if(iError) {
+				Report.Affinity = false;
+				AppendStatus(Report, "CPU affinity", iError);
+			}
+		}
+#endif
+	}
+
+	void LockProcessMemory(RealTimeReport &Report)
+	{
+#ifdef _WIN32
+		// Windows has no equivalent of mlockall; buffers are locked individually by a PageAllocator
+		// whose AllocationPolicy sets Lock (see AudIO::SetBufferAllocator()).
+		Report.MemoryLocked = false;
+		AppendStatus(Report, "Process memory lock", ERROR_NOT_SUPPORTED);
+#else
+		if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+			Report.MemoryLocked = false;
+			AppendStatus(Report, "mlockall", errno);
+		}
+#endif
+	}
+
+	void LockRegion(const void *pRegion, size_t Bytes, RealTimeReport &Report)
+	{
+		if(!pRegion || !Bytes)
+			return;
+#ifdef _WIN32
+		if(!VirtualLock(const_cast<void *>(pRegion), Bytes)) {
+			Report.MemoryLocked = false;
+			AppendStatus(Report, "VirtualLock", (int)GetLastError());
+		}
+#else
+		if(mlock(pRegion, Bytes) != 0) {
+			Report.MemoryLocked = false;
+			AppendStatus(Report, "mlock", errno);
+		}
+#endif
+	}
+
+}
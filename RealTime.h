@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace Audaptr
+{
+	/// @brief Scheduling policy requested for a real-time thread
+	enum class SchedulingPolicy {
+		Unchanged,	///< Leave the scheduling policy and priority as they are
+		Normal,		///< Default time-sharing scheduling
+		Fifo,		///< SCHED_FIFO (Windows: time-critical priority)
+		RoundRobin,	///< SCHED_RR (Windows: time-critical priority)
+		Deadline	///< SCHED_DEADLINE (Linux only)
+	};
+
+	/// @brief Real-time configuration applied to consumer and worker threads
+	struct RealTimeConfig
+	{
+		/// @brief Scheduling policy
+		SchedulingPolicy Policy = SchedulingPolicy::Fifo;
+
+		/// @brief Static priority for SCHED_FIFO / SCHED_RR, clamped to the range supported by the system
+		int Priority = 70;
+
+		/// @brief SCHED_DEADLINE runtime budget per period [seconds]
+		double DeadlineRuntime_s = 0.0;
+
+		/// @brief SCHED_DEADLINE relative deadline [seconds]; zero selects the period
+		double Deadline_s = 0.0;
+
+		/// @brief SCHED_DEADLINE period [seconds], typically the audio block duration
+		double DeadlinePeriod_s = 0.0;
+
+		/// @brief CPUs to which the thread is pinned; empty leaves the affinity unchanged
+		std::vector<int> Cpus;
+
+		/// @brief Lock all current and future process memory into RAM (mlockall)
+		bool LockMemory = true;
+
+		/// @brief Touch every page of the buffers concerned, so that no page faults occur on the hot path
+		bool PrefaultBuffers = true;
+	};
+
+	/// @brief Outcome of applying a RealTimeConfig; each flag is true if the step succeeded or was not requested
+	struct RealTimeReport
+	{
+		bool Scheduling = true;
+
+		bool Affinity = true;
+
+		bool MemoryLocked = true;
+
+		bool Prefaulted = true;
+
+		/// @brief Description of any steps that failed
+		std::string Status;
+
+		/// @brief Flag indicating whether every requested step succeeded
+		bool Success() const
+		{
+			return Scheduling && Affinity && MemoryLocked && Prefaulted;
+		}
+	};
+
+	/// @brief Apply the scheduling policy and CPU affinity of a configuration to the calling thread
+	/// @param Config Requested configuration
+	/// @param Report Updated with the outcome of the scheduling and affinity steps
+	void ConfigureCurrentThread(const RealTimeConfig& Config, RealTimeReport& Report);
+
+	/// @brief Lock all current and future pages of the process into RAM
+	/// @param Report Updated with the outcome
+	void LockProcessMemory(RealTimeReport& Report);
+
+	/// @brief Lock a region of memory into RAM (e.g. a QuickBuffer when process-wide locking is unavailable)
+	/// @param pRegion Start of the region
+	/// @param Bytes Size of the region [bytes]
+	/// @param Report Updated with the outcome
+	void LockRegion(const void* pRegion, size_t Bytes, RealTimeReport& Report);
+
+}
@@ -0,0 +1,276 @@
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include "Audaptr.h"
+#include "RoutingMatrix.h"
+#include "SampleConvert.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define AUDAPTR_AVX2 1
+#endif
+
+using namespace std;
+
+namespace Audaptr
+{
+	// Destinations handled per vector
+	static constexpr size_t kLanes = 8;
+
+	void GatherChannels(const float *pSrc, const size_t NumSrcChannels, float *pDst, const size_t NumDstChannels, const int32_t *pIndices, const size_t NumFrames) noexcept
+	{
+		const size_t NumVectors = NumDstChannels / kLanes;
+#if defined(AUDAPTR_AVX2)
+		for(size_t Frame = 0; Frame < NumFrames; Frame++, pSrc += NumSrcChannels, pDst += NumDstChannels) {
+			for(size_t n = 0; n < NumVectors; n++) {
+				const __m256i Indices = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pIndices + n * kLanes));
+				_mm256_storeu_ps(pDst + n * kLanes, _mm256_i32gather_ps(pSrc, Indices, 4));
+			}
+			for(size_t Channel = NumVectors * kLanes; Channel < NumDstChannels; Channel++)
+				pDst[Channel] = pSrc[pIndices[Channel]];
+		}
+#else
+		(void)NumVectors;
+		for(size_t Frame = 0; Frame < NumFrames; Frame++, pSrc += NumSrcChannels, pDst += NumDstChannels)
+			for(size_t Channel = 0; Channel < NumDstChannels; Channel++)
+				pDst[Channel] = pSrc[pIndices[Channel]];
+#endif
+	}
+
+	// Sum of the layers of gathered, weighted sources for each destination. While Ramping, the gains are advanced by
+	// their steps after each frame.
+	template<bool Ramping>
+	static void MixChannels(const float *pSrc, const size_t NumSrcChannels, float *pDst, const size_t NumDstChannels, const int32_t *pIndices, float *pGains, const float *pSteps, const size_t Stride, const size_t NumLayers, const size_t NumFrames) noexcept
+	{
+		for(size_t Frame = 0; Frame < NumFrames; Frame++, pSrc += NumSrcChannels, pDst += NumDstChannels) {
+			for(size_t First = 0; First < NumDstChannels; First += kLanes) {
+#if defined(AUDAPTR_AVX2)
+				__m256 Sum = _mm256_setzero_ps();
+				for(size_t Layer = 0; Layer < NumLayers; Layer++) {
+					const size_t Slot = Layer * Stride + First;
+					const __m256i Indices = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pIndices + Slot));
+					// Unused slots hold -1: mask them off, and gather from channel 0 instead.
+					const __m256i Used = _mm256_cmpgt_epi32(Indices, _mm256_set1_epi32(-1));
+					const __m256 Sources = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), pSrc, _mm256_and_si256(Indices, Used), _mm256_castsi256_ps(Used), 4);
+					const __m256 Gains = _mm256_loadu_ps(pGains + Slot);
+					Sum = _mm256_add_ps(Sum, _mm256_mul_ps(Gains, Sources));
+					if constexpr(Ramping)
+						_mm256_storeu_ps(pGains + Slot, _mm256_add_ps(Gains, _mm256_loadu_ps(pSteps + Slot)));
+				}
+				if(First + kLanes <= NumDstChannels)
+					_mm256_storeu_ps(pDst + First, Sum);
+				else {
+					alignas(32) float Lanes[kLanes];
+					_mm256_store_ps(Lanes, Sum);
+					memcpy(pDst + First, Lanes, (NumDstChannels - First) * sizeof(float));
+				}
+#else
+				float Sum[kLanes] = {};
+				for(size_t Layer = 0; Layer < NumLayers; Layer++) {
+					const size_t Slot = Layer * Stride + First;
+					for(size_t Lane = 0; Lane < kLanes; Lane++) {
+						const int32_t Index = pIndices[Slot + Lane];
+						Sum[Lane] += (Index >= 0) ? pGains[Slot + Lane] * pSrc[Index] : 0.0f;
+					}
+					if constexpr(Ramping)
+						for(size_t Lane = 0; Lane < kLanes; Lane++)
+							pGains[Slot + Lane] += pSteps[Slot + Lane];
+				}
+				memcpy(pDst + First, Sum, (min(First + kLanes, NumDstChannels) - First) * sizeof(float));
+#endif
+			}
+		}
+	}
+
+	RoutingMatrix::RoutingMatrix(const int NumSources, const int NumDestinations) :
+		NumSources_(NumSources), NumDestinations_(NumDestinations)
+	{
+		if((NumSources <= 0) || (NumDestinations <= 0))
+			throw Exception("A routing matrix requires at least one source and one destination");
+		Stride_ = (((size_t)NumDestinations + kLanes - 1) / kLanes) * kLanes;
+		vScratch_.resize(kChunkFrames * (size_t)max(NumSources, NumDestinations));
+		Build();
+	}
+
+	void RoutingMatrix::Connect(const int Destination, const int Source, const float Gain)
+	{
+		if((Destination < 0) || (Destination >= NumDestinations_) || (Source < 0) || (Source >= NumSources_))
+			throw Exception("Route " + to_string(Source) + " -> " + to_string(Destination) + " is outside the routing matrix");
+		for(Connection &Existing : vConnections_)
+			if((Existing.Destination == Destination) && (Existing.Source == Source)) {
+				Existing.Gain = Gain;
+				Build();
+				return;
+			}
+		vConnections_.push_back({Destination, Source, Gain});
+		Build();
+	}
+
+	void RoutingMatrix::Disconnect(const int Destination, const int Source)
+	{
+		vConnections_.erase(remove_if(vConnections_.begin(), vConnections_.end(), [&](const Connection &Existing) {
+			return (Existing.Destination == Destination) && (Existing.Source == Source);
+		}), vConnections_.end());
+		Build();
+	}
+
+	void RoutingMatrix::Clear()
+	{
+		vConnections_.clear();
+		Build();
+	}
+
+	void RoutingMatrix::Select(const vector<int> &Sources)
+	{
+		if(Sources.size() != (size_t)NumDestinations_)
+			throw Exception("A selection requires one source for each of the " + to_string(NumDestinations_) + " destinations");
+		vConnections_.clear();
+		for(size_t Destination = 0; Destination < Sources.size(); Destination++) {
+			if((Sources[Destination] < 0) || (Sources[Destination] >= NumSources_))
+				throw Exception("Source channel " + to_string(Sources[Destination]) + " is outside the routing matrix");
+			vConnections_.push_back({(int)Destination, Sources[Destination], 1.0f});
+		}
+		Build();
+	}
+
+	void RoutingMatrix::SetGain(const int Destination, const int Source, const float Gain)
+	{
+		const ptrdiff_t Index = Slot(Destination, Source);
+		if(Index < 0)
+			throw Exception("Route " + to_string(Source) + " -> " + to_string(Destination) + " is not connected");
+		vRequested_[(size_t)Index] = Gain;
+		Requested_.Store(vRequested_);
+	}
+
+	float RoutingMatrix::Gain(const int Destination, const int Source) const
+	{
+		const ptrdiff_t Index = Slot(Destination, Source);
+		return (Index < 0) ? 0.0f : vRequested_[(size_t)Index];
+	}
+
+	void RoutingMatrix::SetRampFrames(const size_t Frames)
+	{
+		RampFrames_ = max(Frames, (size_t)1);
+	}
+
+	ptrdiff_t RoutingMatrix::Slot(const int Destination, const int Source) const
+	{
+		if((Destination < 0) || (Destination >= NumDestinations_))
+			return -1;
+		for(size_t Layer = 0; Layer < NumLayers_; Layer++) {
+			const size_t Index = Layer * Stride_ + (size_t)Destination;
+			if(vIndices_[Index] == Source)
+				return (ptrdiff_t)Index;
+		}
+		return -1;
+	}
+
+	void RoutingMatrix::Build()
+	{
+		// One layer per source of the busiest destination; sparser destinations leave slots unused.
+		vector<size_t> vNumSources((size_t)NumDestinations_, 0);
+		NumLayers_ = 0;
+		for(const Connection &Route : vConnections_)
+			NumLayers_ = max(NumLayers_, ++vNumSources[(size_t)Route.Destination]);
+		const size_t NumSlots = max(NumLayers_, (size_t)1) * Stride_;
+		vIndices_.assign(NumSlots, -1);
+		vCurrent_.assign(NumSlots, 0.0f);
+		vStep_.assign(NumSlots, 0.0f);
+		fill(vNumSources.begin(), vNumSources.end(), 0);
+		for(const Connection &Route : vConnections_) {
+			const size_t Index = (vNumSources[(size_t)Route.Destination]++) * Stride_ + (size_t)Route.Destination;
+			vIndices_[Index] = Route.Source;
+			vCurrent_[Index] = Route.Gain;
+		}
+		vRequested_ = vCurrent_;
+		Requested_.Reset(vCurrent_);
+		RampRemaining_ = 0;
+
+		Selection_ = IsSelection();
+	}
+
+	bool RoutingMatrix::IsSelection() const
+	{
+		// A selection routes every destination from exactly one source at unit gain.
+		if(NumLayers_ != 1)
+			return false;
+		for(size_t Destination = 0; Destination < (size_t)NumDestinations_; Destination++)
+			if((vIndices_[Destination] < 0) || (vCurrent_[Destination] != 1.0f))
+				return false;
+		return true;
+	}
+
+	void RoutingMatrix::UpdateGains() noexcept
+	{
+		if(!Requested_.Update())
+			return;
+		// Ramp from wherever the gains are now, even in the middle of a previous ramp.
+		const vector<float> &Target = Requested_.Read();
+		const float Frames = (float)RampFrames_;
+		for(size_t Index = 0; Index < Target.size(); Index++)
+			vStep_[Index] = (Target[Index] - vCurrent_[Index]) / Frames;
+		RampRemaining_ = RampFrames_;
+		Selection_ = false;
+	}
+
+	void RoutingMatrix::Route(const float *pSrc, float *pDst, size_t NumFrames) noexcept
+	{
+		const size_t NumSources = (size_t)NumSources_, NumDestinations = (size_t)NumDestinations_;
+		if(NumLayers_ == 0) {
+			memset(pDst, 0, NumFrames * NumDestinations * sizeof(float));
+			return;
+		}
+		if(Selection_) {
+			GatherChannels(pSrc, NumSources, pDst, NumDestinations, vIndices_.data(), NumFrames);
+			return;
+		}
+		if(RampRemaining_ > 0) {
+			const size_t RampFrames = min(NumFrames, RampRemaining_);
+			MixChannels<true>(pSrc, NumSources, pDst, NumDestinations, vIndices_.data(), vCurrent_.data(), vStep_.data(), Stride_, NumLayers_, RampFrames);
+			pSrc += RampFrames * NumSources;
+			pDst += RampFrames * NumDestinations;
+			NumFrames -= RampFrames;
+			RampRemaining_ -= RampFrames;
+			if(RampRemaining_ > 0)
+				return;
+			// Land exactly on the targets, and return to the plain gather if they form a selection.
+			vCurrent_ = Requested_.Read();
+			Selection_ = IsSelection();
+			if(Selection_) {
+				GatherChannels(pSrc, NumSources, pDst, NumDestinations, vIndices_.data(), NumFrames);
+				return;
+			}
+		}
+		MixChannels<false>(pSrc, NumSources, pDst, NumDestinations, vIndices_.data(), vCurrent_.data(), vStep_.data(), Stride_, NumLayers_, NumFrames);
+	}
+
+	void RoutingMatrix::Process(const float *pSrc, float *pDst, const size_t NumFrames) noexcept
+	{
+		UpdateGains();
+		Route(pSrc, pDst, NumFrames);
+	}
+
+	void RoutingMatrix::Process(const int16_t *pSrc, float *pDst, const size_t NumFrames) noexcept
+	{
+		UpdateGains();
+		const size_t NumSources = (size_t)NumSources_, NumDestinations = (size_t)NumDestinations_;
+		for(size_t Frame = 0; Frame < NumFrames; Frame += kChunkFrames) {
+			const size_t ChunkFrames = min(kChunkFrames, NumFrames - Frame);
+			ConvertSamples(pSrc + Frame * NumSources, vScratch_.data(), ChunkFrames * NumSources);
+			Route(vScratch_.data(), pDst + Frame * NumDestinations, ChunkFrames);
+		}
+	}
+
+	void RoutingMatrix::Process(const float *pSrc, int16_t *pDst, const size_t NumFrames) noexcept
+	{
+		UpdateGains();
+		const size_t NumSources = (size_t)NumSources_, NumDestinations = (size_t)NumDestinations_;
+		for(size_t Frame = 0; Frame < NumFrames; Frame += kChunkFrames) {
+			const size_t ChunkFrames = min(kChunkFrames, NumFrames - Frame);
+			Route(pSrc + Frame * NumSources, vScratch_.data(), ChunkFrames);
+			ConvertSamples(vScratch_.data(), pDst + Frame * NumDestinations, ChunkFrames * NumDestinations);
+		}
+	}
+
+}
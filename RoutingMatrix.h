@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ParamMailbox.h"
+
+namespace Audaptr
+{
+	/// @brief Copy selected channels of interleaved frames: channel n of each destination frame is taken from channel
+	/// pIndices[n] of the corresponding source frame. Vectorised with AVX2 gathers where available.
+	/// @param pSrc Source frames
+	/// @param NumSrcChannels Number of channels in each source frame
+	/// @param pDst Destination frames
+	/// @param NumDstChannels Number of channels in each destination frame
+	/// @param pIndices Source channel of each destination channel
+	/// @param NumFrames Number of frames
+	void GatherChannels(const float* pSrc, size_t NumSrcChannels, float* pDst, size_t NumDstChannels, const int32_t* pIndices, size_t NumFrames) noexcept;
+
+	/// @brief Sparse gain matrix routing interleaved source channels to interleaved destination channels, e.g. to
+	/// select and reorder device inputs before they reach the input ring, or to map ring channels onto device outputs.
+	/// Each destination is the sum of its connected sources, each weighted by a gain. Routes are held as a few dense
+	/// layers (one per source feeding the busiest destination), so that mixing is a gather and multiply-add per layer;
+	/// a pure selection with unit gains reduces to a single gather.
+	/// The routes may only change while no stream processes through the matrix; gains may change at any time, and
+	/// are ramped linearly over RampFrames() to avoid clicks.
+	class RoutingMatrix
+	{
+	public:
+		/// @brief Constructor, for a matrix without any routes
+		/// @param NumSources Number of source channels
+		/// @param NumDestinations Number of destination channels
+		RoutingMatrix(const int NumSources, const int NumDestinations);
+
+		RoutingMatrix(const RoutingMatrix&) = delete;
+		RoutingMatrix& operator=(const RoutingMatrix&) = delete;
+
+		int NumSources() const { return NumSources_; }
+
+		int NumDestinations() const { return NumDestinations_; }
+
+		/// @brief Add a route, or change the gain of an existing route without a ramp. Not valid while processing.
+		void Connect(const int Destination, const int Source, const float Gain = 1.0f);
+
+		/// @brief Remove a route, if present. Not valid while processing.
+		void Disconnect(const int Destination, const int Source);
+
+		/// @brief Remove all routes. Not valid while processing.
+		void Clear();
+
+		/// @brief Replace the routes with a selection (and reordering) of source channels at unit gain.
+		/// Not valid while processing.
+		/// @param Sources Source channel of each destination channel
+		void Select(const std::vector<int>& Sources);
+
+		/// @brief Change the gain of an existing route; the change is ramped in by the processing thread.
+		/// Lockfree, and valid at any time from one control thread. The processing thread always picks up a
+		/// complete set of gains, so changes made together are ramped together.
+		void SetGain(const int Destination, const int Source, const float Gain);
+
+		/// @brief Gain requested for a route (zero if not connected). Only valid on the control thread.
+		float Gain(const int Destination, const int Source) const;
+
+		/// @brief Set the duration of gain ramps [frames]. Not valid while processing.
+		void SetRampFrames(const size_t Frames);
+
+		size_t RampFrames() const { return RampFrames_; }
+
+		/// @brief Route a block of interleaved frames. Only one thread (the audio thread) may call this.
+		void Process(const float* pSrc, float* pDst, const size_t NumFrames) noexcept;
+
+		/// @brief Route a block of interleaved 16-bit frames, converting them to floating point.
+		void Process(const int16_t* pSrc, float* pDst, const size_t NumFrames) noexcept;
+
+		/// @brief Route a block of interleaved frames, converting the result to 16-bit integers.
+		void Process(const float* pSrc, int16_t* pDst, size_t NumFrames) noexcept;
+
+	protected:
+		/// Number of frames converted at a time for 16-bit sources or destinations
+		static constexpr size_t kChunkFrames = 64;
+
+		/// Rebuild the layers after the routes changed
+		void Build();
+
+		/// Slot of a route in the layers, or -1
+		ptrdiff_t Slot(const int Destination, const int Source) const;
+
+		/// Flag indicating whether every destination is routed from exactly one source at unit gain
+		bool IsSelection() const;
+
+		/// Pick up gain changes and start a ramp towards them
+		void UpdateGains() noexcept;
+
+		void Route(const float* pSrc, float* pDst, size_t NumFrames) noexcept;
+
+		struct Connection
+		{
+			int Destination;
+
+			int Source;
+
+			float Gain;
+		};
+
+		int NumSources_;
+
+		int NumDestinations_;
+
+		/// Destinations per layer, rounded up to a whole number of vectors
+		size_t Stride_;
+
+		size_t NumLayers_ = 0;
+
+		size_t RampFrames_ = 256;
+
+		/// Routes, as last connected
+		std::vector<Connection> vConnections_;
+
+		/// Source channel of each slot, or -1 where a destination has fewer sources than there are layers
+		std::vector<int32_t> vIndices_;
+
+		/// Gain applied to each slot; owned by the processing thread
+		std::vector<float> vCurrent_;
+
+		/// Gain increment per frame during a ramp
+		std::vector<float> vStep_;
+
+		/// Requested gain of each slot; owned by the control thread
+		std::vector<float> vRequested_;
+
+		/// Requested gains passed to the processing thread, which ramps towards the copy it last read
+		TripleBuffer<std::vector<float>> Requested_;
+
+		size_t RampRemaining_ = 0;
+
+		/// Flag indicating that the gains form a selection and no ramp is in progress, so a plain gather suffices
+		bool Selection_ = false;
+
+		std::vector<float> vScratch_;
+	};
+
+}
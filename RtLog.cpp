@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+
+#include "Audaptr.h"
+#include "RtLog.h"
+
+using namespace std;
+
+namespace Audaptr
+{
+	const vector<string> RtLogLevelNames{"debug", "info", "warning", "error"};
+
+	// Guards the links between logs and loggers, so that either may go first. It is taken before a logger's mutex.
+	static mutex &LinkMutex()
+	{
+		static mutex Links;
+		return Links;
+	}
+
+	void RtLog::Detach()
+	{
+		lock_guard<mutex> Lock(LinkMutex());
+		if(pLogger_)
+			pLogger_->DetachLinked(*this);
+	}
+
+	RtLogger::RtLogger(Sink Output, const double FlushInterval_s) :
+		Output_(move(Output))
+	{
+		if(!Output_)
+			Output_ = [](const RtLogMessage &Message) {
+				fprintf(stderr, "[%.6f] %s %s: %s\n", 1e-9 * (double)Message.Time_ns, Message.Source.c_str(), RtLogLevelNames[(size_t)Message.Level].c_str(), Message.Text.c_str());
+			};
+		Formatter_ = thread([this, FlushInterval_s]() {
+			unique_lock<mutex> Lock(Mutex_);
+			while(!Wake_.wait_for(Lock, chrono::duration<double>(FlushInterval_s), [this] { return Quit_; }))
+				for(Source &From : vSources_)
+					DrainLocked(From);
+		});
+	}
+
+	RtLogger::~RtLogger()
+	{
+		{
+			lock_guard<mutex> Lock(Mutex_);
+			Quit_ = true;
+		}
+		Wake_.notify_all();
+		Formatter_.join();
+		lock_guard<mutex> Links(LinkMutex());
+		lock_guard<mutex> Lock(Mutex_);
+		for(Source &From : vSources_) {
+			DrainLocked(From);
+			From.pLog->Attached_.store(false, memory_order_relaxed);
+			From.pLog->pLogger_ = nullptr;
+		}
+	}
+
+	void RtLogger::Attach(RtLog &Log, const string &Name)
+	{
+		lock_guard<mutex> Links(LinkMutex());
+		lock_guard<mutex> Lock(Mutex_);
+		if(Log.pLogger_)
+			throw Exception("The log is already attached to a logger");
+		vSources_.push_back(Source{&Log, Name, Log.Dropped()});
+		Log.pLogger_ = this;
+		Log.Attached_.store(true, memory_order_relaxed);
+	}
+
+	void RtLogger::Detach(RtLog &Log)
+	{
+		lock_guard<mutex> Links(LinkMutex());
+		if(Log.pLogger_ == this)
+			DetachLinked(Log);
+	}
+
+	void RtLogger::DetachLinked(RtLog &Log)
+	{
+		lock_guard<mutex> Lock(Mutex_);
+		auto It = find_if(vSources_.begin(), vSources_.end(), [&Log](const Source &From) { return From.pLog == &Log; });
+		Log.Attached_.store(false, memory_order_relaxed);
+		Log.pLogger_ = nullptr;
+		if(It == vSources_.end())
+			return;
+		DrainLocked(*It);
+		vSources_.erase(It);
+	}
+
+	void RtLogger::Flush()
+	{
+		lock_guard<mutex> Lock(Mutex_);
+		for(Source &From : vSources_)
+			DrainLocked(From);
+	}
+
+	void RtLogger::DrainLocked(Source &From)
+	{
+		size_t Available = 0;
+		while(const RtLogRecord *pRecords = From.pLog->Ring_.ReadAcquire(Available)) {
+			for(size_t n = 0; n < Available; n++) {
+				const string Text = Format(pRecords[n]);
+				Output_(RtLogMessage{pRecords[n].Time_ns, pRecords[n].Level, From.Name, Text});
+			}
+			From.pLog->Ring_.ReadRelease(Available);
+		}
+		const uint64_t Dropped = From.pLog->Dropped();
+		if(Dropped != From.Dropped) {
+			const string Text = to_string(Dropped - From.Dropped) + " log records dropped";
+			const uint64_t Now_ns = (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+			Output_(RtLogMessage{Now_ns, RtLogLevel::Warning, From.Name, Text});
+			From.Dropped = Dropped;
+		}
+	}
+
+	string RtLogger::Format(const RtLogRecord &Record)
+	{
+		string Text;
+		size_t Arg = 0;
+		for(const char *p = Record.Format; *p; p++) {
+			const bool Hex = (p[0] == '{') && (p[1] == 'x') && (p[2] == '}');
+			if(((p[0] != '{') || (p[1] != '}')) && !Hex) {
+				Text += *p;
+				continue;
+			}
+			p += Hex ? 2 : 1;
+			if(Arg >= Record.NumArgs) {
+				Text += Hex ? "{x}" : "{}";
+				continue;
+			}
+			char Buffer[32];
+			const RtLogRecord::Value &Value = Record.Args[Arg];
+			switch(Record.Types[Arg++]) {
+			case RtLogArgType::Int:
+				if(Hex)
+					snprintf(Buffer, sizeof(Buffer), "%" PRIx64, (uint64_t)Value.Int);
+				else
+					snprintf(Buffer, sizeof(Buffer), "%" PRId64, Value.Int);
+				break;
+			case RtLogArgType::UInt:
+				snprintf(Buffer, sizeof(Buffer), Hex ? "%" PRIx64 : "%" PRIu64, Value.UInt);
+				break;
+			case RtLogArgType::Real:
+				snprintf(Buffer, sizeof(Buffer), "%g", Value.Real);
+				break;
+			case RtLogArgType::Text:
+				Text += Value.Text ? Value.Text : "(null)";
+				continue;
+			}
+			Text += Buffer;
+		}
+		return Text;
+	}
+
+}
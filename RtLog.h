@@ -0,0 +1,244 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "QuickBuffer.h"
+
+namespace Audaptr
+{
+	enum class RtLogLevel : uint8_t
+	{
+		Debug,
+		Info,
+		Warning,
+		Error
+	};
+
+	extern const std::vector<std::string> RtLogLevelNames;
+
+	/// @brief Type of an argument stored in an RtLogRecord
+	enum class RtLogArgType : uint8_t
+	{
+		Int,
+		UInt,
+		Real,
+		Text
+	};
+
+	/// @brief Fixed-size binary log record: a format string and up to kMaxArgs arguments, formatted later by an
+	/// RtLogger. Trivial, so that it can pass through a QuickBuffer.
+	struct RtLogRecord
+	{
+		static constexpr size_t kMaxArgs = 4;
+
+		union Value
+		{
+			int64_t Int;
+
+			uint64_t UInt;
+
+			double Real;
+
+			/// Text with static storage duration, e.g. a string literal
+			const char* Text;
+		};
+
+		/// @brief Time the record was written, on the steady clock [nanoseconds]
+		uint64_t Time_ns;
+
+		/// @brief Format string with static storage duration, with a "{}" (or "{x}" for hexadecimal) for each argument
+		const char* Format;
+
+		RtLogLevel Level;
+
+		uint8_t NumArgs;
+
+		RtLogArgType Types[kMaxArgs];
+
+		Value Args[kMaxArgs];
+	};
+
+	class RtLogger;
+
+	/// @brief Real-time-safe log of one producer thread, e.g. a stream callback: each message is a fixed-size record
+	/// holding a format string and its arguments, stored in a preallocated single-producer, single-consumer ring.
+	/// Writing never blocks, allocates, formats or makes a system call; a record that finds the ring full (or the
+	/// log not attached to an RtLogger) is dropped and counted. The attached RtLogger formats the records on its own
+	/// thread and passes them to its sink. A log and its logger may be destroyed in either order.
+	class RtLog
+	{
+	public:
+		/// @brief Constructor
+		/// @param Capacity Number of records the ring holds; it need only hold the messages of one flush interval
+		explicit RtLog(const size_t Capacity = 256) : Ring_(Capacity + 1) { Ring_.Open(); }
+
+		/// @brief Destructor, detaching the log from its logger if that still exists
+		~RtLog() { Detach(); }
+
+		RtLog(const RtLog&) = delete;
+		RtLog& operator=(const RtLog&) = delete;
+
+		/// @brief Write a message. Only one thread at a time may write, and threads that take turns must be ordered
+		/// (e.g. the stream callback, then the stream-finished callback).
+		/// @param Level Severity
+		/// @param Format Format string with static storage duration, e.g. a string literal; each "{}" or "{x}" is
+		/// replaced by the next argument
+		/// @param Values Up to RtLogRecord::kMaxArgs integers, floating-point numbers or static strings
+		/// @return false if the record was dropped
+		template<typename... ArgTs>
+		inline bool Write(const RtLogLevel Level, const char* Format, const ArgTs&... Values) noexcept
+		{
+			static_assert(sizeof...(ArgTs) <= RtLogRecord::kMaxArgs, "Too many arguments for a log record");
+			if(!Attached_.load(std::memory_order_relaxed)) {
+				Dropped_.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			RtLogRecord* pRecord = Ring_.WriteReserve(1);
+			if(!pRecord) {
+				Dropped_.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			pRecord->Time_ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+			pRecord->Format = Format;
+			pRecord->Level = Level;
+			pRecord->NumArgs = (uint8_t)sizeof...(ArgTs);
+			size_t Index = 0;
+			(Store(*pRecord, Index++, Values), ...);
+			Ring_.WriteCommit(1);
+			return true;
+		}
+
+		/// @brief Number of records dropped so far
+		uint64_t Dropped() const { return Dropped_.load(std::memory_order_relaxed); }
+
+		/// @brief Flag indicating whether an RtLogger takes the records
+		bool Attached() const { return Attached_.load(std::memory_order_relaxed); }
+
+		/// @brief Detach the log from its logger, if it is attached; valid even if the logger has been destroyed
+		void Detach();
+
+	protected:
+		friend class RtLogger;
+
+		template<typename T>
+		static inline void Store(RtLogRecord& Record, const size_t Index, const T& Value) noexcept
+		{
+			if constexpr(std::is_same_v<T, bool> || (std::is_integral_v<T> && std::is_unsigned_v<T>)) {
+				Record.Types[Index] = RtLogArgType::UInt;
+				Record.Args[Index].UInt = (uint64_t)Value;
+			}
+			else if constexpr(std::is_integral_v<T> || std::is_enum_v<T>) {
+				Record.Types[Index] = RtLogArgType::Int;
+				Record.Args[Index].Int = (int64_t)Value;
+			}
+			else if constexpr(std::is_floating_point_v<T>) {
+				Record.Types[Index] = RtLogArgType::Real;
+				Record.Args[Index].Real = (double)Value;
+			}
+			else {
+				static_assert(std::is_convertible_v<T, const char*>, "Log arguments must be numbers or static strings");
+				Record.Types[Index] = RtLogArgType::Text;
+				Record.Args[Index].Text = Value;
+			}
+		}
+
+		QuickBuffer<RtLogRecord> Ring_;
+
+		std::atomic<bool> Attached_{false};
+
+		std::atomic<uint64_t> Dropped_{0};
+
+		/// Logger taking the records, or nullptr; guarded by the mutex shared by every log and logger
+		RtLogger* pLogger_ = nullptr;
+	};
+
+	/// @brief Formatted log message, as passed to an RtLogger's sink
+	struct RtLogMessage
+	{
+		/// @brief Time the message was written, on the steady clock [nanoseconds]
+		uint64_t Time_ns;
+
+		RtLogLevel Level;
+
+		/// @brief Name the log was attached with
+		const std::string& Source;
+
+		const std::string& Text;
+	};
+
+	/// @brief Formats and sinks the records of real-time logs on a background thread. Logs are polled every flush
+	/// interval, so their writers never have a thread to wake. Records lost by a log since the last flush are
+	/// reported as a warning from it.
+	class RtLogger
+	{
+	public:
+		using Sink = std::function<void(const RtLogMessage&)>;
+
+		/// @brief Constructor, starting the formatting thread
+		/// @param Output Called on the formatting thread for each message; nullptr writes them to stderr
+		/// @param FlushInterval_s Period of the formatting thread [seconds]
+		explicit RtLogger(Sink Output = nullptr, const double FlushInterval_s = 0.05);
+
+		/// @brief Destructor, sinking whatever remains and detaching every log, so that no log refers to it any more
+		~RtLogger();
+
+		RtLogger(const RtLogger&) = delete;
+		RtLogger& operator=(const RtLogger&) = delete;
+
+		/// @brief Take the records of a log, until either is destroyed or the log is detached
+		/// @param Log Log to take records from
+		/// @param Source Name of the log in the messages, e.g. the stream it belongs to
+		void Attach(RtLog& Log, const std::string& Source);
+
+		/// @brief Sink the records of a log that remain, and stop taking them. Records written afterwards are dropped.
+		void Detach(RtLog& Log);
+
+		/// @brief Sink the records of every log now, rather than at the next flush interval
+		void Flush();
+
+		/// @brief Text of a record, with its arguments in place of the placeholders
+		static std::string Format(const RtLogRecord& Record);
+
+	protected:
+		friend class RtLog;
+
+		struct Source
+		{
+			RtLog* pLog;
+
+			std::string Name;
+
+			/// Drop count already reported
+			uint64_t Dropped;
+		};
+
+		/// Sink the records of a log; called with Mutex_ held
+		void DrainLocked(Source& From);
+
+		/// Detach a log; called with the shared mutex held
+		void DetachLinked(RtLog& Log);
+
+		Sink Output_;
+
+		std::vector<Source> vSources_;
+
+		std::mutex Mutex_;
+
+		std::condition_variable Wake_;
+
+		bool Quit_ = false;
+
+		std::thread Formatter_;
+	};
+
+}
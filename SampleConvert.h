@@ -0,0 +1,98 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define AUDAPTR_SSE2 1
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define AUDAPTR_NEON 1
+#endif
+
+namespace Audaptr
+{
+	/// @brief Scale between 16-bit integer and floating-point samples
+	static constexpr float kInt16Scale = 32768.0f;
+
+	/// @brief Copy or convert a run of interleaved samples. Unaligned pointers are permitted.
+	/// @param pSrc Source samples
+	/// @param pDst Destination samples
+	/// @param NumSamples Number of samples (frames x channels)
+	inline void ConvertSamples(const float *pSrc, float *pDst, const size_t NumSamples) noexcept
+	{
+		memcpy(pDst, pSrc, NumSamples * sizeof(float));
+	}
+
+	inline void ConvertSamples(const int16_t *pSrc, float *pDst, const size_t NumSamples) noexcept
+	{
+		size_t n = 0;
+#if defined(AUDAPTR_SSE2)
+		const __m128 Scale = _mm_set1_ps(1.0f / kInt16Scale);
+		for(; n < (NumSamples & ~(size_t)7); n += 8) {
+			const __m128i Packed = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pSrc + n));
+			// Sign-extend each 16-bit sample to 32 bits.
+			const __m128i Lo = _mm_srai_epi32(_mm_unpacklo_epi16(Packed, Packed), 16);
+			const __m128i Hi = _mm_srai_epi32(_mm_unpackhi_epi16(Packed, Packed), 16);
+			_mm_storeu_ps(pDst + n, _mm_mul_ps(_mm_cvtepi32_ps(Lo), Scale));
+			_mm_storeu_ps(pDst + n + 4, _mm_mul_ps(_mm_cvtepi32_ps(Hi), Scale));
+		}
+#elif defined(AUDAPTR_NEON)
+		for(; n < (NumSamples & ~(size_t)7); n += 8) {
+			const int16x8_t Packed = vld1q_s16(pSrc + n);
+			vst1q_f32(pDst + n, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(Packed))), 1.0f / kInt16Scale));
+			vst1q_f32(pDst + n + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(Packed))), 1.0f / kInt16Scale));
+		}
+#endif
+		for(; n < NumSamples; n++)
+			pDst[n] = (float)pSrc[n] * (1.0f / kInt16Scale);
+	}
+
+	inline void ConvertSamples(const float *pSrc, int16_t *pDst, const size_t NumSamples) noexcept
+	{
+		size_t n = 0;
+#if defined(AUDAPTR_SSE2)
+		const __m128 Scale = _mm_set1_ps(kInt16Scale), Lowest = _mm_set1_ps(-32768.0f), Highest = _mm_set1_ps(32767.0f);
+		for(; n < (NumSamples & ~(size_t)7); n += 8) {
+			const __m128 Lo = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(pSrc + n), Scale), Lowest), Highest);
+			const __m128 Hi = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(pSrc + n + 4), Scale), Lowest), Highest);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(pDst + n), _mm_packs_epi32(_mm_cvtps_epi32(Lo), _mm_cvtps_epi32(Hi)));
+		}
+#elif defined(AUDAPTR_NEON)
+		for(; n < (NumSamples & ~(size_t)7); n += 8) {
+			const int32x4_t Lo = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(pSrc + n), kInt16Scale));
+			const int32x4_t Hi = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(pSrc + n + 4), kInt16Scale));
+			vst1q_s16(pDst + n, vcombine_s16(vqmovn_s32(Lo), vqmovn_s32(Hi)));
+		}
+#endif
+		for(; n < NumSamples; n++)
+			pDst[n] = (int16_t)std::clamp(std::lrintf(pSrc[n] * kInt16Scale), -32768l, 32767l);
+	}
+
+	/// @brief Copy or convert interleaved frames. When the channel count is known at compile time, frames are
+	/// processed in fixed-size steps of at least 16 samples, which the compiler fully unrolls and vectorises.
+	/// @tparam Channels Number of channels, or 0 if only known at run time
+	/// @param pSrc Source frames
+	/// @param pDst Destination frames
+	/// @param NumFrames Number of frames
+	/// @param NumChannels Number of channels, used only when Channels is 0
+	template<int Channels, typename SrcT, typename DstT>
+	inline void ConvertFrames(const SrcT *pSrc, DstT *pDst, const size_t NumFrames, const size_t NumChannels) noexcept
+	{
+		if constexpr(Channels == 0)
+			ConvertSamples(pSrc, pDst, NumFrames * NumChannels);
+		else {
+			constexpr size_t kFramesPerStep = (Channels >= 16) ? 1 : (16 / Channels);
+			constexpr size_t kSamplesPerStep = kFramesPerStep * Channels;
+			size_t Frame = 0;
+			for(; Frame + kFramesPerStep <= NumFrames; Frame += kFramesPerStep, pSrc += kSamplesPerStep, pDst += kSamplesPerStep)
+				ConvertSamples(pSrc, pDst, kSamplesPerStep);
+			ConvertSamples(pSrc, pDst, (NumFrames - Frame) * Channels);
+		}
+	}
+
+}
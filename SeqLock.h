@@ -0,0 +1,77 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/// @brief Sequence lock publishing a value from a single writer to any number of readers, without blocking either.
+/// The writer never waits, so it is suitable for a real-time thread; a reader retries if it overlapped a write.
+/// The value is held in atomic words, so that the overlapping copies are free of data races.
+/// @tparam T The type of value published. It must be trivially copyable.
+template<typename T> class SeqLock {
+    static_assert(std::is_trivially_copyable<T>::value, "The published type T must be trivially copyable.");
+
+    static constexpr size_t kNumWords = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+public:
+    SeqLock() : SeqLock(T()) {}
+
+    explicit SeqLock(const T& Value)
+    {
+        uint64_t Words[kNumWords] = {};
+        memcpy(Words, &Value, sizeof(T));
+        for(size_t n = 0; n < kNumWords; n++)
+            Words_[n].store(Words[n], std::memory_order_relaxed);
+    }
+
+    SeqLock(const SeqLock&) = delete;
+    SeqLock& operator=(const SeqLock&) = delete;
+
+    /// @brief Publish a value. Only one thread may store.
+    inline void Store(const T& Value) noexcept
+    {
+        uint64_t Words[kNumWords] = {};
+        memcpy(Words, &Value, sizeof(T));
+        const uint32_t Seq = Seq_.load(std::memory_order_relaxed);
+        // An odd sequence marks a write in progress.
+        Seq_.store(Seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for(size_t n = 0; n < kNumWords; n++)
+            Words_[n].store(Words[n], std::memory_order_relaxed);
+        Seq_.store(Seq + 2, std::memory_order_release);
+    }
+
+    /// @brief Attempt to read the value once
+    /// @param Value Set to the published value, iff the return value is true
+    /// @return false if the read overlapped a write
+    inline bool TryLoad(T& Value) const noexcept
+    {
+        const uint32_t Seq = Seq_.load(std::memory_order_acquire);
+        if(Seq & 1)
+            return false;
+        uint64_t Words[kNumWords];
+        for(size_t n = 0; n < kNumWords; n++)
+            Words[n] = Words_[n].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(Seq_.load(std::memory_order_relaxed) != Seq)
+            return false;
+        memcpy(&Value, Words, sizeof(T));
+        return true;
+    }
+
+    /// @brief Read the value, retrying until a read does not overlap a write
+    inline T Load() const noexcept
+    {
+        T Value;
+        while(!TryLoad(Value)) {}
+        return Value;
+    }
+
+    /// @brief Number of values stored since construction
+    inline uint32_t Version() const noexcept { return Seq_.load(std::memory_order_acquire) / 2; }
+
+private:
+    std::atomic<uint32_t> Seq_{0};
+
+    std::atomic<uint64_t> Words_[kNumWords];
+};
@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "Audaptr.h"
+#include "Stft.h"
+
+using namespace std;
+
+namespace Audaptr
+{
+	SpectrumRing::SpectrumRing(const int NumChannels, const size_t NumBins, const size_t NumSlots, const bool HasPhase) :
+		NumChannels_(NumChannels), NumBins_(NumBins), HasPhase_(HasPhase), vSlots_(NumSlots)
+	{
+		if((NumChannels < 1) || (NumBins < 1) || (NumSlots < 2))
+			throw Exception("A spectrum ring requires at least one channel, one bin and two slots");
+		const size_t NumValues = (size_t)NumChannels_ * NumBins_ * (HasPhase_ ? 2 : 1);
+		for(Slot &Entry : vSlots_) {
+			Entry.pData.reset(new atomic<float>[NumValues]);
+			for(size_t n = 0; n < NumValues; n++)
+				Entry.pData[n].store(0.0f, memory_order_relaxed);
+		}
+	}
+
+	bool SpectrumRing::Read(const uint64_t Sequence, SpectrumFrame &Frame) const
+	{
+		const Slot &Entry = vSlots_[Sequence % vSlots_.size()];
+		const uint64_t Seq = Entry.Seq.load(memory_order_acquire);
+		if(Seq != 2 * Sequence + 2)
+			return false;
+		const size_t NumValues = (size_t)NumChannels_ * NumBins_;
+		Frame.vMagnitude.resize(NumValues);
+		Frame.vPhase.resize(HasPhase_ ? NumValues : 0);
+		for(size_t n = 0; n < NumValues; n++)
+			Frame.vMagnitude[n] = Entry.pData[n].load(memory_order_relaxed);
+		if(HasPhase_)
+			for(size_t n = 0; n < NumValues; n++)
+				Frame.vPhase[n] = Entry.pData[NumValues + n].load(memory_order_relaxed);
+		Frame.Sequence = Sequence;
+		Frame.FirstFrame = Entry.FirstFrame.load(memory_order_relaxed);
+		atomic_thread_fence(memory_order_acquire);
+		return Entry.Seq.load(memory_order_relaxed) == Seq;
+	}
+
+	void SpectrumRing::BeginFrame(const uint64_t FirstFrame) noexcept
+	{
+		const uint64_t Sequence = Published_.load(memory_order_relaxed);
+		Slot &Entry = vSlots_[Sequence % vSlots_.size()];
+		Entry.Seq.store(2 * Sequence + 1, memory_order_relaxed);
+		atomic_thread_fence(memory_order_release);
+		Entry.FirstFrame.store(FirstFrame, memory_order_relaxed);
+	}
+
+	void SpectrumRing::StoreChannel(const int Channel, const float *pMagnitude, const float *pPhase) noexcept
+	{
+		Slot &Entry = vSlots_[Published_.load(memory_order_relaxed) % vSlots_.size()];
+		atomic<float> *pData = Entry.pData.get() + (size_t)Channel * NumBins_;
+		for(size_t n = 0; n < NumBins_; n++)
+			pData[n].store(pMagnitude[n], memory_order_relaxed);
+		if(HasPhase_) {
+			pData += (size_t)NumChannels_ * NumBins_;
+			for(size_t n = 0; n < NumBins_; n++)
+				pData[n].store(pPhase[n], memory_order_relaxed);
+		}
+	}
+
+	void SpectrumRing::EndFrame() noexcept
+	{
+		const uint64_t Sequence = Published_.load(memory_order_relaxed);
+		vSlots_[Sequence % vSlots_.size()].Seq.store(2 * Sequence + 2, memory_order_release);
+		Published_.store(Sequence + 1, memory_order_release);
+	}
+
+	SpectrumReader::SpectrumReader(const SpectrumRing &Ring, const bool FromOldest) :
+		Ring_(Ring), Cursor_(Ring.Published())
+	{
+		if(FromOldest)
+			Cursor_ -= min(Cursor_, (uint64_t)Ring_.NumSlots() - 1);
+	}
+
+	bool SpectrumReader::Next(SpectrumFrame &Frame)
+	{
+		for(;;) {
+			const uint64_t Published = Ring_.Published();
+			if(Cursor_ >= Published)
+				return false;
+			// The slot after the newest may already be under way, so only NumSlots() - 1 frames are safe to read.
+			const uint64_t Oldest = Published - min(Published, (uint64_t)Ring_.NumSlots() - 1);
+			if(Cursor_ < Oldest) {
+				Missed_ += Oldest - Cursor_;
+				Cursor_ = Oldest;
+			}
+			if(Ring_.Read(Cursor_, Frame)) {
+				Cursor_++;
+				return true;
+			}
+			// Overwritten while being copied
+			Missed_++;
+			Cursor_++;
+		}
+	}
+
+	Stft::Stft(const int NumChannels, const StftConfig &Config) :
+		NumChannels_(NumChannels), Config_(Config), Pool_(Config.NumWorkers, (size_t)max(NumChannels, 1)),
+		Output_(max(NumChannels, 1), Config.FftSize / 2 + 1, Config.NumSlots, Config.Phase)
+	{
+		if(NumChannels < 1)
+			throw Exception("An STFT requires at least one channel");
+		if((Config_.Hop < 1) || (Config_.Hop > Config_.FftSize))
+			throw Exception("The STFT hop must be between 1 and the FFT size");
+		vWindow_ = MakeWindow(Config_.Window, Config_.FftSize);
+		double Sum = 0.0;
+		for(const float Weight : vWindow_)
+			Sum += Weight;
+		Scale_ = (float)(2.0 / Sum);
+		vHistory_.resize((size_t)NumChannels_ * Config_.FftSize);
+		for(size_t Thread = 0; Thread < Pool_.NumThreads(); Thread++)
+			vScratch_.emplace_back(make_unique<Scratch>(Config_.FftSize));
+	}
+
+	size_t Stft::Process(const float *pFrames, size_t NumFrames)
+	{
+		const size_t FftSize = Config_.FftSize;
+		size_t NumPublished = 0;
+		while(NumFrames > 0) {
+			// Deinterleave into the history until it holds a whole transform.
+			const size_t Count = min(NumFrames, FftSize - Filled_);
+			for(int Channel = 0; Channel < NumChannels_; Channel++) {
+				float *pHistory = &vHistory_[(size_t)Channel * FftSize + Filled_];
+				for(size_t Frame = 0; Frame < Count; Frame++)
+					pHistory[Frame] = pFrames[Frame * NumChannels_ + Channel];
+			}
+			Filled_ += Count;
+			FramesProcessed_ += Count;
+			pFrames += Count * NumChannels_;
+			NumFrames -= Count;
+			if(Filled_ == FftSize) {
+				Analyse();
+				NumPublished++;
+				// Keep the overlap for the next transform.
+				const size_t Keep = FftSize - Config_.Hop;
+				for(int Channel = 0; Channel < NumChannels_; Channel++) {
+					float *pHistory = &vHistory_[(size_t)Channel * FftSize];
+					memmove(pHistory, pHistory + Config_.Hop, Keep * sizeof(float));
+				}
+				Filled_ = Keep;
+			}
+		}
+		return NumPublished;
+	}
+
+	size_t Stft::Drain(QuickBuffer<float> &Source)
+	{
+		size_t Consumed = 0;
+		// The readable items may be split into two contiguous regions.
+		for(int Region = 0; Region < 2; Region++) {
+			size_t Available = 0;
+			const float *pRead = Source.ReadAcquire(Available);
+			const size_t NumFrames = pRead ? Available / NumChannels_ : 0;
+			if(!NumFrames)
+				break;
+			Process(pRead, NumFrames);
+			Source.ReadRelease(NumFrames * NumChannels_);
+			Consumed += NumFrames;
+		}
+		return Consumed;
+	}
+
+	void Stft::Reset()
+	{
+		Filled_ = 0;
+	}
+
+	void Stft::Analyse()
+	{
+		const size_t FftSize = Config_.FftSize, NumBins = FftSize / 2 + 1;
+		Output_.BeginFrame(FramesProcessed_ - FftSize);
+		Pool_.Run((size_t)NumChannels_, [&](const size_t Channel, const size_t Thread) {
+			Scratch &Work = *vScratch_[Thread];
+			const float *pHistory = &vHistory_[Channel * FftSize];
+			for(size_t n = 0; n < FftSize; n++)
+				Work.vSignal[n] = pHistory[n] * vWindow_[n];
+			Work.Fft.Forward(Work.vSignal.data(), Work.vRe.data(), Work.vIm.data());
+			float *pRe = Work.vRe.data(), *pIm = Work.vIm.data();
+			if(Config_.Phase)
+				for(size_t Bin = 0; Bin < NumBins; Bin++)
+					Work.vPhase[Bin] = atan2f(pIm[Bin], pRe[Bin]);
+			// The magnitudes replace the real parts.
+			for(size_t Bin = 0; Bin < NumBins; Bin++)
+				pRe[Bin] = sqrtf(pRe[Bin] * pRe[Bin] + pIm[Bin] * pIm[Bin]) * Scale_;
+			Output_.StoreChannel((int)Channel, pRe, Work.vPhase.data());
+		});
+		Output_.EndFrame();
+	}
+
+}
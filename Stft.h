@@ -0,0 +1,227 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Fft.h"
+#include "QuickBuffer.h"
+#include "TaskPool.h"
+
+namespace Audaptr
+{
+	/// @brief One spectrum frame, as copied out of a SpectrumRing
+	struct SpectrumFrame
+	{
+		/// @brief Number of the frame in the ring, counting from zero
+		uint64_t Sequence = 0;
+
+		/// @brief Index of the first input frame analysed
+		uint64_t FirstFrame = 0;
+
+		/// @brief Magnitude of each bin, channel after channel
+		std::vector<float> vMagnitude;
+
+		/// @brief Phase of each bin [radians], channel after channel; empty if the analysis omits phase
+		std::vector<float> vPhase;
+	};
+
+	/// @brief Ring of spectrum frames published by one writer (an Stft) and read by any number of analyzers, each
+	/// at its own pace. Slots are overwritten in turn without waiting for readers; every slot is guarded by a
+	/// sequence number, as in a SeqLock, so a reader that falls a whole ring behind skips the frames it missed
+	/// instead of seeing torn data.
+	class SpectrumRing
+	{
+	public:
+		/// @brief Constructor
+		/// @param NumChannels Number of channels per frame
+		/// @param NumBins Number of bins per channel
+		/// @param NumSlots Number of frames held
+		/// @param HasPhase Flag indicating whether frames carry phase as well as magnitude
+		SpectrumRing(const int NumChannels, const size_t NumBins, const size_t NumSlots, const bool HasPhase = true);
+
+		SpectrumRing(const SpectrumRing&) = delete;
+		SpectrumRing& operator=(const SpectrumRing&) = delete;
+
+		int NumChannels() const { return NumChannels_; }
+
+		size_t NumBins() const { return NumBins_; }
+
+		size_t NumSlots() const { return vSlots_.size(); }
+
+		bool HasPhase() const { return HasPhase_; }
+
+		/// @brief Number of frames published so far; safe to call from any thread
+		uint64_t Published() const { return Published_.load(std::memory_order_acquire); }
+
+		/// @brief Copy out a frame. Safe to call from any thread.
+		/// @param Sequence Number of the frame wanted
+		/// @param Frame Destination, resized as needed
+		/// @return false if the frame is not published yet, or has been (or is being) overwritten
+		bool Read(const uint64_t Sequence, SpectrumFrame& Frame) const;
+
+		/// @brief Start writing the next frame, claiming the oldest slot. Only the writer may call this.
+		/// @param FirstFrame Index of the first input frame analysed
+		void BeginFrame(const uint64_t FirstFrame) noexcept;
+
+		/// @brief Fill one channel of the frame begun; channels may be stored concurrently from several threads
+		void StoreChannel(const int Channel, const float* pMagnitude, const float* pPhase) noexcept;
+
+		/// @brief Publish the frame begun
+		void EndFrame() noexcept;
+
+	protected:
+		struct Slot
+		{
+			/// 2 * Sequence + 1 while being written, 2 * Sequence + 2 once published; zero if never written
+			std::atomic<uint64_t> Seq{0};
+
+			std::atomic<uint64_t> FirstFrame{0};
+
+			/// Magnitudes then phases, channel after channel; atomic, so that overlapping reads are free of data races
+			std::unique_ptr<std::atomic<float>[]> pData;
+		};
+
+		int NumChannels_;
+
+		size_t NumBins_;
+
+		bool HasPhase_;
+
+		std::vector<Slot> vSlots_;
+
+		std::atomic<uint64_t> Published_{0};
+	};
+
+	/// @brief Cursor through a SpectrumRing for one analyzer
+	class SpectrumReader
+	{
+	public:
+		/// @brief Constructor
+		/// @param Ring Ring to read
+		/// @param FromOldest Flag requesting that reading start from the oldest frame held, rather than the next one
+		explicit SpectrumReader(const SpectrumRing& Ring, const bool FromOldest = false);
+
+		/// @brief Copy out the next frame, if one is available, skipping any that have been overwritten
+		/// @param Frame Destination, resized as needed
+		/// @return false if no new frame is available
+		bool Next(SpectrumFrame& Frame);
+
+		/// @brief Number of frames skipped because they were overwritten before being read
+		uint64_t Missed() const { return Missed_; }
+
+	protected:
+		const SpectrumRing& Ring_;
+
+		uint64_t Cursor_;
+
+		uint64_t Missed_ = 0;
+	};
+
+	/// @brief Settings for an Stft
+	struct StftConfig
+	{
+		/// @brief Transform length; a power of 2, at least 4
+		size_t FftSize = 1024;
+
+		/// @brief Number of input frames between successive transforms; at most FftSize
+		size_t Hop = 256;
+
+		WindowType Window = WindowType::Hann;
+
+		/// @brief Compute the phase of each bin as well as its magnitude
+		bool Phase = true;
+
+		/// @brief Number of spectrum frames held by the output ring
+		size_t NumSlots = 64;
+
+		/// @brief Number of worker threads transforming channels alongside the calling thread; zero selects one less
+		/// than the hardware concurrency
+		size_t NumWorkers = 0;
+	};
+
+	/// @brief Streaming short-time Fourier transform of interleaved multichannel input, e.g. spans of
+	/// AudIO::InBuffer(), so that the transforms run once for all the analyzers sharing its output ring.
+	/// Every Hop frames, the last FftSize frames of each channel are windowed and transformed, with the channels
+	/// batched across a TaskPool, and the magnitude and phase of each bin are published as one SpectrumFrame.
+	/// Magnitudes are scaled by 2 / (sum of the window), so that a full-scale sinusoid centred on a bin reads 1.
+	class Stft
+	{
+	public:
+		/// @brief Constructor
+		/// @param NumChannels Number of interleaved input channels
+		/// @param Config Analysis settings
+		Stft(const int NumChannels, const StftConfig& Config = StftConfig());
+
+		Stft(const Stft&) = delete;
+		Stft& operator=(const Stft&) = delete;
+
+		int NumChannels() const { return NumChannels_; }
+
+		const StftConfig& Config() const { return Config_; }
+
+		/// @brief Number of bins in each channel of a spectrum frame
+		size_t NumBins() const { return Config_.FftSize / 2 + 1; }
+
+		/// @brief Ring to which spectrum frames are published; create a SpectrumReader on it for each analyzer
+		const SpectrumRing& Output() const { return Output_; }
+
+		/// @brief Analyse interleaved frames, publishing a spectrum frame for each hop completed.
+		/// Only one thread may supply frames.
+		/// @param pFrames Interleaved frames
+		/// @param NumFrames Number of frames
+		/// @return Number of spectrum frames published
+		size_t Process(const float* pFrames, size_t NumFrames);
+
+		/// @brief Analyse and release whatever whole frames a buffer holds, as Process()
+		/// @param Source Buffer of interleaved frames, of which this is the reader
+		/// @return Number of input frames consumed
+		size_t Drain(QuickBuffer<float>& Source);
+
+		/// @brief Discard the input history, so that the next spectrum frame needs FftSize new frames
+		void Reset();
+
+		/// @brief Number of input frames consumed so far
+		uint64_t FramesProcessed() const { return FramesProcessed_; }
+
+	protected:
+		/// Transform the history of every channel and publish the result
+		void Analyse();
+
+		int NumChannels_;
+
+		StftConfig Config_;
+
+		std::vector<float> vWindow_;
+
+		/// Magnitude scale undoing the window's gain
+		float Scale_;
+
+		/// Last FftSize frames, one channel after another
+		std::vector<float> vHistory_;
+
+		/// Number of frames held in the history
+		size_t Filled_ = 0;
+
+		uint64_t FramesProcessed_ = 0;
+
+		TaskPool Pool_;
+
+		/// Per-thread transforms and scratch
+		struct Scratch
+		{
+			explicit Scratch(const size_t FftSize) : Fft(FftSize), vSignal(FftSize), vRe(FftSize / 2 + 1), vIm(FftSize / 2 + 1), vPhase(FftSize / 2 + 1) {}
+
+			RealFft Fft;
+
+			std::vector<float> vSignal, vRe, vIm, vPhase;
+		};
+
+		std::vector<std::unique_ptr<Scratch>> vScratch_;
+
+		SpectrumRing Output_;
+	};
+
+}
@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <string>
+
+#include "Audaptr.h"
+#include "TaskPool.h"
+
+using namespace std;
+
+namespace Audaptr
+{
+	TaskPool::TaskPool(size_t NumWorkers, const size_t MaxTasks)
+	{
+		if(!NumWorkers) {
+			const unsigned NumCores = thread::hardware_concurrency();
+			NumWorkers = (NumCores > 1) ? NumCores - 1 : 0;
+		}
+		NumWorkers = min(NumWorkers, (MaxTasks > 0) ? MaxTasks - 1 : 0);
+		for(size_t Worker = 0; Worker < NumWorkers; Worker++)
+			Workers_.emplace_back(&TaskPool::WorkerLoop, this, Worker);
+	}
+
+	TaskPool::~TaskPool()
+	{
+		{
+			lock_guard<mutex> Lock(Mutex_);
+			Quit_ = true;
+		}
+		BatchReady_.notify_all();
+		for(thread &Worker : Workers_)
+			Worker.join();
+	}
+
+	void TaskPool::Run(const size_t NumTasks, const function<void(size_t, size_t)> &Task)
+	{
+		if(!NumTasks)
+			return;
+		if(NumTasks > 0xffffffffu)
+			throw Exception("A batch of " + to_string(NumTasks) + " tasks is too large");
+		uint64_t Generation;
+		{
+			lock_guard<mutex> Lock(Mutex_);
+			pTask_ = &Task;
+			NumTasks_ = NumTasks;
+			pError_ = nullptr;
+			Generation = ++Generation_;
+			TasksDone_.store(0, memory_order_relaxed);
+			Claim_.store(Generation << 32, memory_order_release);
+		}
+		// A single task is not worth waking anyone for.
+		if((NumTasks > 1) && !Workers_.empty())
+			BatchReady_.notify_all();
+		RunTasks(Workers_.size(), Generation, NumTasks, Task);
+		exception_ptr pError;
+		{
+			unique_lock<mutex> Lock(Mutex_);
+			BatchDone_.wait(Lock, [&] { return TasksDone_.load(memory_order_acquire) == NumTasks; });
+			pError = pError_;
+		}
+		if(pError)
+			rethrow_exception(pError);
+	}
+
+	void TaskPool::RunTasks(const size_t Thread, const uint64_t Generation, const size_t NumTasks, const function<void(size_t, size_t)> &Task) noexcept
+	{
+		for(;;) {
+			uint64_t Claim = Claim_.load(memory_order_acquire);
+			do {
+				if(((Claim >> 32) != (Generation & 0xffffffffu)) || ((Claim & 0xffffffffu) >= NumTasks))
+					return;
+			} while(!Claim_.compare_exchange_weak(Claim, Claim + 1, memory_order_acq_rel, memory_order_acquire));
+			try {
+				Task((size_t)(Claim & 0xffffffffu), Thread);
+			}
+			catch(...) {
+				lock_guard<mutex> Lock(Mutex_);
+				if(!pError_)
+					pError_ = current_exception();
+			}
+			if(TasksDone_.fetch_add(1, memory_order_acq_rel) + 1 == NumTasks) {
+				lock_guard<mutex> Lock(Mutex_);
+				BatchDone_.notify_one();
+			}
+		}
+	}
+
+	void TaskPool::WorkerLoop(const size_t Thread)
+	{
+		uint64_t Seen = 0;
+		for(;;) {
+			size_t NumTasks;
+			const function<void(size_t, size_t)> *pTask;
+			{
+				unique_lock<mutex> Lock(Mutex_);
+				BatchReady_.wait(Lock, [&] { return Quit_ || (Generation_ != Seen); });
+				if(Quit_)
+					return;
+				Seen = Generation_;
+				NumTasks = NumTasks_;
+				pTask = pTask_;
+			}
+			RunTasks(Thread, Seen, NumTasks, *pTask);
+		}
+	}
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Audaptr
+{
+	/// @brief Fixed pool of worker threads running batches of independent tasks (typically one per channel) together
+	/// with the calling thread, for stages that split each block across cores. Tasks are claimed one at a time from a
+	/// shared counter, so uneven tasks balance themselves. Unlike a ProcessGraph, the caller waits for each batch.
+	class TaskPool
+	{
+	public:
+		/// @brief Constructor, starting the workers
+		/// @param NumWorkers Number of worker threads besides the calling thread; zero selects one less than the
+		/// hardware concurrency
+		/// @param MaxTasks Largest batch expected; no more workers are started than can be kept busy
+		explicit TaskPool(size_t NumWorkers = 0, const size_t MaxTasks = SIZE_MAX);
+
+		/// @brief Destructor, stopping the workers
+		~TaskPool();
+
+		TaskPool(const TaskPool&) = delete;
+		TaskPool& operator=(const TaskPool&) = delete;
+
+		/// @brief Number of worker threads, besides the calling thread
+		size_t NumWorkers() const { return Workers_.size(); }
+
+		/// @brief Number of threads that may run tasks at once, for sizing per-thread scratch
+		size_t NumThreads() const { return Workers_.size() + 1; }
+
+		/// @brief Run a batch of tasks and wait until all have finished. Only one thread may run batches.
+		/// If tasks throw, the first exception is rethrown once the batch has finished.
+		/// @param NumTasks Number of tasks
+		/// @param Task Called as Task(Index, Thread) for each Index below NumTasks; Thread (below NumThreads()) identifies
+		/// the thread running it, and so which per-thread scratch it may use
+		void Run(const size_t NumTasks, const std::function<void(size_t, size_t)>& Task);
+
+	protected:
+		void WorkerLoop(const size_t Thread);
+
+		/// Claim and run tasks of a batch until none remain
+		void RunTasks(const size_t Thread, const uint64_t Generation, const size_t NumTasks, const std::function<void(size_t, size_t)>& Task) noexcept;
+
+		std::vector<std::thread> Workers_;
+
+		// Current batch, set under Mutex_
+		const std::function<void(size_t, size_t)>* pTask_ = nullptr;
+
+		size_t NumTasks_ = 0;
+
+		/// Low half of the generation in the high word, next task in the low word, so that a thread still holding an
+		/// earlier batch can never claim a task of the current one
+		std::atomic<uint64_t> Claim_{0};
+
+		std::atomic<size_t> TasksDone_{0};
+
+		std::exception_ptr pError_;
+
+		std::mutex Mutex_;
+
+		std::condition_variable BatchReady_;
+
+		std::condition_variable BatchDone_;
+
+		uint64_t Generation_ = 0;
+
+		bool Quit_ = false;
+	};
+
+}
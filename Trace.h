@@ -0,0 +1,352 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define AUDAPTR_TRACE_TSC
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define AUDAPTR_TRACE_TSC
+#endif
+
+/// @brief One traced span (or instant) of one thread
+struct TraceEvent {
+    /// Name of the span; a string with static storage duration, e.g. a literal
+    const char* Name;
+
+    /// Start, in the units of Tracer::Ticks()
+    uint64_t Start;
+
+    /// Duration, in the units of Tracer::Ticks(); zero for an instant
+    uint64_t Duration;
+
+    /// Flag indicating an instant rather than a span
+    bool Instant;
+};
+
+/// @brief Fixed ring of trace events written by one thread and drained by the tracer's flushing thread.
+/// Events that arrive while the ring is full are dropped and counted rather than waited for.
+class TraceBuffer {
+public:
+    explicit TraceBuffer(const size_t Capacity) : vEvents_(Capacity) {}
+
+    TraceBuffer(const TraceBuffer&) = delete;
+    TraceBuffer& operator=(const TraceBuffer&) = delete;
+
+    /// @brief Append an event. Only the owning thread may record.
+    inline void Record(const TraceEvent& Event) noexcept
+    {
+        const uint64_t Head = Head_.load(std::memory_order_relaxed);
+        if(Head - Tail_.load(std::memory_order_acquire) >= vEvents_.size()) {
+            Dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        vEvents_[Head % vEvents_.size()] = Event;
+        Head_.store(Head + 1, std::memory_order_release);
+    }
+
+    /// @brief Move the events recorded so far to the end of a vector. Only one thread may drain.
+    /// @return Number of events moved
+    size_t Drain(std::vector<TraceEvent>& Events)
+    {
+        const uint64_t Tail = Tail_.load(std::memory_order_relaxed), Head = Head_.load(std::memory_order_acquire);
+        for(uint64_t Index = Tail; Index < Head; Index++)
+            Events.push_back(vEvents_[Index % vEvents_.size()]);
+        Tail_.store(Head, std::memory_order_release);
+        return (size_t)(Head - Tail);
+    }
+
+    /// @brief Name the owning thread, for the exported trace; only the first name given is kept
+    void SetName(const char* Name) noexcept
+    {
+        if(Named_.load(std::memory_order_relaxed))
+            return;
+        snprintf(Name_, sizeof(Name_), "%s", Name);
+        Named_.store(true, std::memory_order_release);
+    }
+
+    /// @brief Name of the owning thread, or an empty string
+    std::string Name() const { return Named_.load(std::memory_order_acquire) ? std::string(Name_) : std::string(); }
+
+    uint64_t Dropped() const { return Dropped_.load(std::memory_order_relaxed); }
+
+private:
+    std::vector<TraceEvent> vEvents_;
+
+    alignas(64) std::atomic<uint64_t> Head_{0};
+
+    alignas(64) std::atomic<uint64_t> Tail_{0};
+
+    std::atomic<uint64_t> Dropped_{0};
+
+    std::atomic<bool> Named_{false};
+
+    char Name_[48] = {};
+};
+
+/// @brief Process-wide, lightweight timeline tracer, to correlate what the stream callbacks, consumer threads and
+/// blocking waits were doing around a glitch. Each thread records into its own preallocated TraceBuffer, without
+/// locks or allocation, at a cost of two timestamps and a store per span; a flushing thread drains the buffers, and
+/// WriteChromeTrace() exports the timeline as Chrome trace JSON, for chrome://tracing or the Perfetto UI.
+/// The hooks in AudIO, QuickBuffer and FastSemaphore (AUDAPTR_TRACE_SCOPE and friends) compile to nothing unless
+/// AUDAPTR_TRACING is defined, and record nothing unless the tracer has been started.
+class Tracer {
+public:
+    /// @brief Start recording, allocating the per-thread buffers on first use and starting the flushing thread.
+    /// Threads are given buffers as they first record, until MaxThreads have been handed out; the buffers of
+    /// threads that end are not reused.
+    /// @param MaxThreads Number of threads that may record
+    /// @param EventsPerThread Capacity of each thread's buffer; it need only hold the events of one flush interval
+    /// @param FlushInterval_s Period of the flushing thread [seconds]
+    static void Start(const size_t MaxThreads = 64, const size_t EventsPerThread = 1 << 14, const double FlushInterval_s = 0.05)
+    {
+        State& Global = Instance();
+        std::lock_guard<std::mutex> Lock(Global.Mutex);
+        if(Global.Enabled.load(std::memory_order_relaxed))
+            return;
+        if(!Global.pBuffers) {
+            Global.pBuffers.reset(new std::unique_ptr<TraceBuffer>[MaxThreads]);
+            for(size_t Index = 0; Index < MaxThreads; Index++)
+                Global.pBuffers[Index] = std::make_unique<TraceBuffer>(EventsPerThread);
+            Global.NumBuffers.store(MaxThreads, std::memory_order_release);
+        }
+        // Discard whatever was recorded after the last session stopped.
+        DrainLocked(Global);
+        Global.vEvents.clear();
+        Global.vThreads.clear();
+        Global.Quit = false;
+        Global.StartClock = std::chrono::steady_clock::now();
+        Global.StartTicks = Ticks();
+        Global.Enabled.store(true, std::memory_order_release);
+        Global.Flusher = std::thread([&Global, FlushInterval_s]() {
+            std::unique_lock<std::mutex> Lock(Global.Mutex);
+            while(!Global.Wake.wait_for(Lock, std::chrono::duration<double>(FlushInterval_s), [&] { return Global.Quit; }))
+                DrainLocked(Global);
+        });
+    }
+
+    /// @brief Stop recording and drain what was recorded; the events are kept until the next Start()
+    static void Stop()
+    {
+        State& Global = Instance();
+        {
+            std::lock_guard<std::mutex> Lock(Global.Mutex);
+            if(!Global.Enabled.load(std::memory_order_relaxed))
+                return;
+            Global.Enabled.store(false, std::memory_order_relaxed);
+            Global.Quit = true;
+        }
+        Global.Wake.notify_all();
+        Global.Flusher.join();
+        std::lock_guard<std::mutex> Lock(Global.Mutex);
+        DrainLocked(Global);
+    }
+
+    static bool Enabled() noexcept { return Instance().Enabled.load(std::memory_order_relaxed); }
+
+    /// @brief Buffer of the calling thread, claimed on first use; nullptr if the tracer never started or every
+    /// buffer is taken
+    static TraceBuffer* ThreadBuffer() noexcept
+    {
+        thread_local TraceBuffer* pBuffer = nullptr;
+        if(!pBuffer) {
+            State& Global = Instance();
+            const size_t NumBuffers = Global.NumBuffers.load(std::memory_order_acquire);
+            const size_t Index = Global.NextBuffer.fetch_add(1, std::memory_order_relaxed);
+            if(Index >= NumBuffers) {
+                Global.NextBuffer.fetch_sub(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            pBuffer = Global.pBuffers[Index].get();
+        }
+        return pBuffer;
+    }
+
+    /// @brief Timestamp for an event: the time stamp counter where there is one, as it costs a fraction of a clock
+    /// read, else the steady clock [nanoseconds]. Ticks are converted when the trace is written.
+    static uint64_t Ticks() noexcept
+    {
+#ifdef AUDAPTR_TRACE_TSC
+        return __rdtsc();
+#else
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    /// @brief Name the calling thread in the exported trace
+    static void NameThread(const char* Name) noexcept
+    {
+        if(Enabled())
+            if(TraceBuffer* pBuffer = ThreadBuffer())
+                pBuffer->SetName(Name);
+    }
+
+    /// @brief Record an instant event on the calling thread, e.g. an overflow
+    static void Instant(const char* Name) noexcept
+    {
+        if(Enabled())
+            if(TraceBuffer* pBuffer = ThreadBuffer())
+                pBuffer->Record({Name, Ticks(), 0, true});
+    }
+
+    /// @brief Number of events dropped because a thread's buffer was full
+    static uint64_t Dropped()
+    {
+        State& Global = Instance();
+        uint64_t Dropped = 0;
+        for(size_t Index = 0; Index < Global.NumBuffers.load(std::memory_order_acquire); Index++)
+            Dropped += Global.pBuffers[Index]->Dropped();
+        return Dropped;
+    }
+
+    /// @brief Write the events drained so far as Chrome trace JSON (the "traceEvents" format)
+    /// @param Path Path of the file to write
+    /// @return false if the file could not be written
+    static bool WriteChromeTrace(const std::string& Path)
+    {
+        State& Global = Instance();
+        std::lock_guard<std::mutex> Lock(Global.Mutex);
+        DrainLocked(Global);
+        FILE* pFile = fopen(Path.c_str(), "w");
+        if(!pFile)
+            return false;
+        // Ticks are scaled by the rate observed since the session started.
+        double Tick_us = 1e-3;
+#ifdef AUDAPTR_TRACE_TSC
+        const double Elapsed_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - Global.StartClock).count();
+        const uint64_t ElapsedTicks = Ticks() - Global.StartTicks;
+        if(ElapsedTicks > 0)
+            Tick_us = Elapsed_us / (double)ElapsedTicks;
+#endif
+        fprintf(pFile, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        bool First = true;
+        for(size_t Thread = 0; Thread < Global.NumBuffers.load(std::memory_order_acquire); Thread++) {
+            std::string Name = Global.pBuffers[Thread]->Name();
+            if(Name.empty())
+                continue;
+            fprintf(pFile, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"%s\"}}", First ? "" : ",\n", Thread + 1, Escape(Name.c_str()).c_str());
+            First = false;
+        }
+        for(size_t Index = 0; Index < Global.vEvents.size(); Index++) {
+            const TraceEvent& Event = Global.vEvents[Index];
+            const size_t Thread = Global.vThreads[Index] + 1;
+            const std::string Name = Escape(Event.Name);
+            const double Start_us = (double)(int64_t)(Event.Start - Global.StartTicks) * Tick_us;
+            if(Event.Instant)
+                fprintf(pFile, "%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%zu}", First ? "" : ",\n", Name.c_str(), Start_us, Thread);
+            else
+                fprintf(pFile, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%zu}", First ? "" : ",\n", Name.c_str(), Start_us, (double)Event.Duration * Tick_us, Thread);
+            First = false;
+        }
+        fprintf(pFile, "\n]}\n");
+        return (fclose(pFile) == 0);
+    }
+
+private:
+    struct State {
+        std::atomic<bool> Enabled{false};
+
+        // Clock and ticks when the session started, to scale ticks; set under Mutex
+        std::chrono::steady_clock::time_point StartClock;
+
+        uint64_t StartTicks = 0;
+
+        std::unique_ptr<std::unique_ptr<TraceBuffer>[]> pBuffers;
+
+        std::atomic<size_t> NumBuffers{0};
+
+        std::atomic<size_t> NextBuffer{0};
+
+        // Events drained, and the buffer each came from; guarded by Mutex
+        std::vector<TraceEvent> vEvents;
+
+        std::vector<uint32_t> vThreads;
+
+        std::mutex Mutex;
+
+        std::condition_variable Wake;
+
+        bool Quit = false;
+
+        std::thread Flusher;
+    };
+
+    static State& Instance() noexcept
+    {
+        static State Global;
+        return Global;
+    }
+
+    static void DrainLocked(State& Global)
+    {
+        for(size_t Thread = 0; Thread < Global.NumBuffers.load(std::memory_order_acquire); Thread++) {
+            const size_t Count = Global.pBuffers[Thread]->Drain(Global.vEvents);
+            Global.vThreads.insert(Global.vThreads.end(), Count, (uint32_t)Thread);
+        }
+    }
+
+    static std::string Escape(const char* pText)
+    {
+        std::string Text;
+        for(; *pText; pText++) {
+            if((*pText == '"') || (*pText == '\\'))
+                Text += '\\';
+            if((unsigned char)*pText >= 0x20)
+                Text += *pText;
+        }
+        return Text;
+    }
+};
+
+/// @brief Records the span from its construction to its destruction on the calling thread
+class TraceScope {
+public:
+    explicit TraceScope(const char* Name) noexcept : Name_(Name)
+    {
+        if(Tracer::Enabled()) {
+            pBuffer_ = Tracer::ThreadBuffer();
+            Start_ = Tracer::Ticks();
+        }
+    }
+
+    ~TraceScope()
+    {
+        if(pBuffer_)
+            pBuffer_->Record({Name_, Start_, Tracer::Ticks() - Start_, false});
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* Name_;
+
+    TraceBuffer* pBuffer_ = nullptr;
+
+    uint64_t Start_ = 0;
+};
+
+#define AUDAPTR_TRACE_JOIN2(A, B) A##B
+#define AUDAPTR_TRACE_JOIN(A, B) AUDAPTR_TRACE_JOIN2(A, B)
+
+#ifdef AUDAPTR_TRACING
+/// @brief Trace the rest of the enclosing scope under a name with static storage duration
+#define AUDAPTR_TRACE_SCOPE(Name) TraceScope AUDAPTR_TRACE_JOIN(TraceScope_, __LINE__)(Name)
+/// @brief Trace an instant event
+#define AUDAPTR_TRACE_INSTANT(Name) Tracer::Instant(Name)
+/// @brief Name the calling thread in the trace
+#define AUDAPTR_TRACE_THREAD(Name) Tracer::NameThread(Name)
+#else
+#define AUDAPTR_TRACE_SCOPE(Name) ((void)0)
+#define AUDAPTR_TRACE_INSTANT(Name) ((void)0)
+#define AUDAPTR_TRACE_THREAD(Name) ((void)0)
+#endif
@@ -0,0 +1,101 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+
+/// @brief Bounded work-stealing deque (Chase-Lev) with lockfree semantics.
+/// The owning thread pushes and pops at the bottom; any other thread may steal from the top.
+/// The capacity is fixed at construction, so no allocation takes place during operation.
+/// @tparam T The type of item queued. It must be trivially copyable (typically a pointer).
+template<typename T> class WorkStealingDeque {
+    static_assert(std::is_trivially_copyable<T>::value, "The deque element type T must be trivially copyable.");
+
+#if((defined(_MSVC_LANG) && _MSVC_LANG >= 201703L) || __cplusplus >= 201703L)
+    static constexpr size_t kCacheLineSize{std::hardware_destructive_interference_size};
+#else
+    static constexpr size_t kCacheLineSize{64};
+#endif
+public:
+    /// @brief Constructor
+    /// @param Capacity Minimum number of items that may be queued; rounded up to a power of 2
+    explicit WorkStealingDeque(const size_t Capacity)
+    {
+        size_t Size = 1;
+        while(Size < Capacity)
+            Size <<= 1;
+        Mask_ = (int64_t)Size - 1;
+        pItems_.reset(new std::atomic<T>[Size]);
+    }
+
+    /// @brief Push an item onto the bottom of the deque. Only the owning thread may call this.
+    /// @return true if the item was queued, false if the deque is full
+    inline bool Push(const T Item) noexcept
+    {
+        const int64_t b = Bottom_.load(std::memory_order_relaxed);
+        const int64_t t = Top_.load(std::memory_order_acquire);
+        if(b - t > Mask_)
+            return false;
+        pItems_[b & Mask_].store(Item, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        Bottom_.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /// @brief Pop an item from the bottom of the deque. Only the owning thread may call this.
+    /// @param Item Set to the item popped, iff the return value is true
+    /// @return true if an item was obtained
+    inline bool Pop(T& Item) noexcept
+    {
+        const int64_t b = Bottom_.load(std::memory_order_relaxed) - 1;
+        Bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = Top_.load(std::memory_order_relaxed);
+        if(t > b) {
+            // Empty: restore the bottom index.
+            Bottom_.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        Item = pItems_[b & Mask_].load(std::memory_order_relaxed);
+        if(t < b)
+            return true;
+        // Last item: race against thieves for it.
+        const bool Won = Top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        Bottom_.store(b + 1, std::memory_order_relaxed);
+        return Won;
+    }
+
+    /// @brief Steal an item from the top of the deque. Any thread may call this.
+    /// @param Item Set to the item stolen, iff the return value is true
+    /// @return true if an item was obtained; false if the deque was empty or the steal lost a race
+    inline bool Steal(T& Item) noexcept
+    {
+        int64_t t = Top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t b = Bottom_.load(std::memory_order_acquire);
+        if(t >= b)
+            return false;
+        Item = pItems_[t & Mask_].load(std::memory_order_relaxed);
+        return Top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    /// @brief Indicate whether the deque appears empty; the result is only a hint when called concurrently.
+    inline bool Empty() const noexcept
+    {
+        return Bottom_.load(std::memory_order_acquire) <= Top_.load(std::memory_order_acquire);
+    }
+
+private:
+    /// @brief Index mask (capacity - 1)
+    int64_t Mask_{0};
+
+    /// @brief Circular array of items
+    std::unique_ptr<std::atomic<T>[]> pItems_;
+
+    /// @brief Index of the next item to steal
+    alignas(kCacheLineSize) std::atomic<int64_t> Top_{0};
+
+    /// @brief Index one past the last item pushed
+    alignas(kCacheLineSize) std::atomic<int64_t> Bottom_{0};
+};